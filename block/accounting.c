@@ -24,10 +24,12 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include "block/accounting.h"
 #include "block/block_int.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
+#include "trace.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
 static const int qtest_latency_ns = NANOSECONDS_PER_SECOND / 1000;
@@ -227,6 +229,10 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
         block_latency_histogram_account(&stats->latency_histogram[cookie->type],
                                         latency_ns);
+        if (!failed) {
+            block_latency_account_ns(&stats->latency, cookie->type,
+                                     latency_ns);
+        }
 
         if (!failed || stats->account_failed) {
             stats->total_time_ns[cookie->type] += latency_ns;
@@ -238,6 +244,8 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         }
     }
 
+    trace_block_acct_done(stats, cookie->type, cookie->bytes, latency_ns,
+                          failed);
     cookie->type = BLOCK_ACCT_NONE;
 }
 
@@ -296,3 +304,117 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+/* Index of the BlockLatencyStats bucket that @ns falls into */
+static unsigned int block_latency_bucket(uint64_t ns)
+{
+    unsigned int exp;
+
+    if (ns < (1 << BLOCK_LATENCY_SUB_BITS)) {
+        return ns;
+    }
+
+    exp = 63 - clz64(ns);
+    if (exp >= BLOCK_LATENCY_MAX_BITS) {
+        return BLOCK_LATENCY_BUCKETS - 1;
+    }
+    return ((exp - BLOCK_LATENCY_SUB_BITS + 1) << BLOCK_LATENCY_SUB_BITS) +
+           ((ns >> (exp - BLOCK_LATENCY_SUB_BITS)) &
+            ((1 << BLOCK_LATENCY_SUB_BITS) - 1));
+}
+
+/*
+ * Smallest latency that goes into bucket @i; @shift is set to log2 of
+ * the bucket's width
+ */
+static uint64_t block_latency_bucket_start(unsigned int i, unsigned int *shift)
+{
+    unsigned int sub = i & ((1 << BLOCK_LATENCY_SUB_BITS) - 1);
+
+    if (i < (1 << BLOCK_LATENCY_SUB_BITS)) {
+        *shift = 0;
+        return i;
+    }
+    *shift = (i >> BLOCK_LATENCY_SUB_BITS) - 1;
+    return (uint64_t)((1 << BLOCK_LATENCY_SUB_BITS) + sub) << *shift;
+}
+
+/* Current time on the clock that block_latency_account() measures with */
+int64_t block_latency_now(void)
+{
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_latency_account(BlockLatencyStats *lat, enum BlockAcctType type,
+                           int64_t start_ns)
+{
+    block_latency_account_ns(lat, type,
+                             MAX(qemu_clock_get_ns(clock_type) - start_ns, 0));
+}
+
+/* This can be called from any thread, without a lock */
+void block_latency_account_ns(BlockLatencyStats *lat, enum BlockAcctType type,
+                              uint64_t latency_ns)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+    stat64_add(&lat->bins[type][block_latency_bucket(latency_ns)], 1);
+}
+
+uint64_t block_latency_count(BlockLatencyStats *lat, enum BlockAcctType type)
+{
+    uint64_t count = 0;
+    int i;
+
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        count += stat64_get(&lat->bins[type][i]);
+    }
+    return count;
+}
+
+/*
+ * Return the latency below which @percentile percent of the requests
+ * completed, or 0 if there were none.  As usual for this kind of
+ * histogram, the result is the highest latency that falls into the
+ * same bucket, so it never underestimates.
+ */
+uint64_t block_latency_percentile(BlockLatencyStats *lat,
+                                  enum BlockAcctType type, double percentile)
+{
+    uint64_t counts[BLOCK_LATENCY_BUCKETS];
+    uint64_t total = 0, rank, seen = 0;
+    unsigned int shift;
+    int i;
+
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        counts[i] = stat64_get(&lat->bins[type][i]);
+        total += counts[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    rank = MAX(ceil(total * percentile / 100), 1);
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS - 1; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    return block_latency_bucket_start(i, &shift) + (1ULL << shift) - 1;
+}
+
+/* Fold a histogram into BLOCK_LATENCY_LOG2_BUCKETS power-of-two buckets */
+void block_latency_log2(BlockLatencyStats *lat, enum BlockAcctType type,
+                        uint64_t *buckets)
+{
+    unsigned int shift;
+    uint64_t start;
+    int i;
+
+    memset(buckets, 0, BLOCK_LATENCY_LOG2_BUCKETS * sizeof(*buckets));
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        start = block_latency_bucket_start(i, &shift);
+        buckets[start ? 64 - clz64(start) : 0] +=
+            stat64_get(&lat->bins[type][i]);
+    }
+}
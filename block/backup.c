@@ -34,6 +34,8 @@ typedef struct BackupBlockJob {
     BlockDriverState *cbw;
     BlockDriverState *source_bs;
     BlockDriverState *target_bs;
+    BlockDriverState **fan_out_bs;
+    int nb_fan_out;
 
     BdrvDirtyBitmap *sync_bitmap;
 
@@ -103,6 +105,9 @@ static void backup_clean(Job *job)
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
     block_job_remove_all_bdrv(&s->common);
     bdrv_cbw_drop(s->cbw);
+    g_free(s->fan_out_bs);
+    s->fan_out_bs = NULL;
+    s->nb_fan_out = 0;
 }
 
 void backup_do_checkpoint(BlockJob *job, Error **errp)
@@ -331,8 +336,12 @@ static void backup_set_speed(BlockJob *job, int64_t speed)
 static bool backup_cancel(Job *job, bool force)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
+    int i;
 
     bdrv_cancel_in_flight(s->target_bs);
+    for (i = 0; i < s->nb_fan_out; i++) {
+        bdrv_cancel_in_flight(s->fan_out_bs[i]);
+    }
     return true;
 }
 
@@ -353,7 +362,9 @@ static const BlockJobDriver backup_job_driver = {
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
-                  BlockDriverState *target, int64_t speed,
+                  BlockDriverState *target,
+                  const BackupFanOutTarget *fan_out, int nb_fan_out,
+                  int64_t speed,
                   MirrorSyncMode sync_mode, BdrvDirtyBitmap *sync_bitmap,
                   BitmapSyncMode bitmap_mode,
                   bool compress,
@@ -370,6 +381,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     int64_t cluster_size;
     BlockDriverState *cbw = NULL;
     BlockCopyState *bcs = NULL;
+    int i;
 
     assert(bs);
     assert(target);
@@ -410,6 +422,40 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    for (i = 0; i < nb_fan_out; i++) {
+        BlockDriverState *fan_out_bs = fan_out[i].bs;
+
+        if (fan_out_bs == bs || fan_out_bs == target) {
+            error_setg(errp, "Fan-out target '%s' is the source or target",
+                       bdrv_get_device_or_node_name(fan_out_bs));
+            return NULL;
+        }
+
+        if (!bdrv_is_inserted(fan_out_bs)) {
+            error_setg(errp, "Device is not inserted: %s",
+                       bdrv_get_device_name(fan_out_bs));
+            return NULL;
+        }
+
+        if (compress && !bdrv_supports_compressed_writes(fan_out_bs)) {
+            error_setg(errp, "Compression is not supported for this drive %s",
+                       bdrv_get_device_name(fan_out_bs));
+            return NULL;
+        }
+
+        if (bdrv_get_aio_context(fan_out_bs) != bdrv_get_aio_context(bs)) {
+            error_setg(errp, "Fan-out target '%s' is in a different iothread "
+                       "than the source",
+                       bdrv_get_device_or_node_name(fan_out_bs));
+            return NULL;
+        }
+
+        if (bdrv_op_is_blocked(fan_out_bs, BLOCK_OP_TYPE_BACKUP_TARGET,
+                               errp)) {
+            return NULL;
+        }
+    }
+
     if (perf->max_workers < 1 || perf->max_workers > INT_MAX) {
         error_setg(errp, "max-workers must be between 1 and %d", INT_MAX);
         return NULL;
@@ -453,7 +499,23 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         goto error;
     }
 
-    cbw = bdrv_cbw_append(bs, target, filter_node_name, &bcs, errp);
+    for (i = 0; i < nb_fan_out; i++) {
+        target_len = bdrv_getlength(fan_out[i].bs);
+        if (target_len < 0) {
+            error_setg_errno(errp, -target_len, "Unable to get length for '%s'",
+                             bdrv_get_device_or_node_name(fan_out[i].bs));
+            goto error;
+        }
+
+        if (target_len != len) {
+            error_setg(errp, "Source and fan-out target '%s' have different "
+                       "sizes", bdrv_get_device_or_node_name(fan_out[i].bs));
+            goto error;
+        }
+    }
+
+    cbw = bdrv_cbw_append(bs, target, fan_out, nb_fan_out, filter_node_name,
+                          &bcs, errp);
     if (!cbw) {
         goto error;
     }
@@ -477,6 +539,11 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->cbw = cbw;
     job->source_bs = bs;
     job->target_bs = target;
+    job->fan_out_bs = g_new(BlockDriverState *, nb_fan_out);
+    job->nb_fan_out = nb_fan_out;
+    for (i = 0; i < nb_fan_out; i++) {
+        job->fan_out_bs[i] = fan_out[i].bs;
+    }
     job->on_source_error = on_source_error;
     job->on_target_error = on_target_error;
     job->sync_mode = sync_mode;
@@ -494,6 +561,10 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     /* Required permissions are taken by copy-before-write filter target */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
                        &error_abort);
+    for (i = 0; i < nb_fan_out; i++) {
+        block_job_add_bdrv(&job->common, "fan-out", fan_out[i].bs, 0,
+                           BLK_PERM_ALL, &error_abort);
+    }
 
     return &job->common;
 
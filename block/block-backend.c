@@ -2702,6 +2702,52 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+/*
+ * Zero copy variant of blk_co_pread() for sockets, see bdrv_co_sendfile().
+ * I/O throttling cannot account for the partial transfers, so throttled
+ * BlockBackends return -ENOTSUP and must be read normally.
+ */
+int coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset,
+                                 int64_t bytes, int out_fd)
+{
+    int ret;
+    IO_CODE();
+
+    blk_inc_in_flight(blk);
+    blk_wait_while_drained(blk);
+    GRAPH_RDLOCK_GUARD();
+
+    ret = blk_check_byte_request(blk, offset, bytes);
+    if (ret == 0) {
+        if (blk->public.throttle_group_member.throttle_state) {
+            ret = -ENOTSUP;
+        } else {
+            ret = bdrv_co_sendfile(blk->root, offset, bytes, out_fd);
+        }
+    }
+
+    blk_dec_in_flight(blk);
+    return ret;
+}
+
+/*
+ * Whether blk_co_sendfile() can work for @blk, see bdrv_co_can_sendfile().
+ * A true result is a hint, not a promise: blk_co_sendfile() may still fail
+ * with -ENOTSUP if the graph or the throttling configuration changes.
+ */
+bool coroutine_fn blk_co_can_sendfile(BlockBackend *blk)
+{
+    BlockDriverState *bs;
+    IO_CODE();
+    GRAPH_RDLOCK_GUARD();
+
+    bs = blk_bs(blk);
+    if (!bs || blk->public.throttle_group_member.throttle_state) {
+        return false;
+    }
+    return bdrv_co_can_sendfile(bs);
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     GLOBAL_STATE_CODE();
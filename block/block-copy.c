@@ -112,6 +112,12 @@ static int64_t task_end(BlockCopyTask *task)
     return task->req.offset + task->req.bytes;
 }
 
+typedef struct BlockCopyFanOut {
+    BdrvChild *target;
+    /* Limits the write rate to @target, independently of the other targets */
+    RateLimit rate_limit;
+} BlockCopyFanOut;
+
 typedef struct BlockCopyState {
     /*
      * BdrvChild objects are not owned or managed by block-copy. They are
@@ -125,6 +131,13 @@ typedef struct BlockCopyState {
      * Fields initialized in block_copy_state_new()
      * and never changed.
      */
+    /*
+     * Additional targets that get the same data as @target, written from the
+     * same buffer after a single read from @source.  Like @target, their
+     * BdrvChild objects are owned by the block-copy user.
+     */
+    BlockCopyFanOut *fan_out;
+    int nb_fan_out;
     int64_t cluster_size;
     int64_t max_transfer;
     uint64_t len;
@@ -264,10 +277,16 @@ static void coroutine_fn block_copy_task_end(BlockCopyTask *task, int ret)
 
 void block_copy_state_free(BlockCopyState *s)
 {
+    int i;
+
     if (!s) {
         return;
     }
 
+    for (i = 0; i < s->nb_fan_out; i++) {
+        ratelimit_destroy(&s->fan_out[i].rate_limit);
+    }
+    g_free(s->fan_out);
     ratelimit_destroy(&s->rate_limit);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
@@ -299,6 +318,9 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     } else if (compress) {
         /* Compression supports only cluster-size writes and no copy-range. */
         s->method = COPY_READ_WRITE_CLUSTER;
+    } else if (s->nb_fan_out) {
+        /* copy_range can't share one read between several targets */
+        s->method = COPY_READ_WRITE;
     } else {
         /*
          * If copy range enabled, start with COPY_RANGE_SMALL, until first
@@ -346,19 +368,36 @@ static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
 }
 
 BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
+                                     BdrvChild **fan_out, int nb_fan_out,
                                      const BdrvDirtyBitmap *bitmap,
                                      Error **errp)
 {
     ERRP_GUARD();
     BlockCopyState *s;
     int64_t cluster_size;
+    uint32_t max_transfer;
     BdrvDirtyBitmap *copy_bitmap;
     bool is_fleecing;
+    int i;
 
     cluster_size = block_copy_calculate_cluster_size(target->bs, errp);
     if (cluster_size < 0) {
         return NULL;
     }
+    max_transfer = block_copy_max_transfer(source, target);
+
+    /* Copy in units that avoid COW on every target */
+    for (i = 0; i < nb_fan_out; i++) {
+        int64_t fan_out_cluster_size =
+            block_copy_calculate_cluster_size(fan_out[i]->bs, errp);
+
+        if (fan_out_cluster_size < 0) {
+            return NULL;
+        }
+        cluster_size = MAX(cluster_size, fan_out_cluster_size);
+        max_transfer = MIN(max_transfer,
+                           block_copy_max_transfer(source, fan_out[i]));
+    }
 
     copy_bitmap = bdrv_create_dirty_bitmap(source->bs, cluster_size, NULL,
                                            errp);
@@ -393,6 +432,9 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
      * tests/qemu-iotests/222
      */
     is_fleecing = bdrv_chain_contains(target->bs, source->bs);
+    for (i = 0; i < nb_fan_out; i++) {
+        is_fleecing |= bdrv_chain_contains(fan_out[i]->bs, source->bs);
+    }
 
     s = g_new(BlockCopyState, 1);
     *s = (BlockCopyState) {
@@ -403,11 +445,18 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = (is_fleecing ? BDRV_REQ_SERIALISING : 0),
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
-        .max_transfer = QEMU_ALIGN_DOWN(
-                                    block_copy_max_transfer(source, target),
-                                    cluster_size),
+        .max_transfer = QEMU_ALIGN_DOWN(max_transfer, cluster_size),
+        .nb_fan_out = nb_fan_out,
     };
 
+    if (nb_fan_out) {
+        s->fan_out = g_new0(BlockCopyFanOut, nb_fan_out);
+        for (i = 0; i < nb_fan_out; i++) {
+            s->fan_out[i].target = fan_out[i];
+            ratelimit_init(&s->fan_out[i].rate_limit);
+        }
+    }
+
     block_copy_set_copy_opts(s, false, false);
 
     ratelimit_init(&s->rate_limit);
@@ -456,6 +505,114 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+typedef struct BlockCopyWriteReq {
+    BlockCopyState *s;
+    int64_t offset;
+    int64_t bytes;
+    void *buf; /* NULL means write zeroes */
+    BdrvRequestFlags flags;
+
+    Coroutine *co;
+    int pending;
+    int ret;
+} BlockCopyWriteReq;
+
+typedef struct BlockCopyWriteCo {
+    BlockCopyWriteReq *req;
+    int idx; /* -1 for s->target, otherwise index into s->fan_out */
+} BlockCopyWriteCo;
+
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_write_one(BdrvChild *target, int64_t offset, int64_t bytes,
+                     void *buf, BdrvRequestFlags flags)
+{
+    if (!buf) {
+        return bdrv_co_pwrite_zeroes(target, offset, bytes,
+                                     flags & ~BDRV_REQ_WRITE_COMPRESSED);
+    }
+    return bdrv_co_pwrite(target, offset, bytes, buf, flags);
+}
+
+static void coroutine_fn GRAPH_RDLOCK block_copy_write_entry(void *opaque)
+{
+    BlockCopyWriteCo *co = opaque;
+    BlockCopyWriteReq *req = co->req;
+    BlockCopyState *s = req->s;
+    BdrvChild *target = s->target;
+    int ret;
+
+    if (co->idx >= 0) {
+        BlockCopyFanOut *fan_out = &s->fan_out[co->idx];
+        uint64_t ns;
+
+        target = fan_out->target;
+        ns = ratelimit_calculate_delay(&fan_out->rate_limit, req->bytes);
+        if (ns > 0) {
+            qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, ns);
+        }
+    }
+
+    ret = block_copy_write_one(target, req->offset, req->bytes, req->buf,
+                               req->flags);
+    if (ret < 0) {
+        if (co->idx >= 0) {
+            trace_block_copy_fan_out_write_fail(s, co->idx, req->offset, ret);
+        }
+        if (!req->ret) {
+            req->ret = ret;
+        }
+    }
+
+    /* Wake up the caller after the last write */
+    if (--req->pending == 0) {
+        qemu_coroutine_enter_if_inactive(req->co);
+    }
+}
+
+/*
+ * Write @bytes at @offset from @buf (or zeroes, if @buf is NULL) to the
+ * target and to all fan-out targets.  The writes share @buf and run
+ * concurrently, each fan-out target at its own speed; returns the first
+ * error.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_write(BlockCopyState *s, int64_t offset, int64_t bytes, void *buf)
+{
+    BlockCopyWriteReq req;
+    g_autofree BlockCopyWriteCo *cos = NULL;
+    int i;
+
+    if (!s->nb_fan_out) {
+        return block_copy_write_one(s->target, offset, bytes, buf,
+                                    s->write_flags);
+    }
+
+    req = (BlockCopyWriteReq) {
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+        .buf = buf,
+        .flags = s->write_flags,
+        .co = qemu_coroutine_self(),
+        .pending = s->nb_fan_out + 1,
+    };
+
+    cos = g_new(BlockCopyWriteCo, s->nb_fan_out + 1);
+    for (i = 0; i <= s->nb_fan_out; i++) {
+        Coroutine *co;
+
+        cos[i] = (BlockCopyWriteCo) { .req = &req, .idx = i - 1 };
+        co = qemu_coroutine_create(block_copy_write_entry, &cos[i]);
+        qemu_coroutine_enter(co);
+    }
+
+    while (req.pending) {
+        qemu_coroutine_yield();
+    }
+
+    return req.ret;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -487,8 +644,7 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
 
     switch (*method) {
     case COPY_WRITE_ZEROES:
-        ret = bdrv_co_pwrite_zeroes(s->target, offset, nbytes, s->write_flags &
-                                    ~BDRV_REQ_WRITE_COMPRESSED);
+        ret = block_copy_write(s, offset, nbytes, NULL);
         if (ret < 0) {
             trace_block_copy_write_zeroes_fail(s, offset, ret);
             *error_is_read = false;
@@ -530,8 +686,7 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
             goto out;
         }
 
-        ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
-                             s->write_flags);
+        ret = block_copy_write(s, offset, nbytes, bounce_buffer);
         if (ret < 0) {
             trace_block_copy_write_fail(s, offset, ret);
             *error_is_read = false;
@@ -724,6 +879,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
      */
     assert(bdrv_get_aio_context(s->source->bs) ==
            bdrv_get_aio_context(s->target->bs));
+    for (int i = 0; i < s->nb_fan_out; i++) {
+        assert(bdrv_get_aio_context(s->source->bs) ==
+               bdrv_get_aio_context(s->fan_out[i].target->bs));
+    }
 
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
     assert(QEMU_IS_ALIGNED(bytes, s->cluster_size));
@@ -1025,6 +1184,14 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_fan_out_speed(BlockCopyState *s, int idx, uint64_t speed)
+{
+    assert(idx >= 0 && idx < s->nb_fan_out);
+    ratelimit_set_speed(&s->fan_out[idx].rate_limit, speed,
+                        BLOCK_COPY_SLICE_TIME);
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
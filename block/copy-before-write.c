@@ -42,6 +42,9 @@
 typedef struct BDRVCopyBeforeWriteState {
     BlockCopyState *bcs;
     BdrvChild *target;
+    /* Additional copy targets, only written to by block-copy */
+    BdrvChild **fan_out;
+    int nb_fan_out;
     OnCbwError on_cbw_error;
     uint32_t cbw_timeout_ns;
 
@@ -412,7 +415,8 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
     int64_t cluster_size;
     g_autoptr(BlockdevOptions) full_opts = NULL;
     BlockdevOptionsCbw *opts;
-    int ret;
+    BlockdevCbwFanOutList *fan_out;
+    int i, ret;
 
     full_opts = cbw_parse_options(options, errp);
     if (!full_opts) {
@@ -432,11 +436,36 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
         return -EINVAL;
     }
 
+    for (fan_out = opts->fan_out; fan_out; fan_out = fan_out->next) {
+        s->nb_fan_out++;
+    }
+    s->fan_out = g_new0(BdrvChild *, s->nb_fan_out);
+    for (i = 0; i < s->nb_fan_out; i++) {
+        g_autofree char *key = g_strdup_printf("fan-out.%d.target", i);
+
+        s->fan_out[i] = bdrv_open_child(NULL, options, key, bs, &child_of_bds,
+                                        BDRV_CHILD_DATA, false, errp);
+        if (!s->fan_out[i]) {
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+    /* The remaining fan-out options were parsed into @opts */
+    qdict_extract_subqdict(options, NULL, "fan-out.");
+
     if (opts->bitmap) {
+        BlockDriverState *bitmap_bs;
+
         bitmap = block_dirty_bitmap_lookup(opts->bitmap->node,
-                                           opts->bitmap->name, NULL, errp);
+                                           opts->bitmap->name, &bitmap_bs,
+                                           errp);
         if (!bitmap) {
-            return -EINVAL;
+            ret = -EINVAL;
+            goto fail;
+        }
+        ret = block_dirty_bitmap_load(bitmap_bs, bitmap, errp);
+        if (ret < 0) {
+            goto fail;
         }
     }
     s->on_cbw_error = opts->has_on_cbw_error ? opts->on_cbw_error :
@@ -451,24 +480,34 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
             ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
              bs->file->bs->supported_zero_flags);
 
-    s->bcs = block_copy_state_new(bs->file, s->target, bitmap, errp);
+    s->bcs = block_copy_state_new(bs->file, s->target, s->fan_out,
+                                  s->nb_fan_out, bitmap, errp);
     if (!s->bcs) {
         error_prepend(errp, "Cannot create block-copy-state: ");
-        return -EINVAL;
+        ret = -EINVAL;
+        goto fail;
+    }
+    i = 0;
+    for (fan_out = opts->fan_out; fan_out; fan_out = fan_out->next, i++) {
+        if (fan_out->value->has_speed) {
+            block_copy_set_fan_out_speed(s->bcs, i, fan_out->value->speed);
+        }
     }
 
     cluster_size = block_copy_cluster_size(s->bcs);
 
     s->done_bitmap = bdrv_create_dirty_bitmap(bs, cluster_size, NULL, errp);
     if (!s->done_bitmap) {
-        return -EINVAL;
+        ret = -EINVAL;
+        goto fail;
     }
     bdrv_disable_dirty_bitmap(s->done_bitmap);
 
     /* s->access_bitmap starts equal to bcs bitmap */
     s->access_bitmap = bdrv_create_dirty_bitmap(bs, cluster_size, NULL, errp);
     if (!s->access_bitmap) {
-        return -EINVAL;
+        ret = -EINVAL;
+        goto fail;
     }
     bdrv_disable_dirty_bitmap(s->access_bitmap);
     bdrv_dirty_bitmap_merge_internal(s->access_bitmap,
@@ -479,6 +518,18 @@ static int cbw_open(BlockDriverState *bs, QDict *options, int flags,
     QLIST_INIT(&s->frozen_read_reqs);
 
     return 0;
+
+fail:
+    if (s->done_bitmap) {
+        bdrv_release_dirty_bitmap(s->done_bitmap);
+        s->done_bitmap = NULL;
+    }
+    block_copy_state_free(s->bcs);
+    s->bcs = NULL;
+    g_free(s->fan_out);
+    s->fan_out = NULL;
+    s->nb_fan_out = 0;
+    return ret;
 }
 
 static void cbw_close(BlockDriverState *bs)
@@ -490,6 +541,8 @@ static void cbw_close(BlockDriverState *bs)
 
     block_copy_state_free(s->bcs);
     s->bcs = NULL;
+    g_free(s->fan_out);
+    s->fan_out = NULL;
 }
 
 BlockDriver bdrv_cbw_filter = {
@@ -518,6 +571,8 @@ BlockDriver bdrv_cbw_filter = {
 
 BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
                                   BlockDriverState *target,
+                                  const BackupFanOutTarget *fan_out,
+                                  int nb_fan_out,
                                   const char *filter_node_name,
                                   BlockCopyState **bcs,
                                   Error **errp)
@@ -525,6 +580,7 @@ BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
     BDRVCopyBeforeWriteState *state;
     BlockDriverState *top;
     QDict *opts;
+    int i;
 
     assert(source->total_sectors == target->total_sectors);
     GLOBAL_STATE_CODE();
@@ -536,6 +592,15 @@ BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
     }
     qdict_put_str(opts, "file", bdrv_get_node_name(source));
     qdict_put_str(opts, "target", bdrv_get_node_name(target));
+    for (i = 0; i < nb_fan_out; i++) {
+        g_autofree char *key = g_strdup_printf("fan-out.%d.", i);
+        g_autofree char *target_key = g_strconcat(key, "target", NULL);
+        g_autofree char *speed_key = g_strconcat(key, "speed", NULL);
+
+        assert(source->total_sectors == fan_out[i].bs->total_sectors);
+        qdict_put_str(opts, target_key, bdrv_get_node_name(fan_out[i].bs));
+        qdict_put_int(opts, speed_key, fan_out[i].speed);
+    }
 
     top = bdrv_insert_node(source, opts, BDRV_O_RDWR, errp);
     if (!top) {
@@ -38,6 +38,8 @@
 
 BlockDriverState *bdrv_cbw_append(BlockDriverState *source,
                                   BlockDriverState *target,
+                                  const BackupFanOutTarget *fan_out,
+                                  int nb_fan_out,
                                   const char *filter_node_name,
                                   BlockCopyState **bcs,
                                   Error **errp);
@@ -23,6 +23,7 @@
  */
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 #include "trace.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
@@ -53,6 +54,12 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    BdrvDirtyBitmapLoadFunc *load; /* Reads the persistent contents from
+                                      the image; NULL once they have been
+                                      merged into @bitmap */
+    void *load_opaque;
+    GDestroyNotify load_opaque_free;
+    bool loading;               /* @load is running */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -259,7 +266,11 @@ static void bdrv_release_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap)
     assert(!bitmap->active_iterators);
     assert(!bdrv_dirty_bitmap_busy(bitmap));
     assert(!bdrv_dirty_bitmap_has_successor(bitmap));
+    assert(!bitmap->loading);
     QLIST_REMOVE(bitmap, list);
+    if (bitmap->load_opaque_free) {
+        bitmap->load_opaque_free(bitmap->load_opaque);
+    }
     hbitmap_free(bitmap->bitmap);
     g_free(bitmap->name);
     g_free(bitmap);
@@ -382,6 +393,95 @@ void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs)
     bdrv_dirty_bitmaps_unlock(bs);
 }
 
+/**
+ * Defer reading the contents of a persistent bitmap from the image until
+ * they are first needed, see bdrv_dirty_bitmap_load().  Until then, the
+ * bitmap only holds the bits that were set since it was created, and
+ * reading it returns incomplete results.
+ * Called with BQL taken.
+ */
+void bdrv_dirty_bitmap_set_loader(BdrvDirtyBitmap *bitmap,
+                                  BdrvDirtyBitmapLoadFunc *load,
+                                  void *opaque, GDestroyNotify free_opaque)
+{
+    assert(!bitmap->load);
+    bitmap->load = load;
+    bitmap->load_opaque = opaque;
+    bitmap->load_opaque_free = free_opaque;
+}
+
+/* Called with BQL taken. */
+bool bdrv_dirty_bitmap_needs_load(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->load;
+}
+
+/**
+ * Make sure that the contents of @bitmap have been read from the image.
+ * This must be called before anything looks at the bits of a persistent
+ * bitmap, i.e. before serializing, merging or exporting it.  Bits that
+ * were set in the meantime are kept.
+ *
+ * On failure, the bitmap is marked inconsistent.
+ *
+ * Called with BQL taken.  Outside of coroutine context the caller must
+ * hold the AioContext lock of the bitmap's node, as for bdrv_pread().
+ */
+int bdrv_dirty_bitmap_load(BdrvDirtyBitmap *bitmap, Error **errp)
+{
+    BdrvDirtyBitmap target;
+    int ret;
+
+    if (!bitmap->load) {
+        return 0;
+    }
+    if (bitmap->loading) {
+        error_setg(errp, "Bitmap '%s' is being loaded and cannot be used yet",
+                   bitmap->name);
+        return -EBUSY;
+    }
+
+    trace_bdrv_dirty_bitmap_load(bitmap->bs, bitmap->name);
+
+    /* Writes may set bits while the loader waits for I/O, so load into a
+     * private bitmap and merge that in at the end.
+     */
+    target = (BdrvDirtyBitmap) {
+        .bs = bitmap->bs,
+        .bitmap = hbitmap_alloc(bitmap->size,
+                                hbitmap_granularity(bitmap->bitmap)),
+        .name = bitmap->name,
+        .size = bitmap->size,
+        .disabled = true,
+        .persistent = true,
+    };
+
+    bitmap->loading = true;
+    ret = bitmap->load(&target, bitmap->load_opaque, errp);
+    bitmap->loading = false;
+    /* For bdrv_query_dirty_bitmaps() */
+    aio_wait_kick();
+
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    if (ret == 0) {
+        hbitmap_merge(bitmap->bitmap, target.bitmap, bitmap->bitmap);
+    }
+    if (bitmap->load_opaque_free) {
+        bitmap->load_opaque_free(bitmap->load_opaque);
+    }
+    bitmap->load = NULL;
+    bitmap->load_opaque = NULL;
+    bitmap->load_opaque_free = NULL;
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+
+    hbitmap_free(target.bitmap);
+
+    if (ret < 0) {
+        bdrv_dirty_bitmap_set_inconsistent(bitmap);
+    }
+    return ret;
+}
+
 /**
  * Remove persistent dirty bitmap from the storage if it exists.
  * Absence of bitmap is not an error, because we have the following scenario:
@@ -449,12 +549,58 @@ void bdrv_enable_dirty_bitmap(BdrvDirtyBitmap *bitmap)
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
 }
 
+/* Called with BQL taken. */
+static bool bdrv_dirty_bitmaps_loading(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bm;
+
+    QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        if (bm->loading) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Called with BQL taken and without the AioContext lock of @bs, which is
+ * needed to read bitmaps that have not been loaded yet.
+ */
 BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
 {
+    AioContext *ctx = bdrv_get_aio_context(bs);
     BdrvDirtyBitmap *bm;
     BlockDirtyInfoList *list = NULL;
     BlockDirtyInfoList **tail = &list;
 
+    /*
+     * The dirty count needs the persistent contents, so read whatever has
+     * not been read yet; this only costs anything on the first query.
+     * Loading polls, which may change the list, so start over after each
+     * bitmap.  Bitmaps that somebody else is loading are waited for, or
+     * their count would not include the stored bits yet.
+     */
+    for (;;) {
+        Error *local_err = NULL;
+
+        QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
+            if (bm->load && !bm->loading) {
+                break;
+            }
+        }
+        if (!bm && !bdrv_dirty_bitmaps_loading(bs)) {
+            break;
+        }
+
+        aio_context_acquire(ctx);
+        if (!bm) {
+            AIO_WAIT_WHILE(ctx, bdrv_dirty_bitmaps_loading(bs));
+        } else if (bdrv_dirty_bitmap_load(bm, &local_err) < 0) {
+            warn_report_err(local_err);
+        }
+        aio_context_release(ctx);
+    }
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
         BlockDirtyInfo *info = g_new0(BlockDirtyInfo, 1);
@@ -21,14 +21,17 @@
 #include "qemu/osdep.h"
 #include "qemu/memalign.h"
 #include "block/aio.h"
+#include "block/aio-wait.h"
 #include "block/block_int-common.h"
 #include "block/export.h"
 #include "block/fuse.h"
 #include "block/qapi.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/coroutine.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 
 #include <fuse.h>
 #include <fuse_lowlevel.h>
@@ -44,13 +47,49 @@
 /* Prevent overly long bounce buffer allocations */
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
+/*
+ * How many readahead and writeback requests the kernel may have
+ * outstanding at once (its default is 12).  Now that requests are processed
+ * concurrently, this is what limits the parallelism of buffered I/O.
+ */
+#define FUSE_MAX_BACKGROUND 128
+
+
+typedef struct FuseExport FuseExport;
+
+/*
+ * An AioContext that reads requests from the FUSE session.  All queues
+ * poll the same /dev/fuse fd; whichever gets to a request first reads and
+ * parses it, and then hands it to a coroutine in the export's AioContext.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    IOThread *iothread; /* NULL for the export's own AioContext */
+    AioContext *ctx;
+    struct fuse_buf fuse_buf;
+    bool fd_handler_set_up;
+} FuseQueue;
 
-typedef struct FuseExport {
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
-    bool mounted, fd_handler_set_up;
+    bool mounted;
+
+    /* queues[0] runs in the export's AioContext, the rest in iothreads */
+    FuseQueue *queues;
+    size_t num_queues;
+
+    /*
+     * Number of queues that are reading a request plus the number of
+     * requests being processed.  Drained sections and the deletion of the
+     * export wait for this to drop to zero.
+     */
+    unsigned int in_flight; /* atomic */
+    bool quiescing; /* atomic */
+
+    /* Serializes length checks with the truncates that depend on them */
+    CoMutex resize_lock;
 
     char *mountpoint;
     bool writable;
@@ -61,7 +100,19 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
+
+/* Arguments of a request that is processed in a coroutine */
+typedef struct FuseRequest {
+    FuseExport *exp;
+    fuse_req_t req;
+    fuse_ino_t inode;
+    int64_t offset;
+    int64_t length;
+    int mode; /* fallocate() mode, lseek() whence or setattr() to_set */
+    struct stat statbuf;
+    void *buf; /* write payload */
+} FuseRequest;
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -77,6 +128,69 @@ static void read_from_fuse_export(void *opaque);
 
 static bool is_regular_file(const char *path, Error **errp);
 
+static void fuse_inc_in_flight(FuseExport *exp)
+{
+    qatomic_inc(&exp->in_flight);
+}
+
+static void fuse_dec_in_flight(FuseExport *exp)
+{
+    qatomic_dec(&exp->in_flight);
+    aio_wait_kick();
+}
+
+static void fuse_queue_set_fd_handler(FuseQueue *q, bool enable)
+{
+    aio_set_fd_handler(q->ctx, fuse_session_fd(q->exp->fuse_session), true,
+                       enable ? read_from_fuse_export : NULL,
+                       NULL, NULL, NULL, enable ? q : NULL);
+    q->fd_handler_set_up = enable;
+}
+
+static void fuse_drained_begin(void *opaque)
+{
+    FuseExport *exp = opaque;
+    size_t i;
+
+    qatomic_set(&exp->quiescing, true);
+    /* Pairs with fuse_inc_in_flight() in read_from_fuse_export() */
+    smp_mb();
+
+    for (i = 0; i < exp->num_queues; i++) {
+        if (exp->queues[i].fd_handler_set_up) {
+            fuse_queue_set_fd_handler(&exp->queues[i], false);
+        }
+    }
+}
+
+static void fuse_drained_end(void *opaque)
+{
+    FuseExport *exp = opaque;
+    size_t i;
+
+    qatomic_set(&exp->quiescing, false);
+
+    if (!exp->mounted || fuse_session_exited(exp->fuse_session)) {
+        return;
+    }
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_set_fd_handler(&exp->queues[i], true);
+    }
+}
+
+static bool fuse_drained_poll(void *opaque)
+{
+    FuseExport *exp = opaque;
+
+    return qatomic_read(&exp->in_flight) > 0;
+}
+
+static const BlockDevOps fuse_block_ops = {
+    .drained_begin = fuse_drained_begin,
+    .drained_end   = fuse_drained_end,
+    .drained_poll  = fuse_drained_poll,
+};
+
 
 static int fuse_export_create(BlockExport *blk_exp,
                               BlockExportOptions *blk_exp_args,
@@ -84,10 +198,62 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    strList *iothreads;
+    size_t i, j;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    qemu_co_mutex_init(&exp->resize_lock);
+
+    exp->num_queues = 1;
+    for (iothreads = args->queue_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        exp->num_queues++;
+    }
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+    exp->queues[0] = (FuseQueue) {
+        .exp = exp,
+        .ctx = exp->common.ctx,
+    };
+    for (i = 1, iothreads = args->queue_iothreads; iothreads;
+         i++, iothreads = iothreads->next)
+    {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+        AioContext *ctx;
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            ret = -ENOENT;
+            goto fail;
+        }
+
+        ctx = iothread_get_aio_context(iothread);
+        for (j = 0; j < i; j++) {
+            if (exp->queues[j].ctx == ctx) {
+                error_setg(errp, "iothread \"%s\" already reads requests for "
+                           "this export", iothreads->value);
+                ret = -EINVAL;
+                goto fail;
+            }
+        }
+
+        object_ref(OBJECT(iothread));
+        exp->queues[i] = (FuseQueue) {
+            .exp = exp,
+            .iothread = iothread,
+            .ctx = ctx,
+        };
+    }
+
+    /*
+     * Requests are only quiesced by fuse_drained_begin() if they do not get
+     * stuck in the block layer's request queue first.
+     */
+    blk_set_disable_request_queuing(exp->common.blk, true);
+    blk_set_dev_ops(exp->common.blk, &fuse_block_ops, exp);
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -97,7 +263,7 @@ static int fuse_export_create(BlockExport *blk_exp,
         ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
                            blk_shared_perm, errp);
         if (ret < 0) {
-            return ret;
+            goto fail;
         }
     }
 
@@ -188,6 +354,7 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     const char *fuse_argv[4];
     char *mount_opts;
     struct fuse_args fuse_args;
+    size_t i;
     int ret;
 
     /*
@@ -223,10 +390,17 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session), true,
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /* Several queues may be woken for one request, only one gets to read it */
+    if (!g_unix_set_fd_nonblocking(fuse_session_fd(exp->fuse_session), true,
+                                   NULL)) {
+        error_setg(errp, "Failed to make the FUSE session fd non-blocking");
+        ret = -EIO;
+        goto fail;
+    }
+
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_set_fd_handler(&exp->queues[i], true);
+    }
 
     return 0;
 
@@ -237,40 +411,63 @@ fail:
 
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
- * (This is basically the FUSE event loop.)
+ * (This is basically the FUSE event loop.)  Runs in the queue's
+ * AioContext; the request handlers only parse the request and then start
+ * a coroutine in the export's AioContext to process it.
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
     int ret;
 
-    blk_exp_ref(&exp->common);
+    /*
+     * Either fuse_drained_begin() sees us in flight and waits, or we see
+     * that it is quiescing and leave the request to be read later.
+     */
+    fuse_inc_in_flight(exp);
+    if (qatomic_read(&exp->quiescing)) {
+        goto out;
+    }
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
+        /* -EAGAIN means that another queue got the request */
         goto out;
     }
 
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
+    fuse_session_process_buf(exp->fuse_session, &q->fuse_buf);
 
 out:
-    blk_exp_unref(&exp->common);
+    fuse_dec_in_flight(exp);
+}
+
+/* Runs in the queue's iothread, so its handler cannot be running anymore */
+static void fuse_queue_detach_bh(void *opaque)
+{
+    FuseQueue *q = opaque;
+
+    if (q->fd_handler_set_up) {
+        fuse_queue_set_fd_handler(q, false);
+    }
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
 
-        if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session), true,
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+        if (exp->queues[0].fd_handler_set_up) {
+            fuse_queue_set_fd_handler(&exp->queues[0], false);
+        }
+        for (i = 1; i < exp->num_queues; i++) {
+            aio_wait_bh_oneshot(exp->queues[i].ctx, fuse_queue_detach_bh,
+                                &exp->queues[i]);
         }
     }
 
@@ -286,6 +483,10 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
+
+    /* Requests do not hold references to the export */
+    AIO_WAIT_WHILE(exp->common.ctx, qatomic_read(&exp->in_flight) > 0);
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -295,7 +496,14 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->num_queues; i++) {
+        free(exp->queues[i].fuse_buf.mem);
+        if (exp->queues[i].iothread) {
+            object_unref(OBJECT(exp->queues[i].iothread));
+        }
+    }
+    g_free(exp->queues);
+    blk_set_disable_request_queuing(exp->common.blk, false);
     g_free(exp->mountpoint);
 }
 
@@ -337,6 +545,19 @@ static void fuse_init(void *userdata, struct fuse_conn_info *conn)
     conn->max_read = FUSE_MAX_BOUNCE_BYTES;
 
     conn->max_write = MIN_NON_ZERO(BDRV_REQUEST_MAX_BYTES, conn->max_write);
+
+    /* Requests are processed concurrently, so let the kernel queue more */
+    conn->max_background = FUSE_MAX_BACKGROUND;
+    conn->congestion_threshold = FUSE_MAX_BACKGROUND * 3 / 4;
+
+    /*
+     * Let libfuse splice requests from /dev/fuse into a pipe rather than
+     * read them into its own buffer.  fuse_write_buf() still copies the
+     * payload out of the pipe once, with fuse_buf_copy().
+     */
+    if (conn->capable & FUSE_CAP_SPLICE_READ) {
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    }
 }
 
 /**
@@ -349,23 +570,61 @@ static void fuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 }
 
 /**
- * Let clients get file attributes (i.e., stat() the file).
+ * Allocate the state of a request that will be processed in a coroutine.
  */
-static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
-                         struct fuse_file_info *fi)
+static FuseRequest *fuse_request_new(fuse_req_t req, fuse_ino_t inode)
+{
+    FuseRequest *r = g_new0(FuseRequest, 1);
+
+    r->exp = fuse_req_userdata(req);
+    r->req = req;
+    r->inode = inode;
+    return r;
+}
+
+/**
+ * Hand a request over to a coroutine in the export's AioContext, so that
+ * the reading queue can go on to read the next request while this one is
+ * being processed.
+ */
+static void fuse_request_start(FuseRequest *r, CoroutineEntry *entry)
+{
+    fuse_inc_in_flight(r->exp);
+    aio_co_enter(r->exp->common.ctx, qemu_coroutine_create(entry, r));
+}
+
+/**
+ * Free a request whose reply has been sent.
+ */
+static void fuse_request_done(FuseRequest *r)
+{
+    FuseExport *exp = r->exp;
+
+    qemu_vfree(r->buf);
+    g_free(r);
+    fuse_dec_in_flight(exp);
+}
+
+/**
+ * Reply to @req with the attributes of the exported image.
+ */
+static void coroutine_fn fuse_co_reply_attr(FuseExport *exp, fuse_req_t req,
+                                            fuse_ino_t inode)
 {
     struct stat statbuf;
     int64_t length, allocated_blocks;
     time_t now = time(NULL);
-    FuseExport *exp = fuse_req_userdata(req);
 
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
     }
 
-    allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
     if (allocated_blocks <= 0) {
         allocated_blocks = DIV_ROUND_UP(length, 512);
     } else {
@@ -389,8 +648,26 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+static void coroutine_fn fuse_co_getattr(void *opaque)
+{
+    FuseRequest *r = opaque;
+
+    fuse_co_reply_attr(r->exp, r->req, r->inode);
+    fuse_request_done(r);
+}
+
+/**
+ * Let clients get file attributes (i.e., stat() the file).
+ */
+static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
+                         struct fuse_file_info *fi)
+{
+    fuse_request_start(fuse_request_new(req, inode), fuse_co_getattr);
+}
+
+static int coroutine_fn fuse_co_do_truncate(const FuseExport *exp,
+                                            int64_t size, bool req_zero_write,
+                                            PreallocMode prealloc)
 {
     uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
@@ -420,8 +697,8 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
         }
     }
 
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
-                       truncate_flags, NULL);
+    ret = blk_co_truncate(exp->common.blk, size, true, prealloc,
+                          truncate_flags, NULL);
 
     if (add_resize_perm) {
         /* Must succeed, because we are only giving up the RESIZE permission */
@@ -433,6 +710,43 @@ static int fuse_do_truncate(const FuseExport *exp, int64_t size,
     return ret;
 }
 
+static void coroutine_fn fuse_co_setattr(void *opaque)
+{
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+    int to_set = r->mode;
+    int ret = 0;
+
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        WITH_QEMU_LOCK_GUARD(&exp->resize_lock) {
+            ret = fuse_co_do_truncate(exp, r->statbuf.st_size, true,
+                                      PREALLOC_MODE_OFF);
+        }
+        if (ret < 0) {
+            fuse_reply_err(r->req, -ret);
+            goto out;
+        }
+    }
+
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        /* Ignore FUSE-supplied file type, only change the mode */
+        exp->st_mode = (r->statbuf.st_mode & 07777) | S_IFREG;
+    }
+
+    if (to_set & FUSE_SET_ATTR_UID) {
+        exp->st_uid = r->statbuf.st_uid;
+    }
+
+    if (to_set & FUSE_SET_ATTR_GID) {
+        exp->st_gid = r->statbuf.st_gid;
+    }
+
+    fuse_co_reply_attr(exp, r->req, r->inode);
+
+out:
+    fuse_request_done(r);
+}
+
 /**
  * Let clients set file attributes.  Only resizing and changing
  * permissions (st_mode, st_uid, st_gid) is allowed.
@@ -445,8 +759,8 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
                          int to_set, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
+    FuseRequest *r;
     int supported_attrs;
-    int ret;
 
     supported_attrs = FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_MODE;
     if (exp->allow_other) {
@@ -480,33 +794,15 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
         }
     }
 
-    if (to_set & FUSE_SET_ATTR_SIZE) {
-        if (!exp->writable) {
-            fuse_reply_err(req, EACCES);
-            return;
-        }
-
-        ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
-        if (ret < 0) {
-            fuse_reply_err(req, -ret);
-            return;
-        }
-    }
-
-    if (to_set & FUSE_SET_ATTR_MODE) {
-        /* Ignore FUSE-supplied file type, only change the mode */
-        exp->st_mode = (statbuf->st_mode & 07777) | S_IFREG;
-    }
-
-    if (to_set & FUSE_SET_ATTR_UID) {
-        exp->st_uid = statbuf->st_uid;
-    }
-
-    if (to_set & FUSE_SET_ATTR_GID) {
-        exp->st_gid = statbuf->st_gid;
+    if ((to_set & FUSE_SET_ATTR_SIZE) && !exp->writable) {
+        fuse_reply_err(req, EACCES);
+        return;
     }
 
-    fuse_getattr(req, inode, fi);
+    r = fuse_request_new(req, inode);
+    r->statbuf = *statbuf;
+    r->mode = to_set;
+    fuse_request_start(r, fuse_co_setattr);
 }
 
 /**
@@ -518,126 +814,172 @@ static void fuse_open(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_open(req, fi);
 }
 
-/**
- * Handle client reads from the exported image.
- */
-static void fuse_read(fuse_req_t req, fuse_ino_t inode,
-                      size_t size, off_t offset, struct fuse_file_info *fi)
+static void coroutine_fn fuse_co_read(void *opaque)
 {
-    FuseExport *exp = fuse_req_userdata(req);
-    int64_t length;
-    void *buf;
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+    int64_t length, size = r->length;
     int ret;
 
-    /* Limited by max_read, should not happen */
-    if (size > FUSE_MAX_BOUNCE_BYTES) {
-        fuse_reply_err(req, EINVAL);
-        return;
-    }
-
     /**
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        fuse_reply_err(r->req, -length);
+        goto out;
     }
 
-    if (offset + size > length) {
-        size = length - offset;
+    if (r->offset + size > length) {
+        size = length - r->offset;
     }
 
-    buf = qemu_try_blockalign(blk_bs(exp->common.blk), size);
-    if (!buf) {
-        fuse_reply_err(req, ENOMEM);
-        return;
+    r->buf = blk_try_blockalign(exp->common.blk, size);
+    if (!r->buf) {
+        fuse_reply_err(r->req, ENOMEM);
+        goto out;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, r->offset, size, r->buf, 0);
     if (ret >= 0) {
-        fuse_reply_buf(req, buf, size);
+        fuse_reply_buf(r->req, r->buf, size);
     } else {
-        fuse_reply_err(req, -ret);
+        fuse_reply_err(r->req, -ret);
     }
 
-    qemu_vfree(buf);
+out:
+    fuse_request_done(r);
 }
 
 /**
- * Handle client writes to the exported image.
+ * Handle client reads from the exported image.
  */
-static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
-                       size_t size, off_t offset, struct fuse_file_info *fi)
+static void fuse_read(fuse_req_t req, fuse_ino_t inode,
+                      size_t size, off_t offset, struct fuse_file_info *fi)
 {
-    FuseExport *exp = fuse_req_userdata(req);
-    int64_t length;
-    int ret;
+    FuseRequest *r;
 
-    /* Limited by max_write, should not happen */
-    if (size > BDRV_REQUEST_MAX_BYTES) {
+    /* Limited by max_read, should not happen */
+    if (size > FUSE_MAX_BOUNCE_BYTES) {
         fuse_reply_err(req, EINVAL);
         return;
     }
 
-    if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
-    }
+    r = fuse_request_new(req, inode);
+    r->offset = offset;
+    r->length = size;
+    fuse_request_start(r, fuse_co_read);
+}
+
+static void coroutine_fn fuse_co_write(void *opaque)
+{
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+    int64_t length, size = r->length;
+    int ret = 0;
 
     /**
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
-    if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
-    }
-
-    if (offset + size > length) {
-        if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
-            if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+    WITH_QEMU_LOCK_GUARD(&exp->resize_lock) {
+        length = blk_co_getlength(exp->common.blk);
+        if (length < 0) {
+            ret = length;
+        } else if (r->offset + size > length) {
+            if (exp->growable) {
+                ret = fuse_co_do_truncate(exp, r->offset + size, true,
+                                          PREALLOC_MODE_OFF);
+            } else {
+                size = length - r->offset;
             }
-        } else {
-            size = length - offset;
         }
     }
+    if (ret < 0) {
+        fuse_reply_err(r->req, -ret);
+        goto out;
+    }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, r->offset, size, r->buf, 0);
     if (ret >= 0) {
-        fuse_reply_write(req, size);
+        fuse_reply_write(r->req, size);
     } else {
-        fuse_reply_err(req, -ret);
+        fuse_reply_err(r->req, -ret);
     }
+
+out:
+    fuse_request_done(r);
 }
 
 /**
- * Let clients perform various fallocate() operations.
+ * Handle client writes to the exported image.  With splice reads enabled,
+ * @bufv may still refer to the pipe the request was read into, so the data
+ * is copied into a buffer of the request's own before the next request can
+ * be read.
  */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
+static void fuse_write_buf(fuse_req_t req, fuse_ino_t inode,
+                           struct fuse_bufvec *bufv, off_t offset,
                            struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
-    int64_t blk_len;
-    int ret;
+    size_t size = fuse_buf_size(bufv);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    FuseRequest *r;
+    ssize_t copied;
+
+    /* Limited by max_write, should not happen */
+    if (size > BDRV_REQUEST_MAX_BYTES) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
 
     if (!exp->writable) {
         fuse_reply_err(req, EACCES);
         return;
     }
 
-    blk_len = blk_getlength(exp->common.blk);
-    if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
+    r = fuse_request_new(req, inode);
+    r->offset = offset;
+    r->length = size;
+    r->buf = blk_try_blockalign(exp->common.blk, size);
+    if (!r->buf) {
+        fuse_reply_err(req, ENOMEM);
+        g_free(r);
+        return;
+    }
+
+    dst.buf[0].mem = r->buf;
+    copied = fuse_buf_copy(&dst, bufv, 0);
+    if (copied != size) {
+        fuse_reply_err(req, copied < 0 ? -copied : EIO);
+        qemu_vfree(r->buf);
+        g_free(r);
         return;
     }
 
+    fuse_request_start(r, fuse_co_write);
+}
+
+static void coroutine_fn fuse_co_fallocate(void *opaque)
+{
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+    int mode = r->mode;
+    int64_t offset = r->offset;
+    int64_t length = r->length;
+    int64_t blk_len;
+    int ret;
+
+    /* Everything here depends on the image length staying the same */
+    qemu_co_mutex_lock(&exp->resize_lock);
+
+    blk_len = blk_co_getlength(exp->common.blk);
+    if (blk_len < 0) {
+        ret = blk_len;
+        goto out;
+    }
+
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     if (mode & FALLOC_FL_KEEP_SIZE) {
         length = MIN(length, blk_len - offset);
@@ -647,34 +989,34 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     if (!mode) {
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
+            ret = -EOPNOTSUPP;
+            goto out;
         }
 
         if (offset > blk_len) {
             /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                goto out;
             }
         }
 
-        ret = fuse_do_truncate(exp, offset + length, true,
-                               PREALLOC_MODE_FALLOC);
+        ret = fuse_co_do_truncate(exp, offset + length, true,
+                                  PREALLOC_MODE_FALLOC);
     }
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            ret = -EINVAL;
+            goto out;
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
-                                    BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
                  * fallocate() specifies to return EOPNOTSUPP for unsupported
@@ -692,19 +1034,18 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset + length, false,
+                                      PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                goto out;
             }
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -714,20 +1055,51 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+out:
+    qemu_co_mutex_unlock(&exp->resize_lock);
+    fuse_reply_err(r->req, ret < 0 ? -ret : 0);
+    fuse_request_done(r);
 }
 
 /**
- * Let clients fsync the exported image.
+ * Let clients perform various fallocate() operations.
  */
-static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
-                       struct fuse_file_info *fi)
+static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
+                           off_t offset, off_t length,
+                           struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
+    FuseRequest *r;
+
+    if (!exp->writable) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    r = fuse_request_new(req, inode);
+    r->mode = mode;
+    r->offset = offset;
+    r->length = length;
+    fuse_request_start(r, fuse_co_fallocate);
+}
+
+static void coroutine_fn fuse_co_fsync(void *opaque)
+{
+    FuseRequest *r = opaque;
     int ret;
 
-    ret = blk_flush(exp->common.blk);
-    fuse_reply_err(req, ret < 0 ? -ret : 0);
+    ret = blk_co_flush(r->exp->common.blk);
+    fuse_reply_err(r->req, ret < 0 ? -ret : 0);
+    fuse_request_done(r);
+}
+
+/**
+ * Let clients fsync the exported image.
+ */
+static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
+                       struct fuse_file_info *fi)
+{
+    fuse_request_start(fuse_request_new(req, inode), fuse_co_fsync);
 }
 
 /**
@@ -741,28 +1113,22 @@ static void fuse_flush(fuse_req_t req, fuse_ino_t inode,
 }
 
 #ifdef CONFIG_FUSE_LSEEK
-/**
- * Let clients inquire allocation status.
- */
-static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
-                       int whence, struct fuse_file_info *fi)
+static void coroutine_fn fuse_co_lseek(void *opaque)
 {
-    FuseExport *exp = fuse_req_userdata(req);
-
-    if (whence != SEEK_HOLE && whence != SEEK_DATA) {
-        fuse_reply_err(req, EINVAL);
-        return;
-    }
+    FuseRequest *r = opaque;
+    FuseExport *exp = r->exp;
+    int64_t offset = r->offset;
+    int whence = r->mode;
 
     while (true) {
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        ret = blk_co_block_status_above(exp->common.blk, NULL,
+                                        offset, INT64_MAX, &pnum, NULL, NULL);
         if (ret < 0) {
-            fuse_reply_err(req, -ret);
-            return;
+            fuse_reply_err(r->req, -ret);
+            break;
         }
 
         if (!pnum && (ret & BDRV_BLOCK_EOF)) {
@@ -777,40 +1143,58 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
              * and @blk_len (the client-visible EOF).
              */
 
-            blk_len = blk_getlength(exp->common.blk);
+            blk_len = blk_co_getlength(exp->common.blk);
             if (blk_len < 0) {
-                fuse_reply_err(req, -blk_len);
-                return;
-            }
-
-            if (offset > blk_len || whence == SEEK_DATA) {
-                fuse_reply_err(req, ENXIO);
+                fuse_reply_err(r->req, -blk_len);
+            } else if (offset > blk_len || whence == SEEK_DATA) {
+                fuse_reply_err(r->req, ENXIO);
             } else {
-                fuse_reply_lseek(req, offset);
+                fuse_reply_lseek(r->req, offset);
             }
-            return;
+            break;
         }
 
         if (ret & BDRV_BLOCK_DATA) {
             if (whence == SEEK_DATA) {
-                fuse_reply_lseek(req, offset);
-                return;
+                fuse_reply_lseek(r->req, offset);
+                break;
             }
         } else {
             if (whence == SEEK_HOLE) {
-                fuse_reply_lseek(req, offset);
-                return;
+                fuse_reply_lseek(r->req, offset);
+                break;
             }
         }
 
         /* Safety check against infinite loops */
         if (!pnum) {
-            fuse_reply_err(req, ENXIO);
-            return;
+            fuse_reply_err(r->req, ENXIO);
+            break;
         }
 
         offset += pnum;
     }
+
+    fuse_request_done(r);
+}
+
+/**
+ * Let clients inquire allocation status.
+ */
+static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
+                       int whence, struct fuse_file_info *fi)
+{
+    FuseRequest *r;
+
+    if (whence != SEEK_HOLE && whence != SEEK_DATA) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    r = fuse_request_new(req, inode);
+    r->offset = offset;
+    r->mode = whence;
+    fuse_request_start(r, fuse_co_lseek);
 }
 #endif
 
@@ -821,7 +1205,7 @@ static const struct fuse_lowlevel_ops fuse_ops = {
     .setattr    = fuse_setattr,
     .open       = fuse_open,
     .read       = fuse_read,
-    .write      = fuse_write,
+    .write_buf  = fuse_write_buf,
     .fallocate  = fuse_fallocate,
     .flush      = fuse_flush,
     .fsync      = fuse_fsync,
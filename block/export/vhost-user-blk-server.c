@@ -18,6 +18,7 @@
 #include "vhost-user-blk-server.h"
 #include "qapi/error.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
 
@@ -29,6 +30,8 @@ typedef struct VuBlkReq {
     VuVirtqElement elem;
     VuServer *server;
     struct VuVirtq *vq;
+    int vq_idx;
+    AioContext *vq_ctx; /* where the virtqueue is processed */
 } VuBlkReq;
 
 /* vhost user block device */
@@ -38,14 +41,20 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+
+    /* Iothreads that process the virtqueues, virtqueue i in i % n */
+    IOThread **queue_iothreads;
+    size_t nr_queue_iothreads;
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
 {
     VuDev *vu_dev = &req->server->vu_dev;
 
+    vhost_user_server_queue_lock(req->server, req->vq_idx);
     vu_queue_push(vu_dev, req->vq, &req->elem, in_len);
     vu_queue_notify(vu_dev, req->vq);
+    vhost_user_server_queue_unlock(req->server, req->vq_idx);
 
     free(req);
 }
@@ -62,10 +71,25 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
     struct iovec *out_iov = elem->out_sg;
     unsigned in_num = elem->in_num;
     unsigned out_num = elem->out_num;
+    AioContext *export_ctx = vexp->export.ctx;
     int in_len;
 
+    /*
+     * Requests of virtqueues that are processed in an iothread only enter
+     * the export's AioContext for the block layer, and come back to
+     * complete the request on their virtqueue.
+     */
+    if (req->vq_ctx != export_ctx) {
+        aio_co_reschedule_self(export_ctx);
+    }
+
     in_len = virtio_blk_process_req(handler, in_iov, out_iov,
                                     in_num, out_num);
+
+    if (req->vq_ctx != export_ctx) {
+        aio_co_reschedule_self(req->vq_ctx);
+    }
+
     if (in_len < 0) {
         free(req);
         vhost_user_server_unref(server);
@@ -91,12 +115,26 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
 
         req->server = server;
         req->vq = vq;
+        req->vq_idx = idx;
+        req->vq_ctx = qemu_get_current_aio_context();
 
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
 
         vhost_user_server_ref(server);
-        qemu_coroutine_enter(co);
+
+        /*
+         * Virtqueues that are processed in iothreads are kicked with the
+         * queue lock held, and completing a request takes it again.
+         * Requests that complete without yielding (or any request, if the
+         * export runs in the same iothread) would deadlock, so they only
+         * start once the kick handler has returned.
+         */
+        if (server->nr_queue_threads) {
+            aio_co_schedule(req->vq_ctx, co);
+        } else {
+            qemu_coroutine_enter(co);
+        }
     }
 }
 
@@ -269,10 +307,42 @@ static void vu_blk_exp_resize(void *opaque)
     vu_config_change_msg(&vexp->vu_server.vu_dev);
 }
 
+/*
+ * Draining only disables the kick fds in the export's AioContext, so
+ * virtqueues that are processed in iothreads must be stopped separately.
+ */
+static void vu_blk_drained_begin(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    vhost_user_server_pause_queues(&vexp->vu_server);
+}
+
+static void vu_blk_drained_end(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    vhost_user_server_resume_queues(&vexp->vu_server);
+}
+
 static const BlockDevOps vu_blk_dev_ops = {
-    .resize_cb = vu_blk_exp_resize,
+    .resize_cb     = vu_blk_exp_resize,
+    .drained_begin = vu_blk_drained_begin,
+    .drained_end   = vu_blk_drained_end,
 };
 
+static void vu_blk_free_queue_iothreads(VuBlkExport *vexp)
+{
+    size_t i;
+
+    for (i = 0; i < vexp->nr_queue_iothreads; i++) {
+        object_unref(OBJECT(vexp->queue_iothreads[i]));
+    }
+    g_free(vexp->queue_iothreads);
+    vexp->queue_iothreads = NULL;
+    vexp->nr_queue_iothreads = 0;
+}
+
 static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
                              Error **errp)
 {
@@ -281,6 +351,9 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     Error *local_err = NULL;
     uint64_t logical_block_size;
     uint16_t num_queues = VHOST_USER_BLK_NUM_QUEUES_DEFAULT;
+    g_autofree AioContext **queue_ctxs = NULL;
+    strList *iothreads;
+    size_t i, j;
 
     vexp->blkcfg.wce = 0;
 
@@ -303,6 +376,45 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         error_setg(errp, "num-queues must be greater than 0");
         return -EINVAL;
     }
+
+    for (iothreads = vu_opts->queue_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        vexp->nr_queue_iothreads++;
+    }
+    if (vexp->nr_queue_iothreads > num_queues) {
+        error_setg(errp, "queue-iothreads must not list more iothreads than "
+                   "num-queues");
+        vexp->nr_queue_iothreads = 0;
+        return -EINVAL;
+    }
+    vexp->queue_iothreads = g_new0(IOThread *, vexp->nr_queue_iothreads);
+    queue_ctxs = g_new0(AioContext *, vexp->nr_queue_iothreads);
+    for (i = 0, iothreads = vu_opts->queue_iothreads; iothreads;
+         i++, iothreads = iothreads->next)
+    {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            vexp->nr_queue_iothreads = i;
+            vu_blk_free_queue_iothreads(vexp);
+            return -ENOENT;
+        }
+        for (j = 0; j < i; j++) {
+            if (vexp->queue_iothreads[j] == iothread) {
+                error_setg(errp, "iothread \"%s\" is listed more than once "
+                           "in queue-iothreads", iothreads->value);
+                vexp->nr_queue_iothreads = i;
+                vu_blk_free_queue_iothreads(vexp);
+                return -EINVAL;
+            }
+        }
+        object_ref(OBJECT(iothread));
+        vexp->queue_iothreads[i] = iothread;
+        queue_ctxs[i] = iothread_get_aio_context(iothread);
+    }
+
     vexp->handler.blk = exp->blk;
     vexp->handler.serial = g_strdup("vhost_user_blk");
     vexp->handler.logical_block_size = logical_block_size;
@@ -317,10 +429,13 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     blk_set_dev_ops(exp->blk, &vu_blk_dev_ops, vexp);
 
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
-                                 num_queues, &vu_blk_iface, errp)) {
+                                 num_queues, queue_ctxs,
+                                 vexp->nr_queue_iothreads, &vu_blk_iface,
+                                 errp)) {
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
+        vu_blk_free_queue_iothreads(vexp);
         return -EADDRNOTAVAIL;
     }
 
@@ -334,6 +449,7 @@ static void vu_blk_exp_delete(BlockExport *exp)
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
     g_free(vexp->handler.serial);
+    vu_blk_free_queue_iothreads(vexp);
 }
 
 const BlockExportDriver blk_exp_vhost_user_blk = {
@@ -74,6 +74,7 @@
 #include <linux/hdreg.h>
 #include <linux/magic.h>
 #include <scsi/sg.h>
+#include <sys/sendfile.h>
 #ifdef __s390__
 #include <asm/dasd.h>
 #endif
@@ -157,6 +158,13 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool use_linux_aio:1;
     bool use_linux_io_uring:1;
+#ifdef CONFIG_LINUX_IO_URING
+    bool io_uring_fixed_files;
+    bool io_uring_fixed_buffers;
+    /* io_uring instance that s->fd is registered with, and its index there */
+    LuringState *fixed_file_ring;
+    int fixed_file_index;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -216,6 +224,9 @@ typedef struct RawPosixAIOData {
             PreallocMode prealloc;
             Error **errp;
         } truncate;
+        struct {
+            int out_fd;
+        } sendfile;
     };
 } RawPosixAIOData;
 
@@ -550,6 +561,19 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "io-uring-fixed-files",
+            .type = QEMU_OPT_BOOL,
+            .help = "register the file with io_uring (default: off)",
+        },
+        {
+            .name = "io-uring-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "use io_uring fixed buffers for registered memory "
+                    "(default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -578,6 +602,54 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Add s->fd to the registered file table of @ctx's io_uring instance */
+static void raw_luring_register_file(BlockDriverState *bs, AioContext *ctx)
+{
+    BDRVRawState *s = bs->opaque;
+    LuringState *ring;
+    Error *local_err = NULL;
+    int ret;
+
+    if (!s->use_linux_io_uring || !s->io_uring_fixed_files || s->fd < 0) {
+        return;
+    }
+
+    assert(!s->fixed_file_ring);
+    ring = aio_get_linux_io_uring(ctx);
+    ret = luring_register_file(ring, s->fd, &local_err);
+    if (ret < 0) {
+        warn_reportf_err(local_err, "Not using an io_uring fixed file: ");
+        return;
+    }
+    s->fixed_file_ring = ring;
+    s->fixed_file_index = ret;
+}
+
+static void raw_luring_unregister_file(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->fixed_file_ring) {
+        luring_unregister_file(s->fixed_file_ring, s->fixed_file_index);
+        s->fixed_file_ring = NULL;
+    }
+}
+
+/* Index of s->fd in the current AioContext's registered file table, or -1 */
+static int raw_luring_file_index(BDRVRawState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    if (s->fixed_file_ring &&
+        s->fixed_file_ring == aio_get_linux_io_uring(ctx)) {
+        return s->fixed_file_index;
+    }
+    return -1;
+}
+#endif
+
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -631,6 +703,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+#ifdef CONFIG_LINUX_IO_URING
+    s->io_uring_fixed_files = qemu_opt_get_bool(opts, "io-uring-fixed-files",
+                                                false);
+    s->io_uring_fixed_buffers = qemu_opt_get_bool(opts,
+                                                  "io-uring-fixed-buffers",
+                                                  false);
+    if ((s->io_uring_fixed_files || s->io_uring_fixed_buffers) &&
+        !s->use_linux_io_uring) {
+        error_setg(errp, "io-uring-fixed-files and io-uring-fixed-buffers "
+                   "require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -796,6 +883,10 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_register_file(bs, bdrv_get_aio_context(bs));
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1824,6 +1915,52 @@ static int handle_aiocb_copy_range(void *opaque)
     return 0;
 }
 
+#ifdef __linux__
+/*
+ * Returns the number of bytes sent, or -EAGAIN if the (non-blocking) output
+ * fd was full before anything could be sent.  Short sends are fine, the
+ * caller waits for the output fd and comes back for the rest.
+ */
+static int handle_aiocb_sendfile(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    off_t offset = aiocb->aio_offset;
+    uint64_t sent = 0;
+
+    while (sent < aiocb->aio_nbytes) {
+        ssize_t ret = sendfile(aiocb->sendfile.out_fd, aiocb->aio_fildes,
+                               &offset, aiocb->aio_nbytes - sent);
+        trace_file_sendfile(aiocb->bs, aiocb->aio_fildes,
+                            aiocb->sendfile.out_fd, aiocb->aio_offset + sent,
+                            aiocb->aio_nbytes - sent, ret);
+        if (ret == 0) {
+            /* EOF, let the caller read (and zero-pad) the rest normally */
+            break;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (sent) {
+                break;
+            }
+            switch (errno) {
+            case EAGAIN:
+                return -EAGAIN;
+            case ENOSYS:
+            case EINVAL:
+                return -ENOTSUP;
+            default:
+                return -errno;
+            }
+        }
+        sent += ret;
+    }
+
+    return sent ? sent : -ENOTSUP;
+}
+#endif
+
 static int handle_aiocb_discard(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2068,7 +2205,8 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
-                                   uint64_t bytes, QEMUIOVector *qiov, int type)
+                                   uint64_t bytes, QEMUIOVector *qiov, int type,
+                                   BdrvRequestFlags flags)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
@@ -2087,7 +2225,11 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (s->use_linux_io_uring) {
         assert(qiov->size == bytes);
-        return luring_co_submit(bs, s->fd, offset, qiov, type);
+        if (!s->io_uring_fixed_buffers) {
+            flags &= ~BDRV_REQ_REGISTERED_BUF;
+        }
+        return luring_co_submit(bs, s->fd, raw_luring_file_index(s), offset,
+                                qiov, type, flags);
 #endif
 #ifdef CONFIG_LINUX_AIO
     } else if (s->use_linux_aio) {
@@ -2116,14 +2258,14 @@ static int coroutine_fn raw_co_preadv(BlockDriverState *bs, int64_t offset,
                                       int64_t bytes, QEMUIOVector *qiov,
                                       BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_READ, flags);
 }
 
 static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, int64_t offset,
                                        int64_t bytes, QEMUIOVector *qiov,
                                        BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE);
+    return raw_co_prw(bs, offset, bytes, qiov, QEMU_AIO_WRITE, flags);
 }
 
 static void coroutine_fn raw_co_io_plug(BlockDriverState *bs)
@@ -2175,7 +2317,8 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, s->fd, raw_luring_file_index(s), 0, NULL,
+                                QEMU_AIO_FLUSH, 0);
     }
 #endif
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
@@ -2203,14 +2346,47 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                          "falling back to thread pool: ");
             s->use_linux_io_uring = false;
         }
+        raw_luring_register_file(bs, new_context);
     }
 #endif
 }
 
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_unregister_file(bs);
+#endif
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!s->io_uring_fixed_buffers) {
+        return true;
+    }
+    return luring_register_buf(host, size, errp);
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->io_uring_fixed_buffers) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_unregister_file(bs);
+#endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -3235,9 +3411,15 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        raw_luring_unregister_file(bs);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+#ifdef CONFIG_LINUX_IO_URING
+        raw_luring_register_file(bs, bdrv_get_aio_context(bs));
+#endif
     }
     s->perm_change_fd = 0;
 
@@ -3305,6 +3487,42 @@ raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(handle_aiocb_copy_range, &acb);
 }
 
+#ifdef __linux__
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs, int64_t offset,
+                                        int64_t bytes, int out_fd)
+{
+    BDRVRawState *s = bs->opaque;
+    RawPosixAIOData acb;
+    int ret;
+
+    /*
+     * O_DIRECT bypasses the page cache that sendfile() reads from, so the
+     * two would not necessarily see the same data.
+     */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+
+    ret = fd_open(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    acb = (RawPosixAIOData) {
+        .bs             = bs,
+        .aio_type       = QEMU_AIO_SENDFILE,
+        .aio_fildes     = s->fd,
+        .aio_offset     = offset,
+        .aio_nbytes     = bytes,
+        .sendfile       = {
+            .out_fd         = out_fd,
+        },
+    };
+
+    return raw_thread_pool_submit(handle_aiocb_sendfile, &acb);
+}
+#endif
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -3331,10 +3549,18 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+#ifdef __linux__
+    .bdrv_co_sendfile       = raw_co_sendfile,
+#endif
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -3707,6 +3933,11 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -3837,6 +4068,11 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -3965,6 +4201,11 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_co_io_plug        = raw_co_io_plug,
     .bdrv_co_io_unplug      = raw_co_io_unplug,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
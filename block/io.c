@@ -576,13 +576,35 @@ void bdrv_drain_all(void)
     bdrv_drain_all_end();
 }
 
+static const enum BlockAcctType tracked_request_acct_type[] = {
+    [BDRV_TRACKED_READ]     = BLOCK_ACCT_READ,
+    [BDRV_TRACKED_WRITE]    = BLOCK_ACCT_WRITE,
+    [BDRV_TRACKED_DISCARD]  = BLOCK_ACCT_UNMAP,
+    [BDRV_TRACKED_TRUNCATE] = BLOCK_ACCT_NONE,
+};
+
 /**
  * Remove an active request from the tracked requests list
  *
  * This function should be called when a tracked request is completing.
+ * @ret is the result of the request; as in the BlockBackend statistics,
+ * only successful requests go into the latency histograms.
  */
-static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
+static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req, int ret)
 {
+    enum BlockAcctType type = tracked_request_acct_type[req->type];
+
+    if (type != BLOCK_ACCT_NONE) {
+        int64_t latency_ns = block_latency_now() - req->start_ns;
+
+        trace_bdrv_request_done(req->bs, type, req->offset, req->bytes,
+                                latency_ns, ret);
+        if (ret >= 0) {
+            block_latency_account_ns(&req->bs->latency, type,
+                                     MAX(latency_ns, 0));
+        }
+    }
+
     if (req->serialising) {
         qatomic_dec(&req->bs->serialising_in_flight);
     }
@@ -615,6 +637,10 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
         .overlap_bytes  = bytes,
     };
 
+    if (tracked_request_acct_type[type] != BLOCK_ACCT_NONE) {
+        req->start_ns = block_latency_now();
+    }
+
     qemu_co_queue_init(&req->wait_queue);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
@@ -1665,7 +1691,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     ret = bdrv_aligned_preadv(child, &req, offset, bytes,
                               bs->bl.request_alignment,
                               qiov, qiov_offset, flags);
-    tracked_request_end(&req);
+    tracked_request_end(&req, ret);
     bdrv_padding_destroy(&pad);
 
 fail:
@@ -2148,7 +2174,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     bdrv_padding_destroy(&pad);
 
 out:
-    tracked_request_end(&req);
+    tracked_request_end(&req, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -2840,6 +2866,7 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
 {
     BdrvChild *primary_child = bdrv_primary_child(bs);
     BdrvChild *child;
+    int64_t start_ns;
     int current_gen;
     int ret = 0;
     IO_CODE();
@@ -2852,6 +2879,8 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
         goto early_exit;
     }
 
+    start_ns = block_latency_now();
+
     qemu_co_mutex_lock(&bs->reqs_lock);
     current_gen = qatomic_read(&bs->write_gen);
 
@@ -2948,6 +2977,7 @@ out:
     /* Notify any pending flushes that we have completed */
     if (ret == 0) {
         bs->flushed_gen = current_gen;
+        block_latency_account(&bs->latency, BLOCK_ACCT_FLUSH, start_ns);
     }
 
     qemu_co_mutex_lock(&bs->reqs_lock);
@@ -3077,7 +3107,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
     ret = 0;
 out:
     bdrv_co_write_req_finish(child, req.offset, req.bytes, &req, ret);
-    tracked_request_end(&req);
+    tracked_request_end(&req, ret);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -3304,7 +3334,7 @@ static int coroutine_fn GRAPH_RDLOCK bdrv_co_copy_range_internal(
                                                     bytes,
                                                     read_flags, write_flags);
 
-        tracked_request_end(&req);
+        tracked_request_end(&req, ret);
         bdrv_dec_in_flight(src->bs);
     } else {
         bdrv_inc_in_flight(dst->bs);
@@ -3320,7 +3350,7 @@ static int coroutine_fn GRAPH_RDLOCK bdrv_co_copy_range_internal(
                                                       read_flags, write_flags);
         }
         bdrv_co_write_req_finish(dst, dst_offset, bytes, &req, ret);
-        tracked_request_end(&req);
+        tracked_request_end(&req, ret);
         bdrv_dec_in_flight(dst->bs);
     }
 
@@ -3376,6 +3406,68 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
                                    bytes, read_flags, write_flags);
 }
 
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, int64_t offset,
+                                  int64_t bytes, int out_fd)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvTrackedRequest req;
+    int ret;
+    IO_CODE();
+    assert_bdrv_graph_readable();
+    trace_bdrv_co_sendfile(bs, offset, bytes, out_fd);
+
+    if (!bdrv_co_is_inserted(bs)) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_request32(offset, bytes, NULL, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /*
+     * Copy-on-read would have to populate the image from the data that we
+     * never see, so leave such nodes to the normal read path.
+     */
+    if (!bs->drv->bdrv_co_sendfile || bs->encrypted ||
+        qatomic_read(&bs->copy_on_read)) {
+        return -ENOTSUP;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    bdrv_wait_serialising_requests(&req);
+
+    ret = bs->drv->bdrv_co_sendfile(bs, offset, bytes, out_fd);
+
+    tracked_request_end(&req, ret);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
+/*
+ * Whether bdrv_co_sendfile() can work for @bs at all, so that callers can
+ * choose between zero copy and a bounce buffer before they commit to either.
+ * Every node down to the protocol node must implement it, and none of the
+ * conditions that make it return -ENOTSUP may apply.
+ */
+bool coroutine_fn bdrv_co_can_sendfile(BlockDriverState *bs)
+{
+    IO_CODE();
+    assert_bdrv_graph_readable();
+
+    while (bs && bs->drv && bs->drv->bdrv_co_sendfile && !bs->encrypted &&
+           !qatomic_read(&bs->copy_on_read)) {
+        if (bs->drv->protocol_name) {
+            /* sendfile() reads from the page cache, which O_DIRECT bypasses */
+            return !(bs->open_flags & BDRV_O_NOCACHE);
+        }
+        bs = bs->file ? bs->file->bs : NULL;
+    }
+
+    return false;
+}
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs)
 {
     BdrvChild *c;
@@ -3516,7 +3608,7 @@ int coroutine_fn bdrv_co_truncate(BdrvChild *child, int64_t offset, bool exact,
     bdrv_co_write_req_finish(child, offset - new_bytes, new_bytes, &req, 0);
 
 out:
-    tracked_request_end(&req);
+    tracked_request_end(&req, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -15,6 +15,9 @@
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "trace.h"
 
@@ -24,6 +27,13 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file table of each ring */
+#define MAX_FIXED_FILES 64
+
+/* The kernel limits registered buffers to 1 GiB each and 16k per ring */
+#define MAX_FIXED_BUF_SIZE (1 * GiB)
+#define MAX_FIXED_BUFS (16 * 1024)
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -32,6 +42,11 @@ typedef struct LuringAIOCB {
     bool is_read;
     QSIMPLEQ_ENTRY(LuringAIOCB) next;
 
+    /* Only used on the AioContext's fd monitoring ring */
+    AioUringRequest req;
+    LuringState *s;
+    int cqe_res;
+
     /*
      * Buffered reads may require resubmission, see
      * luring_resubmit_short_read().
@@ -48,16 +63,74 @@ typedef struct LuringQueue {
     QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
 } LuringQueue;
 
-typedef struct LuringState {
+struct LuringState {
     AioContext *aio_context;
 
-    struct io_uring ring;
+    /*
+     * The ring that requests are submitted on.  If the AioContext monitors
+     * its fds with io_uring, this is that ring (shared == true), so that
+     * requests are submitted and reaped by the same io_uring_enter() as fd
+     * events.  Otherwise it is own_ring.
+     */
+    struct io_uring *ring;
+    bool shared;
+    unsigned int features;
+    struct io_uring own_ring;
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
+    /* Requests completed on the shared ring, processed by completion_bh */
+    QSIMPLEQ_HEAD(, LuringAIOCB) completed;
+
+    /*
+     * The shared ring has no fd of our own to busy poll, so this never
+     * signalled notifier carries the poll handlers for it, see
+     * qemu_luring_shared_poll_cb().
+     */
+    EventNotifier poll_notifier;
+
     QEMUBH *completion_bh;
-} LuringState;
+
+    /*
+     * Registered file table, NULL until the first luring_register_file().
+     * Unused slots are -1.
+     */
+    QemuMutex fixed_files_lock;
+    int *fixed_files;
+    bool fixed_files_lost;
+
+    /*
+     * Buffers registered with the kernel, sorted by address.  Only accessed
+     * from AioContext home thread, see luring_sync_fixed_bufs().
+     */
+    struct iovec *fixed_bufs;
+    unsigned int nb_fixed_bufs;
+    unsigned int fixed_bufs_generation;
+    bool fixed_bufs_stale;
+    bool fixed_bufs_disabled;
+};
+
+/*
+ * Memory registered through luring_register_buf().  This is global because
+ * the block layer registers buffers for all AioContexts at once; each ring
+ * picks up changes the next time it is idle.
+ */
+typedef struct LuringBuf {
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+} LuringBuf;
+
+static QemuMutex luring_bufs_lock;
+static GArray *luring_bufs;
+static unsigned int luring_bufs_generation;
+
+static void __attribute__((__constructor__)) luring_bufs_init(void)
+{
+    qemu_mutex_init(&luring_bufs_lock);
+    luring_bufs = g_array_new(false, false, sizeof(LuringBuf));
+}
 
 /**
  * luring_resubmit:
@@ -89,6 +162,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    /* Fixed-buffer reads address a single buffer directly */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -120,10 +202,48 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
  * canceled.
  *
  */
-static void luring_process_completions(LuringState *s)
+static void luring_shared_complete(AioUringRequest *req, int res)
+{
+    LuringAIOCB *luringcb = container_of(req, LuringAIOCB, req);
+    LuringState *s = luringcb->s;
+
+    luringcb->cqe_res = res;
+    QSIMPLEQ_INSERT_TAIL(&s->completed, luringcb, next);
+    qemu_bh_schedule(s->completion_bh);
+}
+
+/*
+ * Fetch the next completed request, either from the shared ring completions
+ * or from the cq ring of our own ring.  Shared ring completions can be left
+ * over after switching to our own ring, see luring_check_ring().
+ */
+static bool luring_next_completion(LuringState *s, LuringAIOCB **luringcb,
+                                   int *ret)
 {
     struct io_uring_cqe *cqes;
+
+    if (!QSIMPLEQ_EMPTY(&s->completed)) {
+        *luringcb = QSIMPLEQ_FIRST(&s->completed);
+        *ret = (*luringcb)->cqe_res;
+        QSIMPLEQ_REMOVE_HEAD(&s->completed, next);
+        return true;
+    }
+
+    if (s->shared || io_uring_peek_cqe(s->ring, &cqes) != 0 || !cqes) {
+        return false;
+    }
+
+    *luringcb = io_uring_cqe_get_data(cqes);
+    *ret = cqes->res;
+    io_uring_cqe_seen(s->ring, cqes);
+    return true;
+}
+
+static void luring_process_completions(LuringState *s)
+{
+    LuringAIOCB *luringcb;
     int total_bytes;
+    int ret;
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -141,19 +261,7 @@ static void luring_process_completions(LuringState *s)
      */
     qemu_bh_schedule(s->completion_bh);
 
-    while (io_uring_peek_cqe(&s->ring, &cqes) == 0) {
-        LuringAIOCB *luringcb;
-        int ret;
-
-        if (!cqes) {
-            break;
-        }
-
-        luringcb = io_uring_cqe_get_data(cqes);
-        ret = cqes->res;
-        io_uring_cqe_seen(&s->ring, cqes);
-        cqes = NULL;
-
+    while (luring_next_completion(s, &luringcb, &ret)) {
         /* Change counters one-by-one because we can be nested. */
         s->io_q.in_flight--;
         trace_luring_process_completion(s, luringcb, ret);
@@ -219,11 +327,48 @@ end:
     qemu_bh_cancel(s->completion_bh);
 }
 
+static int luring_check_ring(LuringState *s);
+
+/*
+ * Move requests onto the shared ring.  They are submitted to the kernel by
+ * the next aio_poll() iteration, together with the fd monitoring requests,
+ * unless the AioContext busy polls: then they must be in flight before it
+ * starts polling for their completion.
+ */
+static int ioq_submit_shared(LuringState *s)
+{
+    LuringAIOCB *luringcb;
+    int n = 0;
+
+    while (s->io_q.in_flight < MAX_ENTRIES &&
+           (luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        aio_uring_enqueue(s->aio_context, &luringcb->sqeq, &luringcb->req);
+        s->io_q.in_flight++;
+        s->io_q.in_queue--;
+        n++;
+    }
+    if (n && s->aio_context->poll_max_ns) {
+        aio_uring_submit(s->aio_context);
+    }
+    trace_luring_io_uring_submit(s, n);
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+    return n;
+}
+
 static int ioq_submit(LuringState *s)
 {
     int ret = 0;
     LuringAIOCB *luringcb, *luringcb_next;
 
+    ret = luring_check_ring(s);
+    if (ret < 0) {
+        return ret;
+    }
+    if (s->shared) {
+        return ioq_submit_shared(s);
+    }
+
     while (s->io_q.in_queue > 0) {
         /*
          * Try to fetch sqes from the ring for requests waiting in
@@ -231,7 +376,7 @@ static int ioq_submit(LuringState *s)
          */
         QSIMPLEQ_FOREACH_SAFE(luringcb, &s->io_q.submit_queue, next,
                               luringcb_next) {
-            struct io_uring_sqe *sqes = io_uring_get_sqe(&s->ring);
+            struct io_uring_sqe *sqes = io_uring_get_sqe(s->ring);
             if (!sqes) {
                 break;
             }
@@ -239,7 +384,7 @@ static int ioq_submit(LuringState *s)
             *sqes = luringcb->sqeq;
             QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
         }
-        ret = io_uring_submit(&s->ring);
+        ret = io_uring_submit(s->ring);
         trace_luring_io_uring_submit(s, ret);
         /* Prevent infinite loop if submission is refused */
         if (ret <= 0) {
@@ -288,7 +433,7 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
-    return io_uring_cq_ready(&s->ring);
+    return io_uring_cq_ready(s->ring);
 }
 
 static void qemu_luring_poll_ready(void *opaque)
@@ -298,6 +443,130 @@ static void qemu_luring_poll_ready(void *opaque)
     luring_process_completions_and_submit(s);
 }
 
+static void qemu_luring_shared_read(EventNotifier *e)
+{
+    /* Never set, the handler only exists for polling */
+    event_notifier_test_and_clear(e);
+}
+
+static bool qemu_luring_shared_poll_cb(void *opaque)
+{
+    LuringState *s = container_of(opaque, LuringState, poll_notifier);
+
+    /* Completions land on s->completed */
+    if (s->io_q.in_flight) {
+        aio_uring_poll(s->aio_context);
+    }
+    return !QSIMPLEQ_EMPTY(&s->completed);
+}
+
+static void qemu_luring_shared_poll_ready(EventNotifier *e)
+{
+    LuringState *s = container_of(e, LuringState, poll_notifier);
+
+    luring_process_completions_and_submit(s);
+}
+
+static void luring_attach_shared_ring(LuringState *s)
+{
+    aio_set_event_notifier(s->aio_context, &s->poll_notifier, false,
+                           qemu_luring_shared_read,
+                           qemu_luring_shared_poll_cb,
+                           qemu_luring_shared_poll_ready);
+}
+
+static void luring_detach_shared_ring(LuringState *s, AioContext *ctx)
+{
+    aio_set_event_notifier(ctx, &s->poll_notifier, false, NULL, NULL, NULL);
+}
+
+static void luring_attach_own_ring(LuringState *s)
+{
+    aio_set_fd_handler(s->aio_context, s->ring->ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, qemu_luring_poll_ready, s);
+}
+
+static int luring_init_own_ring(LuringState *s, int64_t sqpoll_idle)
+{
+    struct io_uring_params params = {};
+    int rc;
+
+    if (sqpoll_idle) {
+        params.flags = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle;
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, &s->own_ring, &params);
+    if (rc < 0 && sqpoll_idle) {
+        warn_report("Unable to create io_uring submission polling thread: "
+                    "%s, submitting without it", strerror(-rc));
+        params = (struct io_uring_params) {};
+        rc = io_uring_queue_init_params(MAX_ENTRIES, &s->own_ring, &params);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    s->ring = &s->own_ring;
+    s->shared = false;
+    s->features = params.features;
+    return 0;
+}
+
+/*
+ * The AioContext's fd monitoring ring goes away when the AioContext starts
+ * being driven by a glib main loop.  All our requests on it have completed by
+ * then (see aio_uring_enqueue()), so just continue on a ring of our own.
+ */
+static int luring_check_ring(LuringState *s)
+{
+    int ret;
+
+    if (!s->shared ||
+        aio_uring_get_ring(s->aio_context, NULL) == s->ring) {
+        return 0;
+    }
+
+    QEMU_LOCK_GUARD(&s->fixed_files_lock);
+
+    luring_detach_shared_ring(s, s->aio_context);
+    ret = luring_init_own_ring(s, 0);
+    trace_luring_switch_to_own_ring(s, ret);
+    if (ret < 0) {
+        error_report_once("Unable to create io_uring ring: %s",
+                          strerror(-ret));
+        return ret;
+    }
+    luring_attach_own_ring(s);
+
+    if (s->fixed_files) {
+        ret = io_uring_register_files(s->ring, s->fixed_files,
+                                      MAX_FIXED_FILES);
+        s->fixed_files_lost = ret < 0;
+    }
+
+    g_free(s->fixed_bufs);
+    s->fixed_bufs = NULL;
+    s->nb_fixed_bufs = 0;
+    s->fixed_bufs_stale = true;
+    return 0;
+}
+
+/*
+ * Before Linux 5.13 (IORING_FEAT_RSRC_TAGS), registering files or buffers
+ * waits for all requests on the ring to complete.  That never happens on the
+ * fd monitoring ring, whose poll requests stay pending.
+ */
+static bool luring_can_register(LuringState *s)
+{
+#ifdef IORING_FEAT_RSRC_TAGS
+    return !s->shared || (s->features & IORING_FEAT_RSRC_TAGS);
+#else
+    return !s->shared;
+#endif
+}
+
 static void ioq_init(LuringQueue *io_q)
 {
     QSIMPLEQ_INIT(&io_q->submit_queue);
@@ -328,9 +597,147 @@ void luring_io_unplug(void)
     }
 }
 
+static int luring_iov_cmp(const void *a, const void *b)
+{
+    const struct iovec *x = a, *y = b;
+
+    if (x->iov_base == y->iov_base) {
+        return 0;
+    }
+    return x->iov_base < y->iov_base ? -1 : 1;
+}
+
+/**
+ * luring_sync_fixed_bufs:
+ * @s: AIO state
+ *
+ * Brings the buffers registered with the kernel up to date with
+ * luring_register_buf()/luring_unregister_buf().  Registered buffers cannot
+ * be replaced while requests may be using them, so this only happens when
+ * the ring is idle; until then, no fixed buffers are used.
+ *
+ * Returns: true if fixed buffers may be used.
+ */
+static bool luring_sync_fixed_bufs(LuringState *s)
+{
+    unsigned int generation = qatomic_read(&luring_bufs_generation);
+    g_autofree struct iovec *iov = NULL;
+    unsigned int nb_bufs = 0;
+    unsigned int i;
+    int ret = 0;
+
+    if (s->fixed_bufs_generation == generation && !s->fixed_bufs_stale) {
+        return s->nb_fixed_bufs > 0;
+    }
+    if (s->fixed_bufs_disabled || s->io_q.in_flight || s->io_q.in_queue) {
+        return false;
+    }
+    if (!luring_can_register(s)) {
+        warn_report("io_uring fixed buffers on an iothread's shared ring "
+                    "need Linux 5.13 or newer");
+        s->fixed_bufs_disabled = true;
+        return false;
+    }
+
+    if (s->nb_fixed_bufs) {
+        io_uring_unregister_buffers(s->ring);
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        s->nb_fixed_bufs = 0;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&luring_bufs_lock) {
+        generation = luring_bufs_generation;
+        for (i = 0; i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            nb_bufs += DIV_ROUND_UP(buf->size, MAX_FIXED_BUF_SIZE);
+        }
+        if (nb_bufs > MAX_FIXED_BUFS) {
+            ret = -E2BIG;
+            break;
+        }
+
+        iov = g_new(struct iovec, nb_bufs);
+        nb_bufs = 0;
+        for (i = 0; i < luring_bufs->len; i++) {
+            LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+            size_t done;
+
+            for (done = 0; done < buf->size; done += MAX_FIXED_BUF_SIZE) {
+                iov[nb_bufs++] = (struct iovec) {
+                    .iov_base = buf->host + done,
+                    .iov_len = MIN(buf->size - done, MAX_FIXED_BUF_SIZE),
+                };
+            }
+        }
+    }
+    s->fixed_bufs_generation = generation;
+    s->fixed_bufs_stale = false;
+
+    if (ret == 0 && nb_bufs) {
+        qsort(iov, nb_bufs, sizeof(iov[0]), luring_iov_cmp);
+        ret = io_uring_register_buffers(s->ring, iov, nb_bufs);
+    }
+    trace_luring_sync_fixed_bufs(s, nb_bufs, ret);
+    if (ret < 0) {
+        warn_report("Unable to register io_uring fixed buffers: %s, "
+                    "falling back to normal reads and writes", strerror(-ret));
+        s->fixed_bufs_disabled = true;
+        return false;
+    }
+
+    s->fixed_bufs = g_steal_pointer(&iov);
+    s->nb_fixed_bufs = nb_bufs;
+    return nb_bufs > 0;
+}
+
+/**
+ * luring_find_fixed_buf:
+ * @s: AIO state
+ * @qiov: request buffer
+ *
+ * Returns: the index of the registered buffer that contains @qiov, or -1 if
+ * @qiov has more than one element or does not lie in one registered buffer.
+ */
+static int luring_find_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t start, end;
+    unsigned int lo = 0, hi = s->nb_fixed_bufs;
+
+    if (qiov->niov != 1) {
+        return -1;
+    }
+
+    start = (uintptr_t)qiov->iov[0].iov_base;
+    end = start + qiov->iov[0].iov_len;
+
+    /* Find the last buffer that starts at or before @start */
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if ((uintptr_t)s->fixed_bufs[mid].iov_base <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+    lo--;
+
+    if (end > (uintptr_t)s->fixed_bufs[lo].iov_base +
+              s->fixed_bufs[lo].iov_len) {
+        return -1;
+    }
+    return lo;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fd_index: index of @fd in the registered file table, or -1
+ * @buf_index: index of the registered buffer containing the request, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -339,20 +746,32 @@ void luring_io_unplug(void)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+static int luring_do_submit(int fd, int fd_index, int buf_index,
+                            LuringAIOCB *luringcb, LuringState *s,
                             uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    struct iovec *iov = luringcb->qiov ? luringcb->qiov->iov : NULL;
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, iov[0].iov_base,
+                                      iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, iov[0].iov_base,
+                                     iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -362,6 +781,10 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fd_index >= 0) {
+        sqes->fd = fd_index;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -378,10 +801,12 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fd_index,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, BdrvRequestFlags flags)
 {
     int ret;
+    int buf_index = -1;
     AioContext *ctx = qemu_get_current_aio_context();
     LuringState *s = aio_get_linux_io_uring(ctx);
     LuringAIOCB luringcb = {
@@ -389,10 +814,27 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .req.cb     = luring_shared_complete,
+        .s          = s,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+
+    ret = luring_check_ring(s);
+    if (ret < 0) {
+        return ret;
+    }
+    if (s->fixed_files_lost) {
+        fd_index = -1;
+    }
+
+    if ((flags & BDRV_REQ_REGISTERED_BUF) &&
+        (type == QEMU_AIO_READ || type == QEMU_AIO_WRITE) &&
+        luring_sync_fixed_bufs(s)) {
+        buf_index = luring_find_fixed_buf(s, qiov);
+    }
+
+    ret = luring_do_submit(fd, fd_index, buf_index, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -406,8 +848,16 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
-    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
-                       NULL, NULL, NULL, NULL, s);
+    if (!s->shared) {
+        aio_set_fd_handler(old_context, s->ring->ring_fd, false,
+                           NULL, NULL, NULL, NULL, s);
+    } else {
+        luring_detach_shared_ring(s, old_context);
+        if (aio_uring_get_ring(old_context, NULL) != s->ring) {
+            /* Gone with everything that was registered, see luring_cleanup() */
+            s->ring = NULL;
+        }
+    }
     qemu_bh_delete(s->completion_bh);
     s->aio_context = NULL;
 }
@@ -416,26 +866,166 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
-    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
-                       qemu_luring_completion_cb, NULL,
-                       qemu_luring_poll_cb, qemu_luring_poll_ready, s);
+    if (!s->shared) {
+        luring_attach_own_ring(s);
+    } else {
+        luring_attach_shared_ring(s);
+    }
+}
+
+/**
+ * luring_register_file:
+ * @s: AIO state
+ * @fd: file descriptor
+ *
+ * Adds @fd to the registered file table of @s, creating the table on first
+ * use.  The returned index can be passed to luring_co_submit() for requests
+ * on @fd in the AioContext of @s until luring_unregister_file() is called.
+ *
+ * Returns: the index of @fd in the table, or -errno on failure.
+ */
+int luring_register_file(LuringState *s, int fd, Error **errp)
+{
+    int i, ret;
+
+    QEMU_LOCK_GUARD(&s->fixed_files_lock);
+
+    if (!luring_can_register(s)) {
+        error_setg(errp, "io_uring fixed files on an iothread's shared ring "
+                   "need Linux 5.13 or newer");
+        return -ENOTSUP;
+    }
+
+    if (!s->fixed_files) {
+        s->fixed_files = g_new(int, MAX_FIXED_FILES);
+        for (i = 0; i < MAX_FIXED_FILES; i++) {
+            s->fixed_files[i] = -1;
+        }
+        ret = io_uring_register_files(s->ring, s->fixed_files,
+                                      MAX_FIXED_FILES);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to create io_uring "
+                             "registered file table");
+            g_free(s->fixed_files);
+            s->fixed_files = NULL;
+            return ret;
+        }
+    }
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        if (s->fixed_files[i] == -1) {
+            break;
+        }
+    }
+    if (i == MAX_FIXED_FILES) {
+        error_setg(errp, "io_uring registered file table is full");
+        return -ENOSPC;
+    }
+
+    ret = io_uring_register_files_update(s->ring, i, &fd, 1);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to register file with io_uring");
+        return ret;
+    }
+
+    s->fixed_files[i] = fd;
+    trace_luring_register_file(s, fd, i);
+    return i;
 }
 
-LuringState *luring_init(Error **errp)
+void luring_unregister_file(LuringState *s, int fd_index)
+{
+    int fd = -1;
+
+    QEMU_LOCK_GUARD(&s->fixed_files_lock);
+
+    assert(s->fixed_files && s->fixed_files[fd_index] != -1);
+    io_uring_register_files_update(s->ring, fd_index, &fd, 1);
+    s->fixed_files[fd_index] = -1;
+    trace_luring_unregister_file(s, fd_index);
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the memory
+ * @size: size of the memory
+ *
+ * Makes @host available for fixed-buffer reads and writes in all rings.
+ * Registrations of the same range are reference counted.
+ */
+bool luring_register_buf(void *host, size_t size, Error **errp)
+{
+    LuringBuf new_buf = { .host = host, .size = size, .refcnt = 1 };
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    for (i = 0; i < luring_bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            buf->refcnt++;
+            return true;
+        }
+    }
+
+    g_array_append_val(luring_bufs, new_buf);
+    qatomic_inc(&luring_bufs_generation);
+    return true;
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_bufs_lock);
+
+    for (i = 0; i < luring_bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(luring_bufs, LuringBuf, i);
+
+        if (buf->host == host && buf->size == size) {
+            if (--buf->refcnt == 0) {
+                g_array_remove_index_fast(luring_bufs, i);
+                qatomic_inc(&luring_bufs_generation);
+            }
+            return;
+        }
+    }
+}
+
+LuringState *luring_init(AioContext *ctx, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
-    struct io_uring *ring = &s->ring;
+    struct io_uring *ring;
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
-    if (rc < 0) {
-        error_setg_errno(errp, errno, "failed to init linux io_uring ring");
-        g_free(s);
-        return NULL;
+    /* A submission polling thread needs a ring of its own */
+    ring = ctx->io_uring_sqpoll_idle ? NULL :
+           aio_uring_get_ring(ctx, &s->features);
+    if (ring) {
+        rc = event_notifier_init(&s->poll_notifier, false);
+        if (rc < 0) {
+            error_setg_errno(errp, -rc,
+                             "failed to init io_uring poll notifier");
+            g_free(s);
+            return NULL;
+        }
+        s->ring = ring;
+        s->shared = true;
+    } else {
+        rc = luring_init_own_ring(s, ctx->io_uring_sqpoll_idle);
+        if (rc < 0) {
+            error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+            g_free(s);
+            return NULL;
+        }
     }
+    trace_luring_init_ring(s, ctx, s->shared);
 
+    qemu_mutex_init(&s->fixed_files_lock);
+    QSIMPLEQ_INIT(&s->completed);
     ioq_init(&s->io_q);
     return s;
 
@@ -443,7 +1033,26 @@ LuringState *luring_init(Error **errp)
 
 void luring_cleanup(LuringState *s)
 {
-    io_uring_queue_exit(&s->ring);
+    assert(QSIMPLEQ_EMPTY(&s->completed));
+    if (s->shared) {
+        /*
+         * The ring stays, only drop what we registered with it.  The
+         * AioContext may have destroyed it already when switching to glib,
+         * which luring_detach_aio_context() noticed.
+         */
+        if (s->ring && s->nb_fixed_bufs) {
+            io_uring_unregister_buffers(s->ring);
+        }
+        if (s->ring && s->fixed_files) {
+            io_uring_unregister_files(s->ring);
+        }
+    } else {
+        io_uring_queue_exit(s->ring);
+    }
+    event_notifier_cleanup(&s->poll_notifier);
+    qemu_mutex_destroy(&s->fixed_files_lock);
+    g_free(s->fixed_files);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
@@ -56,6 +56,8 @@ typedef struct MirrorBlockJob {
     /* Whether the target image requires explicit zero-initialization */
     bool zero_target;
     MirrorCopyMode copy_mode;
+    /* Only write the chunks that differ from what the target contains */
+    bool dedup;
     BlockdevOnError on_source_error, on_target_error;
     /* Set when the target is synced (dirty bitmap is clean, nothing
      * in flight) and the job is running in active mode */
@@ -239,7 +241,51 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
     mirror_iteration_done(op, ret);
 }
 
-static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
+/*
+ * Write the granularity-sized chunks of @op that differ from @target_buf,
+ * which holds the target's current contents of the range.
+ */
+static int coroutine_fn mirror_write_changed(MirrorOp *op, uint8_t *target_buf)
+{
+    MirrorBlockJob *s = op->s;
+    size_t pos = 0, run_start = 0;
+    uint64_t skipped = 0;
+    bool in_run = false;
+    int i, ret;
+
+    for (i = 0; i < op->qiov.niov; i++) {
+        struct iovec *iov = &op->qiov.iov[i];
+
+        if (memcmp(iov->iov_base, target_buf + pos, iov->iov_len)) {
+            if (!in_run) {
+                run_start = pos;
+                in_run = true;
+            }
+        } else {
+            skipped += iov->iov_len;
+            if (in_run) {
+                ret = blk_co_pwritev_part(s->target, op->offset + run_start,
+                                          pos - run_start, &op->qiov,
+                                          run_start, 0);
+                if (ret < 0) {
+                    return ret;
+                }
+                in_run = false;
+            }
+        }
+        pos += iov->iov_len;
+    }
+
+    trace_mirror_dedup(s, op->offset, op->qiov.size, skipped);
+    if (in_run) {
+        return blk_co_pwritev_part(s->target, op->offset + run_start,
+                                   pos - run_start, &op->qiov, run_start, 0);
+    }
+    return 0;
+}
+
+static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret,
+                                              uint8_t *target_buf)
 {
     MirrorBlockJob *s = op->s;
 
@@ -256,10 +302,37 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
-    ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (target_buf) {
+        ret = mirror_write_changed(op, target_buf);
+    } else {
+        ret = blk_co_pwritev(s->target, op->offset, op->qiov.size,
+                             &op->qiov, 0);
+    }
     mirror_write_complete(op, ret);
 }
 
+typedef struct MirrorTargetRead {
+    MirrorBlockJob *s;
+    int64_t offset;
+    uint64_t bytes;
+    uint8_t *buf;
+
+    bool done;
+    int ret;
+    Coroutine *waiter;
+} MirrorTargetRead;
+
+static void coroutine_fn mirror_co_read_target(void *opaque)
+{
+    MirrorTargetRead *t = opaque;
+
+    t->ret = blk_co_pread(t->s->target, t->offset, t->bytes, t->buf, 0);
+    t->done = true;
+    if (t->waiter) {
+        aio_co_wake(t->waiter);
+    }
+}
+
 /* Clip bytes relative to offset to not exceed end-of-file */
 static inline int64_t mirror_clip_bytes(MirrorBlockJob *s,
                                         int64_t offset,
@@ -339,6 +412,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
 {
     MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
+    MirrorTargetRead target_read = { .s = s };
     int nb_chunks;
     uint64_t ret;
     uint64_t max_bytes;
@@ -389,11 +463,36 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    /* In dedup mode, read the target concurrently with the source */
+    if (s->dedup) {
+        target_read.offset = op->offset;
+        target_read.bytes = op->bytes;
+        target_read.buf = qemu_try_blockalign(blk_bs(s->target), op->bytes);
+        if (target_read.buf) {
+            qemu_coroutine_enter(qemu_coroutine_create(mirror_co_read_target,
+                                                       &target_read));
+        }
+    }
+
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                              &op->qiov, 0);
     }
-    mirror_read_complete(op, ret);
+
+    if (target_read.buf) {
+        if (!target_read.done) {
+            target_read.waiter = qemu_coroutine_self();
+            qemu_coroutine_yield();
+        }
+        if (target_read.ret < 0) {
+            /* Just copy everything */
+            qemu_vfree(target_read.buf);
+            target_read.buf = NULL;
+        }
+    }
+
+    mirror_read_complete(op, ret, target_read.buf);
+    qemu_vfree(target_read.buf);
 }
 
 static void coroutine_fn mirror_co_zero(void *opaque)
@@ -828,7 +927,11 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
     int64_t count;
 
     if (s->zero_target) {
-        if (!bdrv_can_write_zeroes_with_unmap(target_bs)) {
+        /*
+         * Zeroing the target first would throw away what dedup mode tries
+         * to keep, so compare the whole image instead.
+         */
+        if (s->dedup || !bdrv_can_write_zeroes_with_unmap(target_bs)) {
             bdrv_set_dirty_bitmap(s->dirty_bitmap, 0, s->bdev_length);
             return 0;
         }
@@ -1658,7 +1761,7 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             Error **errp)
+                             bool dedup, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
@@ -1748,6 +1851,10 @@ static BlockJob *mirror_start_job(
 
     target_perms = BLK_PERM_WRITE;
     target_shared_perms = BLK_PERM_WRITE_UNCHANGED;
+    if (dedup) {
+        /* Dedup mode relies on reading what the target currently contains */
+        target_perms |= BLK_PERM_CONSISTENT_READ;
+    }
 
     if (target_is_backing) {
         int64_t bs_size, target_size;
@@ -1805,6 +1912,7 @@ static BlockJob *mirror_start_job(
     s->backing_mode = backing_mode;
     s->zero_target = zero_target;
     s->copy_mode = copy_mode;
+    s->dedup = dedup;
     s->base = base;
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
@@ -1921,7 +2029,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, bool dedup, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1940,7 +2048,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, errp);
+                     filter_node_name, true, copy_mode, dedup, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1969,7 +2077,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     errp);
+                     false, errp);
     if (!job) {
         goto error_restore_flags;
     }
@@ -87,6 +87,33 @@ BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *node,
     return bitmap;
 }
 
+/**
+ * block_dirty_bitmap_load:
+ * Read the contents of @bitmap from the image of @bs if that has not
+ * happened yet.  Must be called without holding the AioContext lock of @bs.
+ *
+ * @return: 0 on success, or a negative errno value on failure.
+ */
+int block_dirty_bitmap_load(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                            Error **errp)
+{
+    AioContext *aio_context;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (!bdrv_dirty_bitmap_needs_load(bitmap)) {
+        return 0;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+    ret = bdrv_dirty_bitmap_load(bitmap, errp);
+    aio_context_release(aio_context);
+
+    return ret;
+}
+
 void qmp_block_dirty_bitmap_add(const char *node, const char *name,
                                 bool has_granularity, uint32_t granularity,
                                 bool has_persistent, bool persistent,
@@ -175,6 +202,15 @@ BdrvDirtyBitmap *block_dirty_bitmap_remove(const char *node, const char *name,
         return NULL;
     }
 
+    /*
+     * The data is dropped from the image, so if we keep the bitmap around
+     * (to restore it on transaction abort), we must read it now.
+     */
+    if (!release && bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+        aio_context_release(aio_context);
+        return NULL;
+    }
+
     if (bdrv_dirty_bitmap_get_persistence(bitmap) &&
         bdrv_remove_persistent_dirty_bitmap(bs, name, errp) < 0)
     {
@@ -219,6 +255,11 @@ void qmp_block_dirty_bitmap_clear(const char *node, const char *name,
         return;
     }
 
+    /* Otherwise the data would be merged back in when it is loaded */
+    if (block_dirty_bitmap_load(bs, bitmap, errp) < 0) {
+        return;
+    }
+
     bdrv_clear_dirty_bitmap(bitmap, NULL);
 }
 
@@ -262,7 +303,7 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
                                           BlockDirtyBitmapOrStrList *bms,
                                           HBitmap **backup, Error **errp)
 {
-    BlockDriverState *bs;
+    BlockDriverState *bs, *src_bs;
     BdrvDirtyBitmap *dst, *src;
     BlockDirtyBitmapOrStrList *lst;
     HBitmap *local_backup = NULL;
@@ -279,6 +320,7 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
             const char *name, *node;
         case QTYPE_QSTRING:
             name = lst->value->u.local;
+            src_bs = bs;
             src = bdrv_find_dirty_bitmap(bs, name);
             if (!src) {
                 error_setg(errp, "Dirty bitmap '%s' not found", name);
@@ -288,7 +330,7 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
         case QTYPE_QDICT:
             node = lst->value->u.external.node;
             name = lst->value->u.external.name;
-            src = block_dirty_bitmap_lookup(node, name, NULL, errp);
+            src = block_dirty_bitmap_lookup(node, name, &src_bs, errp);
             if (!src) {
                 goto fail;
             }
@@ -297,6 +339,14 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
             abort();
         }
 
+        /*
+         * Pending data of @dst is merged in when it is loaded, but that of
+         * @src must be there now.
+         */
+        if (block_dirty_bitmap_load(src_bs, src, errp) < 0) {
+            goto fail;
+        }
+
         /* We do backup only for first merge operation */
         if (!bdrv_merge_dirty_bitmap(dst, src,
                                      local_backup ? NULL : &local_backup,
@@ -25,6 +25,7 @@
 #include "qemu/vfio-helpers.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
+#include "sysemu/iothread.h"
 #include "sysemu/replay.h"
 #include "trace.h"
 
@@ -41,13 +42,24 @@
  */
 #define NVME_NUM_REQS (NVME_QUEUE_SIZE - 1)
 
+/*
+ * I/O queue doorbell writes are deferred to a BH, so that all commands
+ * submitted in one event loop iteration share a single MMIO write.  Once
+ * this many commands are waiting, the doorbell is written right away.
+ */
+#define NVME_KICK_BATCH 32
+
 typedef struct BDRVNVMeState BDRVNVMeState;
 
 /* Same index is used for queues and IRQs */
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
-/* This driver shares a single MSIX IRQ for the admin and I/O queues */
+/*
+ * The admin queue and the I/O queue of the node's AioContext share a single
+ * MSIX IRQ.  The I/O queue of each queue-iothread has a vector of its own,
+ * INDEX_IO(n) uses vector n.
+ */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
     MSIX_IRQ_COUNT = 1
@@ -64,6 +76,7 @@ typedef struct {
 typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
+    uint32_t *result; /* if not NULL, receives DW0 of the completion */
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -76,9 +89,13 @@ typedef struct {
     /* Read from I/O code path, initialized under BQL */
     BDRVNVMeState   *s;
     int             index;
+    AioContext      *aio_context;
+    /* NULL for queues that follow the node's AioContext */
+    IOThread        *iothread;
 
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
+    EventNotifier irq_notifier; /* only if @iothread is set */
 
     /* Fields protected by @lock */
     CoQueue     free_req_queue;
@@ -91,6 +108,7 @@ typedef struct {
 
     /* Thread-safe, no lock necessary */
     QEMUBH      *completion_bh;
+    QEMUBH      *kick_bh;
 } NVMeQueuePair;
 
 struct BDRVNVMeState {
@@ -119,7 +137,6 @@ struct BDRVNVMeState {
     int blkshift;
 
     uint64_t max_transfer;
-    bool plugged;
 
     bool supports_write_zeroes;
     bool supports_discard;
@@ -142,8 +159,10 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUE_IOTHREADS "queue-iothreads"
 
 static void nvme_process_completion_bh(void *opaque);
+static void nvme_kick_bh(void *opaque);
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -190,12 +209,43 @@ static void nvme_free_queue(NVMeQueue *q)
     qemu_vfree(q->queue);
 }
 
+static void nvme_remove_queue_handler_bh(void *opaque)
+{
+    NVMeQueuePair *q = opaque;
+
+    aio_set_event_notifier(q->aio_context, &q->irq_notifier,
+                           false, NULL, NULL, NULL);
+}
+
+/* Called from the main loop thread with the node's AioContext acquired */
 static void nvme_free_queue_pair(NVMeQueuePair *q)
 {
     trace_nvme_free_queue_pair(q->index, q, &q->cq, &q->sq);
+    if (q->iothread) {
+        /*
+         * The iothread may be running the handlers right now, so remove
+         * them from there.  Once that is done, nothing uses @q any more.
+         */
+        bool acquire = q->aio_context != q->s->aio_context;
+
+        if (acquire) {
+            aio_context_acquire(q->aio_context);
+        }
+        aio_wait_bh_oneshot(q->aio_context, nvme_remove_queue_handler_bh, q);
+        if (acquire) {
+            aio_context_release(q->aio_context);
+        }
+    }
     if (q->completion_bh) {
         qemu_bh_delete(q->completion_bh);
     }
+    if (q->kick_bh) {
+        qemu_bh_delete(q->kick_bh);
+    }
+    if (q->iothread) {
+        event_notifier_cleanup(&q->irq_notifier);
+        object_unref(OBJECT(q->iothread));
+    }
     nvme_free_queue(&q->sq);
     nvme_free_queue(&q->cq);
     qemu_vfree(q->prp_list_pages);
@@ -215,8 +265,15 @@ static void nvme_free_req_queue_cb(void *opaque)
     qemu_mutex_unlock(&q->lock);
 }
 
+/*
+ * Queue pairs for an @iothread are processed in its AioContext and get an
+ * interrupt notifier of their own.  All others are processed in
+ * @aio_context, which must be the node's, and are signalled through
+ * s->irq_notifier.
+ */
 static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
                                              AioContext *aio_context,
+                                             IOThread *iothread,
                                              unsigned idx, size_t size,
                                              Error **errp)
 {
@@ -230,8 +287,22 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
         error_setg(errp, "Cannot allocate queue pair");
         return NULL;
     }
+    if (iothread) {
+        r = event_notifier_init(&q->irq_notifier, 0);
+        if (r) {
+            error_setg_errno(errp, -r, "Failed to init event notifier");
+            g_free(q);
+            return NULL;
+        }
+        aio_context = iothread_get_aio_context(iothread);
+        object_ref(OBJECT(iothread));
+        q->iothread = iothread;
+    }
+    q->aio_context = aio_context;
     trace_nvme_create_queue_pair(idx, q, size, aio_context,
-                                 event_notifier_get_fd(s->irq_notifier));
+                                 event_notifier_get_fd(iothread ?
+                                                       &q->irq_notifier :
+                                                       s->irq_notifier));
     bytes = QEMU_ALIGN_UP(s->page_size * NVME_NUM_REQS,
                           qemu_real_host_page_size());
     q->prp_list_pages = qemu_try_memalign(qemu_real_host_page_size(), bytes);
@@ -245,6 +316,7 @@ static NVMeQueuePair *nvme_create_queue_pair(BDRVNVMeState *s,
     q->index = idx;
     qemu_co_queue_init(&q->free_req_queue);
     q->completion_bh = aio_bh_new(aio_context, nvme_process_completion_bh, q);
+    q->kick_bh = aio_bh_new(aio_context, nvme_kick_bh, q);
     r = qemu_vfio_dma_map(s->vfio, q->prp_list_pages, bytes,
                           false, &prp_list_iova, errp);
     if (r) {
@@ -282,7 +354,7 @@ static void nvme_kick(NVMeQueuePair *q)
 {
     BDRVNVMeState *s = q->s;
 
-    if (s->plugged || !q->need_kick) {
+    if (!q->need_kick) {
         return;
     }
     trace_nvme_kick(s, q->index);
@@ -294,6 +366,15 @@ static void nvme_kick(NVMeQueuePair *q)
     q->need_kick = 0;
 }
 
+static void nvme_kick_bh(void *opaque)
+{
+    NVMeQueuePair *q = opaque;
+
+    qemu_mutex_lock(&q->lock);
+    nvme_kick(q);
+    qemu_mutex_unlock(&q->lock);
+}
+
 static NVMeRequest *nvme_get_free_req_nofail_locked(NVMeQueuePair *q)
 {
     NVMeRequest *req;
@@ -341,7 +422,7 @@ static void nvme_put_free_req_locked(NVMeQueuePair *q, NVMeRequest *req)
 static void nvme_wake_free_req_locked(NVMeQueuePair *q)
 {
     if (!qemu_co_queue_empty(&q->free_req_queue)) {
-        replay_bh_schedule_oneshot_event(q->s->aio_context,
+        replay_bh_schedule_oneshot_event(q->aio_context,
                 nvme_free_req_queue_cb, q);
     }
 }
@@ -387,10 +468,6 @@ static bool nvme_process_completion(NVMeQueuePair *q)
     NvmeCqe *c;
 
     trace_nvme_process_completion(s, q->index, q->inflight);
-    if (s->plugged) {
-        trace_nvme_process_completion_queue_plugged(s, q->index);
-        return false;
-    }
 
     /*
      * Support re-entrancy when a request cb() function invokes aio_poll().
@@ -430,8 +507,12 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         nvme_put_free_req_locked(q, preq);
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         q->inflight--;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, ret);
@@ -496,8 +577,18 @@ static void nvme_submit_command(NVMeQueuePair *q, NVMeRequest *req,
            q->sq.tail * NVME_SQ_ENTRY_BYTES, cmd, sizeof(*cmd));
     q->sq.tail = (q->sq.tail + 1) % NVME_QUEUE_SIZE;
     q->need_kick++;
-    nvme_kick(q);
-    nvme_process_completion(q);
+    if (q->index == INDEX_ADMIN || q->need_kick >= NVME_KICK_BATCH) {
+        nvme_kick(q);
+    } else {
+        qemu_bh_schedule(q->kick_bh);
+    }
+    /*
+     * The default I/O queue may also be used from other threads, but its
+     * completions are only ever processed in its own AioContext.
+     */
+    if (q->aio_context == qemu_get_current_aio_context()) {
+        nvme_process_completion(q);
+    }
     qemu_mutex_unlock(&q->lock);
 }
 
@@ -508,7 +599,12 @@ static void nvme_admin_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
-static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+/*
+ * Run an admin command; if @result is not NULL, it receives DW0 of the
+ * completion
+ */
+static int nvme_admin_cmd_sync_result(BlockDriverState *bs, NvmeCmd *cmd,
+                                      uint32_t *result)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q = s->queues[INDEX_ADMIN];
@@ -519,12 +615,18 @@ static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(q, req, cmd, nvme_admin_cmd_sync_cb, &ret);
 
     AIO_WAIT_WHILE(aio_context, ret == -EINPROGRESS);
     return ret;
 }
 
+static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+{
+    return nvme_admin_cmd_sync_result(bs, cmd, NULL);
+}
+
 /* Returns true on success, false on failure. */
 static bool nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
@@ -615,18 +717,23 @@ out:
     return ret;
 }
 
-static void nvme_poll_queue(NVMeQueuePair *q)
+/*
+ * q->lock isn't needed because nvme_process_completion() only runs in the
+ * queue's event loop thread and cannot race with itself.
+ */
+static bool nvme_queue_has_completion(NVMeQueuePair *q)
 {
     const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
     NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
+    return (le16_to_cpu(cqe->status) & 0x1) != q->cq_phase;
+}
+
+static void nvme_poll_queue(NVMeQueuePair *q)
+{
     trace_nvme_poll_queue(q->s, q->index);
-    /*
-     * Do an early check for completions. q->lock isn't needed because
-     * nvme_process_completion() only runs in the event loop thread and
-     * cannot race with itself.
-     */
-    if ((le16_to_cpu(cqe->status) & 0x1) == q->cq_phase) {
+    /* Do an early check for completions */
+    if (!nvme_queue_has_completion(q)) {
         return;
     }
 
@@ -637,12 +744,15 @@ static void nvme_poll_queue(NVMeQueuePair *q)
     qemu_mutex_unlock(&q->lock);
 }
 
+/* Poll the queues that share MSIX_SHARED_IRQ_IDX */
 static void nvme_poll_queues(BDRVNVMeState *s)
 {
     int i;
 
     for (i = 0; i < s->queue_count; i++) {
-        nvme_poll_queue(s->queues[i]);
+        if (!s->queues[i]->iothread) {
+            nvme_poll_queue(s->queues[i]);
+        }
     }
 }
 
@@ -656,16 +766,46 @@ static void nvme_handle_event(EventNotifier *n)
     nvme_poll_queues(s);
 }
 
-static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
+static void nvme_queue_handle_event(EventNotifier *n)
+{
+    NVMeQueuePair *q = container_of(n, NVMeQueuePair, irq_notifier);
+
+    trace_nvme_handle_event(q->s);
+    event_notifier_test_and_clear(n);
+    nvme_poll_queue(q);
+}
+
+static bool nvme_queue_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, irq_notifier);
+
+    return nvme_queue_has_completion(q);
+}
+
+static void nvme_queue_poll_ready(EventNotifier *e)
+{
+    NVMeQueuePair *q = container_of(e, NVMeQueuePair, irq_notifier);
+
+    nvme_poll_queue(q);
+}
+
+/*
+ * Add an I/O queue pair that is processed in @iothread, or in the node's
+ * AioContext if @iothread is NULL
+ */
+static bool nvme_add_io_queue(BlockDriverState *bs, IOThread *iothread,
+                              Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     unsigned n = s->queue_count;
+    unsigned vector = iothread ? n - INDEX_IO(0) : MSIX_SHARED_IRQ_IDX;
     NVMeQueuePair *q;
     NvmeCmd cmd;
     unsigned queue_size = NVME_QUEUE_SIZE;
 
     assert(n <= UINT16_MAX);
-    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
+    q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs), iothread,
                                n, queue_size, errp);
     if (!q) {
         return false;
@@ -674,7 +814,7 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         .opcode = NVME_ADM_CMD_CREATE_CQ,
         .dptr.prp1 = cpu_to_le64(q->cq.iova),
         .cdw10 = cpu_to_le32(((queue_size - 1) << 16) | n),
-        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC),
+        .cdw11 = cpu_to_le32(NVME_CQ_IEN | NVME_CQ_PC | (vector << 16)),
     };
     if (nvme_admin_cmd_sync(bs, &cmd)) {
         error_setg(errp, "Failed to create CQ io queue [%u]", n);
@@ -690,6 +830,11 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
         error_setg(errp, "Failed to create SQ io queue [%u]", n);
         goto out_error;
     }
+    if (iothread) {
+        aio_set_event_notifier(q->aio_context, &q->irq_notifier,
+                               false, nvme_queue_handle_event,
+                               nvme_queue_poll_cb, nvme_queue_poll_ready);
+    }
     s->queues = g_renew(NVMeQueuePair *, s->queues, n + 1);
     s->queues[n] = q;
     s->queue_count++;
@@ -699,6 +844,75 @@ out_error:
     return false;
 }
 
+/*
+ * Ask the controller for @nr_io_queues I/O queue pairs.  This must happen
+ * before the first I/O queue is created.  Every controller supports one
+ * I/O queue pair, so that case needs no request.
+ */
+static bool nvme_request_io_queues(BlockDriverState *bs, unsigned nr_io_queues,
+                                   Error **errp)
+{
+    ERRP_GUARD();
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) | (nr_io_queues - 1)),
+    };
+    uint32_t result = 0;
+    unsigned nsqa, ncqa;
+
+    if (nr_io_queues == 1) {
+        return true;
+    }
+    if (nvme_admin_cmd_sync_result(bs, &cmd, &result)) {
+        error_setg(errp, "Failed to request %u I/O queues", nr_io_queues);
+        return false;
+    }
+
+    /* Both counts are 0's based, and may be more than we asked for */
+    nsqa = (result & 0xffff) + 1;
+    ncqa = (result >> 16) + 1;
+    if (nsqa < nr_io_queues || ncqa < nr_io_queues) {
+        error_setg(errp, "NVMe controller granted only %u I/O queues, "
+                   "%u are needed", MIN(nsqa, ncqa), nr_io_queues);
+        error_append_hint(errp, "Use fewer queue-iothreads.\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Create an I/O queue pair for each of @iothreads, in addition to the one
+ * of the node's AioContext, and give each of them an MSIX vector
+ */
+static bool nvme_add_iothread_queues(BlockDriverState *bs,
+                                     IOThread **iothreads,
+                                     unsigned nb_iothreads, Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    g_autofree EventNotifier **notifiers = NULL;
+    unsigned nr_io_queues = 1 + nb_iothreads;
+    unsigned i;
+
+    if (!nb_iothreads) {
+        return true;
+    }
+
+    for (i = 0; i < nb_iothreads; i++) {
+        if (!nvme_add_io_queue(bs, iothreads[i], errp)) {
+            return false;
+        }
+    }
+
+    notifiers = g_new(EventNotifier *, nr_io_queues);
+    notifiers[MSIX_SHARED_IRQ_IDX] = &s->irq_notifier[MSIX_SHARED_IRQ_IDX];
+    for (i = 1; i < nr_io_queues; i++) {
+        notifiers[i] = &s->queues[INDEX_IO(i)]->irq_notifier;
+    }
+    return qemu_vfio_pci_init_irqs(s->vfio, notifiers, nr_io_queues,
+                                   VFIO_PCI_MSIX_IRQ_INDEX, errp) == 0;
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -708,14 +922,8 @@ static bool nvme_poll_cb(void *opaque)
 
     for (i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
-        const size_t cqe_offset = q->cq.head * NVME_CQ_ENTRY_BYTES;
-        NvmeCqe *cqe = (NvmeCqe *)&q->cq.queue[cqe_offset];
 
-        /*
-         * q->lock isn't needed because nvme_process_completion() only runs in
-         * the event loop thread and cannot race with itself.
-         */
-        if ((le16_to_cpu(cqe->status) & 0x1) != q->cq_phase) {
+        if (!q->iothread && nvme_queue_has_completion(q)) {
             return true;
         }
     }
@@ -731,6 +939,7 @@ static void nvme_poll_ready(EventNotifier *e)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
+                     IOThread **iothreads, unsigned nb_iothreads,
                      Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -825,7 +1034,8 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
 
     /* Set up admin queue. */
     s->queues = g_new(NVMeQueuePair *, 1);
-    q = nvme_create_queue_pair(s, aio_context, 0, NVME_QUEUE_SIZE, errp);
+    q = nvme_create_queue_pair(s, aio_context, NULL, 0, NVME_QUEUE_SIZE,
+                               errp);
     if (!q) {
         ret = -EINVAL;
         goto out;
@@ -871,7 +1081,9 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_request_io_queues(bs, 1 + nb_iothreads, errp) ||
+        !nvme_add_io_queue(bs, NULL, errp) ||
+        !nvme_add_iothread_queues(bs, iothreads, nb_iothreads, errp)) {
         ret = -EIO;
     }
 out:
@@ -957,17 +1169,63 @@ static void nvme_close(BlockDriverState *bs)
     g_free(s->device);
 }
 
+/*
+ * QemuOpts has no list type, so the queue-iothreads.N options are taken
+ * from @options directly
+ */
+static int nvme_parse_queue_iothreads(QDict *options, IOThread ***iothreads,
+                                      unsigned *nb_iothreads, Error **errp)
+{
+    g_autoptr(GPtrArray) array = g_ptr_array_new();
+    unsigned i, j;
+
+    for (i = 0; ; i++) {
+        g_autofree char *key =
+            g_strdup_printf(NVME_BLOCK_OPT_QUEUE_IOTHREADS ".%u", i);
+        const char *id = qdict_get_try_str(options, key);
+        IOThread *iothread;
+
+        if (!id) {
+            break;
+        }
+        iothread = iothread_by_id(id);
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", id);
+            return -ENOENT;
+        }
+        for (j = 0; j < array->len; j++) {
+            if (g_ptr_array_index(array, j) == iothread) {
+                error_setg(errp, "iothread \"%s\" is listed twice", id);
+                return -EINVAL;
+            }
+        }
+        g_ptr_array_add(array, iothread);
+        qdict_del(options, key);
+    }
+
+    *nb_iothreads = array->len;
+    *iothreads = (IOThread **)g_ptr_array_free(g_steal_pointer(&array), false);
+    return 0;
+}
+
 static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
                           Error **errp)
 {
     const char *device;
     QemuOpts *opts;
     int namespace;
+    g_autofree IOThread **iothreads = NULL;
+    unsigned nb_iothreads;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
     bs->supported_write_flags = BDRV_REQ_FUA;
 
+    ret = nvme_parse_queue_iothreads(options, &iothreads, &nb_iothreads, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &error_abort);
     device = qemu_opt_get(opts, NVME_BLOCK_OPT_DEVICE);
@@ -978,7 +1236,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    ret = nvme_init(bs, device, namespace, iothreads, nb_iothreads, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1170,6 +1428,25 @@ static void nvme_rw_cb(void *opaque, int ret)
     replay_bh_schedule_oneshot_event(data->ctx, nvme_rw_cb_bh, data);
 }
 
+/*
+ * Return the I/O queue pair of the current thread's iothread, or the one
+ * of the node's AioContext if it has none.  Nothing submits requests from
+ * the queue-iothreads yet (exports move their requests to the node's
+ * AioContext), so for now this always returns the default queue pair.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    unsigned i;
+
+    for (i = INDEX_IO(1); i < s->queue_count; i++) {
+        if (s->queues[i]->aio_context == ctx) {
+            return s->queues[i];
+        }
+    }
+    return s->queues[INDEX_IO(0)];
+}
+
 static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
                                             uint64_t offset, uint64_t bytes,
                                             QEMUIOVector *qiov,
@@ -1178,7 +1455,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1191,7 +1468,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
         .cdw12 = cpu_to_le32(cdw12),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1299,14 +1576,14 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
         .nsid = cpu_to_le32(s->nsid),
     };
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1330,7 +1607,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1357,7 +1634,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1393,7 +1670,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -1407,7 +1684,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     };
 
     NVMeCoData data = {
-        .ctx = bdrv_get_aio_context(bs),
+        .ctx = qemu_get_current_aio_context(),
         .ret = -EINPROGRESS,
     };
 
@@ -1540,8 +1817,13 @@ static void nvme_detach_aio_context(BlockDriverState *bs)
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
+        if (q->iothread) {
+            continue;
+        }
         qemu_bh_delete(q->completion_bh);
         q->completion_bh = NULL;
+        qemu_bh_delete(q->kick_bh);
+        q->kick_bh = NULL;
     }
 
     aio_set_event_notifier(bdrv_get_aio_context(bs),
@@ -1562,29 +1844,13 @@ static void nvme_attach_aio_context(BlockDriverState *bs,
     for (unsigned i = 0; i < s->queue_count; i++) {
         NVMeQueuePair *q = s->queues[i];
 
+        if (q->iothread) {
+            continue;
+        }
+        q->aio_context = new_context;
         q->completion_bh =
             aio_bh_new(new_context, nvme_process_completion_bh, q);
-    }
-}
-
-static void coroutine_fn nvme_co_io_plug(BlockDriverState *bs)
-{
-    BDRVNVMeState *s = bs->opaque;
-    assert(!s->plugged);
-    s->plugged = true;
-}
-
-static void coroutine_fn nvme_co_io_unplug(BlockDriverState *bs)
-{
-    BDRVNVMeState *s = bs->opaque;
-    assert(s->plugged);
-    s->plugged = false;
-    for (unsigned i = INDEX_IO(0); i < s->queue_count; i++) {
-        NVMeQueuePair *q = s->queues[i];
-        qemu_mutex_lock(&q->lock);
-        nvme_kick(q);
-        nvme_process_completion(q);
-        qemu_mutex_unlock(&q->lock);
+        q->kick_bh = aio_bh_new(new_context, nvme_kick_bh, q);
     }
 }
 
@@ -1664,9 +1930,6 @@ static BlockDriver bdrv_nvme = {
     .bdrv_detach_aio_context  = nvme_detach_aio_context,
     .bdrv_attach_aio_context  = nvme_attach_aio_context,
 
-    .bdrv_co_io_plug          = nvme_co_io_plug,
-    .bdrv_co_io_unplug        = nvme_co_io_unplug,
-
     .bdrv_register_buf        = nvme_register_buf,
     .bdrv_unregister_buf      = nvme_unregister_buf,
 };
@@ -91,6 +91,7 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    bool keep_table; /* The data in the image is still up to date */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
@@ -337,6 +338,42 @@ finish:
     return ret;
 }
 
+/* The part of a bitmap's directory entry that is needed to load its data */
+typedef struct Qcow2BitmapLoad {
+    BlockDriverState *bs;
+    uint64_t *bitmap_table;
+    uint32_t bitmap_table_size;
+} Qcow2BitmapLoad;
+
+static void bitmap_load_free(void *opaque)
+{
+    Qcow2BitmapLoad *bl = opaque;
+
+    g_free(bl->bitmap_table);
+    g_free(bl);
+}
+
+static int load_bitmap_cb(BdrvDirtyBitmap *target, void *opaque, Error **errp)
+{
+    Qcow2BitmapLoad *bl = opaque;
+    int ret;
+
+    ret = load_bitmap_data(bl->bs, bl->bitmap_table, bl->bitmap_table_size,
+                           target);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
+                         bdrv_dirty_bitmap_name(target));
+    }
+    return ret;
+}
+
+/*
+ * Create the BdrvDirtyBitmap for @bm.  Only the bitmap table is read here;
+ * the bitmap data is read on first use, see bdrv_dirty_bitmap_load().
+ * This keeps opening images with many large bitmaps fast, and bitmaps
+ * that are never looked at never take more memory than the bits that are
+ * set while the image is open.
+ */
 static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
                                     Qcow2Bitmap *bm, Error **errp)
 {
@@ -344,6 +381,7 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
     uint64_t *bitmap_table = NULL;
     uint32_t granularity;
     BdrvDirtyBitmap *bitmap = NULL;
+    Qcow2BitmapLoad *bl;
 
     granularity = 1U << bm->granularity_bits;
     bitmap = bdrv_create_dirty_bitmap(bs, granularity, bm->name, errp);
@@ -364,14 +402,19 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
-    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
-                         bm->name);
-        goto fail;
+    if (buffer_is_zero(bitmap_table, bm->table.size * BME_TABLE_ENTRY_SIZE)) {
+        /* All clusters are zero, there is nothing to read */
+        g_free(bitmap_table);
+        return bitmap;
     }
 
-    g_free(bitmap_table);
+    bl = g_new(Qcow2BitmapLoad, 1);
+    *bl = (Qcow2BitmapLoad) {
+        .bs = bs,
+        .bitmap_table = bitmap_table,
+        .bitmap_table_size = bm->table.size,
+    };
+    bdrv_dirty_bitmap_set_loader(bitmap, load_bitmap_cb, bl, bitmap_load_free);
     return bitmap;
 
 fail:
@@ -1259,6 +1302,12 @@ int coroutine_fn qcow2_truncate_bitmaps_check(BlockDriverState *bs, Error **errp
             ret = -ENOTSUP;
             goto out;
         }
+
+        /* The data in the image is only valid for the old size */
+        ret = bdrv_dirty_bitmap_load(bitmap, errp);
+        if (ret < 0) {
+            goto out;
+        }
     }
 
 out:
@@ -1581,6 +1630,25 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
         }
 
         bm = find_bitmap_by_name(bm_list, name);
+        if (bm && (bm->flags & BME_FLAG_IN_USE) &&
+            bdrv_dirty_bitmap_needs_load(bitmap))
+        {
+            if (bdrv_get_dirty_count(bitmap) == 0) {
+                /*
+                 * Nothing was set since the image was opened, so the data
+                 * that was never read is still what we would write.
+                 */
+                bm->keep_table = true;
+                bm->flags =
+                    bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
+                bm->dirty_bitmap = bitmap;
+                continue;
+            }
+            if (bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+                goto fail;
+            }
+        }
+
         if (bm == NULL) {
             if (++new_nb_bitmaps > QCOW2_MAX_BITMAPS) {
                 error_setg(errp, "Too many persistent bitmaps");
@@ -1625,7 +1693,8 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
 
-        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap)) {
+        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap) ||
+            bm->keep_table) {
             continue;
         }
 
@@ -1665,7 +1734,7 @@ success:
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
-            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
+            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap) || bm->keep_table)
         {
             continue;
         }
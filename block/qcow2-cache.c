@@ -25,16 +25,28 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/queue.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Cached tables are indexed by a hash table on their offset, so that
+ * lookups do not depend on the number of entries.  Entries that are not
+ * in use (ref == 0) are also kept on an LRU list, least recently used
+ * first, which makes picking the entry to replace O(1).  Free entries
+ * (offset == 0) are kept at the head of that list.
+ */
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    QLIST_ENTRY(Qcow2CachedTable) hash_entry;
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
+typedef QLIST_HEAD(, Qcow2CachedTable) Qcow2CacheBucket;
+
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
@@ -44,6 +56,9 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    Qcow2CacheBucket       *buckets;
+    unsigned                hash_bits;
+    QTAILQ_HEAD(, Qcow2CachedTable) lru;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +74,67 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    /* Fibonacci hashing of the table index */
+    return ((offset / c->table_size) * 0x9e3779b97f4a7c15ULL) >>
+           (64 - c->hash_bits);
+}
+
+static Qcow2CachedTable *qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    Qcow2CachedTable *t;
+
+    QLIST_FOREACH(t, &c->buckets[qcow2_cache_hash(c, offset)], hash_entry) {
+        if (t->offset == offset) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void qcow2_cache_hash_insert(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    QLIST_INSERT_HEAD(&c->buckets[qcow2_cache_hash(c, t->offset)], t,
+                      hash_entry);
+}
+
+/*
+ * Drop the table cached in entry @i, leaving the entry free.  An unused
+ * entry moves to the head of the LRU list so that it is reused first.
+ */
+static void qcow2_cache_entry_forget(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        QLIST_REMOVE(t, hash_entry);
+    }
+    t->offset = 0;
+    t->lru_counter = 0;
+
+    if (t->ref == 0) {
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+        QTAILQ_INSERT_HEAD(&c->lru, t, lru_entry);
+    }
+}
+
+/* Reset the index and the LRU list, all entries must be free and unused */
+static void qcow2_cache_reset_index(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < (1 << c->hash_bits); i++) {
+        QLIST_INIT(&c->buckets[i]);
+    }
+
+    QTAILQ_INIT(&c->lru);
+    for (i = 0; i < c->size; i++) {
+        assert(c->entries[i].ref == 0 && c->entries[i].offset == 0);
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
+    }
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +182,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_forget(c, i);
             i++;
             to_clean++;
         }
@@ -134,17 +209,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
     c->table_size = table_size;
+    /* At least two buckets per entry keeps the chains short */
+    c->hash_bits = MAX(ctz32(pow2ceil(num_tables)) + 1, 1);
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
+    c->buckets = g_try_new(Qcow2CacheBucket, 1 << c->hash_bits);
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->buckets || !c->table_array) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
     }
 
+    qcow2_cache_reset_index(c);
+
     return c;
 }
 
@@ -157,6 +238,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -235,9 +317,28 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     return 0;
 }
 
+typedef struct Qcow2DirtyTable {
+    int64_t offset;
+    int index;
+} Qcow2DirtyTable;
+
+static int qcow2_dirty_table_cmp(const void *a, const void *b)
+{
+    const Qcow2DirtyTable *ta = a, *tb = b;
+
+    return ta->offset < tb->offset ? -1 : ta->offset > tb->offset;
+}
+
+/*
+ * Dirty tables are written in the order of their offsets, so that tables
+ * that are adjacent in the image file (e.g. refcount blocks allocated
+ * together) go out as a sequential stream of writes.
+ */
 int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree Qcow2DirtyTable *dirty = NULL;
+    int nb_dirty = 0;
     int result = 0;
     int ret;
     int i;
@@ -245,7 +346,22 @@ int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
     trace_qcow2_cache_flush(qemu_coroutine_self(), c == s->l2_table_cache);
 
     for (i = 0; i < c->size; i++) {
-        ret = qcow2_cache_entry_flush(bs, c, i);
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            if (!dirty) {
+                dirty = g_new(Qcow2DirtyTable, c->size);
+            }
+            dirty[nb_dirty++] = (Qcow2DirtyTable) {
+                .offset = c->entries[i].offset,
+                .index = i,
+            };
+        }
+    }
+    if (nb_dirty > 1) {
+        qsort(dirty, nb_dirty, sizeof(dirty[0]), qcow2_dirty_table_cmp);
+    }
+
+    for (i = 0; i < nb_dirty; i++) {
+        ret = qcow2_cache_entry_flush(bs, c, dirty[i].index);
         if (ret < 0 && result != -ENOSPC) {
             result = ret;
         }
@@ -311,6 +427,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         c->entries[i].lru_counter = 0;
     }
 
+    qcow2_cache_reset_index(c);
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
@@ -322,11 +439,9 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -341,29 +456,21 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    t = qcow2_cache_lookup(c, offset);
+    if (t) {
+        i = t - c->entries;
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    t = QTAILQ_FIRST(&c->lru);
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
-    /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    /* Cache miss: write the least recently used table back and replace it */
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -374,7 +481,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_entry_forget(c, i);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -387,11 +494,14 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    t->offset = offset;
+    qcow2_cache_hash_insert(c, t);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    if (t->ref++ == 0) {
+        QTAILQ_REMOVE(&c->lru, t, lru_entry);
+    }
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -421,6 +531,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru_entry);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -435,14 +546,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    Qcow2CachedTable *t = offset ? qcow2_cache_lookup(c, offset) : NULL;
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return t ? qcow2_cache_get_table_addr(c, t - c->entries) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -451,8 +557,7 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_forget(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
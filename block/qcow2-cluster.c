@@ -62,6 +62,7 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
     }
 
     BLKDBG_EVENT(bs->file, BLKDBG_L1_SHRINK_FREE_L2_CLUSTERS);
+    qcow2_cluster_map_clear(bs);
     for (i = s->l1_size - 1; i > new_l1_size - 1; i--) {
         if ((s->l1_table[i] & L1E_OFFSET_MASK) == 0) {
             continue;
@@ -879,6 +880,7 @@ int coroutine_fn qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
         set_l2_bitmap(s, l2_slice, l2_index, 0);
     }
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    qcow2_cluster_map_invalidate(bs, offset, 1);
 
     *host_offset = cluster_offset & s->cluster_offset_mask;
     return 0;
@@ -1103,6 +1105,8 @@ int coroutine_fn qcow2_alloc_cluster_link_l2(BlockDriverState *bs,
 
 
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    qcow2_cluster_map_invalidate(bs, m->offset,
+                                 (uint64_t)m->nb_clusters << s->cluster_bits);
 
     /*
      * If this was a COW, we need to decrease the refcount of the old cluster.
@@ -1918,6 +1922,9 @@ static int discard_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
+    /* Lock-free readers must not see the old mappings once they are freed */
+    qcow2_cluster_map_invalidate(bs, offset, nb_clusters << s->cluster_bits);
+
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         uint64_t old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
@@ -2032,6 +2039,8 @@ static int zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
     nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
+    qcow2_cluster_map_invalidate(bs, offset, nb_clusters << s->cluster_bits);
+
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry = get_l2_entry(s, l2_slice, l2_index + i);
         uint64_t old_l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index + i);
@@ -2439,6 +2448,7 @@ int qcow2_expand_zero_clusters(BlockDriverState *bs,
         }
     }
 
+    qcow2_cluster_map_clear(bs);
     ret = expand_zero_clusters_in_l1(bs, s->l1_table, s->l1_size,
                                      &visited_l1_entries, l1_entries,
                                      status_cb, cb_opaque);
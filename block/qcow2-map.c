@@ -0,0 +1,255 @@
+/*
+ * Lock-free guest to host cluster map for qcow2 reads
+ *
+ * Copyright (c) 2023 The QEMU Project Developers
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The cluster map remembers where already allocated (QCOW2_SUBCLUSTER_NORMAL)
+ * guest clusters live in the data file, so that reads that hit it do not
+ * need to take s->lock and walk the L1/L2 tables.
+ *
+ * It is a direct-mapped table: guest cluster N can only live in slot
+ * N & mask, and a colliding insert simply replaces the previous occupant.
+ * Slots are grouped into shards that are each protected by a seqlock.
+ * Readers never block; writers must hold s->lock (or have the node
+ * drained), which also serializes them against each other as the seqlock
+ * requires.
+ *
+ * Anything that changes or frees a mapping must invalidate it under s->lock
+ * before the old host cluster can be reused, i.e. before the lock is dropped.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/seqlock.h"
+#include "qcow2.h"
+#include "trace.h"
+
+#define QCOW2_MAP_SHARD_BITS 6
+#define QCOW2_MAP_SHARDS (1 << QCOW2_MAP_SHARD_BITS)
+#define QCOW2_MAP_MIN_SLOTS QCOW2_MAP_SHARDS
+#define QCOW2_MAP_MAX_SLOTS (1 << 20)
+
+typedef struct Qcow2ClusterMapEntry {
+    /* Guest cluster index plus one, so that 0 means "empty" */
+    uint64_t key;
+    uint64_t host_cluster_offset;
+} Qcow2ClusterMapEntry;
+
+typedef struct Qcow2ClusterMapShard {
+    QemuSeqLock sequence;
+} QEMU_ALIGNED(64) Qcow2ClusterMapShard;
+
+struct Qcow2ClusterMap {
+    uint64_t mask;
+    Qcow2ClusterMapShard shards[QCOW2_MAP_SHARDS];
+    Qcow2ClusterMapEntry *entries;
+};
+
+static inline Qcow2ClusterMapShard *map_shard(Qcow2ClusterMap *map,
+                                              uint64_t slot)
+{
+    return &map->shards[slot & (QCOW2_MAP_SHARDS - 1)];
+}
+
+Qcow2ClusterMap *qcow2_cluster_map_new(uint64_t nb_clusters)
+{
+    Qcow2ClusterMap *map;
+    uint64_t slots;
+    int i;
+
+    slots = pow2ceil(MAX(nb_clusters, QCOW2_MAP_MIN_SLOTS));
+    slots = MIN(slots, QCOW2_MAP_MAX_SLOTS);
+
+    map = g_new0(Qcow2ClusterMap, 1);
+    map->mask = slots - 1;
+    map->entries = g_try_new0(Qcow2ClusterMapEntry, slots);
+    if (!map->entries) {
+        g_free(map);
+        return NULL;
+    }
+    for (i = 0; i < QCOW2_MAP_SHARDS; i++) {
+        seqlock_init(&map->shards[i].sequence);
+    }
+
+    return map;
+}
+
+void qcow2_cluster_map_free(Qcow2ClusterMap *map)
+{
+    if (map) {
+        g_free(map->entries);
+        g_free(map);
+    }
+}
+
+static bool map_lookup(Qcow2ClusterMap *map, uint64_t cluster,
+                       uint64_t *host_cluster_offset)
+{
+    uint64_t slot = cluster & map->mask;
+    Qcow2ClusterMapShard *shard = map_shard(map, slot);
+    Qcow2ClusterMapEntry *e = &map->entries[slot];
+    uint64_t key, host;
+    unsigned seq;
+
+    do {
+        seq = seqlock_read_begin(&shard->sequence);
+        key = qatomic_read__nocheck(&e->key);
+        host = qatomic_read__nocheck(&e->host_cluster_offset);
+    } while (seqlock_read_retry(&shard->sequence, seq));
+
+    if (key != cluster + 1) {
+        return false;
+    }
+    *host_cluster_offset = host;
+    return true;
+}
+
+static void map_set(Qcow2ClusterMap *map, uint64_t slot, uint64_t key,
+                    uint64_t host_cluster_offset)
+{
+    Qcow2ClusterMapShard *shard = map_shard(map, slot);
+    Qcow2ClusterMapEntry *e = &map->entries[slot];
+
+    seqlock_write_begin(&shard->sequence);
+    qatomic_set__nocheck(&e->key, key);
+    qatomic_set__nocheck(&e->host_cluster_offset, host_cluster_offset);
+    seqlock_write_end(&shard->sequence);
+}
+
+/*
+ * Look up the host offset for a read of *bytes at guest offset @offset
+ * without taking s->lock.  On a hit, *bytes is reduced to the length that
+ * is contiguous both in the guest and in the data file, and *host_offset
+ * is set as qcow2_get_host_offset() would for a QCOW2_SUBCLUSTER_NORMAL
+ * range.  Returns false on a miss, in which case the caller must fall back
+ * to qcow2_get_host_offset() under the lock.
+ */
+bool qcow2_get_host_offset_lockless(BlockDriverState *bs, uint64_t offset,
+                                    unsigned int *bytes,
+                                    uint64_t *host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterMap *map = s->cluster_map;
+    unsigned int offset_in_cluster = offset_into_cluster(s, offset);
+    uint64_t cluster = offset >> s->cluster_bits;
+    uint64_t bytes_needed = (uint64_t)*bytes + offset_in_cluster;
+    uint64_t bytes_available, first, next;
+
+    if (!map || !map_lookup(map, cluster, &first)) {
+        return false;
+    }
+
+    bytes_available = s->cluster_size;
+    while (bytes_available < bytes_needed &&
+           map_lookup(map, cluster + 1, &next) &&
+           next == first + bytes_available) {
+        bytes_available += s->cluster_size;
+        cluster++;
+    }
+
+    *host_offset = first + offset_in_cluster;
+    *bytes = MIN(bytes_available, bytes_needed) - offset_in_cluster;
+    trace_qcow2_cluster_map_hit(bs, offset, *bytes, *host_offset);
+    return true;
+}
+
+/*
+ * Record that the @bytes at guest offset @offset, which
+ * qcow2_get_host_offset() has just reported as QCOW2_SUBCLUSTER_NORMAL,
+ * are stored contiguously at @host_offset.  Called with s->lock held.
+ */
+void qcow2_cluster_map_fill(BlockDriverState *bs, uint64_t offset,
+                            unsigned int bytes, uint64_t host_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterMap *map = s->cluster_map;
+    uint64_t first = offset >> s->cluster_bits;
+    uint64_t last = (offset + bytes - 1) >> s->cluster_bits;
+    uint64_t host = start_of_cluster(s, host_offset);
+    uint64_t cluster;
+
+    if (!map || bytes == 0) {
+        return;
+    }
+
+    for (cluster = first; cluster <= last && cluster - first <= map->mask;
+         cluster++, host += s->cluster_size) {
+        map_set(map, cluster & map->mask, cluster + 1, host);
+    }
+}
+
+/*
+ * Forget the mappings of all clusters that intersect the guest range
+ * [@offset, @offset + @bytes).  Called with s->lock held, after the L2
+ * entries have been updated and before the old host clusters are freed.
+ */
+void qcow2_cluster_map_invalidate(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterMap *map = s->cluster_map;
+    uint64_t first, last, cluster;
+
+    if (!map || bytes == 0) {
+        return;
+    }
+
+    first = offset >> s->cluster_bits;
+    last = (offset + bytes - 1) >> s->cluster_bits;
+    if (last - first >= map->mask) {
+        qcow2_cluster_map_clear(bs);
+        return;
+    }
+
+    trace_qcow2_cluster_map_invalidate(bs, offset, bytes);
+    for (cluster = first; cluster <= last; cluster++) {
+        uint64_t slot = cluster & map->mask;
+
+        if (map->entries[slot].key == cluster + 1) {
+            map_set(map, slot, 0, 0);
+        }
+    }
+}
+
+/*
+ * Forget all mappings.  Used whenever the active L1 table is replaced or
+ * rewritten wholesale (snapshots, repairs, truncation).
+ */
+void qcow2_cluster_map_clear(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2ClusterMap *map = s->cluster_map;
+    int i;
+
+    if (!map) {
+        return;
+    }
+
+    trace_qcow2_cluster_map_clear(bs);
+    for (i = 0; i < QCOW2_MAP_SHARDS; i++) {
+        seqlock_write_begin(&map->shards[i].sequence);
+    }
+    memset(map->entries, 0, (map->mask + 1) * sizeof(map->entries[0]));
+    for (i = 0; i < QCOW2_MAP_SHARDS; i++) {
+        seqlock_write_end(&map->shards[i].sequence);
+    }
+}
@@ -966,12 +966,102 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 
+/*
+ * Makes sure that the image file already extends over the newly allocated
+ * range [@offset, @offset + @bytes), and if it does not, grows it to
+ * s->prealloc_size bytes beyond that range in one go.  Growing the file in
+ * large steps keeps the host filesystem from allocating blocks on every
+ * first write, and the preallocated space reads as zeroes, so that COW into
+ * it can be skipped.
+ *
+ * This is best effort.  If growing the file fails, preallocation is switched
+ * off until the options are changed again: from then on, writes beyond the
+ * end of the file may be in flight, and a later extension would zero them.
+ */
+static void prealloc_file_space(BlockDriverState *bs, int64_t offset,
+                                int64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t file_length, end;
+    int ret;
+
+    if (!s->prealloc_size) {
+        return;
+    }
+
+    file_length = bdrv_getlength(bs->file->bs);
+    if (file_length < 0) {
+        s->prealloc_size = 0;
+        return;
+    }
+    if (offset + bytes <= file_length) {
+        return;
+    }
+
+    end = ROUND_UP(offset + bytes + s->prealloc_size, s->cluster_size);
+    ret = bdrv_pwrite_zeroes(bs->file, file_length, end - file_length,
+                             BDRV_REQ_NO_FALLBACK);
+    trace_qcow2_prealloc_file_space(bs, file_length, end, ret);
+    if (ret < 0) {
+        s->prealloc_size = 0;
+        return;
+    }
+
+    s->prealloc_start = file_length;
+    s->prealloc_end = end;
+}
+
+/*
+ * Cuts off the part of the last preallocation that has not been used by
+ * any cluster, so that closing the image leaves no trailing space behind.
+ */
+int qcow2_prealloc_trim(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t file_length, new_length, i;
+    uint64_t refcount;
+    int ret;
+
+    if (!s->prealloc_end) {
+        return 0;
+    }
+
+    file_length = bdrv_getlength(bs->file->bs);
+    if (file_length != s->prealloc_end) {
+        /* The file has grown past the preallocated space since */
+        s->prealloc_start = s->prealloc_end = 0;
+        return 0;
+    }
+
+    new_length = s->prealloc_start;
+    for (i = (file_length >> s->cluster_bits) - 1;
+         i >= (s->prealloc_start >> s->cluster_bits); i--) {
+        ret = qcow2_get_refcount(bs, i, &refcount);
+        if (ret < 0) {
+            return ret;
+        }
+        if (refcount) {
+            new_length = (i + 1) << s->cluster_bits;
+            break;
+        }
+    }
+
+    s->prealloc_start = s->prealloc_end = 0;
+    if (new_length >= file_length) {
+        return 0;
+    }
+
+    return bdrv_truncate(bs->file, new_length, false, PREALLOC_MODE_OFF, 0,
+                         NULL);
+}
+
 /* return < 0 if error */
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
                                     uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t i, nb_clusters, refcount;
+    int64_t offset;
     int ret;
 
     /* We can't allocate clusters if they may still be queued for discard. */
@@ -1005,15 +1095,16 @@ retry:
             size,
             (s->free_cluster_index - nb_clusters) << s->cluster_bits);
 #endif
-    return (s->free_cluster_index - nb_clusters) << s->cluster_bits;
+    offset = (s->free_cluster_index - nb_clusters) << s->cluster_bits;
+    prealloc_file_space(bs, offset, nb_clusters << s->cluster_bits);
+    return offset;
 }
 
-int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
+static int64_t alloc_clusters_unbatched(BlockDriverState *bs, uint64_t size)
 {
     int64_t offset;
     int ret;
 
-    BLKDBG_EVENT(bs->file, BLKDBG_CLUSTER_ALLOC);
     do {
         offset = alloc_clusters_noref(bs, size, QCOW_MAX_CLUSTER_OFFSET);
         if (offset < 0) {
@@ -1030,6 +1121,85 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
     return offset;
 }
 
+/*
+ * Returns the clusters of the current refcount batch that have not been
+ * handed out yet to the free pool.  The batch is dropped even on error; its
+ * clusters are then merely leaked.
+ */
+int qcow2_release_refcount_batch(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->refcount_batch_bytes) {
+        return 0;
+    }
+
+    trace_qcow2_release_refcount_batch(bs, s->refcount_batch_offset,
+                                       s->refcount_batch_bytes);
+    ret = update_refcount(bs, s->refcount_batch_offset,
+                          s->refcount_batch_bytes, 1, true,
+                          QCOW2_DISCARD_NEVER);
+    s->refcount_batch_offset = 0;
+    s->refcount_batch_bytes = 0;
+
+    return ret;
+}
+
+/*
+ * Hands out @size bytes from the refcount batch, taking a new batch from
+ * the free pool when the current one is exhausted.
+ *
+ * All clusters of a batch get their refcount raised in a single
+ * update_refcount() call when the batch is taken, so the refcount blocks
+ * are dirtied (and later written, before any L2 table that references the
+ * clusters) once per batch instead of once per allocation.  Should QEMU
+ * crash before the batch is used up, the remaining clusters are leaked;
+ * they never end up referenced by two owners, and qemu-img check -r leaks
+ * reclaims them.
+ */
+static int64_t alloc_clusters_batched(BlockDriverState *bs, uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+    int ret;
+
+    if (s->refcount_batch_bytes < size) {
+        ret = qcow2_release_refcount_batch(bs);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset = alloc_clusters_unbatched(bs, s->refcount_batch_size);
+        if (offset < 0) {
+            /* Not enough contiguous space left for a whole batch */
+            return alloc_clusters_unbatched(bs, size);
+        }
+        trace_qcow2_alloc_refcount_batch(bs, offset, s->refcount_batch_size);
+        s->refcount_batch_offset = offset;
+        s->refcount_batch_bytes = s->refcount_batch_size;
+    }
+
+    offset = s->refcount_batch_offset;
+    s->refcount_batch_offset += size;
+    s->refcount_batch_bytes -= size;
+
+    return offset;
+}
+
+int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t aligned_size = size_to_clusters(s, size) << s->cluster_bits;
+
+    BLKDBG_EVENT(bs->file, BLKDBG_CLUSTER_ALLOC);
+    if (aligned_size > 0 && aligned_size <= s->refcount_batch_size) {
+        return alloc_clusters_batched(bs, aligned_size);
+    }
+
+    return alloc_clusters_unbatched(bs, size);
+}
+
 int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                              int64_t nb_clusters)
 {
@@ -1043,6 +1213,14 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
         return 0;
     }
 
+    /* Extending an allocation that was taken from the refcount batch */
+    if (s->refcount_batch_bytes && offset == s->refcount_batch_offset) {
+        i = MIN(nb_clusters, s->refcount_batch_bytes >> s->cluster_bits);
+        s->refcount_batch_offset += i << s->cluster_bits;
+        s->refcount_batch_bytes -= i << s->cluster_bits;
+        return i;
+    }
+
     do {
         /* Check how many clusters there are free */
         cluster_index = offset >> s->cluster_bits;
@@ -1064,6 +1242,10 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
         return ret;
     }
 
+    if (i > 0) {
+        prealloc_file_space(bs, offset, i << s->cluster_bits);
+    }
+
     return i;
 }
 
@@ -39,40 +39,43 @@
 #include "crypto.h"
 
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, Qcow2ThreadQueue *q,
+                 ThreadPoolFunc *func, void *arg, int max_threads)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
-        qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+    while (q->nb_threads >= max_threads) {
+        qemu_co_queue_wait(&q->waiters, &s->lock);
     }
-    s->nb_threads++;
+    q->nb_threads++;
     qemu_co_mutex_unlock(&s->lock);
 
     ret = thread_pool_submit_co(func, arg);
 
     qemu_co_mutex_lock(&s->lock);
-    s->nb_threads--;
-    qemu_co_queue_next(&s->thread_task_queue);
+    q->nb_threads--;
+    qemu_co_queue_next(&q->waiters);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
 }
 
-
 /*
  * Compression
  */
 
+/* @level is 0 for the default level, and ignored for decompression */
 typedef ssize_t (*Qcow2CompressFunc)(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size);
+                                     const void *src, size_t src_size,
+                                     int level);
 typedef struct Qcow2CompressData {
     void *dest;
     size_t dest_size;
     const void *src;
     size_t src_size;
+    int level;
     ssize_t ret;
 
     Qcow2CompressFunc func;
@@ -85,20 +88,22 @@ typedef struct Qcow2CompressData {
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zlib compression level, 0 for Z_DEFAULT_COMPRESSION
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     z_stream strm;
 
     /* best compression, small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+    ret = deflateInit2(&strm, level ?: Z_DEFAULT_COMPRESSION, Z_DEFLATED,
                        -12, 9, Z_DEFAULT_STRATEGY);
     if (ret != Z_OK) {
         return -EIO;
@@ -138,7 +143,8 @@ static ssize_t qcow2_zlib_compress(void *dest, size_t dest_size,
  *          -EIO on fail
  */
 static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     int ret;
     z_stream strm;
@@ -180,13 +186,15 @@ static ssize_t qcow2_zlib_decompress(void *dest, size_t dest_size,
  *
  * @dest - destination buffer, @dest_size bytes
  * @src - source buffer, @src_size bytes
+ * @level - zstd compression level, 0 for the zstd default
  *
  * Returns: compressed size on success
  *          -ENOMEM destination buffer is not enough to store compressed data
  *          -EIO    on any other error
  */
 static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
-                                   const void *src, size_t src_size)
+                                   const void *src, size_t src_size,
+                                   int level)
 {
     ssize_t ret;
     size_t zstd_ret;
@@ -205,6 +213,12 @@ static ssize_t qcow2_zstd_compress(void *dest, size_t dest_size,
     if (!cctx) {
         return -EIO;
     }
+    if (level &&
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                            level))) {
+        ret = -EIO;
+        goto out;
+    }
     /*
      * Use the zstd streamed interface for symmetry with decompression,
      * where streaming is essential since we don't record the exact
@@ -254,7 +268,8 @@ out:
  *          -EIO on any error
  */
 static ssize_t qcow2_zstd_decompress(void *dest, size_t dest_size,
-                                     const void *src, size_t src_size)
+                                     const void *src, size_t src_size,
+                                     int level)
 {
     size_t zstd_ret = 0;
     ssize_t ret = 0;
@@ -330,28 +345,53 @@ static int qcow2_compress_pool_func(void *opaque)
     Qcow2CompressData *data = opaque;
 
     data->ret = data->func(data->dest, data->dest_size,
-                           data->src, data->src_size);
+                           data->src, data->src_size, data->level);
 
     return 0;
 }
 
 static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
-                     const void *src, size_t src_size, Qcow2CompressFunc func)
+                     const void *src, size_t src_size, int level,
+                     Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
         .src = src,
         .src_size = src_size,
+        .level = level,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    qcow2_co_process(bs, &s->compress_thread_queue, qcow2_compress_pool_func,
+                     &arg, s->compress_threads);
 
     return arg.ret;
 }
 
+/*
+ * qcow2_compression_level_valid()
+ *
+ * Check whether @level is a valid compression level for compression type
+ * @type.  0, the default level, is not accepted here.
+ */
+bool qcow2_compression_level_valid(Qcow2CompressionType type, int level)
+{
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        return level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION;
+
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return level >= 1 && level <= ZSTD_maxCLevel();
+#endif
+    default:
+        return false;
+    }
+}
+
 /*
  * qcow2_co_compress()
  *
@@ -385,7 +425,8 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size,
+                                s->compression_level, fn);
 }
 
 /*
@@ -422,7 +463,7 @@ qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
         abort();
     }
 
-    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
+    return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, 0, fn);
 }
 
 
@@ -475,7 +516,9 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    return len == 0 ? 0 : qcow2_co_process(bs, &s->crypt_thread_queue,
+                                           qcow2_encdec_pool_func, &arg,
+                                           QCOW2_MAX_THREADS);
 }
 
 /*
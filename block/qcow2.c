@@ -611,6 +611,12 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    /* Reserved clusters would otherwise be reported (and freed) as leaks */
+    ret = qcow2_release_refcount_batch(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -619,6 +625,10 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     ret = qcow2_check_refcounts(bs, &refcount_res, fix);
     qcow2_add_check_result(result, &refcount_res, true);
+    if (fix) {
+        /* Repairs may have rewritten or dropped any L2 entry */
+        qcow2_cluster_map_clear(bs);
+    }
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
         return ret;
@@ -697,6 +707,11 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_LOCKLESS_READS,
+    QCOW2_OPT_REFCOUNT_BATCH_SIZE,
+    QCOW2_OPT_PREALLOC_SIZE,
+    QCOW2_OPT_COMPRESSION_LEVEL,
+    QCOW2_OPT_COMPRESS_THREADS,
     NULL
 };
 
@@ -808,6 +823,36 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_LOCKLESS_READS,
+            .type = QEMU_OPT_BOOL,
+            .help = "Serve reads of allocated clusters without taking the "
+                    "image lock",
+        },
+        {
+            .name = QCOW2_OPT_REFCOUNT_BATCH_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Reserve clusters for new allocations in batches of this "
+                    "many bytes (0 = disabled)",
+        },
+        {
+            .name = QCOW2_OPT_PREALLOC_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Grow the image file this many bytes ahead of new "
+                    "allocations (0 = disabled)",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSION_LEVEL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Compression level for compressed writes (0 = default "
+                    "of the compression type)",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESS_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of clusters that are compressed or "
+                    "decompressed in parallel",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -969,6 +1014,11 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    Qcow2ClusterMap *cluster_map;
+    uint64_t refcount_batch_size;
+    uint64_t prealloc_size;
+    int compression_level;
+    int compress_threads;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1070,6 +1120,82 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    /*
+     * lockless-reads; the map covers as many clusters as the L2 cache does,
+     * and is rebuilt from scratch whenever the options change
+     */
+    if (qemu_opt_get_bool(opts, QCOW2_OPT_LOCKLESS_READS, false)) {
+        if (has_subclusters(s)) {
+            error_setg(errp, QCOW2_OPT_LOCKLESS_READS " is not supported for "
+                       "images with extended L2 entries");
+            ret = -EINVAL;
+            goto fail;
+        }
+        r->cluster_map = qcow2_cluster_map_new(l2_cache_size *
+                                               r->l2_slice_size);
+        if (!r->cluster_map) {
+            error_setg(errp, "Could not allocate cluster map");
+            ret = -ENOMEM;
+            goto fail;
+        }
+    }
+
+    /* refcount-batch-size; the current batch is returned before it changes */
+    r->refcount_batch_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_REFCOUNT_BATCH_SIZE, 0);
+    if (!QEMU_IS_ALIGNED(r->refcount_batch_size, s->cluster_size) ||
+        r->refcount_batch_size > QCOW_MAX_REFCOUNT_BATCH_SIZE) {
+        error_setg(errp, QCOW2_OPT_REFCOUNT_BATCH_SIZE " must be a multiple "
+                   "of the cluster size and may not exceed %" PRId64 " MiB",
+                   QCOW_MAX_REFCOUNT_BATCH_SIZE / MiB);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->prealloc_size = qemu_opt_get_size(opts, QCOW2_OPT_PREALLOC_SIZE, 0);
+    if (r->prealloc_size > QCOW_MAX_PREALLOC_SIZE) {
+        error_setg(errp, QCOW2_OPT_PREALLOC_SIZE " may not exceed %" PRId64
+                   " MiB", QCOW_MAX_PREALLOC_SIZE / MiB);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (r->prealloc_size && has_data_file(bs)) {
+        error_setg(errp, QCOW2_OPT_PREALLOC_SIZE " is not supported for "
+                   "images with an external data file");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (s->refcount_block_cache) {
+        ret = qcow2_release_refcount_batch(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to release reserved clusters");
+            goto fail;
+        }
+    }
+
+    r->compression_level =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSION_LEVEL, 0);
+    if (r->compression_level &&
+        !qcow2_compression_level_valid(s->compression_type,
+                                       r->compression_level)) {
+        error_setg(errp, "Compression level %d is not supported by "
+                   "compression type '%s'", r->compression_level,
+                   Qcow2CompressionType_str(s->compression_type));
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->compress_threads = qemu_opt_get_number(opts, QCOW2_OPT_COMPRESS_THREADS,
+                                              QCOW2_MAX_THREADS);
+    if (r->compress_threads < 1 ||
+        r->compress_threads > QCOW2_MAX_COMPRESS_THREADS) {
+        error_setg(errp, QCOW2_OPT_COMPRESS_THREADS " must be between 1 and "
+                   "%d", QCOW2_MAX_COMPRESS_THREADS);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1211,6 +1337,12 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->l2_table_cache = r->l2_table_cache;
     s->refcount_block_cache = r->refcount_block_cache;
     s->l2_slice_size = r->l2_slice_size;
+    qcow2_cluster_map_free(s->cluster_map);
+    s->cluster_map = r->cluster_map;
+    s->refcount_batch_size = r->refcount_batch_size;
+    s->prealloc_size = r->prealloc_size;
+    s->compression_level = r->compression_level;
+    s->compress_threads = r->compress_threads;
 
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
@@ -1238,6 +1370,7 @@ static void qcow2_update_options_abort(BlockDriverState *bs,
     if (r->refcount_block_cache) {
         qcow2_cache_destroy(r->refcount_block_cache);
     }
+    qcow2_cluster_map_free(r->cluster_map);
     qapi_free_QCryptoBlockOpenOptions(r->crypto_opts);
 }
 
@@ -1849,7 +1982,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
 #endif
 
-    qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->crypt_thread_queue.waiters);
+    qemu_co_queue_init(&s->compress_thread_queue.waiters);
 
     return ret;
 
@@ -1873,6 +2007,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    qcow2_cluster_map_free(s->cluster_map);
+    s->cluster_map = NULL;
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2346,12 +2482,20 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
-        if (ret < 0) {
-            goto out;
+        if (qcow2_get_host_offset_lockless(bs, offset, &cur_bytes,
+                                           &host_offset)) {
+            type = QCOW2_SUBCLUSTER_NORMAL;
+        } else {
+            qemu_co_mutex_lock(&s->lock);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            if (ret == 0 && type == QCOW2_SUBCLUSTER_NORMAL) {
+                qcow2_cluster_map_fill(bs, offset, cur_bytes, host_offset);
+            }
+            qemu_co_mutex_unlock(&s->lock);
+            if (ret < 0) {
+                goto out;
+            }
         }
 
         if (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
@@ -2472,12 +2616,10 @@ static int coroutine_fn GRAPH_RDLOCK
 handle_alloc_space(BlockDriverState *bs, QCowL2Meta *l2meta)
 {
     BDRVQcow2State *s = bs->opaque;
+    bool zero_write = s->data_file->bs->supported_zero_flags &
+                      BDRV_REQ_NO_FALLBACK;
     QCowL2Meta *m;
 
-    if (!(s->data_file->bs->supported_zero_flags & BDRV_REQ_NO_FALLBACK)) {
-        return 0;
-    }
-
     if (bs->encrypted) {
         return 0;
     }
@@ -2499,6 +2641,25 @@ handle_alloc_space(BlockDriverState *bs, QCowL2Meta *l2meta)
             continue;
         }
 
+        /*
+         * If the new clusters already read as zeroes (because they are a
+         * hole in the data file, or were preallocated with prealloc-size),
+         * there is nothing to write at all
+         */
+        ret = bdrv_co_is_zero_fast(s->data_file->bs, start_offset, nb_bytes);
+        if (ret < 0) {
+            return ret;
+        } else if (ret > 0) {
+            trace_qcow2_skip_cow_host_zero(qemu_coroutine_self(), m->offset,
+                                           m->nb_clusters);
+            m->skip_cow = true;
+            continue;
+        }
+
+        if (!zero_write) {
+            continue;
+        }
+
         /*
          * instead of writing zero COW buffers,
          * efficiently zero out the whole clusters
@@ -2713,6 +2874,13 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    ret = qcow2_release_refcount_batch(bs);
+    if (ret) {
+        result = ret;
+        error_report("Failed to release reserved clusters: %s",
+                     strerror(-ret));
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2727,6 +2895,14 @@ static int qcow2_inactivate(BlockDriverState *bs)
                      strerror(-ret));
     }
 
+    if (result == 0) {
+        ret = qcow2_prealloc_trim(bs);
+        if (ret) {
+            warn_report("Failed to trim preallocated space: %s",
+                        strerror(-ret));
+        }
+    }
+
     if (result == 0) {
         qcow2_mark_clean(bs);
     }
@@ -2748,6 +2924,8 @@ static void qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_cluster_map_free(s->cluster_map);
+    s->cluster_map = NULL;
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4266,6 +4444,13 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
             goto fail;
         }
 
+        /* Let reserved clusters at the end of the file be cut off, too */
+        ret = qcow2_release_refcount_batch(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to release reserved clusters");
+            goto fail;
+        }
+
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4711,7 +4896,9 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            /* Keep all compression threads busy */
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS,
+                                        s->compress_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -4792,6 +4979,12 @@ static int make_completely_empty(BlockDriverState *bs)
         uint32_t reftable_clusters;
     } QEMU_PACKED l1_ofs_rt_ofs_cls;
 
+    qcow2_cluster_map_clear(bs);
+
+    /* All refcounts are about to be reset, so just forget the batch */
+    s->refcount_batch_offset = 0;
+    s->refcount_batch_bytes = 0;
+
     ret = qcow2_cache_empty(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
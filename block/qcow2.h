@@ -57,6 +57,12 @@
  * (128 GB for 512 byte clusters, 2 EB for 2 MB clusters) */
 #define QCOW_MAX_L1_SIZE (32 * MiB)
 
+/* Bound on how much space the refcount-batch-size option can keep reserved */
+#define QCOW_MAX_REFCOUNT_BATCH_SIZE (256 * MiB)
+
+/* Bound on how far prealloc-size can grow the image file ahead of its use */
+#define QCOW_MAX_PREALLOC_SIZE (1 * GiB)
+
 /* Allow for an average of 1k per snapshot table entry, should be plenty of
  * space for snapshot names and IDs */
 #define QCOW_MAX_SNAPSHOTS_SIZE (1024 * QCOW_MAX_SNAPSHOTS)
@@ -149,6 +155,11 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_LOCKLESS_READS "lockless-reads"
+#define QCOW2_OPT_REFCOUNT_BATCH_SIZE "refcount-batch-size"
+#define QCOW2_OPT_PREALLOC_SIZE "prealloc-size"
+#define QCOW2_OPT_COMPRESSION_LEVEL "compression-level"
+#define QCOW2_OPT_COMPRESS_THREADS "compress-threads"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -230,6 +241,9 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+struct Qcow2ClusterMap;
+typedef struct Qcow2ClusterMap Qcow2ClusterMap;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
@@ -323,6 +337,15 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+/* Bound on the compress-threads option */
+#define QCOW2_MAX_COMPRESS_THREADS 64
+
+/* Thread pool work of one kind, such as compression, and who waits for it */
+typedef struct Qcow2ThreadQueue {
+    CoQueue waiters;
+    int nb_threads;
+} Qcow2ThreadQueue;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -346,6 +369,8 @@ typedef struct BDRVQcow2State {
     Qcow2Cache *refcount_block_cache;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
+    /* Lock-free guest to host mapping for reads, NULL if disabled */
+    Qcow2ClusterMap *cluster_map;
 
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
@@ -355,6 +380,16 @@ typedef struct BDRVQcow2State {
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
+    /* Bytes to take from the free pool at once, 0 to disable batching */
+    uint64_t refcount_batch_size;
+    /* Part of the current batch that has not been handed out yet */
+    uint64_t refcount_batch_offset;
+    uint64_t refcount_batch_bytes;
+    /* Grow the image file this far beyond new allocations, 0 to disable */
+    uint64_t prealloc_size;
+    /* Range added to the image file by the last preallocation, if any */
+    int64_t prealloc_start;
+    int64_t prealloc_end;
 
     CoMutex lock;
 
@@ -405,8 +440,16 @@ typedef struct BDRVQcow2State {
     char *image_backing_format;
     char *image_data_file;
 
-    CoQueue thread_task_queue;
-    int nb_threads;
+    /*
+     * Encryption and compression have limits of their own, so they are
+     * accounted and woken up separately.  Protected by lock.
+     */
+    Qcow2ThreadQueue crypt_thread_queue;
+    Qcow2ThreadQueue compress_thread_queue;
+    /* Compression level, 0 for the default of the compression type */
+    int compression_level;
+    /* Maximum number of threads that compress or decompress clusters */
+    int compress_threads;
 
     BdrvChild *data_file;
 
@@ -862,6 +905,8 @@ int64_t qcow2_refcount_area(BlockDriverState *bs, uint64_t offset,
                             uint64_t new_refblock_offset);
 
 int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size);
+int qcow2_release_refcount_batch(BlockDriverState *bs);
+int qcow2_prealloc_trim(BlockDriverState *bs);
 int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                              int64_t nb_clusters);
 int64_t coroutine_fn qcow2_alloc_bytes(BlockDriverState *bs, int size);
@@ -988,6 +1033,18 @@ void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-map.c functions */
+Qcow2ClusterMap *qcow2_cluster_map_new(uint64_t nb_clusters);
+void qcow2_cluster_map_free(Qcow2ClusterMap *map);
+bool qcow2_get_host_offset_lockless(BlockDriverState *bs, uint64_t offset,
+                                    unsigned int *bytes,
+                                    uint64_t *host_offset);
+void qcow2_cluster_map_fill(BlockDriverState *bs, uint64_t offset,
+                            unsigned int bytes, uint64_t host_offset);
+void qcow2_cluster_map_invalidate(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes);
+void qcow2_cluster_map_clear(BlockDriverState *bs);
+
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                   void **refcount_table,
@@ -1012,6 +1069,7 @@ bool qcow2_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 uint64_t qcow2_get_persistent_dirty_bitmap_size(BlockDriverState *bs,
                                                 uint32_t cluster_size);
 
+bool qcow2_compression_level_valid(Qcow2CompressionType type, int level);
 ssize_t coroutine_fn
 qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                   const void *src, size_t src_size);
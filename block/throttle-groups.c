@@ -26,8 +26,10 @@
 #include "sysemu/block-backend.h"
 #include "block/throttle-groups.h"
 #include "qemu/throttle-options.h"
+#include "qemu/coroutine-tls.h"
 #include "qemu/main-loop.h"
 #include "qemu/queue.h"
+#include "qemu/seqlock.h"
 #include "qemu/thread.h"
 #include "sysemu/qtest.h"
 #include "qapi/error.h"
@@ -62,6 +64,15 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * The lock is only needed once requests have to wait.  The leaky buckets
+ * live in a ThrottleTokens, which is updated with atomic operations, so
+ * as long as no request of the same type is queued or waiting for a timer
+ * anywhere in the group, throttle_group_co_io_limits_intercept() admits
+ * and accounts requests without touching the lock at all.  Each thread
+ * additionally keeps a few recently prepaid requests' worth of tokens in
+ * a thread-local cache (see ThrottleTokenCache), so that members in
+ * different iothreads do not all bounce the same cache lines.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -69,13 +80,29 @@ struct ThrottleGroup {
     /* refuse individual property change if initialization is complete */
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
+    uint64_t id; /* Unique and constant, used to tag cached tokens */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[2];
-    bool any_timer_armed[2];
     QEMUClockType clock_type;
+    /* Proportional-share scheduling, see next_weighted_token().  The fast
+     * path reads @weighted without the lock. */
+    bool weighted;
+    uint64_t vclock[2];
+
+    /* Written under the lock, read without it by the fast path */
+    bool any_timer_armed[2];
+    unsigned pending_reqs[2]; /* sum of all members' pending_reqs */
+
+    /* Lets the fast path read ts.cfg and generation without the lock.
+     * generation is bumped whenever the configuration changes, which
+     * invalidates all cached tokens. */
+    QemuSeqLock cfg_seq;
+    unsigned generation;
+
+    ThrottleTokens bucket_tokens; /* Accessed with atomic operations */
 
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
@@ -84,6 +111,34 @@ struct ThrottleGroup {
 /* This is protected by the global QEMU mutex */
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
+static uint64_t throttle_group_next_id;
+
+/*
+ * Tokens that a thread has already accounted in a group's buckets on
+ * behalf of requests it has not submitted yet.  A thread that finds
+ * room in the buckets prepays up to THROTTLE_CACHE_REQS more requests
+ * like the current one, but never more than 1/THROTTLE_CACHE_SLICE of
+ * what a bucket can absorb, so the cache cannot starve other threads.
+ * Credit is dropped, not returned, when the configuration changes or
+ * after THROTTLE_CACHE_EXPIRY_NS, which errs on the side of throttling.
+ */
+#define THROTTLE_CACHE_SLOTS 4
+#define THROTTLE_CACHE_REQS 8
+#define THROTTLE_CACHE_SLICE 16
+#define THROTTLE_CACHE_EXPIRY_NS (10 * SCALE_MS)
+
+typedef struct ThrottleTokenCache {
+    uint64_t group_id;
+    unsigned generation;
+    int64_t expires;
+    ThrottleCost credit;
+} ThrottleTokenCache;
+
+typedef struct ThrottleTokenCaches {
+    ThrottleTokenCache slot[THROTTLE_CACHE_SLOTS];
+} ThrottleTokenCaches;
+
+QEMU_DEFINE_STATIC_CO_TLS(ThrottleTokenCaches, token_caches)
 
 
 /* This function reads throttle_groups and must be called under the global
@@ -206,6 +261,75 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
     return tgm->pending_reqs[is_write];
 }
 
+/* Return how much a request costs a member in virtual time: its cost in
+ * the most restrictive bucket, scaled down by the member's weight.
+ */
+static uint64_t throttle_group_service(const ThrottleCost *cost,
+                                       unsigned int weight)
+{
+    uint64_t service = 0;
+    int i;
+
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        service = MAX(service, cost->ticks[i][0]);
+    }
+    return muldiv64(service, THROTTLE_GROUP_WEIGHT_DEFAULT, weight);
+}
+
+/* Add the service that a ThrottleGroupMember got through the fast path to
+ * its virtual time.  Nobody was waiting while those requests ran, so the
+ * group's virtual clock moves along with them.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @tgm:       the ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_charge_fast_service(ThrottleGroup *tg,
+                                               ThrottleGroupMember *tgm,
+                                               bool is_write)
+{
+    uint64_t total = stat64_get(&tgm->fast_service[is_write]);
+    uint64_t service = total - tgm->fast_service_charged[is_write];
+
+    if (!service) {
+        return;
+    }
+    tgm->fast_service_charged[is_write] = total;
+    tgm->vtime[is_write] = MAX(tgm->vtime[is_write], tg->vclock[is_write]) +
+                           service;
+    tg->vclock[is_write] = tgm->vtime[is_write];
+}
+
+/* Return the ThrottleGroupMember with pending I/O requests that has the
+ * smallest virtual time, i.e. the one that got the least service relative
+ * to its weight.  Ties go to the member that comes first in the list.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:        the ThrottleGroup
+ * @tgm:       the current ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ * @ret:       the chosen ThrottleGroupMember, or tgm if there is none.
+ */
+static ThrottleGroupMember *next_weighted_token(ThrottleGroup *tg,
+                                                ThrottleGroupMember *tgm,
+                                                bool is_write)
+{
+    ThrottleGroupMember *iter, *token = NULL;
+
+    QLIST_FOREACH(iter, &tg->head, round_robin) {
+        throttle_group_charge_fast_service(tg, iter, is_write);
+        if (tgm_has_pending_reqs(iter, is_write) &&
+            (!token || iter->vtime[is_write] < token->vtime[is_write])) {
+            token = iter;
+        }
+    }
+
+    return token ? token : tgm;
+}
+
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
  * I/O requests.
  *
@@ -232,6 +356,10 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
         return tgm;
     }
 
+    if (tg->weighted) {
+        return next_weighted_token(tg, tgm, is_write);
+    }
+
     start = token = tg->tokens[is_write];
 
     /* get next bs round in round robin style */
@@ -270,7 +398,7 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     ThrottleTimers *tt = &tgm->throttle_timers;
-    bool must_wait;
+    int64_t now, wait;
 
     if (qatomic_read(&tgm->io_limits_disabled)) {
         return false;
@@ -281,15 +409,21 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
         return true;
     }
 
-    must_wait = throttle_schedule_timer(ts, tt, is_write);
+    now = qemu_clock_get_ns(tg->clock_type);
+    wait = throttle_tokens_compute_wait(&tg->bucket_tokens, &ts->cfg,
+                                        is_write, now);
+    if (!wait) {
+        return false;
+    }
 
-    /* If a timer just got armed, set tgm as the current token */
-    if (must_wait) {
-        tg->tokens[is_write] = tgm;
-        tg->any_timer_armed[is_write] = true;
+    /* Arm the timer and set tgm as the current token */
+    if (!timer_pending(tt->timers[is_write])) {
+        timer_mod(tt->timers[is_write], now + wait);
     }
+    tg->tokens[is_write] = tgm;
+    qatomic_set(&tg->any_timer_armed[is_write], true);
 
-    return must_wait;
+    return true;
 }
 
 /* Start the next pending I/O request for a ThrottleGroupMember. Return whether
@@ -335,23 +469,203 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
 
     /* If it doesn't have to wait, queue it for immediate execution */
     if (!must_wait) {
-        /* Give preference to requests from the current tgm */
-        if (qemu_in_coroutine() &&
+        /* Give preference to requests from the current tgm, unless the
+         * weights say that another member is next */
+        if (qemu_in_coroutine() && (!tg->weighted || token == tgm) &&
             throttle_group_co_restart_queue(tgm, is_write)) {
             token = tgm;
         } else {
             ThrottleTimers *tt = &token->throttle_timers;
             int64_t now = qemu_clock_get_ns(tg->clock_type);
             timer_mod(tt->timers[is_write], now);
-            tg->any_timer_armed[is_write] = true;
+            qatomic_set(&tg->any_timer_armed[is_write], true);
         }
         tg->tokens[is_write] = token;
     }
 }
 
+/* Return this thread's token cache for a group, emptying it first if it
+ * belonged to another group, to an older configuration, or has expired.
+ */
+static ThrottleTokenCache *throttle_group_token_cache(ThrottleGroup *tg,
+                                                      unsigned generation,
+                                                      int64_t now)
+{
+    ThrottleTokenCaches *caches = get_ptr_token_caches();
+    ThrottleTokenCache *cache = &caches->slot[tg->id % THROTTLE_CACHE_SLOTS];
+
+    if (cache->group_id != tg->id || cache->generation != generation ||
+        now >= cache->expires) {
+        memset(cache, 0, sizeof(*cache));
+        cache->group_id = tg->id;
+        cache->generation = generation;
+    }
+    return cache;
+}
+
+/* Take the cost of a request out of the cached credit, if there is
+ * enough of it in every bucket that the request goes through.
+ */
+static bool throttle_token_cache_take(ThrottleTokenCache *cache,
+                                      const ThrottleCost *cost)
+{
+    int i, burst;
+
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        for (burst = 0; burst < 2; burst++) {
+            if (cost->ticks[i][burst] > cache->credit.ticks[i][burst]) {
+                return false;
+            }
+        }
+    }
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        for (burst = 0; burst < 2; burst++) {
+            cache->credit.ticks[i][burst] -= cost->ticks[i][burst];
+        }
+    }
+    return true;
+}
+
+/* Return how many more requests like @cost to prepay, see
+ * ThrottleTokenCache.
+ */
+static unsigned throttle_token_cache_prepay(const ThrottleConfig *cfg,
+                                            const ThrottleCost *cost)
+{
+    unsigned n = THROTTLE_CACHE_REQS;
+    uint64_t slice;
+    int i, burst;
+
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        for (burst = 0; burst < 2; burst++) {
+            if (cost->ticks[i][burst]) {
+                slice = throttle_tokens_tolerance(&cfg->buckets[i], burst) /
+                        THROTTLE_CACHE_SLICE;
+                n = MIN(n, slice / cost->ticks[i][burst]);
+            }
+        }
+    }
+    return n;
+}
+
+/* Account a request in the group's buckets, together with as many more
+ * like it as throttle_token_cache_prepay() allows, which go to @cache.
+ */
+static void throttle_group_prepay(ThrottleGroup *tg, ThrottleTokenCache *cache,
+                                  const ThrottleConfig *cfg,
+                                  const ThrottleCost *cost, int64_t now)
+{
+    ThrottleCost total = *cost;
+    unsigned n;
+    int i, burst;
+
+    n = throttle_token_cache_prepay(cfg, cost);
+    if (n) {
+        for (i = 0; i < BUCKETS_COUNT; i++) {
+            for (burst = 0; burst < 2; burst++) {
+                cache->credit.ticks[i][burst] += n * cost->ticks[i][burst];
+                total.ticks[i][burst] *= n + 1;
+            }
+        }
+        cache->expires = now + THROTTLE_CACHE_EXPIRY_NS;
+    }
+    throttle_tokens_account(&tg->bucket_tokens, &total, now);
+}
+
+/* Try to admit an I/O request without taking tg->lock.  This only
+ * succeeds if no request of the same type is queued or waiting for a
+ * timer anywhere in the group, so that it cannot overtake them, and if
+ * either this thread's cached tokens or the group's buckets have room
+ * for the request.
+ *
+ * A request that races with another one getting queued may still slip
+ * through; that only affects the order in which they run, because both
+ * are accounted in the same buckets.
+ *
+ * In weighted mode the request's service is recorded in the member's
+ * fast_service, which throttle_group_charge_fast_service() adds to its
+ * virtual time the next time the lock is taken.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ * @ret:       whether the request was admitted and accounted
+ */
+static bool throttle_group_try_account(ThrottleGroupMember *tgm,
+                                       int64_t bytes, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleTokenCache *cache;
+    ThrottleConfig cfg;
+    ThrottleCost cost;
+    unsigned seq, generation;
+    int64_t now;
+
+    if (qatomic_read(&tg->pending_reqs[is_write]) ||
+        qatomic_read(&tg->any_timer_armed[is_write])) {
+        return false;
+    }
+
+    do {
+        seq = seqlock_read_begin(&tg->cfg_seq);
+        cfg = tg->ts.cfg;
+        generation = qatomic_read(&tg->generation);
+    } while (seqlock_read_retry(&tg->cfg_seq, seq));
+
+    throttle_tokens_cost(&cfg, is_write, bytes, &cost);
+    now = qemu_clock_get_ns(tg->clock_type);
+    cache = throttle_group_token_cache(tg, generation, now);
+    if (!throttle_token_cache_take(cache, &cost)) {
+        if (throttle_tokens_compute_wait(&tg->bucket_tokens, &cfg, is_write,
+                                         now)) {
+            return false;
+        }
+        throttle_group_prepay(tg, cache, &cfg, &cost, now);
+    }
+
+    if (qatomic_read(&tg->weighted)) {
+        stat64_add(&tgm->fast_service[is_write],
+                   throttle_group_service(&cost,
+                                          qatomic_read(&tgm->weight)));
+    }
+    return true;
+}
+
+/* Do the accounting for an I/O request that is about to be executed,
+ * and advance the member's virtual time in weighted mode.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_account(ThrottleGroupMember *tgm, int64_t bytes,
+                                   bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleCost cost;
+
+    throttle_tokens_cost(&tg->ts.cfg, is_write, bytes, &cost);
+    throttle_tokens_account(&tg->bucket_tokens, &cost,
+                            qemu_clock_get_ns(tg->clock_type));
+
+    if (!tg->weighted) {
+        return;
+    }
+
+    /* Start-time fair queuing: the request starts at the group's virtual
+     * clock (or later, if the member is ahead), and its service is added
+     * to that. */
+    throttle_group_charge_fast_service(tg, tgm, is_write);
+    tgm->vtime[is_write] = MAX(tgm->vtime[is_write], tg->vclock[is_write]);
+    tg->vclock[is_write] = tgm->vtime[is_write];
+    tgm->vtime[is_write] += throttle_group_service(&cost, tgm->weight);
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
- * algorithm.
+ * algorithm (or by weight, in weighted mode).
  *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
@@ -367,6 +681,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     assert(bytes >= 0);
 
+    if (throttle_group_try_account(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -375,18 +693,25 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
+        if (!tgm->pending_reqs[is_write]) {
+            /* A member that was idle must not catch up on lost service */
+            tgm->vtime[is_write] = MAX(tgm->vtime[is_write],
+                                       tg->vclock[is_write]);
+        }
         tgm->pending_reqs[is_write]++;
+        qatomic_inc(&tg->pending_reqs[is_write]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[is_write],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
+        qatomic_dec(&tg->pending_reqs[is_write]);
         tgm->pending_reqs[is_write]--;
     }
 
     /* The I/O will be executed, so do the accounting */
-    throttle_account(tgm->throttle_state, is_write, bytes);
+    throttle_group_account(tgm, bytes, is_write);
 
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
@@ -462,6 +787,22 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm)
     }
 }
 
+/* Set the configuration of a group and empty its buckets.
+ *
+ * This assumes that tg->lock is held, or that the group has no members.
+ *
+ * @tg:  the ThrottleGroup
+ * @cfg: the configuration to set
+ */
+static void throttle_group_set_config(ThrottleGroup *tg, ThrottleConfig *cfg)
+{
+    seqlock_write_begin(&tg->cfg_seq);
+    throttle_config(&tg->ts, tg->clock_type, cfg);
+    qatomic_set(&tg->generation, tg->generation + 1);
+    throttle_tokens_init(&tg->bucket_tokens);
+    seqlock_write_end(&tg->cfg_seq);
+}
+
 /* Update the throttle configuration for a particular group. Similar
  * to throttle_config(), but guarantees atomicity within the
  * throttling group.
@@ -474,7 +815,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
-    throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_set_config(tg, cfg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -509,7 +850,7 @@ static void timer_cb(ThrottleGroupMember *tgm, bool is_write)
 
     /* The timer has just been fired, so we can update the flag */
     qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[is_write] = false;
+    qatomic_set(&tg->any_timer_armed[is_write], false);
     qemu_mutex_unlock(&tg->lock);
 
     /* Run the request that was waiting for this timer */
@@ -548,6 +889,9 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     qatomic_set(&tgm->restart_pending, 0);
+    if (!tgm->weight) {
+        tgm->weight = THROTTLE_GROUP_WEIGHT_DEFAULT;
+    }
 
     QEMU_LOCK_GUARD(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -555,6 +899,9 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
         if (!tg->tokens[i]) {
             tg->tokens[i] = tgm;
         }
+        /* Start with the same share of the bandwidth as everybody else */
+        tgm->vtime[i] = tg->vclock[i];
+        tgm->fast_service_charged[i] = stat64_get(&tgm->fast_service[i]);
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -619,6 +966,21 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
     tgm->throttle_state = NULL;
 }
 
+/* Change the weight of a registered ThrottleGroupMember.  It only matters
+ * if the group is in weighted mode.
+ *
+ * @tgm:    the ThrottleGroupMember
+ * @weight: the new weight, between 1 and THROTTLE_GROUP_WEIGHT_MAX
+ */
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned int weight)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    assert(weight >= 1 && weight <= THROTTLE_GROUP_WEIGHT_MAX);
+    QEMU_LOCK_GUARD(&tg->lock);
+    qatomic_set(&tgm->weight, weight);
+}
+
 void throttle_group_attach_aio_context(ThrottleGroupMember *tgm,
                                        AioContext *new_context)
 {
@@ -642,7 +1004,7 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     WITH_QEMU_LOCK_GUARD(&tg->lock) {
         for (i = 0; i < 2; i++) {
             if (timer_pending(tt->timers[i])) {
-                tg->any_timer_armed[i] = false;
+                qatomic_set(&tg->any_timer_armed[i], false);
                 schedule_next_request(tgm, i);
             }
         }
@@ -758,8 +1120,11 @@ static void throttle_group_obj_init(Object *obj)
         tg->clock_type = QEMU_CLOCK_VIRTUAL;
     }
     tg->is_initialized = false;
+    tg->id = ++throttle_group_next_id;
     qemu_mutex_init(&tg->lock);
     throttle_init(&tg->ts);
+    seqlock_init(&tg->cfg_seq);
+    throttle_tokens_init(&tg->bucket_tokens);
     QLIST_INIT(&tg->head);
 }
 
@@ -788,7 +1153,7 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
     if (!throttle_is_valid(&cfg, errp)) {
         return;
     }
-    throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_set_config(tg, &cfg);
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
 }
@@ -899,7 +1264,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
     if (local_err) {
         goto unlock;
     }
-    throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_set_config(tg, &cfg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -926,6 +1291,35 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static bool throttle_group_get_weighted(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    return tg->weighted;
+}
+
+static void throttle_group_set_weighted(Object *obj, bool value,
+                                        Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroupMember *tgm;
+    int i;
+
+    QEMU_LOCK_GUARD(&tg->lock);
+    if (value && !tg->weighted) {
+        /* Nobody has been charged so far, start from a level field */
+        QLIST_FOREACH(tgm, &tg->head, round_robin) {
+            for (i = 0; i < 2; i++) {
+                tgm->vtime[i] = tg->vclock[i];
+                tgm->fast_service_charged[i] =
+                    stat64_get(&tgm->fast_service[i]);
+            }
+        }
+    }
+    qatomic_set(&tg->weighted, value);
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -955,6 +1349,11 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    /* Proportional-share scheduling of the members */
+    object_class_property_add_bool(klass, "weighted",
+                                   throttle_group_get_weighted,
+                                   throttle_group_set_weighted);
 }
 
 static const TypeInfo throttle_group_info = {
@@ -35,19 +35,26 @@ static QemuOptsList throttle_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Name of the throttle group",
         },
+        {
+            .name = QEMU_OPT_THROTTLE_WEIGHT,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Share of the group's bandwidth in weighted mode",
+        },
         { /* end of list */ }
     },
 };
 
 /*
  * If this function succeeds then the throttle group name is stored in
- * @group and must be freed by the caller.
- * If there's an error then @group remains unmodified.
+ * @group and must be freed by the caller, and the weight in @weight.
+ * If there's an error then @group and @weight remain unmodified.
  */
-static int throttle_parse_options(QDict *options, char **group, Error **errp)
+static int throttle_parse_options(QDict *options, char **group,
+                                  unsigned int *weight, Error **errp)
 {
     int ret;
     const char *group_name;
+    uint64_t weight_value;
     QemuOpts *opts = qemu_opts_create(&throttle_opts, NULL, 0, &error_abort);
 
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
@@ -66,7 +73,17 @@ static int throttle_parse_options(QDict *options, char **group, Error **errp)
         goto fin;
     }
 
+    weight_value = qemu_opt_get_number(opts, QEMU_OPT_THROTTLE_WEIGHT,
+                                       THROTTLE_GROUP_WEIGHT_DEFAULT);
+    if (weight_value < 1 || weight_value > THROTTLE_GROUP_WEIGHT_MAX) {
+        error_setg(errp, "%s must be in the range [1, %d]",
+                   QEMU_OPT_THROTTLE_WEIGHT, THROTTLE_GROUP_WEIGHT_MAX);
+        ret = -EINVAL;
+        goto fin;
+    }
+
     *group = g_strdup(group_name);
+    *weight = weight_value;
     ret = 0;
 fin:
     qemu_opts_del(opts);
@@ -89,7 +106,7 @@ static int throttle_open(BlockDriverState *bs, QDict *options,
     bs->supported_zero_flags = bs->file->bs->supported_zero_flags |
                                BDRV_REQ_WRITE_UNCHANGED;
 
-    ret = throttle_parse_options(options, &group, errp);
+    ret = throttle_parse_options(options, &group, &tgm->weight, errp);
     if (ret == 0) {
         /* Register membership to group with name group_name */
         throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
@@ -178,17 +195,24 @@ static void throttle_attach_aio_context(BlockDriverState *bs,
     throttle_group_attach_aio_context(tgm, new_context);
 }
 
+typedef struct ThrottleReopenState {
+    char *group;
+    unsigned int weight;
+} ThrottleReopenState;
+
 static int throttle_reopen_prepare(BDRVReopenState *reopen_state,
                                    BlockReopenQueue *queue, Error **errp)
 {
+    ThrottleReopenState *rs;
     int ret;
-    char *group = NULL;
 
     assert(reopen_state != NULL);
     assert(reopen_state->bs != NULL);
 
-    ret = throttle_parse_options(reopen_state->options, &group, errp);
-    reopen_state->opaque = group;
+    rs = g_new0(ThrottleReopenState, 1);
+    ret = throttle_parse_options(reopen_state->options, &rs->group,
+                                 &rs->weight, errp);
+    reopen_state->opaque = rs;
     return ret;
 }
 
@@ -196,21 +220,28 @@ static void throttle_reopen_commit(BDRVReopenState *reopen_state)
 {
     BlockDriverState *bs = reopen_state->bs;
     ThrottleGroupMember *tgm = bs->opaque;
-    char *group = reopen_state->opaque;
+    ThrottleReopenState *rs = reopen_state->opaque;
 
-    assert(group);
+    assert(rs->group);
 
-    if (strcmp(group, throttle_group_get_name(tgm))) {
+    if (strcmp(rs->group, throttle_group_get_name(tgm))) {
         throttle_group_unregister_tgm(tgm);
-        throttle_group_register_tgm(tgm, group, bdrv_get_aio_context(bs));
+        tgm->weight = rs->weight;
+        throttle_group_register_tgm(tgm, rs->group, bdrv_get_aio_context(bs));
+    } else {
+        throttle_group_set_weight(tgm, rs->weight);
     }
-    g_free(reopen_state->opaque);
+    g_free(rs->group);
+    g_free(rs);
     reopen_state->opaque = NULL;
 }
 
 static void throttle_reopen_abort(BDRVReopenState *reopen_state)
 {
-    g_free(reopen_state->opaque);
+    ThrottleReopenState *rs = reopen_state->opaque;
+
+    g_free(rs->group);
+    g_free(rs);
     reopen_state->opaque = NULL;
 }
 
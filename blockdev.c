@@ -1678,6 +1678,7 @@ typedef struct DriveBackupState {
 static BlockJob *do_backup_common(BackupCommon *backup,
                                   BlockDriverState *bs,
                                   BlockDriverState *target_bs,
+                                  BackupFanOutList *fan_out,
                                   AioContext *aio_context,
                                   JobTxn *txn, Error **errp);
 
@@ -1819,7 +1820,7 @@ static void drive_backup_prepare(BlkActionState *common, Error **errp)
     }
 
     state->job = do_backup_common(qapi_DriveBackup_base(backup),
-                                  bs, target_bs, aio_context,
+                                  bs, target_bs, NULL, aio_context,
                                   common->block_job_txn, errp);
 
 unref:
@@ -1916,7 +1917,7 @@ static void blockdev_backup_prepare(BlkActionState *common, Error **errp)
     bdrv_drained_begin(state->bs);
 
     state->job = do_backup_common(qapi_BlockdevBackup_base(backup),
-                                  bs, target_bs, aio_context,
+                                  bs, target_bs, backup->fan_out, aio_context,
                                   common->block_job_txn, errp);
 
     aio_context_release(aio_context);
@@ -2037,6 +2038,11 @@ static void block_dirty_bitmap_clear_prepare(BlkActionState *common,
         return;
     }
 
+    /* Otherwise the data would be merged back in when it is loaded */
+    if (block_dirty_bitmap_load(state->bs, state->bitmap, errp) < 0) {
+        return;
+    }
+
     bdrv_clear_dirty_bitmap(state->bitmap, &state->backup);
 }
 
@@ -2405,6 +2411,10 @@ BlockDirtyBitmapSha256 *qmp_x_debug_block_dirty_bitmap_sha256(const char *node,
         return NULL;
     }
 
+    if (block_dirty_bitmap_load(bs, bitmap, errp) < 0) {
+        return NULL;
+    }
+
     sha256 = bdrv_dirty_bitmap_sha256(bitmap, errp);
     if (sha256 == NULL) {
         return NULL;
@@ -2784,12 +2794,16 @@ out:
 static BlockJob *do_backup_common(BackupCommon *backup,
                                   BlockDriverState *bs,
                                   BlockDriverState *target_bs,
+                                  BackupFanOutList *fan_out,
                                   AioContext *aio_context,
                                   JobTxn *txn, Error **errp)
 {
     BlockJob *job = NULL;
     BdrvDirtyBitmap *bmap = NULL;
     BackupPerf perf = { .max_workers = 64 };
+    g_autofree BackupFanOutTarget *fan_out_targets = NULL;
+    BackupFanOutList *it;
+    int nb_fan_out = 0;
     int job_flags = JOB_DEFAULT;
 
     if (!backup->has_speed) {
@@ -2861,6 +2875,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (bdrv_dirty_bitmap_check(bmap, BDRV_BITMAP_ALLOW_RO, errp)) {
             return NULL;
         }
+        if (bdrv_dirty_bitmap_load(bmap, errp) < 0) {
+            return NULL;
+        }
 
         /* This does not produce a useful bitmap artifact: */
         if (backup->sync == MIRROR_SYNC_MODE_NONE) {
@@ -2885,6 +2902,20 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         return NULL;
     }
 
+    for (it = fan_out; it; it = it->next) {
+        nb_fan_out++;
+    }
+    fan_out_targets = g_new0(BackupFanOutTarget, nb_fan_out);
+    for (it = fan_out, nb_fan_out = 0; it; it = it->next, nb_fan_out++) {
+        BackupFanOutTarget *t = &fan_out_targets[nb_fan_out];
+
+        t->bs = bdrv_lookup_bs(it->value->target, it->value->target, errp);
+        if (!t->bs) {
+            return NULL;
+        }
+        t->speed = it->value->has_speed ? it->value->speed : 0;
+    }
+
     if (!backup->auto_finalize) {
         job_flags |= JOB_MANUAL_FINALIZE;
     }
@@ -2892,7 +2923,8 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         job_flags |= JOB_MANUAL_DISMISS;
     }
 
-    job = backup_job_create(backup->job_id, bs, target_bs, backup->speed,
+    job = backup_job_create(backup->job_id, bs, target_bs,
+                            fan_out_targets, nb_fan_out, backup->speed,
                             backup->sync, bmap, backup->bitmap_mode,
                             backup->compress,
                             backup->filter_node_name,
@@ -2954,6 +2986,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_unmap, bool unmap,
                                    const char *filter_node_name,
                                    bool has_copy_mode, MirrorCopyMode copy_mode,
+                                   bool has_dedup, bool dedup,
                                    bool has_auto_finalize, bool auto_finalize,
                                    bool has_auto_dismiss, bool auto_dismiss,
                                    Error **errp)
@@ -2985,6 +3018,9 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_copy_mode) {
         copy_mode = MIRROR_COPY_MODE_BACKGROUND;
     }
+    if (!has_dedup) {
+        dedup = false;
+    }
     if (has_auto_finalize && !auto_finalize) {
         job_flags |= JOB_MANUAL_FINALIZE;
     }
@@ -3062,7 +3098,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                  replaces, job_flags,
                  speed, granularity, buf_size, sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
-                 copy_mode, errp);
+                 copy_mode, dedup, errp);
 }
 
 void qmp_drive_mirror(DriveMirror *arg, Error **errp)
@@ -3214,6 +3250,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_unmap, arg->unmap,
                            NULL,
                            arg->has_copy_mode, arg->copy_mode,
+                           arg->has_dedup, arg->dedup,
                            arg->has_auto_finalize, arg->auto_finalize,
                            arg->has_auto_dismiss, arg->auto_dismiss,
                            errp);
@@ -3235,6 +3272,7 @@ void qmp_blockdev_mirror(const char *job_id,
                          BlockdevOnError on_target_error,
                          const char *filter_node_name,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
+                         bool has_dedup, bool dedup,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
                          Error **errp)
@@ -3282,6 +3320,7 @@ void qmp_blockdev_mirror(const char *job_id,
                            has_on_target_error, on_target_error,
                            true, true, filter_node_name,
                            has_copy_mode, copy_mode,
+                           has_dedup, dedup,
                            has_auto_finalize, auto_finalize,
                            has_auto_dismiss, auto_dismiss,
                            errp);
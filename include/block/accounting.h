@@ -25,6 +25,7 @@
 #ifndef BLOCK_ACCOUNTING_H
 #define BLOCK_ACCOUNTING_H
 
+#include "qemu/stats64.h"
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
 #include "qapi/qapi-types-common.h"
@@ -78,6 +79,31 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Always-on latency histograms, in nanoseconds.  As in HdrHistogram, each
+ * power of two is split into 2^BLOCK_LATENCY_SUB_BITS linear sub-buckets,
+ * so every latency is recorded with a relative error below 1/8 while a
+ * whole histogram is only a few hundred counters.  Latencies of
+ * 2^BLOCK_LATENCY_MAX_BITS ns (about 68 seconds) or more all go into the
+ * last bucket.
+ *
+ * Recording a latency is a single Stat64 increment.  BlockBackends reuse
+ * the timestamps of their BlockAcctCookies; block nodes read the clock
+ * at the start and at the end of each read, write, discard and flush.
+ */
+#define BLOCK_LATENCY_SUB_BITS 3
+#define BLOCK_LATENCY_MAX_BITS 36
+#define BLOCK_LATENCY_BUCKETS \
+    ((BLOCK_LATENCY_MAX_BITS - BLOCK_LATENCY_SUB_BITS + 1) << \
+     BLOCK_LATENCY_SUB_BITS)
+
+/* Buckets of block_latency_log2(), bucket i is < 2^i ns */
+#define BLOCK_LATENCY_LOG2_BUCKETS (BLOCK_LATENCY_MAX_BITS + 1)
+
+typedef struct BlockLatencyStats {
+    Stat64 bins[BLOCK_MAX_IOTYPE][BLOCK_LATENCY_BUCKETS];
+} BlockLatencyStats;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -91,6 +117,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    BlockLatencyStats latency; /* lock-free, of successful requests */
 };
 
 typedef struct BlockAcctCookie {
@@ -120,4 +147,15 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
+int64_t block_latency_now(void);
+void block_latency_account(BlockLatencyStats *lat, enum BlockAcctType type,
+                           int64_t start_ns);
+void block_latency_account_ns(BlockLatencyStats *lat, enum BlockAcctType type,
+                              uint64_t latency_ns);
+uint64_t block_latency_count(BlockLatencyStats *lat, enum BlockAcctType type);
+uint64_t block_latency_percentile(BlockLatencyStats *lat,
+                                  enum BlockAcctType type, double percentile);
+void block_latency_log2(BlockLatencyStats *lat, enum BlockAcctType type,
+                        uint64_t *buckets);
+
 #endif
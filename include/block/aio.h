@@ -20,6 +20,7 @@
 #include "qemu/coroutine-core.h"
 #include "qemu/queue.h"
 #include "qemu/event_notifier.h"
+#include "qemu/stats64.h"
 #include "qemu/thread.h"
 #include "qemu/timer.h"
 #include "block/graph-lock.h"
@@ -123,6 +124,28 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+/* Number of buckets of the log2 histograms in AioPollStats */
+#define AIO_POLL_HIST_BUCKETS 32
+
+/*
+ * Statistics of the adaptive polling controller.  Updated by the event loop
+ * thread, may be read from any thread.
+ */
+typedef struct AioPollStats {
+    Stat64 hits;        /* events of polled handlers found by polling */
+    Stat64 misses;      /* events of polled handlers found by ->wait() */
+    Stat64 grow;        /* number of per-handler polling time increases */
+    Stat64 shrink;      /* number of per-handler polling time decreases */
+    Stat64 max_ns;      /* longest per-handler polling time */
+    Stat64 active;      /* number of handlers with a non-zero polling time */
+
+    /* Event inter-arrival times of polled handlers, bucket i is < 2^i ns */
+    Stat64 interval_hist[AIO_POLL_HIST_BUCKETS];
+
+    /* Polling times picked by the controller, bucket i is < 2^i ns */
+    Stat64 poll_ns_hist[AIO_POLL_HIST_BUCKETS];
+} AioPollStats;
+
 struct AioContext {
     GSource source;
 
@@ -217,7 +240,14 @@ struct AioContext {
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
+    unsigned int fdmon_io_uring_features;
     AioHandlerSList submit_list;
+
+    /* Events of external handlers held back while external clients are off */
+    AioHandlerSList deferred_list;
+
+    /* Number of aio_uring_enqueue() requests that have not completed yet */
+    unsigned int fdmon_io_uring_requests;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -230,14 +260,20 @@ struct AioContext {
     /* Number of AioHandlers without .io_poll() */
     int poll_disable_cnt;
 
-    /* Polling mode parameters */
+    /*
+     * Polling mode parameters.  Each AioHandler has its own polling time
+     * that is adjusted based on its event inter-arrival times, poll_ns is
+     * the longest of them.
+     */
     int64_t poll_ns;        /* current polling time in nanoseconds */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
+    AioPollStats poll_stats;
 
     /* AIO engine parameters */
     int64_t aio_max_batch;  /* maximum number of requests in a batch */
+    int64_t io_uring_sqpoll_idle; /* SQPOLL idle time in ms, 0 = no SQPOLL */
 
     /*
      * List of handlers participating in userspace polling.  Protected by
@@ -530,6 +566,78 @@ struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct AioUringRequest AioUringRequest;
+
+/*
+ * Completion callback for a request submitted with aio_uring_enqueue().  It
+ * is called by the fd monitoring code in the middle of aio_poll(), so it must
+ * not enter coroutines or run nested event loops; schedule a BH instead.
+ */
+typedef void AioUringCompletionFunc(AioUringRequest *req, int res);
+
+struct AioUringRequest {
+    AioUringCompletionFunc *cb;
+};
+
+/**
+ * aio_uring_get_ring:
+ * @ctx: the aio context
+ * @features: if non-NULL, set to the IORING_FEAT_* flags of the ring
+ *
+ * Returns: the io_uring instance that @ctx monitors file descriptors with, or
+ * NULL if @ctx does not use io_uring for that (e.g. because it is driven by
+ * the glib main loop).  The ring can go away when @ctx switches to glib; see
+ * aio_uring_enqueue().
+ */
+struct io_uring *aio_uring_get_ring(AioContext *ctx, unsigned int *features);
+
+/**
+ * aio_uring_enqueue:
+ * @ctx: the aio context
+ * @sqe: the prepared request; its user_data is ignored
+ * @req: completion callback
+ *
+ * Queue @sqe on the io_uring returned by aio_uring_get_ring().  It is
+ * submitted together with the fd monitoring requests by the next aio_poll()
+ * iteration, and @req->cb is called with the result from within aio_poll().
+ *
+ * If @ctx stops using io_uring for fd monitoring, all requests queued with
+ * this function complete before the ring is destroyed.
+ *
+ * Must be called from @ctx's home thread.
+ */
+void aio_uring_enqueue(AioContext *ctx, const struct io_uring_sqe *sqe,
+                       AioUringRequest *req);
+
+/**
+ * aio_uring_submit:
+ * @ctx: the aio context
+ *
+ * Submit the requests queued with aio_uring_enqueue() right away instead of
+ * in the next aio_poll() iteration, so that they can be busy polled for with
+ * aio_uring_poll().  Does not block.
+ *
+ * Must be called from @ctx's home thread.
+ */
+void aio_uring_submit(AioContext *ctx);
+
+/**
+ * aio_uring_poll:
+ * @ctx: the aio context
+ *
+ * Reap the completion queue of the ring returned by aio_uring_get_ring()
+ * without waiting, for use in an ->io_poll() callback.  Completion callbacks
+ * of aio_uring_enqueue() requests are called; fd monitoring events are held
+ * back until the next aio_poll() iteration dispatches them.
+ *
+ * Must be called from @ctx's home thread.
+ *
+ * Returns: true if a request from aio_uring_enqueue() completed.
+ */
+bool aio_uring_poll(AioContext *ctx);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -768,6 +876,37 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_poll_next_ns:
+ * @poll_ns: current polling time of an AioHandler, in nanoseconds
+ * @interval: time it took for the handler's latest event to arrive
+ * @max_ns: the AioContext's poll-max-ns
+ * @grow: the AioContext's poll-grow, 0 for the default of 2
+ * @shrink: the AioContext's poll-shrink, 0 to stop polling at once
+ *
+ * The decision of the adaptive polling controller for one handler.
+ * Polling is only worth it if it would have caught the latest event: the
+ * polling time grows towards @interval as long as that stays within
+ * @max_ns, and shrinks otherwise.
+ *
+ * Returns: the handler's next polling time
+ */
+int64_t aio_poll_next_ns(int64_t poll_ns, int64_t interval, int64_t max_ns,
+                         int64_t grow, int64_t shrink);
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ *
+ * Return the statistics of the adaptive polling controller.  May be called
+ * from any thread; the individual values are read atomically, but not as a
+ * consistent snapshot.
+ */
+static inline const AioPollStats *aio_context_get_poll_stats(AioContext *ctx)
+{
+    return &ctx->poll_stats;
+}
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
@@ -777,6 +916,18 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp);
 
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll_idle: idle time in milliseconds after which the kernel
+ *               submission polling thread of the io_uring instance used by
+ *               block drivers goes to sleep, 0 means no polling thread
+ *
+ * Only applies to an io_uring instance that is created afterwards.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t sqpoll_idle,
+                                     Error **errp);
+
 /**
  * aio_context_set_thread_pool_params:
  * @ctx: the aio context
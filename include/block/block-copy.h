@@ -24,7 +24,14 @@ typedef void (*BlockCopyAsyncCallbackFunc)(void *opaque);
 typedef struct BlockCopyState BlockCopyState;
 typedef struct BlockCopyCallState BlockCopyCallState;
 
+/*
+ * @fan_out is an array of @nb_fan_out further targets that receive the same
+ * data as @target.  Each area is read from @source only once, and the same
+ * buffer is then written to all targets concurrently.  All targets must have
+ * the same length and AioContext as @source.
+ */
 BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
+                                     BdrvChild **fan_out, int nb_fan_out,
                                      const BdrvDirtyBitmap *bitmap,
                                      Error **errp);
 
@@ -80,6 +87,12 @@ bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
+/*
+ * Limit the write rate to fan-out target @idx, 0 means unlimited.  A copy
+ * request completes only when all targets have been written, so a slow
+ * target throttles the whole copy once the in-flight requests are used up.
+ */
+void block_copy_set_fan_out_speed(BlockCopyState *s, int idx, uint64_t speed);
 void block_copy_kick(BlockCopyCallState *call_state);
 
 /*
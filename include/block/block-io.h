@@ -291,6 +291,29 @@ bdrv_co_copy_range(BdrvChild *src, int64_t src_offset,
                    int64_t bytes, BdrvRequestFlags read_flags,
                    BdrvRequestFlags write_flags);
 
+/**
+ * bdrv_co_sendfile:
+ *
+ * Send the data at [@offset, @offset + @bytes) of @child to the socket or
+ * pipe @out_fd without copying it through a user space buffer.  Only
+ * protocol drivers that can hand the data to the kernel (and format drivers
+ * that map guest offsets onto them 1:1) implement this; like
+ * bdrv_co_copy_range(), there is no bounce buffer fallback.
+ *
+ * @out_fd must be non-blocking.  Fewer than @bytes may be sent if @out_fd
+ * fills up, so the caller must wait until it is writable again and retry
+ * with the remainder.
+ *
+ * Returns: the number of bytes sent (> 0); -EAGAIN if @out_fd was full
+ * before anything could be sent; -ENOTSUP if zero copy is not possible for
+ * this request, in which case the caller should read the remainder
+ * normally; or another negative error code.
+ **/
+int coroutine_fn GRAPH_RDLOCK
+bdrv_co_sendfile(BdrvChild *child, int64_t offset, int64_t bytes, int out_fd);
+
+bool coroutine_fn GRAPH_RDLOCK bdrv_co_can_sendfile(BlockDriverState *bs);
+
 /*
  * "I/O or GS" API functions. These functions can run without
  * the BQL, but only in one specific iothread/main loop.
@@ -24,6 +24,7 @@
 #ifndef BLOCK_INT_COMMON_H
 #define BLOCK_INT_COMMON_H
 
+#include "block/accounting.h"
 #include "block/aio.h"
 #include "block/block-common.h"
 #include "block/block-global-state.h"
@@ -88,6 +89,8 @@ typedef struct BdrvTrackedRequest {
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
+
+    int64_t start_ns; /* for bs->latency */
 } BdrvTrackedRequest;
 
 
@@ -577,6 +580,16 @@ struct BlockDriver {
         BdrvChild *dst, int64_t dst_offset, int64_t bytes,
         BdrvRequestFlags read_flags, BdrvRequestFlags write_flags);
 
+    /*
+     * Map [offset, offset + bytes) onto a child of @bs and invoke
+     * bdrv_co_sendfile() on it, or, if @bs is the leaf, let the kernel send
+     * the data to @out_fd directly.
+     *
+     * See the comment of bdrv_co_sendfile for the return value semantics.
+     */
+    int coroutine_fn GRAPH_RDLOCK_PTR (*bdrv_co_sendfile)(
+        BlockDriverState *bs, int64_t offset, int64_t bytes, int out_fd);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -1223,6 +1236,9 @@ struct BlockDriverState {
     CoMutex bsc_modify_lock;
     /* Always non-NULL, but must only be dereferenced under an RCU read guard */
     BdrvBlockStatusCache *block_status_cache;
+
+    /* Latency of the requests to this node, including those of its children */
+    BlockLatencyStats latency;
 };
 
 struct BlockBackendRootState {
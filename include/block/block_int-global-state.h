@@ -141,6 +141,8 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @dedup: Whether to compare dirty areas with the target and only write
+ * the chunks that differ.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -157,7 +159,16 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, bool dedup, Error **errp);
+
+/*
+ * An additional backup target: @bs gets the same data as the main target,
+ * written at no more than @speed bytes per second (0 means unlimited).
+ */
+typedef struct BackupFanOutTarget {
+    BlockDriverState *bs;
+    uint64_t speed;
+} BackupFanOutTarget;
 
 /*
  * backup_job_create:
@@ -165,6 +176,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * device name of @bs.
  * @bs: Block device to operate on.
  * @target: Block device to write to.
+ * @fan_out: Array of @nb_fan_out further block devices to write to.  Data
+ * is read from @bs once and written to all targets.
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @sync_mode: What parts of the disk image should be copied to the destination.
  * @sync_bitmap: The dirty bitmap if sync_mode is 'bitmap' or 'incremental'
@@ -183,8 +196,9 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * until the job is cancelled or manually completed.
  */
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
-                            BlockDriverState *target, int64_t speed,
-                            MirrorSyncMode sync_mode,
+                            BlockDriverState *target,
+                            const BackupFanOutTarget *fan_out, int nb_fan_out,
+                            int64_t speed, MirrorSyncMode sync_mode,
                             BdrvDirtyBitmap *sync_bitmap,
                             BitmapSyncMode bitmap_mode,
                             bool compress,
@@ -265,6 +279,8 @@ BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *node,
                                            const char *name,
                                            BlockDriverState **pbs,
                                            Error **errp);
+int block_dirty_bitmap_load(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                            Error **errp);
 BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
                                           BlockDirtyBitmapOrStrList *bms,
                                           HBitmap **backup, Error **errp);
@@ -17,6 +17,14 @@ typedef enum BitmapCheckFlags {
 
 #define BDRV_BITMAP_MAX_NAME_SIZE 1023
 
+/*
+ * Reads the contents of a persistent bitmap from the image into @target,
+ * a private bitmap with the same size and granularity, using the
+ * bdrv_dirty_bitmap_deserialize_*() functions.
+ */
+typedef int BdrvDirtyBitmapLoadFunc(BdrvDirtyBitmap *target, void *opaque,
+                                    Error **errp);
+
 bool bdrv_supports_persistent_dirty_bitmap(BlockDriverState *bs);
 BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
                                           uint32_t granularity,
@@ -35,6 +43,11 @@ int bdrv_dirty_bitmap_check(const BdrvDirtyBitmap *bitmap, uint32_t flags,
                             Error **errp);
 void bdrv_release_dirty_bitmap(BdrvDirtyBitmap *bitmap);
 void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs);
+void bdrv_dirty_bitmap_set_loader(BdrvDirtyBitmap *bitmap,
+                                  BdrvDirtyBitmapLoadFunc *load,
+                                  void *opaque, GDestroyNotify free_opaque);
+bool bdrv_dirty_bitmap_needs_load(const BdrvDirtyBitmap *bitmap);
+int bdrv_dirty_bitmap_load(BdrvDirtyBitmap *bitmap, Error **errp);
 
 int coroutine_fn GRAPH_RDLOCK
 bdrv_co_remove_persistent_dirty_bitmap(BlockDriverState *bs, const char *name,
@@ -17,6 +17,7 @@
 #define QEMU_RAW_AIO_H
 
 #include "block/aio.h"
+#include "block/block-common.h"
 #include "qemu/iov.h"
 
 /* AIO request types */
@@ -28,6 +29,7 @@
 #define QEMU_AIO_WRITE_ZEROES 0x0020
 #define QEMU_AIO_COPY_RANGE   0x0040
 #define QEMU_AIO_TRUNCATE     0x0080
+#define QEMU_AIO_SENDFILE     0x0100
 #define QEMU_AIO_TYPE_MASK \
         (QEMU_AIO_READ | \
          QEMU_AIO_WRITE | \
@@ -36,7 +38,8 @@
          QEMU_AIO_DISCARD | \
          QEMU_AIO_WRITE_ZEROES | \
          QEMU_AIO_COPY_RANGE | \
-         QEMU_AIO_TRUNCATE)
+         QEMU_AIO_TRUNCATE | \
+         QEMU_AIO_SENDFILE)
 
 /* AIO flags */
 #define QEMU_AIO_MISALIGNED   0x1000
@@ -67,12 +70,24 @@ void laio_io_unplug(uint64_t dev_max_batch);
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
 typedef struct LuringState LuringState;
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(AioContext *ctx, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type);
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext.
+ *
+ * @fd_index is the index of @fd in the registered file table of that
+ * AioContext's io_uring instance as returned by luring_register_file(), or -1.
+ * BDRV_REQ_REGISTERED_BUF in @flags allows the use of fixed buffers for memory
+ * registered with luring_register_buf().
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fd_index,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, BdrvRequestFlags flags);
+int luring_register_file(LuringState *s, int fd, Error **errp);
+void luring_unregister_file(LuringState *s, int fd_index);
+bool luring_register_buf(void *host, size_t size, Error **errp);
+void luring_unregister_buf(void *host, size_t size);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 
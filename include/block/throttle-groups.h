@@ -57,8 +57,22 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* Share of the group's bandwidth that this member gets while the
+     * group is saturated, if the group is in weighted mode.  Set before
+     * registering; 0 means THROTTLE_GROUP_WEIGHT_DEFAULT.  */
+    unsigned int   weight;
+    /* Virtual finish time of the member's requests in weighted mode */
+    uint64_t       vtime[2];
+    /* Service in units of @vtime that the member got without taking the
+     * lock, and how much of it has been added to @vtime so far */
+    Stat64         fast_service[2];
+    uint64_t       fast_service_charged[2];
+
 } ThrottleGroupMember;
 
+#define THROTTLE_GROUP_WEIGHT_DEFAULT 100
+#define THROTTLE_GROUP_WEIGHT_MAX     10000
+
 #define TYPE_THROTTLE_GROUP "throttle-group"
 OBJECT_DECLARE_SIMPLE_TYPE(ThrottleGroup, THROTTLE_GROUP)
 
@@ -74,6 +88,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 const char *groupname,
                                 AioContext *ctx);
 void throttle_group_unregister_tgm(ThrottleGroupMember *tgm);
+void throttle_group_set_weight(ThrottleGroupMember *tgm, unsigned int weight);
 void throttle_group_restart_tgm(ThrottleGroupMember *tgm);
 
 void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm,
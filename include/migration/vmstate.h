@@ -196,6 +196,15 @@ struct VMStateDescription {
      * a QEMU_VM_SECTION_START section.
      */
     bool early_setup;
+    /*
+     * Set when saving and loading this state only touches the device's
+     * own state, including in the pre/post callbacks, and does not need
+     * the BQL.  With the parallel-device-state capability such devices
+     * are saved and loaded on worker threads, concurrently with the other
+     * devices of the same priority, and are sent after the devices of that
+     * priority that are not parallel_safe.
+     */
+    bool parallel_safe;
     int version_id;
     int minimum_version_id;
     MigrationPriority priority;
@@ -350,4 +350,13 @@ bool hbitmap_status(const HBitmap *hb, int64_t start, int64_t count,
  */
 int64_t hbitmap_iter_next(HBitmapIter *hbi);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch the HBitmap word scanning functions to the next, less preferred
+ * implementation supported by the host.  Returns false once the generic
+ * C implementation is in use.  Only meant for the unit tests.
+ */
+bool test_hbitmap_next_accel(void);
+
 #endif
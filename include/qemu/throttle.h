@@ -26,6 +26,7 @@
 #define THROTTLE_H
 
 #include "qapi/qapi-types-block-core.h"
+#include "qemu/stats64.h"
 #include "qemu/timer.h"
 
 #define THROTTLE_VALUE_MAX 1000000000000000LL
@@ -99,6 +100,36 @@ typedef struct ThrottleState {
     int64_t previous_leak;    /* timestamp of the last leak done */
 } ThrottleState;
 
+/*
+ * ThrottleTokens holds the state of the leaky buckets described by a
+ * ThrottleConfig in a form that several threads can update at once
+ * without a lock.  Instead of the level of each bucket it stores the
+ * time at which the bucket will be empty again, in ticks of
+ * 1 / THROTTLE_TICKS_PER_NS nanoseconds:
+ *
+ * - The level at time @now is (empty_at - now) * rate, so the bucket
+ *   is full once empty_at - now exceeds the time the bucket needs to
+ *   leak its whole size (the "tolerance").
+ *
+ * - Doing I/O of n units moves empty_at to MAX(empty_at, now) + n / rate.
+ *   That is an atomic max followed by an atomic add, so concurrent
+ *   updates are never lost.
+ *
+ * Index [1] is the burst bucket, which is only used if burst_length > 1.
+ * The buckets are full or empty at exactly the same times as the ones
+ * in ThrottleState; the levels in the ThrottleConfig are not used.
+ */
+#define THROTTLE_TICKS_PER_NS 16
+
+typedef struct ThrottleTokens {
+    Stat64 empty_at[BUCKETS_COUNT][2];
+} ThrottleTokens;
+
+/* The time that one I/O request adds to each of the buckets, in ticks */
+typedef struct ThrottleCost {
+    uint64_t ticks[BUCKETS_COUNT][2];
+} ThrottleCost;
+
 typedef struct ThrottleTimers {
     QEMUTimer *timers[2];     /* timers used to do the throttling */
     QEMUClockType clock_type; /* the clock used */
@@ -152,6 +183,22 @@ bool throttle_schedule_timer(ThrottleState *ts,
                              bool is_write);
 
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size);
+
+/* lock-free accounting */
+void throttle_tokens_init(ThrottleTokens *tok);
+
+uint64_t throttle_tokens_tolerance(const LeakyBucket *bkt, bool burst);
+
+void throttle_tokens_cost(const ThrottleConfig *cfg, bool is_write,
+                          uint64_t size, ThrottleCost *cost);
+
+int64_t throttle_tokens_compute_wait(ThrottleTokens *tok,
+                                     const ThrottleConfig *cfg,
+                                     bool is_write, int64_t now);
+
+void throttle_tokens_account(ThrottleTokens *tok, const ThrottleCost *cost,
+                             int64_t now);
+
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
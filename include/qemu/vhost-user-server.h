@@ -18,12 +18,25 @@
 #include "qapi/error.h"
 #include "standard-headers/linux/virtio_blk.h"
 
+/*
+ * An AioContext other than VuServer->ctx that processes some of the
+ * virtqueues.  @lock serializes virtqueue accesses in @ctx with the
+ * handling of vhost-user messages, which may change the virtqueues or the
+ * guest memory map.
+ */
+typedef struct VuQueueThread {
+    AioContext *ctx;
+    QemuMutex lock;
+} VuQueueThread;
+
 /* A kick fd that we monitor on behalf of libvhost-user */
 typedef struct VuFdWatch {
     VuDev *vu_dev;
     int fd; /*kick fd*/
     void *pvt;
     vu_watch_cb cb;
+    VuQueueThread *thread; /* NULL if the fd is monitored in VuServer->ctx */
+    bool stopped; /* protected by thread->lock */
     QTAILQ_ENTRY(VuFdWatch) next;
 } VuFdWatch;
 
@@ -31,7 +44,9 @@ typedef struct VuFdWatch {
  * VuServer:
  * A vhost-user server instance with user-defined VuDevIface callbacks.
  * Vhost-user device backends can be implemented using VuServer. VuDevIface
- * callbacks and virtqueue kicks run in the given AioContext.
+ * callbacks and virtqueue kicks run in the given AioContext, unless queue
+ * AioContexts are given, in which case virtqueue i is kicked in queue
+ * AioContext i % nr_queue_ctxs.
  */
 typedef struct {
     QIONetListener *listener;
@@ -40,9 +55,15 @@ typedef struct {
     int max_queues;
     const VuDevIface *vu_iface;
 
+    VuQueueThread *queue_threads;
+    unsigned int nr_queue_threads;
+    bool queue_threads_locked; /* by vu_client_trip() */
+    bool queues_paused; /* protected by all queue thread locks */
+
+    unsigned int refcount; /* atomic */
+    bool wait_idle; /* atomic */
+
     /* Protected by ctx lock */
-    unsigned int refcount;
-    bool wait_idle;
     VuDev vu_dev;
     QIOChannel *ioc; /* The I/O channel with the client */
     QIOChannelSocket *sioc; /* The underlying data channel with the client */
@@ -55,6 +76,8 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *unix_socket,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctxs,
+                             unsigned int nr_queue_ctxs,
                              const VuDevIface *vu_iface,
                              Error **errp);
 
@@ -63,6 +86,12 @@ void vhost_user_server_stop(VuServer *server);
 void vhost_user_server_ref(VuServer *server);
 void vhost_user_server_unref(VuServer *server);
 
+void vhost_user_server_queue_lock(VuServer *server, int vq_idx);
+void vhost_user_server_queue_unlock(VuServer *server, int vq_idx);
+
+void vhost_user_server_pause_queues(VuServer *server);
+void vhost_user_server_resume_queues(VuServer *server);
+
 void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx);
 void vhost_user_server_detach_aio_context(VuServer *server);
 
@@ -32,12 +32,16 @@ struct IOThread {
     QemuSemaphore init_done_sem; /* is thread init done? */
     bool stopping;              /* has iothread_stop() been called? */
     bool running;               /* should iothread_run() continue? */
+    bool aio_source_attached;   /* is ctx's GSource in worker_context? */
     int thread_id;
 
     /* AioContext poll parameters */
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* AioContext io_uring parameters */
+    int64_t io_uring_sqpoll_idle;
 };
 typedef struct IOThread IOThread;
 
@@ -36,6 +36,28 @@
 #define IOTHREAD_POLL_MAX_NS_DEFAULT 0ULL
 #endif
 
+/*
+ * Runs in iothread_run() thread.
+ *
+ * The AioContext's GSource is only attached to the GMainContext once somebody
+ * actually wants to run the GMainContext, because this makes the AioContext
+ * stop using io_uring for fd monitoring.  That must happen in this thread,
+ * between two aio_poll() calls.
+ */
+static void iothread_attach_aio_source(IOThread *iothread)
+{
+    GSource *source;
+
+    if (iothread->aio_source_attached) {
+        return;
+    }
+
+    source = aio_get_g_source(iothread->ctx);
+    g_source_attach(source, iothread->worker_context);
+    g_source_unref(source);
+    iothread->aio_source_attached = true;
+}
+
 static void *iothread_run(void *opaque)
 {
     IOThread *iothread = opaque;
@@ -67,6 +89,7 @@ static void *iothread_run(void *opaque)
          * changed in previous aio_poll()
          */
         if (iothread->running && qatomic_read(&iothread->run_gcontext)) {
+            iothread_attach_aio_source(iothread);
             g_main_loop_run(iothread->main_loop);
         }
     }
@@ -140,12 +163,7 @@ static void iothread_instance_finalize(Object *obj)
 
 static void iothread_init_gcontext(IOThread *iothread)
 {
-    GSource *source;
-
     iothread->worker_context = g_main_context_new();
-    source = aio_get_g_source(iothread_get_aio_context(iothread));
-    g_source_attach(source, iothread->worker_context);
-    g_source_unref(source);
     iothread->main_loop = g_main_loop_new(iothread->worker_context, TRUE);
 }
 
@@ -170,6 +188,16 @@ static void iothread_set_aio_context_params(EventLoopBase *base, Error **errp)
     aio_context_set_aio_params(iothread->ctx,
                                iothread->parent_obj.aio_max_batch,
                                errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_io_uring_params(iothread->ctx,
+                                    iothread->io_uring_sqpoll_idle,
+                                    errp);
+    if (*errp) {
+        return;
+    }
 
     aio_context_set_thread_pool_params(iothread->ctx, base->thread_pool_min,
                                        base->thread_pool_max, errp);
@@ -232,6 +260,9 @@ static IOThreadParamInfo poll_grow_info = {
 static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo io_uring_sqpoll_idle_info = {
+    "io-uring-sqpoll-idle", offsetof(IOThread, io_uring_sqpoll_idle),
+};
 
 static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, IOThreadParamInfo *info, Error **errp)
@@ -291,6 +322,23 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_set_io_uring_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+
+    if (!iothread_set_param(obj, v, name, info, errp)) {
+        return;
+    }
+
+    if (iothread->ctx) {
+        aio_context_set_io_uring_params(iothread->ctx,
+                                        iothread->io_uring_sqpoll_idle,
+                                        errp);
+    }
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -310,6 +358,10 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "io-uring-sqpoll-idle", "int",
+                              iothread_get_poll_param,
+                              iothread_set_io_uring_param,
+                              NULL, &io_uring_sqpoll_idle_info);
 }
 
 static const TypeInfo iothread_info = {
@@ -566,6 +566,11 @@ static int add_bitmaps_to_list(DBMSaveState *s, BlockDriverState *bs,
             bitmap_alias = bitmap_name;
         }
 
+        if (block_dirty_bitmap_load(bs, bitmap, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+
         bdrv_ref(bs);
         bdrv_dirty_bitmap_set_busy(bitmap, true);
 
@@ -127,6 +127,13 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "postcopy request count: %" PRIu64 "\n",
                            info->ram->postcopy_requests);
         }
+        if (info->ram->postcopy_prefetch_pages) {
+            monitor_printf(mon, "postcopy prefetch: %" PRIu64 " pages, %"
+                           PRIu64 " hits, hit rate %0.2f\n",
+                           info->ram->postcopy_prefetch_pages,
+                           info->ram->postcopy_prefetch_hits,
+                           info->ram->postcopy_prefetch_hit_rate);
+        }
         if (info->ram->precopy_bytes) {
             monitor_printf(mon, "precopy ram: %" PRIu64 " kbytes\n",
                            info->ram->precopy_bytes >> 10);
@@ -335,6 +342,9 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_MAX_POSTCOPY_BANDWIDTH),
             params->max_postcopy_bandwidth);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
         monitor_printf(mon, "%s: '%s'\n",
             MigrationParameter_str(MIGRATION_PARAMETER_TLS_AUTHZ),
             params->tls_authz);
@@ -600,6 +610,10 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_max_postcopy_bandwidth = true;
         visit_type_size(v, param, &p->max_postcopy_bandwidth, &err);
         break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_uint32(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
     case MIGRATION_PARAMETER_ANNOUNCE_INITIAL:
         p->has_announce_initial = true;
         visit_type_size(v, param, &p->announce_initial, &err);
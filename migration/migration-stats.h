@@ -65,6 +65,19 @@ typedef struct {
      * postcopy stage.
      */
     Stat64 postcopy_requests;
+    /*
+     * Number of host pages pushed by the postcopy prefetcher.
+     */
+    Stat64 postcopy_prefetch_pages;
+    /*
+     * Number of postcopy page requests for host pages that the
+     * previous prefetch had pushed.
+     */
+    Stat64 postcopy_prefetch_hits;
+    /*
+     * Number of postcopy page requests that came after a prefetch.
+     */
+    Stat64 postcopy_prefetch_samples;
     /*
      * Number of bytes sent during precopy stage.
      */
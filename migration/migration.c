@@ -946,6 +946,15 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
+    info->ram->postcopy_prefetch_pages =
+        stat64_get(&mig_stats.postcopy_prefetch_pages);
+    info->ram->postcopy_prefetch_hits =
+        stat64_get(&mig_stats.postcopy_prefetch_hits);
+    if (stat64_get(&mig_stats.postcopy_prefetch_samples)) {
+        info->ram->postcopy_prefetch_hit_rate =
+            (double)stat64_get(&mig_stats.postcopy_prefetch_hits) /
+            stat64_get(&mig_stats.postcopy_prefetch_samples);
+    }
     info->ram->page_size = page_size;
     info->ram->multifd_bytes = stat64_get(&mig_stats.multifd_bytes);
     info->ram->pages_per_second = s->pages_per_second;
@@ -953,7 +962,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->downtime_bytes = stat64_get(&mig_stats.downtime_bytes);
     info->ram->postcopy_bytes = stat64_get(&mig_stats.postcopy_bytes);
 
-    if (migrate_xbzrle()) {
+    if (migrate_xbzrle() ||
+        (migrate_multifd() &&
+         migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE)) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
         info->xbzrle_cache->bytes = xbzrle_counters.bytes;
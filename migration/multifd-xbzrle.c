@@ -0,0 +1,420 @@
+/*
+ * Multifd XBZRLE compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/rcu.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "trace.h"
+#include "options.h"
+#include "ram.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+#include "xbzrle-cache.h"
+#include "multifd.h"
+
+/* Encoding of each page inside a packet */
+#define MULTIFD_XBZRLE_PAGE_RAW        0
+#define MULTIFD_XBZRLE_PAGE_DELTA      1
+#define MULTIFD_XBZRLE_PAGE_UNCHANGED  2
+
+/* encoding byte plus 32 bit length of a delta */
+#define MULTIFD_XBZRLE_HDR_SIZE (1 + sizeof(uint32_t))
+
+/*
+ * The source keeps one cache shard per channel.  A page always uses
+ * the shard selected by its address, whatever channel sends it, so
+ * that the cached copy is the one the destination has.  Each page is
+ * sent at most once between two sync points, so two channels only
+ * contend on a shard lock when they happen to hit the same shard.
+ */
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} XBZRLECacheShard;
+
+static struct {
+    XBZRLECacheShard *shards;
+    unsigned int nr_shards;
+    /* number of channels that have a shard set up */
+    unsigned int users;
+    /* protects xbzrle_counters */
+    QemuMutex stats_lock;
+} multifd_xbzrle;
+
+struct xbzrle_data {
+    /* buffer with the encoded pages of a packet */
+    uint8_t *zbuff;
+    /* size of zbuff */
+    uint32_t zbuff_len;
+    /* stable copy of the page being encoded */
+    uint8_t *buf;
+};
+
+static XBZRLECacheShard *xbzrle_shard_for(ram_addr_t addr, uint32_t page_size,
+                                          uint64_t *cache_addr)
+{
+    uint64_t page = addr / page_size;
+    unsigned int nr = multifd_xbzrle.nr_shards;
+
+    /*
+     * Strip the shard index from the address, otherwise the direct
+     * mapped cache of each shard would only use 1/nr of its slots.
+     */
+    *cache_addr = (page / nr) * page_size;
+    return &multifd_xbzrle.shards[page % nr];
+}
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Allocate the encoding buffers and the cache shard owned by this
+ * channel.  Each shard gets an equal part of xbzrle-cache-size.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z;
+    XBZRLECacheShard *shard;
+    uint64_t shard_pages;
+
+    if (!multifd_xbzrle.shards) {
+        multifd_xbzrle.nr_shards = migrate_multifd_channels();
+        multifd_xbzrle.shards = g_new0(XBZRLECacheShard,
+                                       multifd_xbzrle.nr_shards);
+        qemu_mutex_init(&multifd_xbzrle.stats_lock);
+    }
+    assert(p->id < multifd_xbzrle.nr_shards);
+
+    shard_pages = migrate_xbzrle_cache_size() / p->page_size /
+                  multifd_xbzrle.nr_shards;
+    shard_pages = shard_pages ? pow2floor(shard_pages) : 1;
+
+    shard = &multifd_xbzrle.shards[p->id];
+    shard->cache = cache_init(shard_pages * p->page_size, p->page_size, errp);
+    if (!shard->cache) {
+        error_prepend(errp, "multifd %u: ", p->id);
+        return -1;
+    }
+    qemu_mutex_init(&shard->lock);
+    multifd_xbzrle.users++;
+
+    z = g_new0(struct xbzrle_data, 1);
+    z->zbuff_len = p->page_count * (p->page_size + MULTIFD_XBZRLE_HDR_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    z->buf = g_try_malloc(p->page_size);
+    if (!z->zbuff || !z->buf) {
+        g_free(z->zbuff);
+        g_free(z->buf);
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Free the buffers and the cache shard of this channel.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    XBZRLECacheShard *shard;
+
+    if (z) {
+        g_free(z->zbuff);
+        g_free(z->buf);
+        g_free(z);
+        p->data = NULL;
+    }
+
+    if (!multifd_xbzrle.shards) {
+        return;
+    }
+    shard = &multifd_xbzrle.shards[p->id];
+    if (shard->cache) {
+        cache_fini(shard->cache);
+        shard->cache = NULL;
+        qemu_mutex_destroy(&shard->lock);
+        multifd_xbzrle.users--;
+    }
+    if (!multifd_xbzrle.users) {
+        qemu_mutex_destroy(&multifd_xbzrle.stats_lock);
+        g_free(multifd_xbzrle.shards);
+        multifd_xbzrle.shards = NULL;
+        multifd_xbzrle.nr_shards = 0;
+    }
+}
+
+/**
+ * multifd_xbzrle_zero_page: note that a page was sent as a zero page
+ *
+ * Zero pages do not go through the channels, so the cache shard of
+ * the page has to be told that the destination now has zeroes there.
+ *
+ * @addr: ram_addr_t of the page
+ */
+void multifd_xbzrle_zero_page(ram_addr_t addr)
+{
+    uint32_t page_size = qemu_target_page_size();
+    XBZRLECacheShard *shard;
+    uint64_t cache_addr;
+
+    if (!multifd_xbzrle.shards) {
+        return;
+    }
+    shard = xbzrle_shard_for(addr, page_size, &cache_addr);
+    qemu_mutex_lock(&shard->lock);
+    xbzrle_cache_zero(shard->cache, cache_addr, page_size,
+                      stat64_get(&mig_stats.dirty_sync_count));
+    qemu_mutex_unlock(&shard->lock);
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode every page of the packet against its cached copy.  Pages
+ * that miss the cache, or whose delta would not be smaller than the
+ * page, are sent raw.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
+    uint64_t cache_miss = 0, encoded = 0, overflow = 0, bytes = 0;
+    uint32_t out_size = 0;
+    uint32_t i;
+
+    for (i = 0; i < p->normal_num; i++) {
+        ram_addr_t addr = p->pages->block->offset + p->normal[i];
+        uint8_t *host = p->pages->block->host + p->normal[i];
+        uint8_t *out = z->zbuff + out_size;
+        XBZRLECacheShard *shard;
+        XBZRLECacheResult res;
+        uint64_t cache_addr;
+        int encoded_len;
+
+        shard = xbzrle_shard_for(addr, p->page_size, &cache_addr);
+        qemu_mutex_lock(&shard->lock);
+        res = xbzrle_cache_encode(shard->cache, cache_addr, host, z->buf,
+                                  out + MULTIFD_XBZRLE_HDR_SIZE, &encoded_len,
+                                  p->page_size, generation);
+        qemu_mutex_unlock(&shard->lock);
+
+        switch (res) {
+        case XBZRLE_CACHE_MISS:
+            cache_miss++;
+            out[0] = MULTIFD_XBZRLE_PAGE_RAW;
+            memcpy(out + 1, z->buf, p->page_size);
+            out_size += 1 + p->page_size;
+            break;
+        case XBZRLE_CACHE_UNCHANGED:
+            encoded++;
+            out[0] = MULTIFD_XBZRLE_PAGE_UNCHANGED;
+            out_size += 1;
+            break;
+        case XBZRLE_CACHE_OVERFLOW:
+            encoded++;
+            overflow++;
+            bytes += p->page_size;
+            out[0] = MULTIFD_XBZRLE_PAGE_RAW;
+            memcpy(out + 1, z->buf, p->page_size);
+            out_size += 1 + p->page_size;
+            break;
+        case XBZRLE_CACHE_DELTA:
+            encoded++;
+            out[0] = MULTIFD_XBZRLE_PAGE_DELTA;
+            stl_be_p(out + 1, encoded_len);
+            bytes += MULTIFD_XBZRLE_HDR_SIZE + encoded_len;
+            out_size += MULTIFD_XBZRLE_HDR_SIZE + encoded_len;
+            break;
+        }
+    }
+
+    qemu_mutex_lock(&multifd_xbzrle.stats_lock);
+    xbzrle_counters.cache_miss += cache_miss;
+    xbzrle_counters.pages += encoded;
+    xbzrle_counters.overflow += overflow;
+    xbzrle_counters.bytes += bytes;
+    qemu_mutex_unlock(&multifd_xbzrle.stats_lock);
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Allocate the buffer for the encoded pages.  The destination needs
+ * no cache, deltas are applied to the pages already in guest RAM.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = g_new0(struct xbzrle_data, 1);
+
+    z->zbuff_len = p->page_count * (p->page_size + MULTIFD_XBZRLE_HDR_SIZE);
+    z->zbuff = g_try_malloc(z->zbuff_len);
+    if (!z->zbuff) {
+        g_free(z);
+        error_setg(errp, "multifd %u: out of memory for zbuff", p->id);
+        return -1;
+    }
+    p->data = z;
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *z = p->data;
+
+    if (z) {
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+/**
+ * xbzrle_recv_pages: read the data from the channel into actual pages
+ *
+ * Read the encoded buffer, then copy raw pages and apply deltas in
+ * place.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_pages(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: packet size received %u max %u",
+                   p->id, in_size, z->zbuff_len);
+        return -1;
+    }
+
+    p->iov[0].iov_base = z->zbuff;
+    p->iov[0].iov_len = in_size;
+    ret = multifd_recv_readv(p, 1, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *host = p->host + p->normal[i];
+        uint32_t len;
+
+        if (pos >= in_size) {
+            goto truncated;
+        }
+        switch (z->zbuff[pos++]) {
+        case MULTIFD_XBZRLE_PAGE_UNCHANGED:
+            break;
+        case MULTIFD_XBZRLE_PAGE_RAW:
+            if (in_size - pos < p->page_size) {
+                goto truncated;
+            }
+            memcpy(host, z->zbuff + pos, p->page_size);
+            pos += p->page_size;
+            break;
+        case MULTIFD_XBZRLE_PAGE_DELTA:
+            if (in_size - pos < sizeof(uint32_t)) {
+                goto truncated;
+            }
+            len = ldl_be_p(z->zbuff + pos);
+            pos += sizeof(uint32_t);
+            if (len > p->page_size || in_size - pos < len) {
+                goto truncated;
+            }
+            if (xbzrle_decode_buffer(z->zbuff + pos, len, host,
+                                     p->page_size) == -1) {
+                error_setg(errp, "multifd %u: decode error for page %d",
+                           p->id, i);
+                return -1;
+            }
+            pos += len;
+            break;
+        default:
+            error_setg(errp, "multifd %u: unknown encoding 0x%x for page %d",
+                       p->id, z->zbuff[pos - 1], i);
+            return -1;
+        }
+    }
+
+    if (pos != in_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, pos);
+        return -1;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: truncated packet of %u bytes at page %d",
+               p->id, in_size, i);
+    return -1;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv_pages = xbzrle_recv_pages
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
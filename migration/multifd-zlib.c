@@ -256,7 +256,9 @@ static int zlib_recv_pages(MultiFDRecvParams *p, Error **errp)
                    p->id, flags, MULTIFD_FLAG_ZLIB);
         return -1;
     }
-    ret = qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp);
+    p->iov[0].iov_base = z->zbuff;
+    p->iov[0].iov_len = in_size;
+    ret = multifd_recv_readv(p, 1, errp);
 
     if (ret != 0) {
         return ret;
@@ -150,7 +150,7 @@ static int nocomp_recv_pages(MultiFDRecvParams *p, Error **errp)
         p->iov[i].iov_base = p->host + p->normal[i];
         p->iov[i].iov_len = p->page_size;
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return multifd_recv_readv(p, p->normal_num, errp);
 }
 
 static MultiFDMethods multifd_nocomp_ops = {
@@ -172,6 +172,45 @@ void multifd_register_ops(int method, MultiFDMethods *ops)
     multifd_ops[method] = ops;
 }
 
+/**
+ * multifd_recv_readv: read the payload of the current packet
+ *
+ * The payload goes straight into the buffers described by
+ * p->iov[0..iovcnt-1].  Unless the current packet is a sync point,
+ * the sender always follows it with the header of another packet, so
+ * that header is read with the same readv() calls instead of through
+ * a separate small read in multifd_recv_thread().
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @iovcnt: number of entries of p->iov filled by the caller
+ * @errp: pointer to an error
+ */
+int multifd_recv_readv(MultiFDRecvParams *p, unsigned int iovcnt,
+                       Error **errp)
+{
+    size_t size = iov_size(p->iov, iovcnt);
+    int ret;
+
+    assert(iovcnt <= p->page_count);
+    if (p->prefetch_allowed) {
+        p->iov[iovcnt].iov_base = p->packet;
+        p->iov[iovcnt].iov_len = p->packet_len;
+        iovcnt++;
+        size += p->packet_len;
+    }
+
+    ret = qio_channel_readv_all(p->c, p->iov, iovcnt, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    p->packet_prefetched = p->prefetch_allowed;
+    p->total_bytes += size;
+    return 0;
+}
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg = {};
@@ -1101,6 +1140,7 @@ static void *multifd_recv_thread(void *opaque)
 
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
+    p->start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     while (true) {
         uint32_t flags;
@@ -1109,10 +1149,15 @@ static void *multifd_recv_thread(void *opaque)
             break;
         }
 
-        ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
-                                       p->packet_len, &local_err);
-        if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
-            break;
+        if (p->packet_prefetched) {
+            p->packet_prefetched = false;
+        } else {
+            ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
+                                           p->packet_len, &local_err);
+            if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
+                break;
+            }
+            p->total_bytes += p->packet_len;
         }
 
         qemu_mutex_lock(&p->mutex);
@@ -1132,6 +1177,7 @@ static void *multifd_recv_thread(void *opaque)
         qemu_mutex_unlock(&p->mutex);
 
         if (p->normal_num) {
+            p->prefetch_allowed = !(flags & MULTIFD_FLAG_SYNC);
             ret = multifd_recv_state->ops->recv_pages(p, &local_err);
             if (ret != 0) {
                 break;
@@ -1139,6 +1185,8 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         if (flags & MULTIFD_FLAG_SYNC) {
+            trace_multifd_recv_channel_stats(p->id, p->total_bytes,
+                qemu_clock_get_us(QEMU_CLOCK_REALTIME) - p->start_time);
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
         }
@@ -1153,7 +1201,10 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_bytes,
+                                  qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                  p->start_time);
 
     return NULL;
 }
@@ -1190,7 +1241,7 @@ int multifd_load_setup(Error **errp)
                       + sizeof(uint64_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdrecv_%d", i);
-        p->iov = g_new0(struct iovec, page_count);
+        p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
         p->page_count = page_count;
         p->page_size = qemu_target_page_size();
@@ -23,6 +23,7 @@ void multifd_recv_new_channel(QIOChannel *ioc, Error **errp);
 void multifd_recv_sync_main(void);
 int multifd_send_sync_main(QEMUFile *f);
 int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
+void multifd_xbzrle_zero_page(ram_addr_t addr);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -33,6 +34,7 @@ int multifd_queue_page(QEMUFile *f, RAMBlock *block, ram_addr_t offset);
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -175,13 +177,21 @@ typedef struct {
     uint32_t next_packet_size;
     /* packets sent through this channel */
     uint64_t num_packets;
+    /* the header of the next packet can be read with this payload */
+    bool prefetch_allowed;
+    /* the header of the next packet is already in 'packet' */
+    bool packet_prefetched;
+    /* bytes received through this channel */
+    uint64_t total_bytes;
+    /* time when the channel thread started, in microseconds */
+    int64_t start_time;
     /* ramblock */
     RAMBlock *block;
     /* ramblock host address */
     uint8_t *host;
     /* non zero pages recv through this channel */
     uint64_t total_normal_pages;
-    /* buffers to recv */
+    /* buffers to recv, with one spare entry for the next packet header */
     struct iovec *iov;
     /* Pages that are not zero */
     ram_addr_t *normal;
@@ -207,6 +217,8 @@ typedef struct {
 } MultiFDMethods;
 
 void multifd_register_ops(int method, MultiFDMethods *ops);
+int multifd_recv_readv(MultiFDRecvParams *p, unsigned int iovcnt,
+                       Error **errp);
 
 #endif
 
@@ -66,6 +66,8 @@
  * that page requests can still exceed this limit.
  */
 #define DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH 0
+/* Postcopy prefetching is disabled by default */
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
 
 /*
  * Parameters for self_announce_delay giving a stream of RARP/ARP
@@ -144,6 +146,9 @@ Property migration_properties[] = {
     DEFINE_PROP_SIZE("max-postcopy-bandwidth", MigrationState,
                       parameters.max_postcopy_bandwidth,
                       DEFAULT_MIGRATE_MAX_POSTCOPY_BANDWIDTH),
+    DEFINE_PROP_UINT32("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages,
+                      DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
     DEFINE_PROP_UINT8("max-cpu-throttle", MigrationState,
                       parameters.max_cpu_throttle,
                       DEFAULT_MIGRATE_MAX_CPU_THROTTLE),
@@ -258,6 +263,13 @@ bool migrate_multifd(void)
     return s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_parallel_device_state(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PARALLEL_DEVICE_STATE];
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s = migrate_get_current();
@@ -724,6 +736,13 @@ uint64_t migrate_max_postcopy_bandwidth(void)
     return s->parameters.max_postcopy_bandwidth;
 }
 
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
 int migrate_multifd_channels(void)
 {
     MigrationState *s = migrate_get_current();
@@ -872,6 +891,8 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
     params->max_postcopy_bandwidth = s->parameters.max_postcopy_bandwidth;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
     params->has_max_cpu_throttle = true;
     params->max_cpu_throttle = s->parameters.max_cpu_throttle;
     params->has_announce_initial = true;
@@ -917,6 +938,7 @@ void migrate_params_init(MigrationParameters *params)
     params->has_multifd_zstd_level = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
+    params->has_postcopy_prefetch_pages = true;
     params->has_max_cpu_throttle = true;
     params->has_announce_initial = true;
     params->has_announce_max = true;
@@ -1027,6 +1049,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_postcopy_prefetch_pages &&
+        params->postcopy_prefetch_pages > MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "a value between 0 and "
+                   stringify(MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES));
+        return false;
+    }
+
     if (params->has_max_cpu_throttle &&
         (params->max_cpu_throttle < params->cpu_throttle_initial ||
          params->max_cpu_throttle > 99)) {
@@ -1161,6 +1192,9 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_max_postcopy_bandwidth) {
         dest->max_postcopy_bandwidth = params->max_postcopy_bandwidth;
     }
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
     if (params->has_max_cpu_throttle) {
         dest->max_cpu_throttle = params->max_cpu_throttle;
     }
@@ -1276,6 +1310,9 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
                     s->parameters.max_postcopy_bandwidth / XFER_LIMIT_RATIO);
         }
     }
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
     if (params->has_max_cpu_throttle) {
         s->parameters.max_cpu_throttle = params->max_cpu_throttle;
     }
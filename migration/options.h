@@ -24,6 +24,9 @@
 #define BUFFER_DELAY     100
 #define XFER_LIMIT_RATIO (1000 / BUFFER_DELAY)
 
+/* Upper bound of the postcopy-prefetch-pages parameter */
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES 1024
+
 /* migration properties */
 
 extern Property migration_properties[];
@@ -40,6 +43,7 @@ bool migrate_events(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
 bool migrate_multifd(void);
+bool migrate_parallel_device_state(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
 bool migrate_postcopy_preempt(void);
@@ -86,6 +90,7 @@ uint64_t migrate_downtime_limit(void);
 uint8_t migrate_max_cpu_throttle(void);
 uint64_t migrate_max_bandwidth(void);
 uint64_t migrate_max_postcopy_bandwidth(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
 int migrate_multifd_channels(void);
 MultiFDCompression migrate_multifd_compression(void);
 int migrate_multifd_zlib_level(void);
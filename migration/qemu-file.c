@@ -24,8 +24,11 @@
 #include "qemu/osdep.h"
 #include <zlib.h>
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
+#include "io/channel-socket.h"
+#include "io/channel-tls.h"
 #include "migration.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -34,6 +37,47 @@
 #define IO_BUF_SIZE 32768
 #define MAX_IOV_SIZE MIN_CONST(IOV_MAX, 64)
 
+/*
+ * Buffer and batching parameters, chosen from the type of the channel
+ * backing the QEMUFile.
+ *
+ * Plain sockets gather the iovec in a single sendmsg(), so allow more
+ * entries (page header + page payload pairs) per flush.
+ *
+ * TLS channels encrypt and send every iovec entry as a separate record,
+ * so the small page header and the page payload each cost a record and a
+ * send().  For those, async writes up to coalesce_max bytes are copied
+ * into the (larger) linear buffer so that a whole batch of pages goes out
+ * as a few full-sized records.
+ */
+typedef struct QEMUFileIOProfile {
+    const char *type;
+    size_t buf_size;
+    unsigned int iov_max;
+    size_t coalesce_max;
+} QEMUFileIOProfile;
+
+static const QEMUFileIOProfile qemu_file_io_profiles[] = {
+    {
+        .type = TYPE_QIO_CHANNEL_TLS,
+        .buf_size = 256 * KiB,
+        .iov_max = MAX_IOV_SIZE,
+        .coalesce_max = 64 * KiB,
+    }, {
+        .type = TYPE_QIO_CHANNEL_SOCKET,
+        .buf_size = 128 * KiB,
+        .iov_max = MIN_CONST(IOV_MAX, 256),
+        .coalesce_max = 0,
+    },
+};
+
+static const QEMUFileIOProfile qemu_file_io_profile_default = {
+    .type = "default",
+    .buf_size = IO_BUF_SIZE,
+    .iov_max = MAX_IOV_SIZE,
+    .coalesce_max = 0,
+};
+
 struct QEMUFile {
     const QEMUFileHooks *hooks;
     QIOChannel *ioc;
@@ -55,11 +99,15 @@ struct QEMUFile {
 
     int buf_index;
     int buf_size; /* 0 when writing */
-    uint8_t buf[IO_BUF_SIZE];
+    int buf_max; /* allocated size of buf, at least IO_BUF_SIZE */
+    uint8_t *buf;
+    /* Async writes up to this size are copied into buf instead */
+    size_t coalesce_max;
 
-    DECLARE_BITMAP(may_free, MAX_IOV_SIZE);
-    struct iovec iov[MAX_IOV_SIZE];
+    unsigned long *may_free;
+    struct iovec *iov;
     unsigned int iovcnt;
+    unsigned int iov_max;
 
     int last_error;
     Error *last_error_obj;
@@ -123,8 +171,22 @@ bool qemu_file_mode_is_not_valid(const char *mode)
     return false;
 }
 
+static const QEMUFileIOProfile *qemu_file_io_profile(QIOChannel *ioc)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(qemu_file_io_profiles); i++) {
+        if (object_dynamic_cast(OBJECT(ioc), qemu_file_io_profiles[i].type)) {
+            return &qemu_file_io_profiles[i];
+        }
+    }
+
+    return &qemu_file_io_profile_default;
+}
+
 static QEMUFile *qemu_file_new_impl(QIOChannel *ioc, bool is_writable)
 {
+    const QEMUFileIOProfile *profile = qemu_file_io_profile(ioc);
     QEMUFile *f;
 
     f = g_new0(QEMUFile, 1);
@@ -133,6 +195,16 @@ static QEMUFile *qemu_file_new_impl(QIOChannel *ioc, bool is_writable)
     f->ioc = ioc;
     f->is_writable = is_writable;
 
+    f->buf_max = profile->buf_size;
+    f->buf = g_malloc(f->buf_max);
+    f->coalesce_max = is_writable ? profile->coalesce_max : 0;
+    f->iov_max = profile->iov_max;
+    f->iov = g_new(struct iovec, f->iov_max);
+    f->may_free = bitmap_new(f->iov_max);
+
+    trace_qemu_file_new(profile->type, is_writable, f->buf_max, f->iov_max,
+                        f->coalesce_max);
+
     return f;
 }
 
@@ -274,7 +346,7 @@ static void qemu_iovec_release_ram(QEMUFile *f)
             error_report("migrate: madvise DONTNEED failed %p %zd: %s",
                          iov.iov_base, iov.iov_len, strerror(errno));
     }
-    memset(f->may_free, 0, sizeof(f->may_free));
+    bitmap_zero(f->may_free, f->iov_max);
 }
 
 
@@ -400,7 +472,7 @@ static ssize_t coroutine_mixed_fn qemu_fill_buffer(QEMUFile *f)
     do {
         len = qio_channel_read(f->ioc,
                                (char *)f->buf + pending,
-                               IO_BUF_SIZE - pending,
+                               f->buf_max - pending,
                                &local_error);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
             if (qemu_in_coroutine()) {
@@ -457,6 +529,9 @@ int qemu_fclose(QEMUFile *f)
         ret = f->last_error;
     }
     error_free(f->last_error_obj);
+    g_free(f->may_free);
+    g_free(f->iov);
+    g_free(f->buf);
     g_free(f);
     trace_qemu_file_fclose();
     return ret;
@@ -480,7 +555,7 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
     {
         f->iov[f->iovcnt - 1].iov_len += size;
     } else {
-        if (f->iovcnt >= MAX_IOV_SIZE) {
+        if (f->iovcnt >= f->iov_max) {
             /* Should only happen if a previous fflush failed */
             assert(qemu_file_get_error(f) || !qemu_file_is_writable(f));
             return 1;
@@ -492,7 +567,7 @@ static int add_to_iovec(QEMUFile *f, const uint8_t *buf, size_t size,
         f->iov[f->iovcnt++].iov_len = size;
     }
 
-    if (f->iovcnt >= MAX_IOV_SIZE) {
+    if (f->iovcnt >= f->iov_max) {
         qemu_fflush(f);
         return 1;
     }
@@ -504,7 +579,7 @@ static void add_buf_to_iovec(QEMUFile *f, size_t len)
 {
     if (!add_to_iovec(f, f->buf + f->buf_index, len, false)) {
         f->buf_index += len;
-        if (f->buf_index == IO_BUF_SIZE) {
+        if (f->buf_index == f->buf_max) {
             qemu_fflush(f);
         }
     }
@@ -517,6 +592,16 @@ void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, size_t size,
         return;
     }
 
+    /*
+     * Small payloads go through the linear buffer when the channel
+     * prefers a few large writes, so that they are sent together with
+     * the headers queued around them.
+     */
+    if (!may_free && size <= f->coalesce_max) {
+        qemu_put_buffer(f, buf, size);
+        return;
+    }
+
     f->rate_limit_used += size;
     add_to_iovec(f, buf, size, may_free);
 }
@@ -530,7 +615,7 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 
     while (size > 0) {
-        l = IO_BUF_SIZE - f->buf_index;
+        l = f->buf_max - f->buf_index;
         if (l > size) {
             l = size;
         }
@@ -577,8 +662,8 @@ size_t coroutine_mixed_fn qemu_peek_buffer(QEMUFile *f, uint8_t **buf, size_t si
     size_t index;
 
     assert(!qemu_file_is_writable(f));
-    assert(offset < IO_BUF_SIZE);
-    assert(size <= IO_BUF_SIZE - offset);
+    assert(offset < f->buf_max);
+    assert(size <= f->buf_max - offset);
 
     /* The 1st byte to read from */
     index = f->buf_index + offset;
@@ -628,7 +713,7 @@ size_t coroutine_mixed_fn qemu_get_buffer(QEMUFile *f, uint8_t *buf, size_t size
         size_t res;
         uint8_t *src;
 
-        res = qemu_peek_buffer(f, &src, MIN(pending, IO_BUF_SIZE), 0);
+        res = qemu_peek_buffer(f, &src, MIN(pending, f->buf_max), 0);
         if (res == 0) {
             return done;
         }
@@ -662,7 +747,7 @@ size_t coroutine_mixed_fn qemu_get_buffer(QEMUFile *f, uint8_t *buf, size_t size
  */
 size_t coroutine_mixed_fn qemu_get_buffer_in_place(QEMUFile *f, uint8_t **buf, size_t size)
 {
-    if (size < IO_BUF_SIZE) {
+    if (size < f->buf_max) {
         size_t res;
         uint8_t *src = NULL;
 
@@ -687,7 +772,7 @@ int coroutine_mixed_fn qemu_peek_byte(QEMUFile *f, int offset)
     int index = f->buf_index + offset;
 
     assert(!qemu_file_is_writable(f));
-    assert(offset < IO_BUF_SIZE);
+    assert(offset < f->buf_max);
 
     if (index >= f->buf_size) {
         qemu_fill_buffer(f);
@@ -836,7 +921,7 @@ static int qemu_compress_data(z_stream *stream, uint8_t *dest, size_t dest_len,
 ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size)
 {
-    ssize_t blen = IO_BUF_SIZE - f->buf_index - sizeof(int32_t);
+    ssize_t blen = f->buf_max - f->buf_index - sizeof(int32_t);
 
     if (blen < compressBound(size)) {
         return -1;
@@ -881,6 +966,17 @@ bool qemu_file_buffer_empty(QEMUFile *file)
     return !file->iovcnt;
 }
 
+/*
+ * Check if data was already read from the channel but not consumed yet
+ */
+
+bool qemu_file_input_pending(QEMUFile *file)
+{
+    assert(!qemu_file_is_writable(file));
+
+    return file->buf_index < file->buf_size;
+}
+
 /*
  * Get a string whose length is determined by a single preceding byte
  * A preallocated 256 byte buffer must be passed in.
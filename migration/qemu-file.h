@@ -114,6 +114,7 @@ ssize_t qemu_put_compression_data(QEMUFile *f, z_stream *stream,
                                   const uint8_t *p, size_t size);
 int qemu_put_qemu_file(QEMUFile *f_des, QEMUFile *f_src);
 bool qemu_file_buffer_empty(QEMUFile *file);
+bool qemu_file_input_pending(QEMUFile *file);
 
 /*
  * Note that you can only peek continuous bytes from where the current pointer
@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
@@ -415,6 +416,15 @@ struct RAMState {
     QemuMutex bitmap_mutex;
     /* The RAMBlock used in the last src_page_requests */
     RAMBlock *last_req_rb;
+    /*
+     * Postcopy prefetcher state, protected by the bitmap_mutex.
+     * prefetch_block is NULL unless the last prefetch pushed at least
+     * one page, and prefetch_end is the target page right after the last
+     * one it pushed.  The window is in host pages.
+     */
+    RAMBlock *prefetch_block;
+    unsigned long prefetch_end;
+    unsigned int prefetch_window;
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
@@ -481,6 +491,8 @@ typedef struct MigrationOps MigrationOps;
 MigrationOps *migration_ops;
 
 static int ram_save_host_page_urgent(PageSearchStatus *pss);
+static int ram_save_prefetch_pages(RAMState *rs, PageSearchStatus *pss,
+                                   RAMBlock *block, unsigned long page);
 
 /* NOTE: page is the PFN not real ram_addr_t. */
 static void pss_init(PageSearchStatus *pss, RAMBlock *rb, ram_addr_t page)
@@ -972,7 +984,9 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         return;
     }
 
-    if (migrate_xbzrle()) {
+    if (migrate_xbzrle() ||
+        (migrate_multifd() &&
+         migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE)) {
         double encoded_size, unencoded_size;
 
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
@@ -2014,7 +2028,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
          */
         assert(len % page_size == 0);
         while (len) {
-            if (ram_save_host_page_urgent(pss)) {
+            if (ram_save_host_page_urgent(pss) < 0) {
                 error_report("%s: ram_save_host_page_urgent() failed: "
                              "ramblock=%s, start_addr=0x"RAM_ADDR_FMT,
                              __func__, ramblock->idstr, start);
@@ -2032,6 +2046,11 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
              */
             len -= page_size;
         };
+        if (!ret && ram_save_prefetch_pages(rs, pss, ramblock, page_start)) {
+            error_report("%s: prefetch failed: ramblock=%s, start_addr=0x"
+                         RAM_ADDR_FMT, __func__, ramblock->idstr, start);
+            ret = -1;
+        }
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
         return ret;
@@ -2136,6 +2155,10 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
             XBZRLE_cache_lock();
             xbzrle_cache_zero_page(rs, block->offset + offset);
             XBZRLE_cache_unlock();
+        } else if (migrate_multifd() &&
+                   migrate_multifd_compression() ==
+                   MULTIFD_COMPRESSION_XBZRLE) {
+            multifd_xbzrle_zero_page(block->offset + offset);
         }
         return res;
     }
@@ -2212,7 +2235,8 @@ static void pss_host_page_finish(PageSearchStatus *pss)
  * Send an urgent host page specified by `pss'.  Need to be called with
  * bitmap_mutex held.
  *
- * Returns 0 if save host page succeeded, false otherwise.
+ * Returns 1 if (part of) the host page was sent, 0 if there was nothing
+ * to send, or negative on error.
  */
 static int ram_save_host_page_urgent(PageSearchStatus *pss)
 {
@@ -2254,7 +2278,94 @@ out:
     if (sent) {
         qemu_fflush(pss->pss_channel);
     }
-    return ret;
+    return ret < 0 ? ret : sent;
+}
+
+/*
+ * Upper bound of a prefetch window in bytes, so that the return path
+ * thread does not get stuck pushing a long run of huge pages.
+ */
+#define RAM_PREFETCH_MAX_BYTES (4 * MiB)
+
+/**
+ * ram_save_prefetch_pages: push the pages following an urgent request
+ *
+ * Guests tend to fault on the pages next to the one they just got, so
+ * send up to a window of the dirty host pages after @page on the
+ * preempt channel.  The next request is a hit if it comes from right
+ * past the last pushed page: the guest went through the pushed pages
+ * without faulting on any of them.  The window doubles on a hit and
+ * halves otherwise; a request for a page that was pushed but had not
+ * arrived yet is not a hit.  It never covers more than
+ * RAM_PREFETCH_MAX_BYTES, and the push stops early once the return path
+ * has received another request, which is more urgent than any
+ * prefetched page.
+ *
+ * Needs to be called with bitmap_mutex held.
+ *
+ * Returns 0 on success or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: the postcopy channel PSS
+ * @block: block of the urgent request
+ * @page: target page of the urgent request
+ */
+static int ram_save_prefetch_pages(RAMState *rs, PageSearchStatus *pss,
+                                   RAMBlock *block, unsigned long page)
+{
+    QEMUFile *rp = migrate_get_current()->rp_state.from_dst_file;
+    size_t page_size = qemu_ram_pagesize(block);
+    unsigned long guest_pfns = page_size >> TARGET_PAGE_BITS;
+    unsigned int max_window = MIN(migrate_postcopy_prefetch_pages(),
+                                  RAM_PREFETCH_MAX_BYTES / page_size);
+    unsigned long start, limit;
+    int ret;
+
+    if (!max_window) {
+        return 0;
+    }
+
+    if (rs->prefetch_block) {
+        unsigned long slack = rs->prefetch_window * guest_pfns;
+
+        stat64_add(&mig_stats.postcopy_prefetch_samples, 1);
+        if (block == rs->prefetch_block && page >= rs->prefetch_end &&
+            page < rs->prefetch_end + slack) {
+            stat64_add(&mig_stats.postcopy_prefetch_hits, 1);
+            rs->prefetch_window *= 2;
+        } else {
+            rs->prefetch_window /= 2;
+        }
+    }
+    rs->prefetch_window = MAX(MIN(rs->prefetch_window, max_window), 1);
+
+    start = ROUND_DOWN(page, guest_pfns) + guest_pfns;
+    limit = MIN(start + rs->prefetch_window * guest_pfns,
+                block->used_length >> TARGET_PAGE_BITS);
+
+    rs->prefetch_block = NULL;
+    trace_ram_save_prefetch_pages(block->idstr, start, limit,
+                                  rs->prefetch_window);
+
+    pss_init(pss, block, start);
+    while (start < limit && !qemu_file_input_pending(rp)) {
+        pss->page = find_next_bit(block->bmap, limit, start);
+        if (pss->page >= limit) {
+            break;
+        }
+        start = ROUND_DOWN(pss->page, guest_pfns) + guest_pfns;
+        ret = ram_save_host_page_urgent(pss);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret) {
+            rs->prefetch_block = block;
+            rs->prefetch_end = start;
+            stat64_add(&mig_stats.postcopy_prefetch_pages, 1);
+        }
+    }
+
+    return 0;
 }
 
 /**
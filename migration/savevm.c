@@ -46,6 +46,7 @@
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/qmp/qerror.h"
+#include "qapi/qmp/json-writer.h"
 #include "qemu/error-report.h"
 #include "sysemu/cpus.h"
 #include "exec/memory.h"
@@ -953,7 +954,8 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
-        section_type == QEMU_VM_SECTION_START) {
+        section_type == QEMU_VM_SECTION_START ||
+        section_type == QEMU_VM_SECTION_PARALLEL) {
         /* ID string */
         size_t len = strlen(se->idstr);
         qemu_put_byte(f, len);
@@ -1013,6 +1015,329 @@ static int vmstate_save(QEMUFile *f, SaveStateEntry *se, JSONWriter *vmdesc)
     }
     return 0;
 }
+
+/*
+ * Worker threads for saving and loading the state of devices whose
+ * VMStateDescription is marked parallel_safe.
+ *
+ * On the source, each such device is saved into its own buffer while the
+ * migration thread carries on with the other devices of the same priority;
+ * the buffers are then emitted as QEMU_VM_SECTION_PARALLEL sections, which
+ * carry the length of their payload.  That length lets the destination
+ * read a section out of the stream and hand it to a worker without
+ * parsing it, so the loads can proceed concurrently too.  Devices that the
+ * migration thread saves while jobs are outstanding go to a buffer as
+ * well, so that all sections reach the stream in the order of the
+ * handlers list, as they would without the workers.
+ *
+ * Devices of different priorities are never processed concurrently: both
+ * sides wait for the outstanding jobs before moving on to a new priority.
+ */
+#define DEVICE_STATE_WORKERS_MAX 8
+
+typedef struct DeviceStateJob {
+    SaveStateEntry *se;
+    QIOChannelBuffer *bioc;
+    QEMUFile *file;
+    /* Description of the section, spliced into the main vmdesc */
+    JSONWriter *vmdesc;
+    /* Saved by the migration thread as a QEMU_VM_SECTION_FULL section */
+    bool inline_section;
+    int ret;
+} DeviceStateJob;
+
+typedef struct DeviceStateWorkers {
+    QemuThread threads[DEVICE_STATE_WORKERS_MAX];
+    int nthreads;
+    bool is_load;
+
+    QemuMutex lock;
+    /* Signalled when a job is queued or the workers should quit */
+    QemuCond work_cond;
+    /* Signalled when the last outstanding job completes */
+    QemuCond done_cond;
+    GQueue queue;
+    /* Jobs queued or running */
+    unsigned int outstanding;
+    bool quit;
+
+    /* Jobs submitted since the last device_state_workers_wait() */
+    GPtrArray *jobs;
+    MigrationPriority priority;
+} DeviceStateWorkers;
+
+static void device_state_job_free(gpointer opaque)
+{
+    DeviceStateJob *job = opaque;
+
+    if (job->file) {
+        qemu_fclose(job->file);
+    }
+    object_unref(OBJECT(job->bioc));
+    json_writer_free(job->vmdesc);
+    g_free(job);
+}
+
+static void device_state_job_run(DeviceStateWorkers *w, DeviceStateJob *job)
+{
+    SaveStateEntry *se = job->se;
+
+    if (w->is_load) {
+        trace_vmstate_load(se->idstr, se->vmsd->name);
+        job->file = qemu_file_new_input(QIO_CHANNEL(job->bioc));
+        job->ret = vmstate_load_state(job->file, se->vmsd, se->opaque,
+                                      se->load_version_id);
+    } else {
+        trace_vmstate_save(se->idstr, se->vmsd->name);
+        job->file = qemu_file_new_output(QIO_CHANNEL(job->bioc));
+        if (job->vmdesc) {
+            json_writer_start_object(job->vmdesc, NULL);
+            json_writer_str(job->vmdesc, "name", se->idstr);
+            json_writer_int64(job->vmdesc, "instance_id", se->instance_id);
+        }
+        job->ret = vmstate_save_state(job->file, se->vmsd, se->opaque,
+                                      job->vmdesc);
+        if (job->vmdesc) {
+            json_writer_end_object(job->vmdesc);
+        }
+        qemu_fflush(job->file);
+    }
+
+    if (!job->ret) {
+        job->ret = qemu_file_get_error(job->file);
+    }
+}
+
+static void *device_state_worker_thread(void *opaque)
+{
+    DeviceStateWorkers *w = opaque;
+    DeviceStateJob *job;
+
+    qemu_mutex_lock(&w->lock);
+    while (true) {
+        while (!w->quit && g_queue_is_empty(&w->queue)) {
+            qemu_cond_wait(&w->work_cond, &w->lock);
+        }
+        job = g_queue_pop_head(&w->queue);
+        if (!job) {
+            break;
+        }
+        qemu_mutex_unlock(&w->lock);
+
+        device_state_job_run(w, job);
+
+        qemu_mutex_lock(&w->lock);
+        if (--w->outstanding == 0) {
+            qemu_cond_broadcast(&w->done_cond);
+        }
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static DeviceStateWorkers *device_state_workers_new(bool is_load)
+{
+    DeviceStateWorkers *w = g_new0(DeviceStateWorkers, 1);
+    int i;
+
+    w->is_load = is_load;
+    w->nthreads = MIN(g_get_num_processors(), DEVICE_STATE_WORKERS_MAX);
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->work_cond);
+    qemu_cond_init(&w->done_cond);
+    g_queue_init(&w->queue);
+    w->jobs = g_ptr_array_new_with_free_func(device_state_job_free);
+
+    for (i = 0; i < w->nthreads; i++) {
+        qemu_thread_create(&w->threads[i],
+                           is_load ? "devstate-load" : "devstate-save",
+                           device_state_worker_thread, w,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    return w;
+}
+
+static void device_state_workers_submit(DeviceStateWorkers *w,
+                                        DeviceStateJob *job)
+{
+    if (!w->jobs->len) {
+        w->priority = save_state_priority(job->se);
+    }
+    assert(w->priority == save_state_priority(job->se));
+    g_ptr_array_add(w->jobs, job);
+
+    qemu_mutex_lock(&w->lock);
+    w->outstanding++;
+    g_queue_push_tail(&w->queue, job);
+    qemu_cond_signal(&w->work_cond);
+    qemu_mutex_unlock(&w->lock);
+}
+
+/*
+ * Wait for all the jobs submitted so far.  The jobs stay in w->jobs, in
+ * submission order, until the caller drops them.
+ *
+ * Returns: 0 on success, or the error of the first failed job
+ */
+static int device_state_workers_wait(DeviceStateWorkers *w)
+{
+    int i;
+
+    qemu_mutex_lock(&w->lock);
+    while (w->outstanding) {
+        qemu_cond_wait(&w->done_cond, &w->lock);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    for (i = 0; i < w->jobs->len; i++) {
+        DeviceStateJob *job = g_ptr_array_index(w->jobs, i);
+
+        if (job->ret) {
+            error_report("%s of device '%s' failed: %d",
+                         w->is_load ? "Load" : "Save", job->se->idstr,
+                         job->ret);
+            return job->ret;
+        }
+    }
+
+    return 0;
+}
+
+static void device_state_workers_free(DeviceStateWorkers *w)
+{
+    int i;
+
+    if (!w) {
+        return;
+    }
+
+    qemu_mutex_lock(&w->lock);
+    while (w->outstanding) {
+        qemu_cond_wait(&w->done_cond, &w->lock);
+    }
+    w->quit = true;
+    qemu_cond_broadcast(&w->work_cond);
+    qemu_mutex_unlock(&w->lock);
+
+    for (i = 0; i < w->nthreads; i++) {
+        qemu_thread_join(&w->threads[i]);
+    }
+
+    g_ptr_array_free(w->jobs, true);
+    qemu_cond_destroy(&w->done_cond);
+    qemu_cond_destroy(&w->work_cond);
+    qemu_mutex_destroy(&w->lock);
+    g_free(w);
+}
+
+static bool vmstate_save_parallel_allowed(SaveStateEntry *se)
+{
+    return se->vmsd && se->vmsd->parallel_safe && !se->is_ram;
+}
+
+/*
+ * Queue the state of @se to be saved by a worker thread.  The workers
+ * are started on the first device that needs them.
+ */
+static void vmstate_save_parallel(DeviceStateWorkers **workers,
+                                  SaveStateEntry *se, JSONWriter *vmdesc)
+{
+    DeviceStateJob *job;
+
+    if (!vmstate_save_needed(se->vmsd, se->opaque)) {
+        trace_savevm_section_skip(se->idstr, se->section_id);
+        return;
+    }
+
+    if (!*workers) {
+        *workers = device_state_workers_new(false);
+    }
+
+    job = g_new0(DeviceStateJob, 1);
+    job->se = se;
+    job->bioc = qio_channel_buffer_new(4096);
+    if (vmdesc) {
+        job->vmdesc = json_writer_new(false);
+    }
+    device_state_workers_submit(*workers, job);
+}
+
+/*
+ * Save @se from the migration thread into a buffer that is kept in order
+ * with the saves queued to @w, so that vmstate_save_parallel_flush() can
+ * write it out after the sections that precede it.
+ */
+static int vmstate_save_inline(DeviceStateWorkers *w, SaveStateEntry *se,
+                               JSONWriter *vmdesc)
+{
+    DeviceStateJob *job;
+    int ret;
+
+    job = g_new0(DeviceStateJob, 1);
+    job->se = se;
+    job->inline_section = true;
+    job->bioc = qio_channel_buffer_new(4096);
+    job->file = qemu_file_new_output(QIO_CHANNEL(job->bioc));
+    if (vmdesc) {
+        job->vmdesc = json_writer_new(false);
+    }
+
+    ret = vmstate_save(job->file, se, job->vmdesc);
+    qemu_fflush(job->file);
+    if (!ret) {
+        ret = qemu_file_get_error(job->file);
+    }
+    if (ret || !job->bioc->usage) {
+        device_state_job_free(job);
+        return ret;
+    }
+
+    g_ptr_array_add(w->jobs, job);
+    return 0;
+}
+
+/*
+ * Wait for the queued saves and write them out, together with the
+ * sections saved by vmstate_save_inline(), in the order they were queued.
+ */
+static int vmstate_save_parallel_flush(QEMUFile *f, DeviceStateWorkers *w,
+                                       JSONWriter *vmdesc)
+{
+    int ret, i;
+
+    ret = device_state_workers_wait(w);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < w->jobs->len; i++) {
+        DeviceStateJob *job = g_ptr_array_index(w->jobs, i);
+        SaveStateEntry *se = job->se;
+
+        if (job->inline_section) {
+            qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+            if (vmdesc) {
+                json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+            }
+            continue;
+        }
+
+        trace_savevm_section_start(se->idstr, se->section_id);
+        save_section_header(f, se, QEMU_VM_SECTION_PARALLEL);
+        qemu_put_be32(f, job->bioc->usage);
+        qemu_put_buffer(f, job->bioc->data, job->bioc->usage);
+        trace_savevm_section_end(se->idstr, se->section_id, 0);
+        save_section_footer(f, se);
+        if (vmdesc) {
+            json_writer_raw(vmdesc, NULL, json_writer_get(job->vmdesc));
+        }
+    }
+    g_ptr_array_set_size(w->jobs, 0);
+
+    return 0;
+}
 /**
  * qemu_savevm_command_send: Send a 'QEMU_VM_COMMAND' type element with the
  *                           command and associated data.
@@ -1453,6 +1778,8 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
 {
     MigrationState *ms = migrate_get_current();
     JSONWriter *vmdesc = ms->vmdesc;
+    DeviceStateWorkers *workers = NULL;
+    bool parallel = migrate_parallel_device_state();
     int vmdesc_len;
     SaveStateEntry *se;
     int ret;
@@ -1463,10 +1790,37 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
             continue;
         }
 
-        ret = vmstate_save(f, se, vmdesc);
+        /* Finish the previous priority before starting a new one */
+        if (workers && workers->jobs->len &&
+            workers->priority != save_state_priority(se)) {
+            ret = vmstate_save_parallel_flush(f, workers, vmdesc);
+            if (ret) {
+                goto err;
+            }
+        }
+
+        if (parallel && vmstate_save_parallel_allowed(se)) {
+            vmstate_save_parallel(&workers, se, vmdesc);
+            continue;
+        }
+
+        /* Keep the sections in order behind the outstanding saves */
+        if (workers && workers->jobs->len) {
+            ret = vmstate_save_inline(workers, se, vmdesc);
+        } else {
+            ret = vmstate_save(f, se, vmdesc);
+        }
         if (ret) {
-            qemu_file_set_error(f, ret);
-            return ret;
+            goto err;
+        }
+    }
+
+    if (workers) {
+        ret = vmstate_save_parallel_flush(f, workers, vmdesc);
+        device_state_workers_free(workers);
+        workers = NULL;
+        if (ret) {
+            goto err;
         }
     }
 
@@ -1501,6 +1855,11 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     ms->vmdesc = NULL;
 
     return 0;
+
+err:
+    device_state_workers_free(workers);
+    qemu_file_set_error(f, ret);
+    return ret;
 }
 
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
@@ -2444,8 +2803,79 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
+/*
+ * Read the payload of a QEMU_VM_SECTION_PARALLEL section and queue it to
+ * be loaded by a worker thread.  The workers are started on the first
+ * such section.
+ */
+static int qemu_loadvm_section_parallel(QEMUFile *f, SaveStateEntry *se,
+                                        DeviceStateWorkers **workers)
+{
+    DeviceStateWorkers *w = *workers;
+    DeviceStateJob *job;
+    uint32_t len;
+    int ret;
+
+    /*
+     * The worker runs without the BQL, so what matters is whether the
+     * local device can cope with that, whatever the source thought.
+     */
+    if (!se->vmsd || !se->vmsd->parallel_safe || se->is_ram) {
+        error_report("Device '%s' cannot be loaded in parallel", se->idstr);
+        return -EINVAL;
+    }
+
+    len = qemu_get_be32(f);
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        return ret;
+    }
+
+    if (!w) {
+        w = *workers = device_state_workers_new(true);
+    } else if (w->jobs->len && w->priority != save_state_priority(se)) {
+        ret = device_state_workers_wait(w);
+        g_ptr_array_set_size(w->jobs, 0);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    job = g_new0(DeviceStateJob, 1);
+    job->se = se;
+    job->bioc = qio_channel_buffer_new(len);
+    job->bioc->usage = qemu_get_buffer(f, job->bioc->data, len);
+    if (job->bioc->usage != len) {
+        device_state_job_free(job);
+        ret = qemu_file_get_error(f);
+        return ret ? ret : -EIO;
+    }
+
+    trace_qemu_loadvm_state_section_parallel(se->idstr, len);
+    device_state_workers_submit(w, job);
+    return 0;
+}
+
+/*
+ * Wait for the device states queued by qemu_loadvm_section_parallel().
+ */
+static int qemu_loadvm_parallel_wait(DeviceStateWorkers *w)
+{
+    int ret;
+
+    if (!w || !w->jobs->len) {
+        return 0;
+    }
+
+    ret = device_state_workers_wait(w);
+    g_ptr_array_set_size(w->jobs, 0);
+    return ret;
+}
+
 static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis,
+                               uint8_t section_type,
+                               DeviceStateWorkers **workers)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2496,7 +2926,14 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
-    ret = vmstate_load(f, se);
+    if (section_type == QEMU_VM_SECTION_PARALLEL) {
+        ret = qemu_loadvm_section_parallel(f, se, workers);
+    } else {
+        ret = qemu_loadvm_parallel_wait(*workers);
+        if (!ret) {
+            ret = vmstate_load(f, se);
+        }
+    }
     if (ret < 0) {
         error_report("error while loading state for instance 0x%"PRIx32" of"
                      " device '%s'", instance_id, idstr);
@@ -2696,6 +3133,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
+    DeviceStateWorkers *workers = NULL;
     uint8_t section_type;
     int ret = 0;
 
@@ -2709,10 +3147,26 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+
+        /*
+         * Anything but another device section may depend on the state
+         * being loaded in the background, wait for it first.
+         */
+        if (section_type != QEMU_VM_SECTION_START &&
+            section_type != QEMU_VM_SECTION_FULL &&
+            section_type != QEMU_VM_SECTION_PARALLEL) {
+            ret = qemu_loadvm_parallel_wait(workers);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
-            ret = qemu_loadvm_section_start_full(f, mis);
+        case QEMU_VM_SECTION_PARALLEL:
+            ret = qemu_loadvm_section_start_full(f, mis, section_type,
+                                                 &workers);
             if (ret < 0) {
                 goto out;
             }
@@ -2742,6 +3196,16 @@ retry:
     }
 
 out:
+    if (workers) {
+        int wait_ret = qemu_loadvm_parallel_wait(workers);
+
+        if (!ret || ret == LOADVM_QUIT) {
+            ret = wait_ret ? wait_ret : ret;
+        }
+        device_state_workers_free(workers);
+        workers = NULL;
+    }
+
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
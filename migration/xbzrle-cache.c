@@ -0,0 +1,83 @@
+/*
+ * XBZRLE encoding of pages against a page cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "xbzrle.h"
+#include "xbzrle-cache.h"
+
+/**
+ * xbzrle_cache_encode: encode a page against its cached copy
+ *
+ * The page is first copied to @buf, because the guest might be
+ * changing it under our feet, and the cache must hold exactly what
+ * the destination will have.  On a miss the copy is inserted in the
+ * cache; otherwise the delta is written to @out, which must have room
+ * for @page_size bytes, and the cached copy is updated.
+ *
+ * The caller must serialize calls on the same @cache.
+ *
+ * @cache: cache holding the copies of the pages already sent
+ * @addr: address of the page in the cache
+ * @host: current contents of the page
+ * @buf: buffer of @page_size bytes for a stable copy of the page
+ * @out: buffer for the delta
+ * @delta_len: set to the length of the delta for XBZRLE_CACHE_DELTA
+ * @page_size: size of the page
+ * @age: current dirty sync count
+ */
+XBZRLECacheResult xbzrle_cache_encode(PageCache *cache, uint64_t addr,
+                                      const uint8_t *host, uint8_t *buf,
+                                      uint8_t *out, int *delta_len,
+                                      int page_size, uint64_t age)
+{
+    uint8_t *cached;
+    int len;
+
+    memcpy(buf, host, page_size);
+    if (!cache_is_cached(cache, addr, age)) {
+        cache_insert(cache, addr, buf, age);
+        return XBZRLE_CACHE_MISS;
+    }
+
+    cached = get_cached_data(cache, addr);
+    len = xbzrle_encode_buffer_func(cached, buf, page_size, out, page_size);
+    if (len == 0) {
+        return XBZRLE_CACHE_UNCHANGED;
+    }
+    memcpy(cached, buf, page_size);
+    if (len == -1) {
+        return XBZRLE_CACHE_OVERFLOW;
+    }
+    *delta_len = len;
+    return XBZRLE_CACHE_DELTA;
+}
+
+/**
+ * xbzrle_cache_zero: record that a page was sent as all zeroes
+ *
+ * A stale cached copy must not survive, or the next delta for the
+ * page would be computed against data the destination does not have.
+ * If the page was not cached, it is added so that small writes into
+ * the zeroed page can be sent as deltas.
+ *
+ * @cache: cache holding the copies of the pages already sent
+ * @addr: address of the page in the cache
+ * @page_size: size of the page
+ * @age: current dirty sync count
+ */
+void xbzrle_cache_zero(PageCache *cache, uint64_t addr, int page_size,
+                       uint64_t age)
+{
+    if (cache_is_cached(cache, addr, age)) {
+        memset(get_cached_data(cache, addr), 0, page_size);
+    } else {
+        g_autofree uint8_t *zero = g_malloc0(page_size);
+
+        /* It does not matter if this fails, no stale copy is left behind */
+        cache_insert(cache, addr, zero, age);
+    }
+}
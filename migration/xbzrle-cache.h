@@ -0,0 +1,32 @@
+/*
+ * XBZRLE encoding of pages against a page cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_XBZRLE_CACHE_H
+#define QEMU_MIGRATION_XBZRLE_CACHE_H
+
+#include "page_cache.h"
+
+/* Result of xbzrle_cache_encode() */
+typedef enum {
+    /* The page was not cached; send the copy in @buf raw */
+    XBZRLE_CACHE_MISS,
+    /* The delta is not smaller than the page; send the copy in @buf raw */
+    XBZRLE_CACHE_OVERFLOW,
+    /* The page did not change since it was last sent */
+    XBZRLE_CACHE_UNCHANGED,
+    /* @out holds a delta of *@delta_len bytes */
+    XBZRLE_CACHE_DELTA,
+} XBZRLECacheResult;
+
+XBZRLECacheResult xbzrle_cache_encode(PageCache *cache, uint64_t addr,
+                                      const uint8_t *host, uint8_t *buf,
+                                      uint8_t *out, int *delta_len,
+                                      int page_size, uint64_t age);
+void xbzrle_cache_zero(PageCache *cache, uint64_t addr, int page_size,
+                       uint64_t age);
+
+#endif
@@ -18,6 +18,10 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
+
+/* The fastest encoder the host supports, defined by the user of xbzrle.c */
+extern int (*xbzrle_encode_buffer_func)(uint8_t *, uint8_t *, int,
+                                        uint8_t *, int);
 #if defined(CONFIG_AVX512BW_OPT)
 int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
                                 uint8_t *dst, int dlen);
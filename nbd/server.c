@@ -28,6 +28,8 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -101,6 +103,11 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Iothreads that negotiated connections are distributed across */
+    IOThread **conn_iothreads;
+    size_t nr_conn_iothreads;
+    size_t next_conn_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -120,7 +127,7 @@ typedef struct NBDExportMetaContexts {
 } NBDExportMetaContexts;
 
 struct NBDClient {
-    int refcount;
+    int refcount; /* atomic */
     void (*close_fn)(NBDClient *client, bool negotiated);
 
     NBDExport *exp;
@@ -129,6 +136,21 @@ struct NBDClient {
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
 
+    /*
+     * If the export has connection iothreads, the one that serves this
+     * connection.  Socket I/O and request parsing then run in conn_ctx, and
+     * requests only enter the export's AioContext for their block layer
+     * calls (see nbd_client_enter_export()).  NULL otherwise.
+     */
+    IOThread *conn_iothread;
+    AioContext *conn_ctx;
+
+    /*
+     * Protects recv_coroutine, read_yielding, quiescing, wake_pending and
+     * nb_requests, which the drain callbacks access from the main loop.
+     */
+    QemuMutex lock;
+
     Coroutine *recv_coroutine;
 
     CoMutex send_lock;
@@ -136,16 +158,29 @@ struct NBDClient {
 
     bool read_yielding;
     bool quiescing;
+    bool wake_pending; /* nbd_client_wake_read_bh() is scheduled */
 
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
-    bool closing;
+    bool closing; /* atomic */
+
+    /* Counters for query-block-exports */
+    Stat64 nr_completed;
+    Stat64 bytes_read;
+    Stat64 bytes_written;
 
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
     bool structured_reply;
     NBDExportMetaContexts export_meta;
 
+    /*
+     * Send read payloads straight from the image to the socket, see
+     * nbd_co_send_zero_copy_read().  Only possible without TLS; whether
+     * the export supports it is checked for every request.
+     */
+    bool zero_copy;
+
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
                         negotiated now */
@@ -1352,8 +1387,20 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
         return ret;
     }
 
-    /* Attach the channel to the same AioContext as the export */
-    if (client->exp && client->exp->common.ctx) {
+    /*
+     * Attach the channel to the next connection iothread if the export has
+     * any, or else to the same AioContext as the export
+     */
+    if (client->exp && client->exp->nr_conn_iothreads) {
+        NBDExport *exp = client->exp;
+        size_t i = exp->next_conn_iothread++ % exp->nr_conn_iothreads;
+
+        client->conn_iothread = exp->conn_iothreads[i];
+        object_ref(OBJECT(client->conn_iothread));
+        client->conn_ctx = iothread_get_aio_context(client->conn_iothread);
+        trace_nbd_negotiate_conn_iothread(exp->name, client->conn_ctx);
+        qio_channel_attach_aio_context(client->ioc, client->conn_ctx);
+    } else if (client->exp && client->exp->common.ctx) {
         qio_channel_attach_aio_context(client->ioc, client->exp->common.ctx);
     }
 
@@ -1383,11 +1430,22 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
-            client->read_yielding = true;
+            WITH_QEMU_LOCK_GUARD(&client->lock) {
+                /*
+                 * Don't start waiting if a drained section has already
+                 * polled us, it would not know that it needs to wake us up.
+                 */
+                if (client->quiescing) {
+                    return -EAGAIN;
+                }
+                client->read_yielding = true;
+            }
             qio_channel_yield(client->ioc, G_IO_IN);
-            client->read_yielding = false;
-            if (client->quiescing) {
-                return -EAGAIN;
+            WITH_QEMU_LOCK_GUARD(&client->lock) {
+                client->read_yielding = false;
+                if (client->quiescing) {
+                    return -EAGAIN;
+                }
             }
             continue;
         } else if (len < 0) {
@@ -1454,40 +1512,61 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 void nbd_client_get(NBDClient *client)
 {
-    client->refcount++;
+    qatomic_inc(&client->refcount);
+}
+
+static void nbd_client_free(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    qio_channel_detach_aio_context(client->ioc);
+    object_unref(OBJECT(client->sioc));
+    object_unref(OBJECT(client->ioc));
+    if (client->tlscreds) {
+        object_unref(OBJECT(client->tlscreds));
+    }
+    g_free(client->tlsauthz);
+    if (client->exp) {
+        QTAILQ_REMOVE(&client->exp->clients, client, next);
+        blk_exp_unref(&client->exp->common);
+    }
+    if (client->conn_iothread) {
+        object_unref(OBJECT(client->conn_iothread));
+    }
+    qemu_mutex_destroy(&client->lock);
+    g_free(client->export_meta.bitmaps);
+    g_free(client);
 }
 
 void nbd_client_put(NBDClient *client)
 {
-    if (--client->refcount == 0) {
+    if (qatomic_fetch_dec(&client->refcount) == 1) {
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
-        assert(client->closing);
+        assert(qatomic_read(&client->closing));
 
-        qio_channel_detach_aio_context(client->ioc);
-        object_unref(OBJECT(client->sioc));
-        object_unref(OBJECT(client->ioc));
-        if (client->tlscreds) {
-            object_unref(OBJECT(client->tlscreds));
-        }
-        g_free(client->tlsauthz);
-        if (client->exp) {
-            QTAILQ_REMOVE(&client->exp->clients, client, next);
-            blk_exp_unref(&client->exp->common);
+        /*
+         * Requests of connections that are served from a connection iothread
+         * may drop the last reference there, but the export's client list
+         * belongs to the main loop.
+         */
+        if (client->conn_ctx && !qemu_in_main_thread()) {
+            aio_bh_schedule_oneshot(qemu_get_aio_context(), nbd_client_free,
+                                    client);
+        } else {
+            nbd_client_free(client);
         }
-        g_free(client->export_meta.bitmaps);
-        g_free(client);
     }
 }
 
 static void client_close(NBDClient *client, bool negotiated)
 {
-    if (client->closing) {
+    if (qatomic_read(&client->closing)) {
         return;
     }
 
-    client->closing = true;
+    qatomic_set(&client->closing, true);
 
     /* Force requests to finish.  They will drop their own references,
      * then we'll close the socket and free the NBDClient.
@@ -1501,6 +1580,7 @@ static void client_close(NBDClient *client, bool negotiated)
     }
 }
 
+/* Called with client->lock held */
 static NBDRequestData *nbd_request_get(NBDClient *client)
 {
     NBDRequestData *req;
@@ -1523,10 +1603,12 @@ static void nbd_request_put(NBDRequestData *req)
     }
     g_free(req);
 
-    client->nb_requests--;
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        client->nb_requests--;
 
-    if (client->quiescing && client->nb_requests == 0) {
-        aio_wait_kick();
+        if (client->quiescing && client->nb_requests == 0) {
+            aio_wait_kick();
+        }
     }
 
     nbd_client_receive_next_request(client);
@@ -1544,11 +1626,16 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->common.ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_attach_aio_context(client->ioc, ctx);
+        /* Connections served from an iothread of their own stay there */
+        if (!client->conn_ctx) {
+            qio_channel_attach_aio_context(client->ioc, ctx);
+        }
 
-        assert(client->nb_requests == 0);
-        assert(client->recv_coroutine == NULL);
-        assert(client->send_coroutine == NULL);
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            assert(client->nb_requests == 0);
+            assert(client->recv_coroutine == NULL);
+            assert(client->send_coroutine == NULL);
+        }
     }
 }
 
@@ -1560,7 +1647,9 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->common.ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_detach_aio_context(client->ioc);
+        if (!client->conn_ctx) {
+            qio_channel_detach_aio_context(client->ioc);
+        }
     }
 
     exp->common.ctx = NULL;
@@ -1572,7 +1661,9 @@ static void nbd_drained_begin(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = true;
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            client->quiescing = true;
+        }
     }
 }
 
@@ -1582,27 +1673,71 @@ static void nbd_drained_end(void *opaque)
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        client->quiescing = false;
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            client->quiescing = false;
+        }
         nbd_client_receive_next_request(client);
     }
 }
 
+/*
+ * Wakes up the coroutine of a connection that is served from a connection
+ * iothread if it is waiting for a request on nbd_read_eof().  Runs in that
+ * iothread, so the channel can't wake the coroutine at the same time.
+ */
+static void nbd_client_wake_read_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+    Coroutine *co = NULL;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        client->wake_pending = false;
+        if (client->recv_coroutine != NULL && client->read_yielding) {
+            co = client->recv_coroutine;
+        }
+    }
+
+    if (co) {
+        aio_co_wake(co);
+    }
+    nbd_client_put(client);
+}
+
 static bool nbd_drained_poll(void *opaque)
 {
     NBDExport *exp = opaque;
     NBDClient *client;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        if (client->nb_requests != 0) {
-            /*
-             * If there's a coroutine waiting for a request on nbd_read_eof()
-             * enter it here so we don't depend on the client to wake it up.
-             */
-            if (client->recv_coroutine != NULL && client->read_yielding) {
-                qemu_aio_coroutine_enter(exp->common.ctx,
-                                         client->recv_coroutine);
+        Coroutine *co = NULL;
+        bool busy = false;
+
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            if (client->nb_requests != 0) {
+                busy = true;
+                /*
+                 * If there's a coroutine waiting for a request on
+                 * nbd_read_eof() wake it up so we don't depend on the client
+                 * to do so.
+                 */
+                if (client->recv_coroutine != NULL && client->read_yielding) {
+                    if (!client->conn_ctx) {
+                        co = client->recv_coroutine;
+                    } else if (!client->wake_pending) {
+                        client->wake_pending = true;
+                        nbd_client_get(client);
+                        aio_bh_schedule_oneshot(client->conn_ctx,
+                                                nbd_client_wake_read_bh,
+                                                client);
+                    }
+                }
             }
+        }
 
+        if (busy) {
+            if (co) {
+                qemu_aio_coroutine_enter(exp->common.ctx, co);
+            }
             return true;
         }
     }
@@ -1646,6 +1781,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1761,10 +1897,35 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
             goto fail;
         }
 
+        ret = bdrv_dirty_bitmap_load(bm, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+
         exp->export_bitmaps[i] = bm;
         assert(strlen(bitmap) <= BDRV_BITMAP_MAX_NAME_SIZE);
     }
 
+    for (iothreads = arg->connection_iothreads; iothreads;
+         iothreads = iothreads->next)
+    {
+        exp->nr_conn_iothreads++;
+    }
+    exp->conn_iothreads = g_new0(IOThread *, exp->nr_conn_iothreads);
+    for (i = 0, iothreads = arg->connection_iothreads; iothreads;
+         i++, iothreads = iothreads->next)
+    {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            ret = -ENOENT;
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            goto fail;
+        }
+        object_ref(OBJECT(iothread));
+        exp->conn_iothreads[i] = iothread;
+    }
+
     /* Mark bitmaps busy in a separate loop, to simplify roll-back concerns. */
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], true);
@@ -1788,6 +1949,12 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     return 0;
 
 fail:
+    for (i = 0; i < exp->nr_conn_iothreads; i++) {
+        if (exp->conn_iothreads[i]) {
+            object_unref(OBJECT(exp->conn_iothreads[i]));
+        }
+    }
+    g_free(exp->conn_iothreads);
     g_free(exp->export_bitmaps);
     g_free(exp->name);
     g_free(exp->description);
@@ -1858,6 +2025,41 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    for (i = 0; i < exp->nr_conn_iothreads; i++) {
+        object_unref(OBJECT(exp->conn_iothreads[i]));
+    }
+    g_free(exp->conn_iothreads);
+}
+
+static void nbd_export_query(BlockExport *blk_exp, BlockExportInfo *info)
+{
+    NBDExport *exp = container_of(blk_exp, NBDExport, common);
+    BlockExportNbdConnectionInfoList **tail = &info->u.nbd.connections;
+    NBDClient *client;
+
+    if (!exp->nr_conn_iothreads) {
+        return;
+    }
+
+    info->u.nbd.has_connections = true;
+    QTAILQ_FOREACH(client, &exp->clients, next) {
+        BlockExportNbdConnectionInfo *conn;
+
+        /* Still negotiating */
+        if (!client->conn_iothread) {
+            continue;
+        }
+
+        conn = g_new(BlockExportNbdConnectionInfo, 1);
+        *conn = (BlockExportNbdConnectionInfo) {
+            .iothread       = iothread_get_id(client->conn_iothread),
+            .requests       = stat64_get(&client->nr_completed),
+            .bytes_read     = stat64_get(&client->bytes_read),
+            .bytes_written  = stat64_get(&client->bytes_written),
+        };
+        QAPI_LIST_APPEND(tail, conn);
+    }
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -1866,8 +2068,29 @@ const BlockExportDriver blk_exp_nbd = {
     .create             = nbd_export_create,
     .delete             = nbd_export_delete,
     .request_shutdown   = nbd_export_request_shutdown,
+    .query              = nbd_export_query,
 };
 
+/*
+ * The BlockBackend of the export may only be accessed from the export's
+ * AioContext, so connections that are served from a connection iothread
+ * move there for the duration of their block layer calls.  Both functions
+ * are no-ops for other connections.
+ */
+static void coroutine_fn nbd_client_enter_export(NBDClient *client)
+{
+    if (client->conn_ctx) {
+        aio_co_reschedule_self(client->exp->common.ctx);
+    }
+}
+
+static void coroutine_fn nbd_client_leave_export(NBDClient *client)
+{
+    if (client->conn_ctx) {
+        aio_co_reschedule_self(client->conn_ctx);
+    }
+}
+
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
                                         unsigned niov, Error **errp)
 {
@@ -1987,9 +2210,134 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, errp);
 }
 
+/*
+ * Send the reply header in @iov, followed by @size bytes of payload from
+ * @offset of the export.  The payload goes from the image to the socket
+ * with blk_co_sendfile() for as long as that works; the rest is read into a
+ * bounce buffer and written normally.  The header is already out by then,
+ * so if that read fails, all we can do is drop the connection.
+ *
+ * Returns -ENOTSUP without sending anything if the export cannot do zero
+ * copy (any more), in which case the caller must use the normal read path.
+ */
+static int coroutine_fn nbd_co_send_iov_sendfile(NBDClient *client,
+                                                 struct iovec *iov,
+                                                 unsigned niov,
+                                                 uint64_t offset,
+                                                 size_t size,
+                                                 Error **errp)
+{
+    NBDExport *exp = client->exp;
+    QEMU_AUTO_VFREE uint8_t *data = NULL;
+    size_t progress = 0;
+    int ret;
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /*
+     * Recheck now that we own the socket: requests may have been queued on
+     * send_lock while the export was reconfigured.
+     */
+    nbd_client_enter_export(client);
+    ret = blk_co_can_sendfile(exp->common.blk) ? 0 : -ENOTSUP;
+    nbd_client_leave_export(client);
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (qio_channel_writev_all(client->ioc, iov, niov, errp) < 0) {
+        ret = -EIO;
+        goto out;
+    }
+
+    while (progress < size) {
+        nbd_client_enter_export(client);
+        ret = blk_co_sendfile(exp->common.blk, offset + progress,
+                              size - progress, client->sioc->fd);
+        nbd_client_leave_export(client);
+
+        if (ret == -EAGAIN) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (ret < 0) {
+            trace_nbd_co_send_zero_copy_fallback(offset + progress,
+                                                 size - progress, ret);
+            break;
+        }
+        progress += ret;
+    }
+
+    ret = 0;
+    if (progress < size) {
+        data = blk_try_blockalign(exp->common.blk, size - progress);
+        if (!data) {
+            error_setg(errp, "No memory");
+            ret = -ENOMEM;
+            goto out;
+        }
+
+        nbd_client_enter_export(client);
+        ret = blk_co_pread(exp->common.blk, offset + progress, size - progress,
+                           data, 0);
+        nbd_client_leave_export(client);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "reading from file failed");
+            ret = -EIO;
+            goto out;
+        }
+        if (qio_channel_write_all(client->ioc, (char *)data, size - progress,
+                                  errp) < 0) {
+            ret = -EIO;
+        }
+    }
+
+out:
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
+/*
+ * Send a successful read reply (a simple reply, or a structured data chunk)
+ * for @size bytes at @offset without reading them into a buffer first.
+ * Returns -ENOTSUP if nothing was sent because zero copy is not possible.
+ */
+static int coroutine_fn nbd_co_send_zero_copy_read(NBDClient *client,
+                                                   uint64_t handle,
+                                                   uint64_t offset,
+                                                   size_t size,
+                                                   bool final,
+                                                   Error **errp)
+{
+    NBDSimpleReply reply;
+    NBDStructuredReadData chunk;
+    struct iovec iov;
+
+    assert(size);
+    trace_nbd_co_send_zero_copy_read(handle, offset, size);
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                     sizeof(chunk) - sizeof(chunk.h) + size);
+        stq_be_p(&chunk.offset, offset);
+        iov = (struct iovec) { .iov_base = &chunk, .iov_len = sizeof(chunk) };
+    } else {
+        set_be_simple_reply(&reply, 0, handle);
+        iov = (struct iovec) { .iov_base = &reply, .iov_len = sizeof(reply) };
+    }
+
+    return nbd_co_send_iov_sendfile(client, &iov, 1, offset, size, errp);
+}
+
 /* Do a sparse read and send the structured reply to the client.
  * Returns -errno if sending fails. blk_co_block_status_above() failure is
  * reported to the client, at which point this function succeeds.
+ * A NULL @data means that the payload is sent with zero copy, a bounce
+ * buffer is only allocated if that turns out not to work.
  */
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 uint64_t handle,
@@ -2000,16 +2348,25 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
 {
     int ret = 0;
     NBDExport *exp = client->exp;
+    QEMU_AUTO_VFREE uint8_t *buf = NULL;
     size_t progress = 0;
 
     while (progress < size) {
+        bool zero_copy = !data;
         int64_t pnum;
-        int status = blk_co_block_status_above(exp->common.blk, NULL,
-                                               offset + progress,
-                                               size - progress, &pnum, NULL,
-                                               NULL);
+        int status;
         bool final;
 
+        nbd_client_enter_export(client);
+        status = blk_co_block_status_above(exp->common.blk, NULL,
+                                           offset + progress, size - progress,
+                                           &pnum, NULL, NULL);
+        if (status >= 0 && !(status & BDRV_BLOCK_ZERO) && !zero_copy) {
+            ret = blk_co_pread(exp->common.blk, offset + progress, pnum,
+                               data + progress, 0);
+        }
+        nbd_client_leave_export(client);
+
         if (status < 0) {
             char *msg = g_strdup_printf("unable to check for holes: %s",
                                         strerror(-status));
@@ -2035,9 +2392,19 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stq_be_p(&chunk.offset, offset + progress);
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
+        } else if (zero_copy) {
+            ret = nbd_co_send_zero_copy_read(client, handle, offset + progress,
+                                             pnum, final, errp);
+            if (ret == -ENOTSUP) {
+                /* Nothing sent for this extent, redo it with a buffer */
+                data = buf = blk_try_blockalign(exp->common.blk, size);
+                if (!data) {
+                    error_setg(errp, "No memory");
+                    return -ENOMEM;
+                }
+                continue;
+            }
         } else {
-            ret = blk_co_pread(exp->common.blk, offset + progress, pnum,
-                               data + progress, 0);
             if (ret < 0) {
                 error_setg_errno(errp, -ret, "reading from file failed");
                 break;
@@ -2230,11 +2597,13 @@ coroutine_fn nbd_co_send_block_status(NBDClient *client, uint64_t handle,
     unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
     g_autoptr(NBDExtentArray) ea = nbd_extent_array_new(nb_extents);
 
+    nbd_client_enter_export(client);
     if (context_id == NBD_META_ID_BASE_ALLOCATION) {
         ret = blockstatus_to_extents(blk, offset, length, ea);
     } else {
         ret = blockalloc_to_extents(blk, offset, length, ea);
     }
+    nbd_client_leave_export(client);
     if (ret < 0) {
         return nbd_co_send_structured_error(
                 client, handle, -ret, "can't get block status", errp);
@@ -2332,7 +2701,11 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req, NBDRequest *
             return -EINVAL;
         }
 
-        if (request->type != NBD_CMD_CACHE) {
+        if (request->type == NBD_CMD_READ && request->len &&
+            client->zero_copy && blk_co_can_sendfile(client->exp->common.blk))
+        {
+            /* Sent with blk_co_sendfile(), see nbd_do_cmd_read() */
+        } else if (request->type != NBD_CMD_CACHE) {
             req->data = blk_try_blockalign(client->exp->common.blk,
                                            request->len);
             if (req->data == NULL) {
@@ -2419,18 +2792,22 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
 
 /* Handle NBD_CMD_READ request.
  * Return -errno if sending fails. Other errors are reported directly to the
- * client as an error reply. */
+ * client as an error reply.
+ * @data is NULL if nbd_co_receive_request() chose zero copy. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                         uint8_t *data, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    QEMU_AUTO_VFREE uint8_t *buf = NULL;
 
     assert(request->type == NBD_CMD_READ);
 
     /* XXX: NBD Protocol only documents use of FUA with WRITE */
     if (request->flags & NBD_CMD_FLAG_FUA) {
+        nbd_client_enter_export(client);
         ret = blk_co_flush(exp->common.blk);
+        nbd_client_leave_export(client);
         if (ret < 0) {
             return nbd_send_generic_reply(client, request->handle, ret,
                                           "flush failed", errp);
@@ -2444,7 +2821,25 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    if (!data) {
+        ret = nbd_co_send_zero_copy_read(client, request->handle,
+                                         request->from, request->len, true,
+                                         errp);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+
+        /* Nothing was sent, so errors can still be reported normally */
+        data = buf = blk_try_blockalign(exp->common.blk, request->len);
+        if (!data) {
+            error_setg(errp, "No memory");
+            return -ENOMEM;
+        }
+    }
+
+    nbd_client_enter_export(client);
     ret = blk_co_pread(exp->common.blk, request->from, request->len, data, 0);
+    nbd_client_leave_export(client);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "reading from file failed", errp);
@@ -2479,8 +2874,10 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
 
     assert(request->type == NBD_CMD_CACHE);
 
+    nbd_client_enter_export(client);
     ret = blk_co_preadv(exp->common.blk, request->from, request->len,
                         NULL, BDRV_REQ_COPY_ON_READ | BDRV_REQ_PREFETCH);
+    nbd_client_leave_export(client);
 
     return nbd_send_generic_reply(client, request->handle, ret,
                                   "caching data failed", errp);
@@ -2511,8 +2908,10 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         if (request->flags & NBD_CMD_FLAG_FUA) {
             flags |= BDRV_REQ_FUA;
         }
+        nbd_client_enter_export(client);
         ret = blk_co_pwrite(exp->common.blk, request->from, request->len, data,
                             flags);
+        nbd_client_leave_export(client);
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "writing to file failed", errp);
 
@@ -2527,8 +2926,10 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         if (request->flags & NBD_CMD_FLAG_FAST_ZERO) {
             flags |= BDRV_REQ_NO_FALLBACK;
         }
+        nbd_client_enter_export(client);
         ret = blk_co_pwrite_zeroes(exp->common.blk, request->from, request->len,
                                    flags);
+        nbd_client_leave_export(client);
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "writing to file failed", errp);
 
@@ -2537,15 +2938,19 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         abort();
 
     case NBD_CMD_FLUSH:
+        nbd_client_enter_export(client);
         ret = blk_co_flush(exp->common.blk);
+        nbd_client_leave_export(client);
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "flush failed", errp);
 
     case NBD_CMD_TRIM:
+        nbd_client_enter_export(client);
         ret = blk_co_pdiscard(exp->common.blk, request->from, request->len);
         if (ret >= 0 && request->flags & NBD_CMD_FLAG_FUA) {
             ret = blk_co_flush(exp->common.blk);
         }
+        nbd_client_leave_export(client);
         return nbd_send_generic_reply(client, request->handle, ret,
                                       "discard failed", errp);
 
@@ -2627,27 +3032,33 @@ static coroutine_fn void nbd_trip(void *opaque)
     Error *local_err = NULL;
 
     trace_nbd_trip();
-    if (client->closing) {
+    if (qatomic_read(&client->closing)) {
         nbd_client_put(client);
         return;
     }
 
+    qemu_mutex_lock(&client->lock);
     if (client->quiescing) {
         /*
          * We're switching between AIO contexts. Don't attempt to receive a new
          * request and kick the main context which may be waiting for us.
          */
-        nbd_client_put(client);
         client->recv_coroutine = NULL;
+        qemu_mutex_unlock(&client->lock);
         aio_wait_kick();
+        nbd_client_put(client);
         return;
     }
 
     req = nbd_request_get(client);
+    qemu_mutex_unlock(&client->lock);
+
     ret = nbd_co_receive_request(req, &request, &local_err);
-    client->recv_coroutine = NULL;
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        client->recv_coroutine = NULL;
+    }
 
-    if (client->closing) {
+    if (qatomic_read(&client->closing)) {
         /*
          * The client may be closed when we are blocked in
          * nbd_co_receive_request()
@@ -2656,7 +3067,6 @@ static coroutine_fn void nbd_trip(void *opaque)
     }
 
     if (ret == -EAGAIN) {
-        assert(client->quiescing);
         goto done;
     }
 
@@ -2684,6 +3094,13 @@ static coroutine_fn void nbd_trip(void *opaque)
         goto disconnect;
     }
 
+    stat64_add(&client->nr_completed, 1);
+    if (request.type == NBD_CMD_READ) {
+        stat64_add(&client->bytes_read, request.len);
+    } else if (request.type == NBD_CMD_WRITE) {
+        stat64_add(&client->bytes_written, request.len);
+    }
+
     /* We must disconnect after NBD_CMD_WRITE if we did not
      * read the payload.
      */
@@ -2703,17 +3120,25 @@ disconnect:
         error_reportf_err(local_err, "Disconnect client, due to: ");
     }
     nbd_request_put(req);
+
+    /* client_close() and the close_fn it calls belong to the main loop */
+    if (client->conn_ctx) {
+        aio_co_reschedule_self(qemu_get_aio_context());
+    }
     client_close(client, true);
     nbd_client_put(client);
 }
 
 static void nbd_client_receive_next_request(NBDClient *client)
 {
+    AioContext *ctx = client->conn_ctx ?: client->exp->common.ctx;
+
+    QEMU_LOCK_GUARD(&client->lock);
     if (!client->recv_coroutine && client->nb_requests < MAX_NBD_REQUESTS &&
         !client->quiescing) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(ctx, client->recv_coroutine);
     }
 }
 
@@ -2732,6 +3157,8 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    client->zero_copy = client->ioc == QIO_CHANNEL(client->sioc);
+
     nbd_client_receive_next_request(client);
 }
 
@@ -2750,6 +3177,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     client->refcount = 1;
+    qemu_mutex_init(&client->lock);
     client->tlscreds = tlscreds;
     if (tlscreds) {
         object_ref(OBJECT(client->tlscreds));
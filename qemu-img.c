@@ -86,6 +86,9 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_COMPRESSION_LEVEL = 278,
+    OPTION_COMPRESS_THREADS = 279,
+    OPTION_STATS = 280,
 };
 
 typedef enum OutputFormat {
@@ -1658,9 +1661,44 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/*
+ * Block status is discovered in stripes of this many sectors (1 GiB), so
+ * that it can be queried for several stripes in parallel.  Must be a
+ * multiple of any cluster size.
+ */
+#define CONVERT_STRIPE_SECTORS (1 * GiB / BDRV_SECTOR_SIZE)
+
+typedef struct ConvertExtent {
+    int64_t sector_num;
+    int64_t nb_sectors;
+    enum ImgConvertBlockStatus status;
+} ConvertExtent;
+
+typedef struct ConvertStripe {
+    /* Extents covering the stripe, adjacent ones never have equal status */
+    GArray *extents;
+
+    /* Block status cache used by convert_iteration_sectors() */
+    enum ImgConvertBlockStatus status;
+    int64_t sector_next_status;
+    int64_t end;
+} ConvertStripe;
+
+/* Per-stage statistics, printed with --stats */
+typedef struct ConvertStats {
+    int64_t start_ns;
+    int64_t discover_ns;        /* wall clock time of block status discovery */
+    uint64_t extents;
+    uint64_t read_bytes;
+    int64_t read_ns;            /* summed over all coroutines */
+    uint64_t write_bytes;       /* including zeroed and skipped ranges */
+    int64_t write_ns;
+    int64_t order_wait_ns;      /* time spent waiting for in-order writes */
+} ConvertStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1671,11 +1709,10 @@ typedef struct ImgConvertState {
     int64_t allocated_done;
     int64_t sector_num;
     int64_t wr_offs;
-    enum ImgConvertBlockStatus status;
-    int64_t sector_next_status;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
+    bool compress_multi_cluster; /* can write several clusters at once */
     bool target_is_new;
     bool target_has_backing;
     int64_t target_backing_sectors; /* negative if unknown */
@@ -1693,6 +1730,15 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+
+    ConvertStripe *stripes;
+    int64_t nb_stripes;
+    int64_t discover_stripe;    /* next stripe to discover */
+    int64_t copy_stripe;        /* stripe and extent that the copy is at */
+    guint copy_extent;
+
+    bool print_stats;
+    ConvertStats stats;
 } ImgConvertState;
 
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
@@ -1707,7 +1753,8 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
-static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+static int convert_iteration_sectors(ImgConvertState *s,
+                                     ConvertStripe *stripe, int64_t sector_num)
 {
     int64_t src_cur_offset;
     int ret, n, src_cur;
@@ -1715,8 +1762,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 
     convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
 
-    assert(s->total_sectors > sector_num);
-    n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
+    assert(stripe->end > sector_num);
+    n = MIN(stripe->end - sector_num, BDRV_REQUEST_MAX_SECTORS);
 
     if (s->target_backing_sectors >= 0) {
         if (sector_num >= s->target_backing_sectors) {
@@ -1728,7 +1775,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (stripe->sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1773,7 +1820,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
 
         /*
-         * Avoid that s->sector_next_status becomes unaligned to the source
+         * Avoid that stripe->sector_next_status becomes unaligned to the source
          * request alignment and/or cluster size to avoid unnecessary read
          * cycles.
          */
@@ -1783,18 +1830,19 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         if (ret & BDRV_BLOCK_ZERO) {
-            s->status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
+            stripe->status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
         } else if (ret & BDRV_BLOCK_DATA) {
-            s->status = BLK_DATA;
+            stripe->status = BLK_DATA;
         } else {
-            s->status = s->target_has_backing ? BLK_BACKING_FILE : BLK_DATA;
+            stripe->status = s->target_has_backing ? BLK_BACKING_FILE
+                                                   : BLK_DATA;
         }
 
-        s->sector_next_status = sector_num + n;
+        stripe->sector_next_status = sector_num + n;
     }
 
-    n = MIN(n, s->sector_next_status - sector_num);
-    if (s->status == BLK_DATA) {
+    n = MIN(n, stripe->sector_next_status - sector_num);
+    if (stripe->status == BLK_DATA) {
         n = MIN(n, s->buf_sectors);
     }
 
@@ -1804,7 +1852,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
     if (s->compressed) {
         if (n < s->cluster_sectors) {
             n = MIN(s->cluster_sectors, s->total_sectors - sector_num);
-            s->status = BLK_DATA;
+            stripe->status = BLK_DATA;
         } else {
             n = QEMU_ALIGN_DOWN(n, s->cluster_sectors);
         }
@@ -1813,6 +1861,119 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
     return n;
 }
 
+/*
+ * Discover the block status of whole stripes until there are none left.
+ * Several of these run in parallel, each on its own stripes.
+ */
+static void coroutine_fn convert_co_discover(void *opaque)
+{
+    ImgConvertState *s = opaque;
+
+    s->running_coroutines++;
+    while (s->ret == -EINPROGRESS && s->discover_stripe < s->nb_stripes) {
+        ConvertStripe *stripe = &s->stripes[s->discover_stripe];
+        int64_t sector_num = s->discover_stripe * CONVERT_STRIPE_SECTORS;
+
+        s->discover_stripe++;
+        stripe->extents = g_array_new(false, false, sizeof(ConvertExtent));
+        stripe->end = MIN(sector_num + CONVERT_STRIPE_SECTORS,
+                          s->total_sectors);
+        stripe->sector_next_status = 0;
+
+        while (sector_num < stripe->end) {
+            ConvertExtent *last = NULL;
+            int n;
+
+            WITH_GRAPH_RDLOCK_GUARD() {
+                n = convert_iteration_sectors(s, stripe, sector_num);
+            }
+            if (n < 0) {
+                s->ret = n;
+                break;
+            }
+
+            if (stripe->extents->len) {
+                last = &g_array_index(stripe->extents, ConvertExtent,
+                                      stripe->extents->len - 1);
+            }
+            if (last && last->status == stripe->status) {
+                last->nb_sectors += n;
+            } else {
+                ConvertExtent extent = {
+                    .sector_num = sector_num,
+                    .nb_sectors = n,
+                    .status = stripe->status,
+                };
+                g_array_append_val(stripe->extents, extent);
+            }
+
+            if (stripe->status == BLK_DATA ||
+                (!s->min_sparse && stripe->status == BLK_ZERO)) {
+                s->allocated_sectors += n;
+            }
+            sector_num += n;
+        }
+        s->stats.extents += stripe->extents->len;
+    }
+    s->running_coroutines--;
+}
+
+/*
+ * Return the next range to copy, starting at s->sector_num, and its status.
+ * Ranges that need a buffer are limited to s->buf_sectors.
+ */
+static int convert_next_extent(ImgConvertState *s,
+                               enum ImgConvertBlockStatus *status)
+{
+    ConvertStripe *stripe = &s->stripes[s->copy_stripe];
+    ConvertExtent *extent;
+    int64_t n;
+
+    extent = &g_array_index(stripe->extents, ConvertExtent, s->copy_extent);
+    assert(s->sector_num >= extent->sector_num &&
+           s->sector_num < extent->sector_num + extent->nb_sectors);
+
+    n = extent->sector_num + extent->nb_sectors - s->sector_num;
+    n = MIN(n, BDRV_REQUEST_MAX_SECTORS);
+    *status = extent->status;
+    if (extent->status == BLK_DATA ||
+        (!s->min_sparse && extent->status == BLK_ZERO)) {
+        n = MIN(n, s->buf_sectors);
+    }
+
+    if (s->sector_num + n == extent->sector_num + extent->nb_sectors) {
+        if (++s->copy_extent == stripe->extents->len) {
+            s->copy_stripe++;
+            s->copy_extent = 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * Returns true if the first cluster of @buf contains data, false if it is
+ * zeroed.  *pnum is set to the number of sectors of the following whole
+ * clusters that are the same in this respect.
+ */
+static bool is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                  int cluster_sectors)
+{
+    bool is_zero;
+    int i;
+
+    is_zero = buffer_is_zero(buf, MIN(n, cluster_sectors) * BDRV_SECTOR_SIZE);
+    for (i = cluster_sectors; i < n; i += cluster_sectors) {
+        int len = MIN(n - i, cluster_sectors) * BDRV_SECTOR_SIZE;
+
+        if (buffer_is_zero(buf + i * BDRV_SECTOR_SIZE, len) != is_zero) {
+            break;
+        }
+    }
+
+    *pnum = MIN(i, n);
+    return !is_zero;
+}
+
 static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
                                         int nb_sectors, uint8_t *buf)
 {
@@ -1897,7 +2058,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
                 (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                 is_allocated_clusters(buf, n, &n, s->cluster_sectors)))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
@@ -1982,7 +2143,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 
     while (1) {
         int n;
-        int64_t sector_num;
+        int64_t sector_num, start_ns;
         enum ImgConvertBlockStatus status;
         bool copy_range;
 
@@ -1991,20 +2152,9 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
             qemu_co_mutex_unlock(&s->lock);
             break;
         }
-        WITH_GRAPH_RDLOCK_GUARD() {
-            n = convert_iteration_sectors(s, s->sector_num);
-        }
-        if (n < 0) {
-            qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
-            break;
-        }
         /* save current sector and allocation status to local variables */
         sector_num = s->sector_num;
-        status = s->status;
-        if (!s->min_sparse && s->status == BLK_ZERO) {
-            n = MIN(n, s->buf_sectors);
-        }
+        n = convert_next_extent(s, &status);
         /* increment global sector counter so that other coroutines can
          * already continue reading beyond this request */
         s->sector_num += n;
@@ -2017,9 +2167,13 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
 retry:
-        copy_range = s->copy_range && s->status == BLK_DATA;
+        copy_range = s->copy_range && status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             ret = convert_co_read(s, sector_num, n, buf);
+            s->stats.read_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                start_ns;
+            s->stats.read_bytes += n * BDRV_SECTOR_SIZE;
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2031,15 +2185,23 @@ retry:
         }
 
         if (s->wr_in_order) {
-            /* keep writes in order */
+            /*
+             * Keep writes in order.  Coroutines that are done reading wait
+             * here, so this is also what bounds the read-ahead to
+             * num_coroutines buffers.
+             */
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+            s->stats.order_wait_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                      start_ns;
         }
 
         if (s->ret == -EINPROGRESS) {
+            start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             if (copy_range) {
                 WITH_GRAPH_RDLOCK_GUARD() {
                     ret = convert_co_copy_range(s, sector_num, n);
@@ -2051,6 +2213,9 @@ retry:
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
+            s->stats.write_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                 start_ns;
+            s->stats.write_bytes += n * BDRV_SECTOR_SIZE;
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2085,10 +2250,44 @@ retry:
     }
 }
 
+static void convert_print_rate(const char *stage, uint64_t bytes,
+                               int64_t busy_ns)
+{
+    g_autofree char *size = size_to_str(bytes);
+
+    printf("%-8s %12s in %10.3f s busy", stage, size,
+           (double)busy_ns / NANOSECONDS_PER_SECOND);
+    if (busy_ns > 0) {
+        printf(", %10.1f MiB/s per coroutine",
+               (double)bytes / MiB * NANOSECONDS_PER_SECOND / busy_ns);
+    }
+    printf("\n");
+}
+
+static void convert_print_stats(ImgConvertState *s)
+{
+    int64_t total_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                       s->stats.start_ns;
+    uint64_t total_bytes = s->total_sectors * BDRV_SECTOR_SIZE;
+
+    printf("Block status: %" PRId64 " stripes, %" PRIu64 " extents in "
+           "%.3f s\n", s->nb_stripes, s->stats.extents,
+           (double)s->stats.discover_ns / NANOSECONDS_PER_SECOND);
+    convert_print_rate("Read:", s->stats.read_bytes, s->stats.read_ns);
+    convert_print_rate("Write:", s->stats.write_bytes, s->stats.write_ns);
+    if (s->wr_in_order) {
+        printf("Waiting for in-order writes: %.3f s\n",
+               (double)s->stats.order_wait_ns / NANOSECONDS_PER_SECOND);
+    }
+    printf("Total: %.3f s, %.1f MiB/s\n",
+           (double)total_ns / NANOSECONDS_PER_SECOND,
+           total_ns ? (double)total_bytes / MiB * NANOSECONDS_PER_SECOND /
+                      total_ns : 0.0);
+}
+
 static int convert_do_copy(ImgConvertState *s)
 {
-    int ret, i, n;
-    int64_t sector_num = 0;
+    int ret, i;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2096,32 +2295,46 @@ static int convert_do_copy(ImgConvertState *s)
         s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data.  For compressed images, buffers
+     * consist of whole clusters.  Unless the target can compress several
+     * clusters of a request in parallel, only one cluster can be copied at
+     * a time.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
-    }
-
-    while (sector_num < s->total_sectors) {
-        n = convert_iteration_sectors(s, sector_num);
-        if (n < 0) {
-            return n;
-        }
-        if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
-        {
-            s->allocated_sectors += n;
+        if (s->compress_multi_cluster) {
+            s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors,
+                                             s->cluster_sectors);
+        } else {
+            s->buf_sectors = s->cluster_sectors;
         }
-        sector_num += n;
     }
 
-    /* Do the copy */
-    s->sector_next_status = 0;
+    s->stats.start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     s->ret = -EINPROGRESS;
 
+    /* Discover the block status of the whole source, in parallel */
+    s->nb_stripes = DIV_ROUND_UP(s->total_sectors, CONVERT_STRIPE_SECTORS);
+    s->stripes = g_new0(ConvertStripe, s->nb_stripes);
+    for (i = 0; i < s->num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(convert_co_discover, s);
+        qemu_coroutine_enter(co);
+    }
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+    s->stats.discover_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                           s->stats.start_ns;
+    if (s->ret != -EINPROGRESS) {
+        ret = s->ret;
+        goto out;
+    }
+
+    /* Do the copy */
     qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
@@ -2133,15 +2346,27 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
-    if (s->compressed && !s->ret) {
+    ret = s->ret;
+    if (s->compressed && !ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
-        if (ret < 0) {
-            return ret;
+        if (ret > 0) {
+            ret = 0;
         }
     }
 
-    return s->ret;
+    if (!ret && s->print_stats && !s->quiet) {
+        convert_print_stats(s);
+    }
+
+out:
+    for (i = 0; i < s->nb_stripes; i++) {
+        if (s->stripes[i].extents) {
+            g_array_free(s->stripes[i].extents, true);
+        }
+    }
+    g_free(s->stripes);
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
@@ -2243,6 +2468,8 @@ static int img_convert(int argc, char **argv)
     bool bitmaps = false;
     bool skip_broken = false;
     int64_t rate_limit = 0;
+    int compression_level = 0;
+    int compress_threads = 0;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2264,6 +2491,11 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"compression-level", required_argument, 0,
+             OPTION_COMPRESSION_LEVEL},
+            {"compress-threads", required_argument, 0,
+             OPTION_COMPRESS_THREADS},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2398,6 +2630,24 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_COMPRESSION_LEVEL:
+            if (qemu_strtoi(optarg, NULL, 0, &compression_level) ||
+                compression_level < 1) {
+                error_report("Invalid compression level '%s'", optarg);
+                goto fail_getopt;
+            }
+            break;
+        case OPTION_COMPRESS_THREADS:
+            if (qemu_strtoi(optarg, NULL, 0, &compress_threads) ||
+                compress_threads < 1) {
+                error_report("Invalid number of compression threads '%s'",
+                             optarg);
+                goto fail_getopt;
+            }
+            break;
+        case OPTION_STATS:
+            s.print_stats = true;
+            break;
         }
     }
 
@@ -2405,6 +2655,19 @@ static int img_convert(int argc, char **argv)
         out_fmt = "raw";
     }
 
+    if ((compression_level || compress_threads) && !s.compressed) {
+        error_report("--compression-level and --compress-threads require -c");
+        goto fail_getopt;
+    }
+
+    if ((compression_level || compress_threads) && tgt_image_opts) {
+        error_report("--compression-level and --compress-threads cannot be "
+                     "used with --target-image-opts, use the "
+                     "compression-level and compress-threads image options "
+                     "instead");
+        goto fail_getopt;
+    }
+
     if (skip_broken && !bitmaps) {
         error_report("Use of --skip-broken-bitmaps requires --bitmaps");
         goto fail_getopt;
@@ -2682,7 +2945,20 @@ static int img_convert(int argc, char **argv)
         flags |= BDRV_O_RESIZE;
     }
 
-    if (skip_create) {
+    /* Compression parameters are runtime options of the target format */
+    if (compression_level || compress_threads) {
+        if (!open_opts) {
+            open_opts = qdict_new();
+        }
+        if (compression_level) {
+            qdict_put_int(open_opts, "compression-level", compression_level);
+        }
+        if (compress_threads) {
+            qdict_put_int(open_opts, "compress-threads", compress_threads);
+        }
+    }
+
+    if (skip_create && !open_opts) {
         s.target = img_open(tgt_image_opts, out_filename, out_fmt,
                             flags, writethrough, s.quiet, false);
     } else {
@@ -2714,6 +2990,13 @@ static int img_convert(int argc, char **argv)
         goto out;
     }
 
+    /*
+     * Drivers that take compressed writes in parts compress the clusters
+     * of a longer request in parallel, so they get whole buffers.
+     */
+    s.compress_multi_cluster =
+        bdrv_skip_filters(out_bs)->drv->bdrv_co_pwritev_compressed_part != NULL;
+
     /* increase bufsectors from the default 4096 (2M) if opt_transfer
      * or discard_alignment of the out_bs is greater. Limit to
      * MAX_BUF_SECTORS as maximum which is currently 32768 (16MB). */
@@ -0,0 +1,158 @@
+/*
+ * query-stats provider for block backends and block nodes
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+#include "block/block_int.h"
+#include "hw/qdev-core.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/stats.h"
+
+typedef struct BlockStatDesc {
+    const char *name;
+    enum BlockAcctType type;
+    double percentile; /* or 0 for the whole histogram */
+} BlockStatDesc;
+
+#define LATENCY_STATS(prefix_, type_) \
+    { prefix_ "-latency", BLOCK_ACCT_##type_, 0 }, \
+    { prefix_ "-latency-p50", BLOCK_ACCT_##type_, 50 }, \
+    { prefix_ "-latency-p90", BLOCK_ACCT_##type_, 90 }, \
+    { prefix_ "-latency-p99", BLOCK_ACCT_##type_, 99 }, \
+    { prefix_ "-latency-p99.9", BLOCK_ACCT_##type_, 99.9 }
+
+static const BlockStatDesc block_stats[] = {
+    LATENCY_STATS("read", READ),
+    LATENCY_STATS("write", WRITE),
+    LATENCY_STATS("flush", FLUSH),
+    LATENCY_STATS("discard", UNMAP),
+};
+
+#undef LATENCY_STATS
+
+static StatsValue *block_stat_value(BlockLatencyStats *lat,
+                                    const BlockStatDesc *desc)
+{
+    StatsValue *value = g_new0(StatsValue, 1);
+
+    if (desc->percentile) {
+        value->type = QTYPE_QNUM;
+        value->u.scalar = block_latency_percentile(lat, desc->type,
+                                                   desc->percentile);
+    } else {
+        uint64_t buckets[BLOCK_LATENCY_LOG2_BUCKETS];
+        uint64List **tail = &value->u.list;
+        int i;
+
+        block_latency_log2(lat, desc->type, buckets);
+        value->type = QTYPE_QLIST;
+        for (i = 0; i < BLOCK_LATENCY_LOG2_BUCKETS; i++) {
+            QAPI_LIST_APPEND(tail, buckets[i]);
+        }
+    }
+    return value;
+}
+
+/* Takes ownership of @qom_path */
+static void block_stats_add(StatsResultList **result, BlockLatencyStats *lat,
+                            strList *names, char *qom_path,
+                            const char *device, const char *node_name)
+{
+    StatsList *stats_list = NULL;
+    StatsResult *entry;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(block_stats); i++) {
+        const BlockStatDesc *desc = &block_stats[i];
+        Stats *stats;
+
+        if (!apply_str_list_filter(desc->name, names)) {
+            continue;
+        }
+
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(desc->name);
+        stats->value = block_stat_value(lat, desc);
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (!stats_list) {
+        g_free(qom_path);
+        return;
+    }
+
+    entry = g_new0(StatsResult, 1);
+    entry->provider = STATS_PROVIDER_BLOCK;
+    entry->qom_path = qom_path;
+    entry->device = g_strdup(device);
+    entry->node_name = g_strdup(node_name);
+    entry->stats = stats_list;
+    QAPI_LIST_PREPEND(*result, entry);
+}
+
+static void block_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    BlockBackend *blk = NULL;
+    BlockDriverState *bs = NULL;
+
+    GLOBAL_STATE_CODE();
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+
+    while ((blk = blk_all_next(blk))) {
+        DeviceState *dev = blk_get_attached_dev(blk);
+        const char *name = blk_name(blk);
+
+        /* Skip the anonymous backends of block jobs and exports */
+        if (!dev && !*name) {
+            continue;
+        }
+        block_stats_add(result, &blk_get_stats(blk)->latency, names,
+                        dev ? object_get_canonical_path(OBJECT(dev)) : NULL,
+                        *name ? name : NULL, NULL);
+    }
+
+    while ((bs = bdrv_next_node(bs))) {
+        block_stats_add(result, &bs->latency, names, NULL, NULL,
+                        bdrv_get_node_name(bs));
+    }
+}
+
+static void block_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(block_stats); i++) {
+        const BlockStatDesc *desc = &block_stats[i];
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(desc->name);
+        value->type = desc->percentile ? STATS_TYPE_INSTANT :
+                                         STATS_TYPE_LOG2_HISTOGRAM;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+        QAPI_LIST_PREPEND(list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK, list);
+}
+
+static void block_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_stats_cb,
+                        block_schemas_cb);
+}
+
+type_init(block_stats_register)
@@ -0,0 +1,157 @@
+/*
+ * query-stats provider for iothreads
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qom/object.h"
+#include "block/aio.h"
+#include "sysemu/iothread.h"
+#include "sysemu/stats.h"
+
+typedef struct IOThreadStatDesc {
+    const char *name;
+    StatsType type;
+    bool nanoseconds;
+    size_t offset; /* of the Stat64 (or bucket array) in AioPollStats */
+} IOThreadStatDesc;
+
+#define STAT(name_, type_, ns_, field_) { \
+    .name = name_, .type = STATS_TYPE_##type_, .nanoseconds = ns_, \
+    .offset = offsetof(AioPollStats, field_), \
+}
+
+static const IOThreadStatDesc iothread_stats[] = {
+    STAT("poll-hits", CUMULATIVE, false, hits),
+    STAT("poll-misses", CUMULATIVE, false, misses),
+    STAT("poll-grow", CUMULATIVE, false, grow),
+    STAT("poll-shrink", CUMULATIVE, false, shrink),
+    STAT("poll-time", INSTANT, true, max_ns),
+    STAT("poll-active-handlers", INSTANT, false, active),
+    STAT("poll-event-interval", LOG2_HISTOGRAM, true, interval_hist),
+    STAT("poll-time-decisions", LOG2_HISTOGRAM, true, poll_ns_hist),
+};
+
+#undef STAT
+
+static StatsValue *iothread_stat_value(const AioPollStats *poll_stats,
+                                       const IOThreadStatDesc *desc)
+{
+    const Stat64 *stat = (const Stat64 *)((const char *)poll_stats +
+                                          desc->offset);
+    StatsValue *value = g_new0(StatsValue, 1);
+
+    if (desc->type == STATS_TYPE_LOG2_HISTOGRAM) {
+        uint64List **tail = &value->u.list;
+        int i;
+
+        value->type = QTYPE_QLIST;
+        for (i = 0; i < AIO_POLL_HIST_BUCKETS; i++) {
+            QAPI_LIST_APPEND(tail, stat64_get(&stat[i]));
+        }
+    } else {
+        value->type = QTYPE_QNUM;
+        value->u.scalar = stat64_get(stat);
+    }
+    return value;
+}
+
+typedef struct IOThreadStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} IOThreadStatsArgs;
+
+static int iothread_stats_query(Object *obj, void *opaque)
+{
+    IOThreadStatsArgs *args = opaque;
+    const AioPollStats *poll_stats;
+    StatsList *stats_list = NULL;
+    IOThread *iothread;
+    AioContext *ctx;
+    int i;
+
+    iothread = (IOThread *)object_dynamic_cast(obj, TYPE_IOTHREAD);
+    if (!iothread) {
+        return 0;
+    }
+
+    ctx = iothread_get_aio_context(iothread);
+    if (!ctx) {
+        return 0;
+    }
+    poll_stats = aio_context_get_poll_stats(ctx);
+
+    for (i = 0; i < ARRAY_SIZE(iothread_stats); i++) {
+        const IOThreadStatDesc *desc = &iothread_stats[i];
+        Stats *stats;
+
+        if (!apply_str_list_filter(desc->name, args->names)) {
+            continue;
+        }
+
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(desc->name);
+        stats->value = iothread_stat_value(poll_stats, desc);
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+
+    if (stats_list) {
+        g_autofree char *qom_path = object_get_canonical_path(obj);
+
+        add_stats_entry(args->result, STATS_PROVIDER_IOTHREAD, qom_path,
+                        stats_list);
+    }
+    return 0;
+}
+
+static void iothread_stats_cb(StatsResultList **result, StatsTarget target,
+                              strList *names, strList *targets, Error **errp)
+{
+    IOThreadStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_IOTHREAD) {
+        return;
+    }
+
+    object_child_foreach(object_get_objects_root(), iothread_stats_query,
+                         &args);
+}
+
+static void iothread_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(iothread_stats); i++) {
+        const IOThreadStatDesc *desc = &iothread_stats[i];
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(desc->name);
+        value->type = desc->type;
+        if (desc->nanoseconds) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_IOTHREAD, STATS_TARGET_IOTHREAD,
+                     list);
+}
+
+static void iothread_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_IOTHREAD, iothread_stats_cb,
+                        iothread_schemas_cb);
+}
+
+type_init(iothread_stats_register)
@@ -91,6 +91,14 @@ static void print_stats_results(Monitor *mon, StatsTarget target,
         monitor_printf(mon, "provider: %s\n",
                        StatsProvider_str(result->provider));
     }
+    if (target == STATS_TARGET_BLOCK) {
+        if (result->node_name) {
+            monitor_printf(mon, "node: %s\n", result->node_name);
+        } else {
+            monitor_printf(mon, "device: %s\n",
+                           result->device ?: result->qom_path);
+        }
+    }
 
     for (stats_list = result->stats; stats_list;
              stats_list = stats_list->next,
@@ -156,6 +164,8 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
         break;
     }
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_IOTHREAD:
+    case STATS_TARGET_BLOCK:
         break;
     default:
         break;
@@ -229,6 +239,8 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_IOTHREAD:
+    case STATS_TARGET_BLOCK:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
@@ -0,0 +1,12 @@
+#include "qemu/osdep.h"
+#include "sysemu/iothread.h"
+
+IOThread *iothread_by_id(const char *id)
+{
+    return NULL;
+}
+
+AioContext *iothread_get_aio_context(IOThread *iothread)
+{
+    abort();
+}
@@ -0,0 +1,203 @@
+/*
+ * HBitmap range operation benchmark
+ *
+ * Times the operations that backup, mirror and dirty bitmap migration
+ * run over whole disks: walking all dirty areas, looking for the next
+ * clean cluster, setting and resetting huge ranges, and merging bitmaps.
+ * Bitmaps track disks of 1 and 16 TiB at the default 64 KiB dirty bitmap
+ * granularity, either sparsely dirty (one cluster per GiB) or densely
+ * dirty (everything but one cluster per 16 MiB).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/hbitmap.h"
+
+#define BENCH_GRANULARITY_BITS 16
+#define BENCH_CLUSTER_SIZE (1ULL << BENCH_GRANULARITY_BITS)
+#define BENCH_SPARSE_STEP GiB
+#define BENCH_DENSE_STEP (16 * MiB)
+#define BENCH_REPEAT 8
+
+typedef struct HBitmapBench {
+    uint64_t disk_size;
+    bool dense;
+} HBitmapBench;
+
+static void bench_bitmap_fill(HBitmap *hb, const HBitmapBench *hbb,
+                              uint64_t phase)
+{
+    uint64_t offset;
+
+    if (hbb->dense) {
+        hbitmap_set(hb, 0, hbb->disk_size);
+        for (offset = phase; offset < hbb->disk_size;
+             offset += BENCH_DENSE_STEP) {
+            hbitmap_reset(hb, offset, BENCH_CLUSTER_SIZE);
+        }
+    } else {
+        for (offset = phase; offset < hbb->disk_size;
+             offset += BENCH_SPARSE_STEP) {
+            hbitmap_set(hb, offset, BENCH_CLUSTER_SIZE);
+        }
+    }
+}
+
+static HBitmap *bench_bitmap_new(const HBitmapBench *hbb, uint64_t phase)
+{
+    HBitmap *hb = hbitmap_alloc(hbb->disk_size, BENCH_GRANULARITY_BITS);
+
+    bench_bitmap_fill(hb, hbb, phase);
+    return hb;
+}
+
+static void bench_print(const char *op, const HBitmapBench *hbb,
+                        int64_t elapsed, uint64_t n, const char *unit)
+{
+    printf("%-16s %4" PRIu64 " TiB %-6s: %10.3f ms  %10.1f ns/%s\n",
+           op, hbb->disk_size / TiB, hbb->dense ? "dense" : "sparse",
+           (double)elapsed / 1000, n ? (double)elapsed * 1000 / n : 0.0,
+           unit);
+}
+
+/* Walk all dirty areas, like block jobs do */
+static void bench_iter(gconstpointer opaque)
+{
+    const HBitmapBench *hbb = opaque;
+    HBitmap *hb = bench_bitmap_new(hbb, 0);
+    int64_t start, elapsed, offset, count;
+    uint64_t areas = 0;
+    int i;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_REPEAT; i++) {
+        for (offset = 0;
+             hbitmap_next_dirty_area(hb, offset, hbb->disk_size, INT64_MAX,
+                                     &offset, &count);
+             offset += count) {
+            areas++;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    g_assert_cmpint(areas, ==, BENCH_REPEAT *
+                    (hbb->dense ? hbb->disk_size / BENCH_DENSE_STEP :
+                                  hbb->disk_size / BENCH_SPARSE_STEP));
+    bench_print("next_dirty_area", hbb, elapsed / BENCH_REPEAT,
+                areas / BENCH_REPEAT, "area");
+    hbitmap_free(hb);
+}
+
+/* Walk all clean clusters of a densely dirty bitmap */
+static void bench_next_zero(gconstpointer opaque)
+{
+    const HBitmapBench *hbb = opaque;
+    HBitmap *hb = bench_bitmap_new(hbb, 0);
+    int64_t start, elapsed, offset;
+    uint64_t clean = 0;
+    int i;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_REPEAT; i++) {
+        for (offset = 0;
+             (offset = hbitmap_next_zero(hb, offset,
+                                         hbb->disk_size - offset)) >= 0;
+             offset += BENCH_CLUSTER_SIZE) {
+            clean++;
+        }
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    g_assert_cmpint(clean, ==,
+                    BENCH_REPEAT * (hbb->disk_size / BENCH_DENSE_STEP));
+    bench_print("next_zero", hbb, elapsed / BENCH_REPEAT,
+                hbb->disk_size / BENCH_CLUSTER_SIZE, "cluster");
+    hbitmap_free(hb);
+}
+
+/* Mark the whole disk dirty and clean it again */
+static void bench_set_reset(gconstpointer opaque)
+{
+    const HBitmapBench *hbb = opaque;
+    HBitmap *hb = hbitmap_alloc(hbb->disk_size, BENCH_GRANULARITY_BITS);
+    int64_t start, elapsed = 0;
+    int i;
+
+    for (i = 0; i < BENCH_REPEAT; i++) {
+        bench_bitmap_fill(hb, hbb, 0);
+        start = g_get_monotonic_time();
+        hbitmap_set(hb, 0, hbb->disk_size);
+        hbitmap_reset(hb, 0, hbb->disk_size);
+        elapsed += g_get_monotonic_time() - start;
+    }
+
+    g_assert(hbitmap_empty(hb));
+    bench_print("set+reset", hbb, elapsed / BENCH_REPEAT,
+                hbb->disk_size / BENCH_CLUSTER_SIZE, "cluster");
+    hbitmap_free(hb);
+}
+
+/* Merge two bitmaps with the same pattern at different offsets */
+static void bench_merge(gconstpointer opaque)
+{
+    const HBitmapBench *hbb = opaque;
+    HBitmap *a = bench_bitmap_new(hbb, 0);
+    HBitmap *b = bench_bitmap_new(hbb, BENCH_CLUSTER_SIZE);
+    HBitmap *result = hbitmap_alloc(hbb->disk_size, BENCH_GRANULARITY_BITS);
+    int64_t start, elapsed;
+    int i;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_REPEAT; i++) {
+        hbitmap_merge(a, b, result);
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    g_assert_cmpint(hbitmap_count(result), ==,
+                    hbb->dense ? hbb->disk_size :
+                    hbb->disk_size / BENCH_SPARSE_STEP * 2 *
+                    BENCH_CLUSTER_SIZE);
+    bench_print("merge", hbb, elapsed / BENCH_REPEAT,
+                hbb->disk_size / BENCH_CLUSTER_SIZE, "cluster");
+    hbitmap_free(result);
+    hbitmap_free(b);
+    hbitmap_free(a);
+}
+
+int main(int argc, char **argv)
+{
+    static const uint64_t sizes[] = { 1 * TiB, 16 * TiB };
+    static const struct {
+        const char *name;
+        GTestDataFunc fn;
+        bool dense_only;
+    } benchs[] = {
+        { "iter", bench_iter },
+        { "next-zero", bench_next_zero, true },
+        { "set-reset", bench_set_reset },
+        { "merge", bench_merge },
+    };
+    int i, j, dense;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(benchs); i++) {
+        for (j = 0; j < ARRAY_SIZE(sizes); j++) {
+            for (dense = benchs[i].dense_only; dense <= 1; dense++) {
+                HBitmapBench *hbb = g_new(HBitmapBench, 1);
+                g_autofree char *path = NULL;
+
+                hbb->disk_size = sizes[j];
+                hbb->dense = dense;
+                path = g_strdup_printf("/hbitmap/%s/%" PRIu64 "T/%s",
+                                       benchs[i].name, sizes[j] / TiB,
+                                       dense ? "dense" : "sparse");
+                g_test_add_data_func_full(path, hbb, benchs[i].fn, g_free);
+            }
+        }
+    }
+
+    return g_test_run();
+}
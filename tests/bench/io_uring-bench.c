@@ -0,0 +1,174 @@
+/*
+ * io_uring vs. linux-aio benchmark
+ *
+ * Runs random 4k reads with O_DIRECT through the file driver at a fixed
+ * queue depth, with aio=native and with aio=io_uring with and without
+ * fixed files and fixed buffers, and reports the IOPS of each.  By
+ * default the reads go to a temporary file, which needs a filesystem
+ * that supports O_DIRECT (i.e. not tmpfs); an existing file or block
+ * device can be passed as argument instead, it is only read from.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/units.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+
+#define BENCH_FILE_SIZE (256 * MiB)
+#define BENCH_REQ_SIZE (4 * KiB)
+#define BENCH_QUEUE_DEPTH 32
+#define BENCH_REQUESTS (256 * 1024)
+
+static char *image_path;
+static int64_t image_size;
+
+typedef struct AioBench {
+    const char *name;
+    const char *aio;
+    bool fixed_files;
+    bool fixed_buffers;
+} AioBench;
+
+typedef struct BenchState {
+    BlockBackend *blk;
+    uint8_t *buf;
+    int remaining;
+    int running;
+} BenchState;
+
+static void coroutine_fn bench_read_co(void *opaque)
+{
+    BenchState *b = opaque;
+    /* Each coroutine uses a slot of the buffer of its own */
+    uint8_t *buf = b->buf + (b->running - 1) * BENCH_REQ_SIZE;
+
+    while (b->remaining > 0) {
+        int64_t offset = g_test_rand_int_range(0, image_size / BENCH_REQ_SIZE) *
+                         BENCH_REQ_SIZE;
+        int ret;
+
+        b->remaining--;
+        ret = blk_co_pread(b->blk, offset, BENCH_REQ_SIZE, buf,
+                           BDRV_REQ_REGISTERED_BUF);
+        g_assert(ret == 0);
+    }
+    b->running--;
+}
+
+static void bench_aio(gconstpointer opaque)
+{
+    const AioBench *ab = opaque;
+    size_t buf_size = BENCH_QUEUE_DEPTH * BENCH_REQ_SIZE;
+    BenchState b = { .remaining = BENCH_REQUESTS };
+    Error *local_err = NULL;
+    QDict *options;
+    int64_t start, elapsed;
+    int i;
+
+    options = qdict_new();
+    qdict_put_str(options, "driver", "file");
+    qdict_put_str(options, "filename", image_path);
+    qdict_put_str(options, "aio", ab->aio);
+    qdict_put_str(options, "cache.direct", "on");
+    qdict_put_bool(options, "io-uring-fixed-files", ab->fixed_files);
+    qdict_put_bool(options, "io-uring-fixed-buffers", ab->fixed_buffers);
+    b.blk = blk_new_open(NULL, NULL, options, 0, &local_err);
+    if (!b.blk) {
+        g_test_skip(error_get_pretty(local_err));
+        error_free(local_err);
+        return;
+    }
+
+    b.buf = qemu_memalign(4096, buf_size);
+    blk_register_buf(b.blk, b.buf, buf_size, &error_abort);
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_QUEUE_DEPTH; i++) {
+        b.running++;
+        qemu_coroutine_enter(qemu_coroutine_create(bench_read_co, &b));
+    }
+    while (b.running) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    printf("%-28s %8.0f IOPS\n", ab->name,
+           (double)BENCH_REQUESTS * G_USEC_PER_SEC / elapsed);
+
+    blk_unregister_buf(b.blk, b.buf, buf_size);
+    qemu_vfree(b.buf);
+    blk_unref(b.blk);
+}
+
+static void create_image(void)
+{
+    g_autofree uint8_t *buf = g_malloc(1 * MiB);
+    int64_t offset;
+    int fd;
+
+    fd = g_file_open_tmp("io_uring-bench-XXXXXX", &image_path, NULL);
+    g_assert(fd >= 0);
+
+    /* Actual data, reads from holes would not reach the disk */
+    memset(buf, 0xa5, 1 * MiB);
+    for (offset = 0; offset < BENCH_FILE_SIZE; offset += 1 * MiB) {
+        g_assert(pwrite(fd, buf, 1 * MiB, offset) == 1 * MiB);
+    }
+    fsync(fd);
+    close(fd);
+    image_size = BENCH_FILE_SIZE;
+}
+
+int main(int argc, char **argv)
+{
+    static const AioBench benchs[] = {
+        { "linux-aio", "native" },
+        { "io_uring", "io_uring" },
+        { "io_uring fixed-files", "io_uring", true },
+        { "io_uring fixed-buffers", "io_uring", false, true },
+        { "io_uring fixed-files+buffers", "io_uring", true, true },
+    };
+    bool tmp_image = false;
+    int i, ret;
+
+    qemu_init_main_loop(&error_fatal);
+    bdrv_init();
+    g_test_init(&argc, &argv, NULL);
+
+    if (argc > 1) {
+        BlockBackend *blk;
+        QDict *options = qdict_new();
+
+        image_path = g_strdup(argv[1]);
+        qdict_put_str(options, "driver", "file");
+        qdict_put_str(options, "filename", image_path);
+        blk = blk_new_open(NULL, NULL, options, 0, &error_fatal);
+        image_size = blk_getlength(blk);
+        blk_unref(blk);
+        g_assert(image_size >= BENCH_REQ_SIZE);
+    } else {
+        create_image();
+        tmp_image = true;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(benchs); i++) {
+        g_autofree char *path = g_strdup_printf("/io_uring/randread/%s",
+                                                benchs[i].name);
+        g_strdelimit(path, " +", '-');
+        g_test_add_data_func(path, &benchs[i], bench_aio);
+    }
+
+    ret = g_test_run();
+    if (tmp_image) {
+        unlink(image_path);
+    }
+    g_free(image_path);
+    return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * qcow2 metadata cache lookup benchmark
+ *
+ * Drives random qcow2_cache_get_empty()/qcow2_cache_put() pairs against
+ * caches of increasing size, for working sets that fit in the cache and
+ * for ones that are twice as large, and reports the cost per lookup.
+ * Tables are never read from or written to disk, so this only measures
+ * the cache's own lookup and replacement.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "../../block/qcow2.h"
+
+#define BENCH_TABLE_SIZE 4096
+#define BENCH_LOOKUPS (4 * 1000 * 1000)
+
+static char *image_path;
+
+typedef struct CacheBench {
+    int num_tables;
+    /* Working set size, relative to the number of tables */
+    int working_set_ratio;
+} CacheBench;
+
+static void bench_cache_lookups(gconstpointer opaque)
+{
+    const CacheBench *cb = opaque;
+    int64_t working_set = (int64_t)cb->num_tables * cb->working_set_ratio;
+    g_autofree uint64_t *offsets = g_new(uint64_t, BENCH_LOOKUPS);
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    Qcow2Cache *c;
+    QDict *options;
+    int64_t start, elapsed;
+    void *table;
+    int i;
+
+    options = qdict_new();
+    qdict_put_str(options, "driver", "qcow2");
+    qdict_put_str(options, "file.driver", "file");
+    qdict_put_str(options, "file.filename", image_path);
+    blk = blk_new_open(NULL, NULL, options, 0, &error_abort);
+    bs = blk_bs(blk);
+
+    c = qcow2_cache_create(bs, cb->num_tables, BENCH_TABLE_SIZE);
+    g_assert(c);
+
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        offsets[i] = (g_test_rand_int_range(0, working_set) + 1) *
+                     (uint64_t)BENCH_TABLE_SIZE;
+    }
+
+    /* Warm up */
+    for (i = 0; i < MIN(working_set, BENCH_LOOKUPS); i++) {
+        g_assert(qcow2_cache_get_empty(bs, c, offsets[i], &table) == 0);
+        qcow2_cache_put(c, &table);
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        qcow2_cache_get_empty(bs, c, offsets[i], &table);
+        qcow2_cache_put(c, &table);
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    printf("%8d tables, working set %dx: %8.1f ns/lookup\n",
+           cb->num_tables, cb->working_set_ratio,
+           (double)elapsed * 1000 / BENCH_LOOKUPS);
+
+    qcow2_cache_destroy(c);
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    static const int sizes[] = { 256, 4096, 32768, 131072 };
+    int fd, i, ratio, ret;
+
+    qemu_init_main_loop(&error_fatal);
+    bdrv_init();
+    g_test_init(&argc, &argv, NULL);
+
+    fd = g_file_open_tmp("qcow2-cache-bench-XXXXXX", &image_path, NULL);
+    g_assert(fd >= 0);
+    close(fd);
+    bdrv_img_create(image_path, "qcow2", NULL, NULL, NULL, 1 * GiB,
+                    BDRV_O_RDWR, true, &error_abort);
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        for (ratio = 1; ratio <= 2; ratio++) {
+            CacheBench *cb = g_new(CacheBench, 1);
+            g_autofree char *path = NULL;
+
+            cb->num_tables = sizes[i];
+            cb->working_set_ratio = ratio;
+            path = g_strdup_printf("/qcow2-cache/lookup/%d/ws%d",
+                                   sizes[i], ratio);
+            g_test_add_data_func_full(path, cb, bench_cache_lookups, g_free);
+        }
+    }
+
+    ret = g_test_run();
+    unlink(image_path);
+    g_free(image_path);
+    return ret;
+}
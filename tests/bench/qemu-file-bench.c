@@ -0,0 +1,152 @@
+/*
+ * QEMUFile write batching benchmark
+ *
+ * Streams a RAM-migration-like sequence of page headers and page payloads
+ * through a QEMUFile backed by a counting sink channel, and reports how
+ * many writev() calls and iovec entries (i.e. TLS records) each channel
+ * type's buffering profile ends up issuing.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/module.h"
+#include "qemu/units.h"
+#include "qemu/iov.h"
+#include "io/channel-socket.h"
+#include "io/channel-tls.h"
+#include "../migration/qemu-file.h"
+
+#define BENCH_PAGE_SIZE 4096
+#define BENCH_PAGES (64 * MiB / BENCH_PAGE_SIZE)
+#define BENCH_GUEST_PAGES 1024
+
+#define TYPE_BENCH_CHANNEL_PLAIN "qemu-file-bench-channel-plain"
+#define TYPE_BENCH_CHANNEL_SOCKET "qemu-file-bench-channel-socket"
+#define TYPE_BENCH_CHANNEL_TLS "qemu-file-bench-channel-tls"
+
+static uint64_t bench_writev_calls;
+static uint64_t bench_iov_entries;
+static uint64_t bench_bytes;
+
+static ssize_t bench_channel_writev(QIOChannel *ioc,
+                                    const struct iovec *iov,
+                                    size_t niov,
+                                    int *fds,
+                                    size_t nfds,
+                                    int flags,
+                                    Error **errp)
+{
+    size_t len = iov_size(iov, niov);
+
+    bench_writev_calls++;
+    bench_iov_entries += niov;
+    bench_bytes += len;
+    return len;
+}
+
+static ssize_t bench_channel_readv(QIOChannel *ioc,
+                                   const struct iovec *iov,
+                                   size_t niov,
+                                   int **fds,
+                                   size_t *nfds,
+                                   int flags,
+                                   Error **errp)
+{
+    return 0;
+}
+
+static int bench_channel_close(QIOChannel *ioc, Error **errp)
+{
+    return 0;
+}
+
+static void bench_channel_class_init(ObjectClass *klass, void *class_data)
+{
+    QIOChannelClass *ioc_klass = QIO_CHANNEL_CLASS(klass);
+
+    ioc_klass->io_writev = bench_channel_writev;
+    ioc_klass->io_readv = bench_channel_readv;
+    ioc_klass->io_close = bench_channel_close;
+}
+
+/*
+ * The sink channels only override the I/O callbacks, so they inherit the
+ * type (and thus the QEMUFile buffering profile) of their parent.
+ */
+static const TypeInfo bench_channel_types[] = {
+    {
+        .name = TYPE_BENCH_CHANNEL_PLAIN,
+        .parent = TYPE_QIO_CHANNEL,
+        .class_init = bench_channel_class_init,
+    }, {
+        .name = TYPE_BENCH_CHANNEL_SOCKET,
+        .parent = TYPE_QIO_CHANNEL_SOCKET,
+        .class_init = bench_channel_class_init,
+    }, {
+        .name = TYPE_BENCH_CHANNEL_TLS,
+        .parent = TYPE_QIO_CHANNEL_TLS,
+        .class_init = bench_channel_class_init,
+    },
+};
+
+static void bench_stream(gconstpointer opaque)
+{
+    const char *type = opaque;
+    uint8_t *guest = g_malloc(BENCH_GUEST_PAGES * BENCH_PAGE_SIZE);
+    QIOChannel *ioc = QIO_CHANNEL(object_new(type));
+    QEMUFile *f = qemu_file_new_output(ioc);
+    int64_t start, elapsed;
+    uint64_t i;
+
+    memset(guest, 0x5a, BENCH_GUEST_PAGES * BENCH_PAGE_SIZE);
+    bench_writev_calls = bench_iov_entries = bench_bytes = 0;
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < BENCH_PAGES; i++) {
+        /* Same shape as save_normal_page(): header, then async payload */
+        qemu_put_be64(f, (i * BENCH_PAGE_SIZE) | 0x8);
+        qemu_put_buffer_async(f, guest + (i % BENCH_GUEST_PAGES) *
+                              BENCH_PAGE_SIZE, BENCH_PAGE_SIZE, false);
+        /* Sprinkle a small device-state style record every 256 pages */
+        if ((i & 255) == 255) {
+            qemu_put_be32(f, 0xfeedcafe);
+            qemu_put_counted_string(f, "bench-device");
+        }
+    }
+    qemu_fflush(f);
+    elapsed = g_get_monotonic_time() - start;
+
+    g_assert_cmpint(qemu_file_get_error(f), ==, 0);
+    g_assert_cmpuint(bench_bytes, >=, (uint64_t)BENCH_PAGES * BENCH_PAGE_SIZE);
+
+    printf("%-32s writev calls %8" PRIu64 "  iovecs %8" PRIu64
+           "  avg %7.1f KiB/call  %9.2f MB/s\n",
+           type, bench_writev_calls, bench_iov_entries,
+           (double)bench_bytes / KiB / bench_writev_calls,
+           elapsed ? (double)bench_bytes / elapsed : 0.0);
+
+    qemu_fclose(f);
+    object_unref(OBJECT(ioc));
+    g_free(guest);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    g_test_init(&argc, &argv, NULL);
+    module_call_init(MODULE_INIT_QOM);
+    for (i = 0; i < ARRAY_SIZE(bench_channel_types); i++) {
+        type_register_static(&bench_channel_types[i]);
+    }
+
+    g_test_add_data_func("/qemu-file/stream/plain",
+                         TYPE_BENCH_CHANNEL_PLAIN, bench_stream);
+    g_test_add_data_func("/qemu-file/stream/socket",
+                         TYPE_BENCH_CHANNEL_SOCKET, bench_stream);
+    g_test_add_data_func("/qemu-file/stream/tls",
+                         TYPE_BENCH_CHANNEL_TLS, bench_stream);
+
+    return g_test_run();
+}
@@ -12,7 +12,10 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/thread.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/page_cache.h"
 
 #if defined(CONFIG_AVX512BW_OPT)
 #define XBZRLE_PAGE_SIZE 4096
@@ -449,10 +452,133 @@ static void test_encode_decode_random_avx512(void)
 }
 #endif
 
+/*
+ * Multi-channel scaling: like multifd XBZRLE, every channel encodes the
+ * pages of its own cache shard, so the channels only share memory
+ * bandwidth.
+ */
+#define MC_PAGE_SIZE 4096
+#define MC_PAGES_PER_CHANNEL 4096
+#define MC_MAX_CHANNELS 8
+
+typedef struct {
+    QemuThread thread;
+    PageCache *cache;
+    uint8_t *ram;
+    uint8_t *current;
+    uint8_t *encoded;
+    bool use_avx512;
+    uint64_t encoded_bytes;
+} MultiChannelShard;
+
+static void *multi_channel_encode(void *opaque)
+{
+    MultiChannelShard *shard = opaque;
+    int i;
+
+    for (i = 0; i < MC_PAGES_PER_CHANNEL; i++) {
+        uint64_t addr = (uint64_t)i * MC_PAGE_SIZE;
+        uint8_t *cached = get_cached_data(shard->cache, addr);
+        int rc;
+
+        memcpy(shard->current, shard->ram + addr, MC_PAGE_SIZE);
+#if defined(CONFIG_AVX512BW_OPT)
+        if (shard->use_avx512) {
+            rc = xbzrle_encode_buffer_avx512(cached, shard->current,
+                                             MC_PAGE_SIZE, shard->encoded,
+                                             MC_PAGE_SIZE);
+        } else
+#endif
+        {
+            rc = xbzrle_encode_buffer(cached, shard->current, MC_PAGE_SIZE,
+                                      shard->encoded, MC_PAGE_SIZE);
+        }
+        if (rc > 0) {
+            memcpy(cached, shard->current, MC_PAGE_SIZE);
+            shard->encoded_bytes += rc;
+        }
+    }
+    return NULL;
+}
+
+static void encode_multi_channel(int channels, bool use_avx512)
+{
+    MultiChannelShard shards[MC_MAX_CHANNELS] = {};
+    int64_t start, elapsed;
+    uint64_t encoded_bytes = 0;
+    int c, i;
+
+    for (c = 0; c < channels; c++) {
+        MultiChannelShard *shard = &shards[c];
+
+        shard->cache = cache_init((uint64_t)MC_PAGES_PER_CHANNEL * MC_PAGE_SIZE,
+                                  MC_PAGE_SIZE, &error_abort);
+        shard->ram = g_malloc0(MC_PAGES_PER_CHANNEL * MC_PAGE_SIZE);
+        shard->current = g_malloc(MC_PAGE_SIZE);
+        shard->encoded = g_malloc(MC_PAGE_SIZE);
+        shard->use_avx512 = use_avx512;
+
+        /* first round: every page misses the cache and gets inserted */
+        for (i = 0; i < MC_PAGES_PER_CHANNEL; i++) {
+            uint64_t addr = (uint64_t)i * MC_PAGE_SIZE;
+
+            shard->ram[addr + g_test_rand_int_range(0, MC_PAGE_SIZE)] = i;
+            cache_insert(shard->cache, addr, shard->ram + addr, 1);
+        }
+        /* guest dirties a few bytes of every page */
+        for (i = 0; i < MC_PAGES_PER_CHANNEL; i++) {
+            uint8_t *page = shard->ram + (uint64_t)i * MC_PAGE_SIZE;
+            int off = g_test_rand_int_range(0, MC_PAGE_SIZE - 64);
+
+            memset(page + off, i + 1, g_test_rand_int_range(1, 64));
+        }
+    }
+
+    start = g_get_monotonic_time();
+    for (c = 0; c < channels; c++) {
+        qemu_thread_create(&shards[c].thread, "xbzrle-bench",
+                           multi_channel_encode, &shards[c],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (c = 0; c < channels; c++) {
+        qemu_thread_join(&shards[c].thread);
+        encoded_bytes += shards[c].encoded_bytes;
+    }
+    elapsed = MAX(g_get_monotonic_time() - start, 1);
+
+    printf("%s %d channel(s): %" PRId64 " us, %.1f MB/s, %" PRIu64
+           " encoded bytes\n", use_avx512 ? "512" : "Raw", channels, elapsed,
+           (double)channels * MC_PAGES_PER_CHANNEL * MC_PAGE_SIZE / elapsed,
+           encoded_bytes);
+
+    for (c = 0; c < channels; c++) {
+        cache_fini(shards[c].cache);
+        g_free(shards[c].ram);
+        g_free(shards[c].current);
+        g_free(shards[c].encoded);
+    }
+}
+
+static void test_encode_multi_channel(void)
+{
+    int channels;
+
+    printf("Multi-channel test:\n");
+    for (channels = 1; channels <= MC_MAX_CHANNELS; channels *= 2) {
+        encode_multi_channel(channels, false);
+#if defined(CONFIG_AVX512BW_OPT)
+        if (is_cpu_support_avx512bw) {
+            encode_multi_channel(channels, true);
+        }
+#endif
+    }
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     g_test_rand_int();
+    g_test_add_func("/xbzrle/encode_multi_channel", test_encode_multi_channel);
     #if defined(CONFIG_AVX512BW_OPT)
     if (likely(is_cpu_support_avx512bw)) {
         g_test_add_func("/xbzrle/encode_decode_zero", test_encode_decode_zero_avx512);
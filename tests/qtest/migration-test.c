@@ -1252,6 +1252,23 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *test_migrate_postcopy_prefetch_start(QTestState *from,
+                                                  QTestState *to)
+{
+    migrate_set_parameter_int(from, "postcopy-prefetch-pages", 64);
+    return NULL;
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_postcopy_prefetch_start,
+        .postcopy_preempt = true,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1608,6 +1625,28 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_parallel_device_state_start(QTestState *from,
+                                         QTestState *to)
+{
+    migrate_set_capability(from, "parallel-device-state", true);
+    migrate_set_capability(to, "parallel-device-state", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_parallel_device_state(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_parallel_device_state_start,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_compress(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2038,6 +2077,14 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -2065,6 +2112,16 @@ static void test_multifd_tcp_zlib(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        .iterations = 2,
+    };
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -2648,6 +2705,8 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/postcopy/recovery/plain",
                        test_postcopy_recovery);
         qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
+        qtest_add_func("/migration/postcopy/preempt/prefetch",
+                       test_postcopy_preempt_prefetch);
         qtest_add_func("/migration/postcopy/preempt/recovery/plain",
                        test_postcopy_preempt_recovery);
         if (getenv("QEMU_TEST_FLAKY_TESTS")) {
@@ -2661,6 +2720,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/parallel-device-state",
+                   test_precopy_unix_parallel_device_state);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -2749,6 +2810,8 @@ int main(int argc, char **argv)
     }
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
                    test_multifd_tcp_zlib);
+    qtest_add_func("/migration/multifd/tcp/plain/xbzrle",
+                   test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     qtest_add_func("/migration/multifd/tcp/plain/zstd",
                    test_multifd_tcp_zstd);
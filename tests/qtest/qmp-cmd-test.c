@@ -15,6 +15,8 @@
 #include "qapi/error.h"
 #include "qapi/qapi-visit-introspect.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qapi/qobject-input-visitor.h"
 
 const char common_args[] = "-nodefaults -machine none";
@@ -343,6 +345,85 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+/* Check the output of the "iothread" query-stats provider */
+static void test_query_stats_iothread(void)
+{
+    static const char *const hist_names[] = {
+        "poll-event-interval", "poll-time-decisions",
+    };
+    static const char *const scalar_names[] = {
+        "poll-hits", "poll-misses", "poll-grow", "poll-shrink", "poll-time",
+        "poll-active-handlers",
+    };
+    QTestState *qts;
+    QDict *resp, *entry, *stat;
+    QList *results, *stats;
+    QListEntry *e;
+    int i, found = 0;
+
+    qts = qtest_initf("%s -object iothread,id=iothread0", common_args);
+
+    resp = qtest_qmp(qts, "{'execute': 'query-stats', 'arguments':"
+                     " {'target': 'iothread'} }");
+    results = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(results), ==, 1);
+    entry = qobject_to(QDict, qlist_peek(results));
+    g_assert_cmpstr(qdict_get_str(entry, "provider"), ==, "iothread");
+    g_assert_cmpstr(qdict_get_str(entry, "qom-path"), ==,
+                    "/objects/iothread0");
+
+    stats = qdict_get_qlist(entry, "stats");
+    QLIST_FOREACH_ENTRY(stats, e) {
+        const char *name;
+
+        stat = qobject_to(QDict, qlist_entry_obj(e));
+        name = qdict_get_str(stat, "name");
+        for (i = 0; i < ARRAY_SIZE(hist_names); i++) {
+            if (!strcmp(name, hist_names[i])) {
+                /* One value per bucket, AIO_POLL_HIST_BUCKETS of them */
+                g_assert_cmpint(qlist_size(qdict_get_qlist(stat, "value")),
+                                ==, 32);
+                found++;
+            }
+        }
+        for (i = 0; i < ARRAY_SIZE(scalar_names); i++) {
+            if (!strcmp(name, scalar_names[i])) {
+                g_assert(qobject_to(QNum, qdict_get(stat, "value")));
+                found++;
+            }
+        }
+    }
+    g_assert_cmpint(found, ==,
+                    ARRAY_SIZE(hist_names) + ARRAY_SIZE(scalar_names));
+    g_assert_cmpint(qlist_size(stats), ==, found);
+    qobject_unref(resp);
+
+    /* Filtered by name */
+    resp = qtest_qmp(qts, "{'execute': 'query-stats', 'arguments':"
+                     " {'target': 'iothread', 'providers':"
+                     " [{'provider': 'iothread', 'names': ['poll-hits']}]} }");
+    results = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(results), ==, 1);
+    entry = qobject_to(QDict, qlist_peek(results));
+    stats = qdict_get_qlist(entry, "stats");
+    g_assert_cmpint(qlist_size(stats), ==, 1);
+    stat = qobject_to(QDict, qlist_peek(stats));
+    g_assert_cmpstr(qdict_get_str(stat, "name"), ==, "poll-hits");
+    qobject_unref(resp);
+
+    /* The schema lists the same values */
+    resp = qtest_qmp(qts, "{'execute': 'query-stats-schemas', 'arguments':"
+                     " {'provider': 'iothread'} }");
+    results = qdict_get_qlist(resp, "return");
+    g_assert_cmpint(qlist_size(results), ==, 1);
+    entry = qobject_to(QDict, qlist_peek(results));
+    g_assert_cmpstr(qdict_get_str(entry, "target"), ==, "iothread");
+    g_assert_cmpint(qlist_size(qdict_get_qlist(entry, "stats")), ==, found);
+    qobject_unref(resp);
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -355,6 +436,7 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/query-stats-iothread", test_query_stats_iothread);
 
     ret = g_test_run();
 
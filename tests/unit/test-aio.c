@@ -913,6 +913,112 @@ static void test_worker_thread_co_enter(void)
     g_assert(!aio_poll(ctx, false));
 }
 
+#ifdef CONFIG_POSIX
+static void test_poll_next_ns(void)
+{
+    const int64_t max = 64000;
+
+    /* The first event within poll-max-ns starts polling */
+    g_assert_cmpint(aio_poll_next_ns(0, 1000, max, 2, 2), ==, 4000);
+
+    /* Events that the current polling time catches change nothing */
+    g_assert_cmpint(aio_poll_next_ns(4000, 3000, max, 2, 2), ==, 4000);
+    g_assert_cmpint(aio_poll_next_ns(4000, 4000, max, 2, 2), ==, 4000);
+
+    /* Later ones grow it by poll-grow, 2 by default, up to poll-max-ns */
+    g_assert_cmpint(aio_poll_next_ns(4000, 6000, max, 2, 2), ==, 8000);
+    g_assert_cmpint(aio_poll_next_ns(8000, 20000, max, 4, 2), ==, 32000);
+    g_assert_cmpint(aio_poll_next_ns(8000, 10000, max, 0, 2), ==, 16000);
+    g_assert_cmpint(aio_poll_next_ns(32000, 60000, max, 4, 2), ==, max);
+    g_assert_cmpint(aio_poll_next_ns(max, max, max, 2, 2), ==, max);
+
+    /* Events that polling could not catch shrink it by poll-shrink */
+    g_assert_cmpint(aio_poll_next_ns(max, max + 1, max, 2, 2), ==, max / 2);
+    g_assert_cmpint(aio_poll_next_ns(max, max + 1, max, 2, 4), ==, max / 4);
+    g_assert_cmpint(aio_poll_next_ns(max, max + 1, max, 2, 0), ==, 0);
+    g_assert_cmpint(aio_poll_next_ns(0, max + 1, max, 2, 2), ==, 0);
+
+    /* A lower poll-max-ns takes effect at once */
+    g_assert_cmpint(aio_poll_next_ns(max, 1000, max / 4, 2, 2), ==, max / 4);
+    g_assert_cmpint(aio_poll_next_ns(max, 1000, 0, 2, 2), ==, 0);
+}
+
+typedef struct {
+    EventNotifier e;
+    bool pending;
+} PollTestData;
+
+static bool poll_test_poll(void *opaque)
+{
+    PollTestData *data = container_of(opaque, PollTestData, e);
+
+    return qatomic_read(&data->pending);
+}
+
+static void poll_test_ready(EventNotifier *e)
+{
+    PollTestData *data = container_of(e, PollTestData, e);
+
+    event_notifier_test_and_clear(e);
+    qatomic_set(&data->pending, false);
+}
+
+/* Deliver an event after @us microseconds, found through the fd */
+static void poll_test_event(PollTestData *data, unsigned long us)
+{
+    g_usleep(us);
+    qatomic_set(&data->pending, true);
+    event_notifier_set(&data->e);
+    g_assert(aio_poll(ctx, false));
+}
+
+static void test_poll_adaptive(void)
+{
+    const AioPollStats *stats = aio_context_get_poll_stats(ctx);
+    PollTestData data = {};
+    uint64_t grow, shrink, hits;
+    int i;
+
+    event_notifier_init(&data.e, false);
+    aio_context_set_poll_params(ctx, 10 * SCALE_MS, 2, 2, &error_abort);
+    aio_set_event_notifier(ctx, &data.e, false, poll_test_ready,
+                           poll_test_poll, poll_test_ready);
+    while (aio_poll(ctx, false)) {
+        /* Consume aio_notify() */
+    }
+
+    /* Events every 100 us: the polling time grows until it catches them */
+    grow = stat64_get(&stats->grow);
+    for (i = 0; i < 20; i++) {
+        poll_test_event(&data, 100);
+    }
+    g_assert_cmpint(stat64_get(&stats->grow) - grow, >=, 3);
+    g_assert_cmpint(stat64_get(&stats->active), >=, 1);
+    g_assert_cmpint(stat64_get(&stats->max_ns), >, 0);
+
+    /* Now the handler is polled, and the event is found without the fd */
+    hits = stat64_get(&stats->hits);
+    qatomic_set(&data.pending, true);
+    g_assert(aio_poll(ctx, true));
+    g_assert(!qatomic_read(&data.pending));
+    g_assert_cmpint(stat64_get(&stats->hits), >, hits);
+
+    /* Events further apart than poll-max-ns: the polling time shrinks */
+    shrink = stat64_get(&stats->shrink);
+    for (i = 0; i < 3; i++) {
+        poll_test_event(&data, 20 * 1000);
+    }
+    g_assert_cmpint(stat64_get(&stats->shrink) - shrink, >=, 3);
+
+    aio_set_event_notifier(ctx, &data.e, false, NULL, NULL, NULL);
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    while (aio_poll(ctx, false)) {
+        /* Consume aio_notify() */
+    }
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -937,6 +1043,10 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifdef CONFIG_POSIX
+    g_test_add_func("/aio/poll/next-ns",            test_poll_next_ns);
+    g_test_add_func("/aio/poll/adaptive",           test_poll_adaptive);
+#endif
 
     g_test_add_func("/aio/coroutine/queue-chaining", test_queue_chaining);
     g_test_add_func("/aio/coroutine/worker-thread-co-enter", test_worker_thread_co_enter);
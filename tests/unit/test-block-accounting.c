@@ -0,0 +1,90 @@
+/*
+ * Block latency histogram tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "block/accounting.h"
+
+static void test_latency_empty(void)
+{
+    BlockLatencyStats lat = {};
+    uint64_t buckets[BLOCK_LATENCY_LOG2_BUCKETS];
+    int i;
+
+    g_assert_cmpint(block_latency_count(&lat, BLOCK_ACCT_READ), ==, 0);
+    g_assert_cmpint(block_latency_percentile(&lat, BLOCK_ACCT_READ, 99), ==, 0);
+
+    block_latency_log2(&lat, BLOCK_ACCT_READ, buckets);
+    for (i = 0; i < BLOCK_LATENCY_LOG2_BUCKETS; i++) {
+        g_assert_cmpint(buckets[i], ==, 0);
+    }
+}
+
+static void test_latency_percentile(void)
+{
+    BlockLatencyStats lat = {};
+    uint64_t p50, p99, p999;
+    int i;
+
+    /* 1000 requests of 1..1000 us */
+    for (i = 1; i <= 1000; i++) {
+        block_latency_account_ns(&lat, BLOCK_ACCT_WRITE, i * SCALE_US);
+    }
+    g_assert_cmpint(block_latency_count(&lat, BLOCK_ACCT_WRITE), ==, 1000);
+    g_assert_cmpint(block_latency_count(&lat, BLOCK_ACCT_READ), ==, 0);
+
+    /* Never below the real value, and at most 1/8 above it */
+    p50 = block_latency_percentile(&lat, BLOCK_ACCT_WRITE, 50);
+    g_assert_cmpint(p50, >=, 500 * SCALE_US);
+    g_assert_cmpint(p50, <, 500 * SCALE_US * 9 / 8);
+
+    p99 = block_latency_percentile(&lat, BLOCK_ACCT_WRITE, 99);
+    g_assert_cmpint(p99, >=, 990 * SCALE_US);
+    g_assert_cmpint(p99, <, 990 * SCALE_US * 9 / 8);
+
+    p999 = block_latency_percentile(&lat, BLOCK_ACCT_WRITE, 99.9);
+    g_assert_cmpint(p999, >=, 999 * SCALE_US);
+    g_assert_cmpint(p999, <, 999 * SCALE_US * 9 / 8);
+    g_assert_cmpint(p50, <=, p99);
+    g_assert_cmpint(p99, <=, p999);
+}
+
+static void test_latency_log2(void)
+{
+    BlockLatencyStats lat = {};
+    uint64_t buckets[BLOCK_LATENCY_LOG2_BUCKETS];
+    uint64_t total = 0;
+    int i;
+
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, 0);
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, 1);
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, 1000);
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, 1023);
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, 1024);
+    block_latency_account_ns(&lat, BLOCK_ACCT_FLUSH, UINT64_MAX);
+
+    block_latency_log2(&lat, BLOCK_ACCT_FLUSH, buckets);
+    g_assert_cmpint(buckets[0], ==, 1);
+    g_assert_cmpint(buckets[1], ==, 1);
+    g_assert_cmpint(buckets[10], ==, 2);
+    g_assert_cmpint(buckets[11], ==, 1);
+    g_assert_cmpint(buckets[BLOCK_LATENCY_LOG2_BUCKETS - 1], ==, 1);
+    for (i = 0; i < BLOCK_LATENCY_LOG2_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    g_assert_cmpint(total, ==, 6);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/block-accounting/latency/empty", test_latency_empty);
+    g_test_add_func("/block-accounting/latency/percentile",
+                    test_latency_percentile);
+    g_test_add_func("/block-accounting/latency/log2", test_latency_log2);
+    return g_test_run();
+}
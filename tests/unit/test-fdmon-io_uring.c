@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fdmon-io_uring tests
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+
+static AioContext *ctx;
+
+typedef struct {
+    AioUringRequest req;
+    int res;
+    bool done;
+} TestRequest;
+
+static void test_request_cb(AioUringRequest *req, int res)
+{
+    TestRequest *test_req = container_of(req, TestRequest, req);
+
+    test_req->res = res;
+    test_req->done = true;
+}
+
+/* Check that requests queued on the fd monitoring ring complete */
+static void test_enqueue(void)
+{
+    TestRequest reqs[300] = {};
+    struct io_uring_sqe sqe = {};
+    size_t i;
+
+    /* More requests than sq ring entries */
+    io_uring_prep_nop(&sqe);
+    for (i = 0; i < G_N_ELEMENTS(reqs); i++) {
+        reqs[i].req.cb = test_request_cb;
+        reqs[i].res = -EINPROGRESS;
+        aio_uring_enqueue(ctx, &sqe, &reqs[i].req);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(reqs); i++) {
+        while (!reqs[i].done) {
+            aio_poll(ctx, true);
+        }
+        g_assert_cmpint(reqs[i].res, ==, 0);
+    }
+}
+
+/* Check that aio_uring_poll() reaps requests without aio_poll() */
+static void test_poll(void)
+{
+    TestRequest req = {
+        .req.cb = test_request_cb,
+        .res = -EINPROGRESS,
+    };
+    struct io_uring_sqe sqe = {};
+
+    io_uring_prep_nop(&sqe);
+    aio_uring_enqueue(ctx, &sqe, &req.req);
+    g_assert(!aio_uring_poll(ctx));
+    g_assert(!req.done);
+
+    aio_uring_submit(ctx);
+    while (!aio_uring_poll(ctx)) {
+        /* Busy poll */
+    }
+    g_assert(req.done);
+    g_assert_cmpint(req.res, ==, 0);
+}
+
+static void dummy_fd_handler(EventNotifier *notifier)
+{
+    event_notifier_test_and_clear(notifier);
+}
+
+/*
+ * Check that events of external fd handlers are held back while external
+ * clients are disabled, without blocking internal ones
+ */
+static void test_external_disabled(void)
+{
+    EventNotifier external, internal;
+
+    event_notifier_init(&external, false);
+    event_notifier_init(&internal, false);
+    aio_set_event_notifier(ctx, &external, true, dummy_fd_handler, NULL, NULL);
+    aio_set_event_notifier(ctx, &internal, false, dummy_fd_handler, NULL, NULL);
+    while (aio_poll(ctx, false)) {
+        /* Submit the poll requests */
+    }
+
+    aio_disable_external(ctx);
+    event_notifier_set(&external);
+    event_notifier_set(&internal);
+    g_assert(aio_poll(ctx, true));
+    g_assert(!aio_poll(ctx, false));
+    g_assert(!event_notifier_test_and_clear(&internal));
+    g_assert(event_notifier_test_and_clear(&external));
+
+    event_notifier_set(&external);
+    aio_enable_external(ctx);
+    g_assert(aio_poll(ctx, false));
+    g_assert(!event_notifier_test_and_clear(&external));
+
+    aio_set_event_notifier(ctx, &external, true, NULL, NULL, NULL);
+    aio_set_event_notifier(ctx, &internal, false, NULL, NULL, NULL);
+    while (aio_poll(ctx, false)) {
+        /* Let the poll requests complete */
+    }
+    event_notifier_cleanup(&external);
+    event_notifier_cleanup(&internal);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_fatal);
+
+    /* Unlike the main loop's AioContext, this one is not driven by glib */
+    ctx = aio_context_new(&error_fatal);
+    qemu_set_current_aio_context(ctx);
+
+    g_test_init(&argc, &argv, NULL);
+    if (!aio_uring_get_ring(ctx, NULL)) {
+        g_test_skip("io_uring is not available");
+        return g_test_run();
+    }
+
+    g_test_add_func("/fdmon-io_uring/enqueue", test_enqueue);
+    g_test_add_func("/fdmon-io_uring/poll", test_poll);
+    g_test_add_func("/fdmon-io_uring/external-disabled",
+                    test_external_disabled);
+    return g_test_run();
+}
@@ -911,6 +911,34 @@ static void test_hbitmap_next_x_4(TestHBitmapData *data, const void *unused)
     test_hbitmap_next_x_do(data, 4);
 }
 
+static void test_hbitmap_next_x_accel(TestHBitmapData *data,
+                                      const void *unused)
+{
+    HBitmap *hb2;
+
+    /* Repeat with each word scanning implementation the host supports */
+    do {
+        test_hbitmap_next_x_do(data, 0);
+
+        hbitmap_reset(data->hb, L2 + 1, L3 - L2 * 2);
+        g_assert_cmpint(hbitmap_count(data->hb), ==, L2 * 2);
+        test_hbitmap_next_x_check(data, L2);
+        test_hbitmap_next_x_check(data, L2 + 1);
+        test_hbitmap_next_x_check(data, L3 - L2);
+
+        hb2 = hbitmap_alloc(L3, 0);
+        hbitmap_set(hb2, L2 * 2, L2);
+        hbitmap_merge(data->hb, hb2, data->hb);
+        hbitmap_free(hb2);
+        g_assert_cmpint(hbitmap_count(data->hb), ==, L2 * 3);
+        test_hbitmap_next_x_check(data, L2 + 1);
+        test_hbitmap_next_x_check(data, L2 * 2);
+        test_hbitmap_next_x_check(data, L2 * 3);
+
+        hbitmap_test_teardown(data, NULL);
+    } while (test_hbitmap_next_accel());
+}
+
 static void test_hbitmap_next_x_after_truncate(TestHBitmapData *data,
                                                const void *unused)
 {
@@ -1042,6 +1070,58 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/*
+ * A bitmap whose last level would take 1 GiB if it was allocated densely.
+ * Only the chunks around the set bits are allocated.
+ */
+static void test_hbitmap_sparse_large(TestHBitmapData *data,
+                                      const void *unused)
+{
+    uint64_t size = 1ULL << 33;
+    uint64_t positions[] = { 0, L3 - 1, 1ULL << 20, size / 2, size - 2 * L1 };
+    HBitmap *hb2;
+    uint8_t *buf;
+    int64_t next;
+    uint64_t len;
+    int i;
+
+    data->hb = hbitmap_alloc(size, 0);
+    for (i = 0; i < ARRAY_SIZE(positions); i++) {
+        hbitmap_set(data->hb, positions[i], L1);
+    }
+    g_assert_cmpint(hbitmap_count(data->hb), ==, ARRAY_SIZE(positions) * L1);
+
+    next = 0;
+    for (i = 0; i < ARRAY_SIZE(positions); i++) {
+        next = hbitmap_next_dirty(data->hb, next, size - next);
+        g_assert_cmpint(next, ==, positions[i]);
+        g_assert(hbitmap_get(data->hb, next + L1 - 1));
+        next = hbitmap_next_zero(data->hb, next, size - next);
+        g_assert_cmpint(next, ==, positions[i] + L1);
+    }
+    g_assert_cmpint(hbitmap_next_dirty(data->hb, next, size - next), ==, -1);
+
+    /* Round-trip a region that spans both allocated and unallocated chunks */
+    hb2 = hbitmap_alloc(size, 0);
+    len = hbitmap_serialization_size(data->hb, 0, L3 * 2);
+    buf = g_malloc(len);
+    hbitmap_serialize_part(data->hb, buf, 0, L3 * 2);
+    hbitmap_deserialize_ones(hb2, 0, size, false);
+    hbitmap_deserialize_zeroes(hb2, 0, size, false);
+    hbitmap_deserialize_part(hb2, buf, 0, L3 * 2, true);
+    g_free(buf);
+    g_assert_cmpint(hbitmap_count(hb2), ==, 2 * L1);
+    g_assert_cmpint(hbitmap_next_dirty(hb2, L1, size - L1), ==, L3 - 1);
+
+    hbitmap_merge(data->hb, hb2, hb2);
+    g_assert_cmpint(hbitmap_count(hb2), ==, ARRAY_SIZE(positions) * L1);
+
+    hbitmap_reset(hb2, 0, size);
+    g_assert(hbitmap_empty(hb2));
+    g_assert_cmpint(hbitmap_next_dirty(hb2, 0, size), ==, -1);
+    hbitmap_free(hb2);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1091,6 +1171,7 @@ int main(int argc, char **argv)
                      test_hbitmap_serialize_basic);
     hbitmap_test_add("/hbitmap/serialize/part",
                      test_hbitmap_serialize_part);
+    hbitmap_test_add("/hbitmap/sparse/large", test_hbitmap_sparse_large);
     hbitmap_test_add("/hbitmap/serialize/zeroes",
                      test_hbitmap_serialize_zeroes);
 
@@ -1101,6 +1182,8 @@ int main(int argc, char **argv)
                      test_hbitmap_next_x_0);
     hbitmap_test_add("/hbitmap/next_zero/next_x_4",
                      test_hbitmap_next_x_4);
+    hbitmap_test_add("/hbitmap/next_zero/next_x_accel",
+                     test_hbitmap_next_x_accel);
     hbitmap_test_add("/hbitmap/next_zero/next_x_after_truncate",
                      test_hbitmap_next_x_after_truncate);
 
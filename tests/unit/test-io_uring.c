@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * io_uring block backend tests
+ *
+ * Each test runs in a thread of its own, with an AioContext of its own,
+ * because the io_uring instance of an AioContext is set up only once.
+ */
+
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/thread.h"
+
+#define TEST_BUF_SIZE (64 * 1024)
+
+/* Copied from block/io_uring.c */
+#define MAX_FIXED_FILES 64
+#define MAX_FIXED_BUFS (16 * 1024)
+
+typedef struct {
+    /* Test configuration */
+    int64_t sqpoll_idle;
+    bool fixed_files;
+    bool fill_fixed_files;
+    bool fixed_bufs;
+    bool too_many_fixed_bufs;
+
+    /* Test thread state */
+    const char *skip;
+    int fd;
+    int fd_index;
+    LuringState *s;
+    uint8_t *buf;
+    BdrvRequestFlags flags;
+    bool done;
+} TestParams;
+
+static int tmp_fd;
+
+static void coroutine_fn test_rw_co(void *opaque)
+{
+    TestParams *p = opaque;
+    QEMUIOVector qiov;
+    uint64_t offset;
+    int i, ret;
+
+    qemu_iovec_init_buf(&qiov, p->buf, TEST_BUF_SIZE);
+
+    /* Write a different pattern at a few offsets, then read it back */
+    for (i = 0; i < 4; i++) {
+        offset = i * 3 * TEST_BUF_SIZE;
+        memset(p->buf, 0x40 + i, TEST_BUF_SIZE);
+        ret = luring_co_submit(NULL, p->fd, p->fd_index, offset, &qiov,
+                               QEMU_AIO_WRITE, p->flags);
+        g_assert_cmpint(ret, ==, TEST_BUF_SIZE);
+    }
+
+    ret = luring_co_submit(NULL, p->fd, p->fd_index, 0, NULL,
+                           QEMU_AIO_FLUSH, 0);
+    g_assert_cmpint(ret, ==, 0);
+
+    for (i = 0; i < 4; i++) {
+        offset = i * 3 * TEST_BUF_SIZE;
+        memset(p->buf, 0, TEST_BUF_SIZE);
+        ret = luring_co_submit(NULL, p->fd, p->fd_index, offset, &qiov,
+                               QEMU_AIO_READ, p->flags);
+        g_assert_cmpint(ret, ==, TEST_BUF_SIZE);
+        g_assert_cmpint(p->buf[0], ==, 0x40 + i);
+        g_assert_cmpint(p->buf[TEST_BUF_SIZE - 1], ==, 0x40 + i);
+    }
+
+    p->done = true;
+}
+
+static void test_register_files(TestParams *p)
+{
+    Error *local_err = NULL;
+    int i, ret;
+
+    p->fd_index = luring_register_file(p->s, p->fd, &local_err);
+    if (p->fd_index == -ENOTSUP) {
+        /* Shared ring before Linux 5.13 */
+        error_free(local_err);
+        p->fd_index = -1;
+        p->skip = "io_uring fixed files are not supported";
+        return;
+    }
+    g_assert_cmpint(p->fd_index, >=, 0);
+    g_assert(!local_err);
+
+    if (!p->fill_fixed_files) {
+        return;
+    }
+
+    /* Use up the table, the caller must then fall back to a plain fd */
+    for (i = 1; i < MAX_FIXED_FILES; i++) {
+        ret = luring_register_file(p->s, p->fd, &error_abort);
+        g_assert_cmpint(ret, >=, 0);
+    }
+    ret = luring_register_file(p->s, p->fd, &local_err);
+    g_assert_cmpint(ret, ==, -ENOSPC);
+    error_free_or_abort(&local_err);
+
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        luring_unregister_file(p->s, i);
+    }
+    p->fd_index = -1;
+}
+
+static void *test_thread(void *opaque)
+{
+    TestParams *p = opaque;
+    AioContext *ctx;
+    Coroutine *co;
+    size_t i;
+
+    ctx = aio_context_new(&error_abort);
+    qemu_set_current_aio_context(ctx);
+
+    /* Falls back to a ring without SQPOLL if the kernel refuses it */
+    aio_context_set_io_uring_params(ctx, p->sqpoll_idle, &error_abort);
+    p->s = aio_setup_linux_io_uring(ctx, NULL);
+    if (!p->s) {
+        p->skip = "io_uring is not available";
+        goto out;
+    }
+
+    p->fd = tmp_fd;
+    p->fd_index = -1;
+    p->buf = qemu_memalign(4096, TEST_BUF_SIZE);
+
+    if (p->fixed_files) {
+        test_register_files(p);
+    }
+
+    if (p->fixed_bufs) {
+        luring_register_buf(p->buf, TEST_BUF_SIZE, &error_abort);
+        p->flags = BDRV_REQ_REGISTERED_BUF;
+    }
+
+    /*
+     * More chunks than a ring can register: registration fails and the
+     * requests fall back to plain reads and writes
+     */
+    if (p->too_many_fixed_bufs) {
+        for (i = 1; i <= MAX_FIXED_BUFS; i++) {
+            luring_register_buf(p->buf, i, &error_abort);
+        }
+    }
+
+    co = qemu_coroutine_create(test_rw_co, p);
+    qemu_coroutine_enter(co);
+    while (!p->done) {
+        aio_poll(ctx, true);
+    }
+
+    if (p->too_many_fixed_bufs) {
+        for (i = 1; i <= MAX_FIXED_BUFS; i++) {
+            luring_unregister_buf(p->buf, i);
+        }
+    }
+    if (p->fixed_bufs) {
+        luring_unregister_buf(p->buf, TEST_BUF_SIZE);
+    }
+    if (p->fd_index >= 0) {
+        luring_unregister_file(p->s, p->fd_index);
+    }
+    qemu_vfree(p->buf);
+
+out:
+    aio_context_unref(ctx);
+    return NULL;
+}
+
+static void test_io_uring(gconstpointer opaque)
+{
+    TestParams p = *(const TestParams *)opaque;
+    QemuThread thread;
+
+    qemu_thread_create(&thread, "test-io_uring", test_thread, &p,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_join(&thread);
+
+    if (p.skip) {
+        g_test_skip(p.skip);
+    }
+}
+
+#define ADD_TEST(name_, ...) \
+    do { \
+        static const TestParams params = { __VA_ARGS__ }; \
+        g_test_add_data_func("/io_uring/" name_, &params, test_io_uring); \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    g_autofree char *path = NULL;
+    int ret;
+
+    qemu_init_main_loop(&error_fatal);
+    g_test_init(&argc, &argv, NULL);
+
+    tmp_fd = g_file_open_tmp("test-io_uring-XXXXXX", &path, NULL);
+    g_assert(tmp_fd >= 0);
+    unlink(path);
+
+    ADD_TEST("plain", .sqpoll_idle = 0);
+    ADD_TEST("fixed-files", .fixed_files = true);
+    ADD_TEST("fixed-files-full", .fixed_files = true,
+             .fill_fixed_files = true);
+    ADD_TEST("fixed-buffers", .fixed_bufs = true);
+    ADD_TEST("fixed-buffers-fallback", .fixed_bufs = true,
+             .too_many_fixed_bufs = true);
+    ADD_TEST("sqpoll", .sqpoll_idle = 10);
+    ADD_TEST("sqpoll-fixed", .sqpoll_idle = 10, .fixed_files = true,
+             .fixed_bufs = true);
+
+    ret = g_test_run();
+    close(tmp_fd);
+    return ret;
+}
@@ -671,6 +671,115 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+/* account @n read requests of @size at @now, checking that none waits */
+static void do_test_tokens_account(ThrottleTokens *tok, int n, uint64_t size,
+                                   int64_t now)
+{
+    ThrottleCost cost;
+    int i;
+
+    throttle_tokens_cost(&cfg, false, size, &cost);
+    for (i = 0; i < n; i++) {
+        g_assert_cmpint(throttle_tokens_compute_wait(tok, &cfg, false, now),
+                        ==, 0);
+        throttle_tokens_account(tok, &cost, now);
+    }
+}
+
+static void test_tokens(void)
+{
+    ThrottleTokens tok;
+    int64_t now = 0;
+
+    /* 100 iops and no burst: the bucket holds 10 operations */
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = 100;
+    throttle_tokens_init(&tok);
+
+    do_test_tokens_account(&tok, 11, 512, now);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, false, now),
+                    ==, 10 * SCALE_MS);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, true, now),
+                    ==, 10 * SCALE_MS);
+
+    /* one operation leaks in 10 ms */
+    now += 10 * SCALE_MS;
+    do_test_tokens_account(&tok, 1, 512, now);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, false, now),
+                    ==, 10 * SCALE_MS);
+
+    /* an idle bucket does not save up more than its size */
+    now += 10 * NANOSECONDS_PER_SECOND;
+    do_test_tokens_account(&tok, 11, 512, now);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, false, now),
+                    ==, 10 * SCALE_MS);
+
+    /* bursts of 10000 bps for two seconds, 1000 bps on average */
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_READ].avg = 1000;
+    cfg.buckets[THROTTLE_BPS_READ].max = 10000;
+    cfg.buckets[THROTTLE_BPS_READ].burst_length = 2;
+    throttle_tokens_init(&tok);
+    now = 0;
+
+    /* the burst bucket holds 1000 bytes and leaks them in 100 ms */
+    do_test_tokens_account(&tok, 2, 1000, now);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, false, now),
+                    ==, 100 * SCALE_MS);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, true, now),
+                    ==, 0);
+
+    /* the main bucket holds 20000 bytes and leaks 1000 per second, so at
+     * 10000 bps it is full after 2.2 seconds */
+    for (now = 100 * SCALE_MS;
+         !throttle_tokens_compute_wait(&tok, &cfg, false, now);
+         now += 100 * SCALE_MS) {
+        do_test_tokens_account(&tok, 1, 1000, now);
+    }
+    g_assert_cmpint(now, ==, 2 * NANOSECONDS_PER_SECOND + 200 * SCALE_MS);
+    g_assert_cmpint(throttle_tokens_compute_wait(&tok, &cfg, false, now),
+                    ==, 800 * SCALE_MS);
+}
+
+/* ThrottleTokens must agree with LeakyBucket on random workloads */
+static void test_tokens_match_leaky_bucket(void)
+{
+    ThrottleTokens tok;
+    ThrottleCost cost;
+    LeakyBucket *b;
+    int64_t now = 0, delta, wait, token_wait;
+    uint64_t size;
+    int i;
+
+    throttle_config_init(&cfg);
+    b = &cfg.buckets[THROTTLE_BPS_READ];
+    b->avg = 1 * 1024 * 1024;
+    b->max = 8 * 1024 * 1024;
+    b->burst_length = 3;
+    throttle_tokens_init(&tok);
+
+    for (i = 0; i < 100000; i++) {
+        delta = g_test_rand_int_range(0, 2 * SCALE_MS);
+        size = g_test_rand_int_range(512, 256 * 1024);
+
+        now += delta;
+        throttle_leak_bucket(b, delta);
+        wait = throttle_compute_wait(b);
+        token_wait = throttle_tokens_compute_wait(&tok, &cfg, false, now);
+
+        /* both round, but differently */
+        g_assert_cmpint(token_wait, >=, wait - 4);
+        g_assert_cmpint(token_wait, <=, wait + 4);
+
+        if (!wait) {
+            b->level += size;
+            b->burst_level += size;
+            throttle_tokens_cost(&cfg, false, size, &cost);
+            throttle_tokens_account(&tok, &cost, now);
+        }
+    }
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -738,6 +847,163 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+typedef struct GroupTestReq {
+    ThrottleGroupMember *tgm;
+    int64_t deadline;      /* send requests until then... */
+    int64_t total_limit;   /* ...or until the group admitted this many */
+    int64_t count_from;    /* only count requests admitted after this many */
+    int64_t *admitted;     /* counted requests of this member */
+    int64_t *total;        /* requests admitted in the whole group */
+    int *running;
+} GroupTestReq;
+
+static void coroutine_fn group_test_co(void *opaque)
+{
+    GroupTestReq *req = opaque;
+
+    while (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < req->deadline &&
+           *req->total < req->total_limit) {
+        throttle_group_co_io_limits_intercept(req->tgm, 4096, false);
+        if (*req->total >= req->count_from &&
+            *req->total < req->total_limit) {
+            (*req->admitted)++;
+        }
+        (*req->total)++;
+    }
+    (*req->running)--;
+}
+
+/* Run @nr_cos coroutines per member that send reads through @tgms, see
+ * GroupTestReq.  Returns the number of requests admitted in the group */
+static int64_t run_group_test(ThrottleGroupMember **tgms, int nr_tgms,
+                              int nr_cos, int64_t duration,
+                              int64_t total_limit, int64_t count_from,
+                              int64_t *admitted)
+{
+    GroupTestReq *reqs = g_new(GroupTestReq, nr_tgms * nr_cos);
+    int64_t deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + duration;
+    int64_t total = 0;
+    int running = 0;
+    int i;
+
+    for (i = 0; i < nr_tgms; i++) {
+        admitted[i] = 0;
+    }
+    for (i = 0; i < nr_tgms * nr_cos; i++) {
+        reqs[i] = (GroupTestReq) {
+            .tgm = tgms[i % nr_tgms],
+            .deadline = deadline,
+            .total_limit = total_limit,
+            .count_from = count_from,
+            .admitted = &admitted[i % nr_tgms],
+            .total = &total,
+            .running = &running,
+        };
+        running++;
+        qemu_coroutine_enter(qemu_coroutine_create(group_test_co, &reqs[i]));
+    }
+    while (running) {
+        aio_poll(ctx, true);
+    }
+    while (aio_poll(ctx, false)) {
+        /* Let throttle_group_restart_queue_entry() finish */
+    }
+    g_free(reqs);
+    return total;
+}
+
+/* The fast path and the per-thread token cache must not let more
+ * requests through than the group's buckets allow */
+static void test_groups_fast_path_limit(void)
+{
+    ThrottleConfig cfg1;
+    BlockBackend *blk1, *blk2;
+    ThrottleGroupMember *tgms[2];
+    int64_t admitted[2], total, start, elapsed, limit;
+    int nr_cos;
+
+    blk1 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    blk2 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgms[0] = &blk_get_public(blk1)->throttle_group_member;
+    tgms[1] = &blk_get_public(blk2)->throttle_group_member;
+    throttle_group_register_tgm(tgms[0], "fast", ctx);
+    throttle_group_register_tgm(tgms[1], "fast", ctx);
+
+    /* 1000 iops without bursts: the bucket holds 100 requests */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_TOTAL].avg = 1000;
+
+    /* One request at a time per member, then several at a time */
+    for (nr_cos = 1; nr_cos <= 8; nr_cos *= 8) {
+        /* Start from an empty bucket and no cached tokens */
+        throttle_group_config(tgms[0], &cfg1);
+
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        total = run_group_test(tgms, 2, nr_cos, 200 * SCALE_MS, INT64_MAX, 0,
+                               admitted);
+        elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+
+        /* What leaked out during the test, plus the full bucket, plus the
+         * requests that one thread may prepay in a single go */
+        limit = 1000 * elapsed / NANOSECONDS_PER_SECOND + 100 + 10;
+        g_assert_cmpint(total, <=, limit);
+        g_assert_cmpint(total, >=, 100);
+        g_assert_cmpint(admitted[0], >, 0);
+        g_assert_cmpint(admitted[1], >, 0);
+    }
+
+    throttle_group_unregister_tgm(tgms[0]);
+    throttle_group_unregister_tgm(tgms[1]);
+    blk_unref(blk1);
+    blk_unref(blk2);
+}
+
+/* A saturated weighted group shares its bandwidth by weight */
+static void test_groups_weighted(void)
+{
+    ThrottleConfig cfg1;
+    Object *tg;
+    BlockBackend *blk1, *blk2;
+    ThrottleGroupMember *tgms[2];
+    int64_t admitted[2];
+    double share;
+
+    tg = object_new_with_props(TYPE_THROTTLE_GROUP, object_get_objects_root(),
+                               "weighted-group", &error_abort,
+                               "weighted", "on", NULL);
+
+    blk1 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    blk2 = blk_new(qemu_get_aio_context(), 0, BLK_PERM_ALL);
+    tgms[0] = &blk_get_public(blk1)->throttle_group_member;
+    tgms[1] = &blk_get_public(blk2)->throttle_group_member;
+    throttle_group_register_tgm(tgms[0], "weighted-group", ctx);
+    throttle_group_register_tgm(tgms[1], "weighted-group", ctx);
+    throttle_group_set_weight(tgms[1], 3 * THROTTLE_GROUP_WEIGHT_DEFAULT);
+
+    /* 2000 iops without bursts: the bucket holds 200 requests */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_TOTAL].avg = 2000;
+    throttle_group_config(tgms[0], &cfg1);
+
+    /*
+     * The first requests go through the fast path until the bucket is
+     * full.  Of the 800 requests after the first 300, the second member
+     * gets three quarters.
+     */
+    run_group_test(tgms, 2, 8, 10 * NANOSECONDS_PER_SECOND, 300 + 800, 300,
+                   admitted);
+    g_assert_cmpint(admitted[0] + admitted[1], ==, 800);
+    share = (double)admitted[1] / 800;
+    g_assert_cmpfloat(share, >=, 0.65);
+    g_assert_cmpfloat(share, <=, 0.85);
+
+    throttle_group_unregister_tgm(tgms[0]);
+    throttle_group_unregister_tgm(tgms[1]);
+    blk_unref(blk1);
+    blk_unref(blk2);
+    object_unparent(tg);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -764,7 +1030,13 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/tokens",             test_tokens);
+    g_test_add_func("/throttle/tokens/leaky_bucket",
+                    test_tokens_match_leaky_bucket);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/fast_path_limit",
+                    test_groups_fast_path_limit);
+    g_test_add_func("/throttle/groups/weighted",    test_groups_weighted);
     return g_test_run();
 }
 
@@ -12,7 +12,9 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/xbzrle-cache.h"
 
 #define XBZRLE_PAGE_SIZE 4096
 
@@ -202,6 +204,69 @@ static void test_encode_decode(void)
     }
 }
 
+/*
+ * Send @page through @cache and apply the result to @dest, as the
+ * multifd xbzrle channels do
+ */
+static XBZRLECacheResult cache_send_page(PageCache *cache, uint8_t *page,
+                                         uint8_t *dest, uint64_t age)
+{
+    g_autofree uint8_t *buf = g_malloc(XBZRLE_PAGE_SIZE);
+    g_autofree uint8_t *out = g_malloc(XBZRLE_PAGE_SIZE);
+    XBZRLECacheResult res;
+    int len = 0;
+
+    res = xbzrle_cache_encode(cache, 0, page, buf, out, &len,
+                              XBZRLE_PAGE_SIZE, age);
+    switch (res) {
+    case XBZRLE_CACHE_MISS:
+    case XBZRLE_CACHE_OVERFLOW:
+        memcpy(dest, buf, XBZRLE_PAGE_SIZE);
+        break;
+    case XBZRLE_CACHE_UNCHANGED:
+        break;
+    case XBZRLE_CACHE_DELTA:
+        g_assert(xbzrle_decode_buffer(out, len, dest, XBZRLE_PAGE_SIZE) > 0);
+        break;
+    }
+    return res;
+}
+
+static void test_cache_zero_page(void)
+{
+    PageCache *cache = cache_init(16 * XBZRLE_PAGE_SIZE, XBZRLE_PAGE_SIZE,
+                                  &error_abort);
+    g_autofree uint8_t *page = g_malloc(XBZRLE_PAGE_SIZE);
+    g_autofree uint8_t *dest = g_malloc0(XBZRLE_PAGE_SIZE);
+
+    /* A is sent raw and cached */
+    memset(page, 0x55, XBZRLE_PAGE_SIZE);
+    g_assert(cache_send_page(cache, page, dest, 1) == XBZRLE_CACHE_MISS);
+    g_assert(memcmp(page, dest, XBZRLE_PAGE_SIZE) == 0);
+
+    /* The page becomes zero and is sent as a zero page */
+    memset(page, 0, XBZRLE_PAGE_SIZE);
+    memset(dest, 0, XBZRLE_PAGE_SIZE);
+    xbzrle_cache_zero(cache, 0, XBZRLE_PAGE_SIZE, 2);
+
+    /* B must be encoded against zeroes, not against A */
+    page[100] = 1;
+    page[2000] = 2;
+    g_assert(cache_send_page(cache, page, dest, 3) == XBZRLE_CACHE_DELTA);
+    g_assert(memcmp(page, dest, XBZRLE_PAGE_SIZE) == 0);
+
+    /* A zero page that was not cached yet is added */
+    cache_fini(cache);
+    cache = cache_init(16 * XBZRLE_PAGE_SIZE, XBZRLE_PAGE_SIZE,
+                       &error_abort);
+    memset(dest, 0, XBZRLE_PAGE_SIZE);
+    xbzrle_cache_zero(cache, 0, XBZRLE_PAGE_SIZE, 1);
+    g_assert(cache_send_page(cache, page, dest, 2) == XBZRLE_CACHE_DELTA);
+    g_assert(memcmp(page, dest, XBZRLE_PAGE_SIZE) == 0);
+
+    cache_fini(cache);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -214,6 +279,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/cache_zero_page", test_cache_zero_page);
 
     return g_test_run();
 }
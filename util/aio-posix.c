@@ -146,6 +146,12 @@ void aio_set_fd_handler(AioContext *ctx,
         new_node->opaque = opaque;
         new_node->is_external = is_external;
 
+        if (node) {
+            /* Keep the polling history of the fd */
+            new_node->poll_ns = node->poll_ns;
+            new_node->poll_last_event = node->poll_last_event;
+        }
+
         if (is_new) {
             new_node->pfd.fd = fd;
         } else {
@@ -429,6 +435,7 @@ void aio_dispatch(AioContext *ctx)
 static bool run_poll_handlers_once(AioContext *ctx,
                                    AioHandlerList *ready_list,
                                    int64_t now,
+                                   int64_t elapsed,
                                    int64_t *timeout)
 {
     bool progress = false;
@@ -436,6 +443,14 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        /*
+         * Every handler is polled at least once, but only for as long as its
+         * own polling time after that.
+         */
+        if (elapsed > node->poll_ns) {
+            continue;
+        }
+
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             aio_add_poll_ready_handler(ready_list, node);
@@ -539,9 +554,10 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
     RCU_READ_LOCK_GUARD();
 
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    elapsed_time = 0;
     do {
-        progress = run_poll_handlers_once(ctx, ready_list,
-                                          start_time, timeout);
+        progress = run_poll_handlers_once(ctx, ready_list, start_time,
+                                          elapsed_time, timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
@@ -583,7 +599,8 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
         return false;
     }
 
-    max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
+    max_ns = qemu_soonest_timeout(*timeout,
+                                  MIN(ctx->poll_ns, ctx->poll_max_ns));
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         /*
          * Enable poll mode. It pairs with the poll_set_started() in
@@ -598,13 +615,134 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+/* Index of the AioPollStats histogram bucket that @ns falls into */
+static unsigned int poll_hist_bucket(int64_t ns)
+{
+    unsigned int bucket = ns > 0 ? 64 - clz64(ns) : 0;
+
+    return MIN(bucket, AIO_POLL_HIST_BUCKETS - 1);
+}
+
+static void set_handler_polling_time(AioContext *ctx, AioHandler *node,
+                                     int64_t ns)
+{
+    int64_t old = node->poll_ns;
+
+    if (ns == old) {
+        return;
+    }
+
+    node->poll_ns = ns;
+    if (ns > old) {
+        stat64_add(&ctx->poll_stats.grow, 1);
+        trace_poll_grow(ctx, node, old, ns);
+    } else {
+        stat64_add(&ctx->poll_stats.shrink, 1);
+        trace_poll_shrink(ctx, node, old, ns);
+    }
+    stat64_add(&ctx->poll_stats.poll_ns_hist[poll_hist_bucket(ns)], 1);
+}
+
+int64_t aio_poll_next_ns(int64_t poll_ns, int64_t interval, int64_t max_ns,
+                         int64_t grow, int64_t shrink)
+{
+    /* poll-max-ns may have been lowered in the meantime */
+    poll_ns = MIN(poll_ns, max_ns);
+
+    if (interval <= poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+        return poll_ns;
+    } else if (interval > max_ns) {
+        /* We'd have to poll for too long, poll less */
+        return shrink ? poll_ns / shrink : 0;
+    } else if (poll_ns < max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t ns;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (poll_ns) {
+            ns = poll_ns * grow;
+        } else {
+            ns = 4000; /* start polling at 4 microseconds */
+        }
+        return MIN(ns, max_ns);
+    }
+    return poll_ns;
+}
+
+static void adjust_handler_polling_time(AioContext *ctx, AioHandler *node,
+                                        int64_t interval)
+{
+    set_handler_polling_time(ctx, node,
+                             aio_poll_next_ns(node->poll_ns, interval,
+                                              ctx->poll_max_ns,
+                                              ctx->poll_grow,
+                                              ctx->poll_shrink));
+}
+
+/*
+ * Adaptive polling controller.  Each handler with ->io_poll() gets its own
+ * polling time, which follows the inter-arrival times of its events, so that
+ * a handler with sparse events neither keeps the event loop spinning for the
+ * others nor stops a busy one from being polled.  run_poll_handlers() polls
+ * each handler for its own polling time and the event loop as a whole for
+ * the longest of them.
+ */
+static void adjust_polling_times(AioContext *ctx, AioHandlerList *ready_list)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t max_ns = 0;
+    uint64_t active = 0;
+    AioHandler *node;
+
+    QLIST_FOREACH(node, ready_list, node_ready) {
+        if (!node->io_poll) {
+            continue;
+        }
+
+        stat64_add(node->poll_ready ? &ctx->poll_stats.hits :
+                                      &ctx->poll_stats.misses, 1);
+
+        if (node->poll_last_event) {
+            int64_t interval = now - node->poll_last_event;
+
+            stat64_add(&ctx->poll_stats.interval_hist[
+                           poll_hist_bucket(interval)], 1);
+            adjust_handler_polling_time(ctx, node, interval);
+        }
+        node->poll_last_event = now;
+    }
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        /*
+         * Without an event within poll_max_ns the next one can't be caught
+         * by polling anymore, so don't wait for it to arrive to shrink.
+         */
+        if (node->poll_ns && now - node->poll_last_event > ctx->poll_max_ns) {
+            adjust_handler_polling_time(ctx, node,
+                                        now - node->poll_last_event);
+        }
+
+        if (node->poll_ns) {
+            max_ns = MAX(max_ns, node->poll_ns);
+            active++;
+        }
+    }
+
+    ctx->poll_ns = max_ns;
+    stat64_set(&ctx->poll_stats.max_ns, max_ns);
+    stat64_set(&ctx->poll_stats.active, active);
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
     bool progress;
     bool use_notify_me;
     int64_t timeout;
-    int64_t start = 0;
 
     /*
      * There cannot be two concurrent aio_poll calls for the same AioContext (or
@@ -620,10 +758,6 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     qemu_lockcnt_inc(&ctx->list_lock);
 
-    if (ctx->poll_max_ns) {
-        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-    }
-
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
     progress = try_poll_mode(ctx, &ready_list, &timeout);
     assert(!(timeout && progress));
@@ -679,43 +813,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     /* Adjust polling time */
     if (ctx->poll_max_ns) {
-        int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
-
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
-        }
+        adjust_polling_times(ctx, &ready_list);
     }
 
     progress |= aio_bh_poll(ctx);
@@ -34,9 +34,13 @@ struct AioHandler {
     QLIST_ENTRY(AioHandler) node_poll;
 #ifdef CONFIG_LINUX_IO_URING
     QSLIST_ENTRY(AioHandler) node_submitted;
+    QSLIST_ENTRY(AioHandler) node_deferred; /* only used by home thread */
+    int deferred_res; /* see fdmon-io_uring.c */
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_ns; /* this handler's polling time, see aio-posix.c */
+    int64_t poll_last_event; /* when the last event was seen, 0 = never */
     bool poll_ready; /* has polling detected an event? */
     bool is_external;
 };
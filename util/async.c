@@ -466,7 +466,7 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -482,6 +482,25 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
 }
 #endif
 
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t sqpoll_idle,
+                                     Error **errp)
+{
+#ifndef CONFIG_LINUX_IO_URING
+    if (sqpoll_idle) {
+        error_setg(errp, "io_uring is not supported by this build");
+        return;
+    }
+#endif
+    if (sqpoll_idle > UINT32_MAX) {
+        error_setg(errp, "io_uring SQPOLL idle time must be at most %" PRIu32
+                   " ms", UINT32_MAX);
+        return;
+    }
+
+    /* Takes effect when aio_setup_linux_io_uring() creates the ring */
+    ctx->io_uring_sqpoll_idle = sqpoll_idle;
+}
+
 void aio_notify(AioContext *ctx)
 {
     /*
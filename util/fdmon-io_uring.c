@@ -19,9 +19,12 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other io_uring users in the same thread, i.e. the io_uring block driver, can
+ * put their requests on this ring with aio_uring_enqueue() instead of using a
+ * ring of their own.  They are then submitted and reaped by the same
+ * io_uring_enter(2) call as the fd monitoring requests, and their completions
+ * do not have to be signalled through a ring fd that is itself monitored.
+ * Their cqes are told apart from fd monitoring cqes by a tag bit in user_data.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -38,9 +41,17 @@
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * fdmon_io_uring_wait() and the aio_uring_*() functions, all of which run in
+ * the AioContext's home thread.  Changes to AioHandlers are made by enqueuing
+ * them on ctx->submit_list so that fdmon_io_uring_wait() can submit
+ * IORING_OP_POLL_ADD and/or IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * While external clients are disabled, events of external AioHandlers are
+ * held back on ctx->deferred_list instead of being dispatched.  Since
+ * IORING_OP_POLL_ADD is one-shot and is only re-armed once the event has been
+ * dispatched, each handler holds back at most one event.  The same list holds
+ * the events that aio_uring_poll() reaps while busy polling, until aio_poll()
+ * gets to dispatch them.
  */
 
 #include "qemu/osdep.h"
@@ -57,6 +68,12 @@ enum {
     FDMON_IO_URING_REMOVE   = (1 << 2),
 };
 
+/*
+ * Low bit of the user_data of aio_uring_enqueue() requests.  AioHandler and
+ * AioUringRequest pointers are aligned, so the bit is clear for poll requests.
+ */
+#define FDMON_IO_URING_REQUEST_TAG ((uintptr_t)1)
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -74,8 +91,8 @@ static inline int pfd_events_from_poll(int poll_events)
 }
 
 /*
- * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * Returns an sqe for submitting a request.  Only called from the AioContext's
+ * home thread.
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -219,37 +236,119 @@ static void fill_sq_ring(AioContext *ctx)
     }
 }
 
+/*
+ * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
+ * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
+ * bit before IORING_OP_POLL_REMOVE is submitted.
+ *
+ * Returns true if the handler was deleted.
+ */
+static bool process_remove(AioContext *ctx, AioHandler *node)
+{
+    unsigned flags;
+
+    flags = qatomic_fetch_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+    if (flags & FDMON_IO_URING_REMOVE) {
+        QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
+        return true;
+    }
+    return false;
+}
+
+/* Returns true if a handler became ready */
+static bool process_poll_event(AioContext *ctx,
+                               AioHandlerList *ready_list,
+                               AioHandler *node,
+                               int res)
+{
+    if (process_remove(ctx, node)) {
+        return false;
+    }
+
+    if (!aio_node_check(ctx, node->is_external)) {
+        node->deferred_res = res;
+        QSLIST_INSERT_HEAD(&ctx->deferred_list, node, node_deferred);
+        return false;
+    }
+
+    aio_add_ready_handler(ready_list, node, pfd_events_from_poll(res));
+
+    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    add_poll_add_sqe(ctx, node);
+    return true;
+}
+
+/* Complete a request from aio_uring_enqueue() */
+static void process_request(AioContext *ctx, uintptr_t user_data, int res)
+{
+    AioUringRequest *req = (void *)(user_data & ~FDMON_IO_URING_REQUEST_TAG);
+
+    assert(ctx->fdmon_io_uring_requests > 0);
+    ctx->fdmon_io_uring_requests--;
+    req->cb(req, res);
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
-    AioHandler *node = io_uring_cqe_get_data(cqe);
-    unsigned flags;
+    uintptr_t user_data = (uintptr_t)io_uring_cqe_get_data(cqe);
 
     /* poll_timeout and poll_remove have a zero user_data field */
-    if (!node) {
+    if (!user_data) {
         return false;
     }
 
-    /*
-     * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
-     * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
-     * bit before IORING_OP_POLL_REMOVE is submitted.
-     */
-    flags = qatomic_fetch_and(&node->flags, ~FDMON_IO_URING_REMOVE);
-    if (flags & FDMON_IO_URING_REMOVE) {
-        QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
+    if (user_data & FDMON_IO_URING_REQUEST_TAG) {
+        process_request(ctx, user_data, cqe->res);
         return false;
     }
 
-    aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
+    return process_poll_event(ctx, ready_list, (AioHandler *)user_data,
+                              cqe->res);
+}
+
+static bool deferred_list_ready(AioContext *ctx)
+{
+    AioHandler *node;
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
-    add_poll_add_sqe(ctx, node);
-    return true;
+    QSLIST_FOREACH(node, &ctx->deferred_list, node_deferred) {
+        if (aio_node_check(ctx, node->is_external)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Dispatch the events held back while external clients were disabled, or
+ * reaped by aio_uring_poll().  Events that still cannot be dispatched go
+ * back on the list.
+ */
+static int process_deferred_list(AioContext *ctx, AioHandlerList *ready_list)
+{
+    AioHandlerSList deferred_list;
+    AioHandler *node;
+    int num_ready = 0;
+
+    if (!deferred_list_ready(ctx)) {
+        return 0;
+    }
+
+    deferred_list = ctx->deferred_list;
+    QSLIST_INIT(&ctx->deferred_list);
+
+    while ((node = QSLIST_FIRST(&deferred_list))) {
+        QSLIST_REMOVE_HEAD(&deferred_list, node_deferred);
+        if (process_poll_event(ctx, ready_list, node, node->deferred_res)) {
+            num_ready++;
+        }
+    }
+    return num_ready;
 }
 
+
 static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
 {
     struct io_uring *ring = &ctx->fdmon_io_uring;
@@ -276,9 +375,9 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
     int ret;
 
-    /* Fall back while external clients are disabled */
-    if (qatomic_read(&ctx->external_disable_cnt)) {
-        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+    /* Don't block if held back events can be dispatched now */
+    if (deferred_list_ready(ctx)) {
+        timeout = 0;
     }
 
     if (timeout == 0) {
@@ -295,7 +394,8 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
 
     assert(ret >= 0);
 
-    return process_cq_ring(ctx, ready_list);
+    ret = process_cq_ring(ctx, ready_list);
+    return ret + process_deferred_list(ctx, ready_list);
 }
 
 static bool fdmon_io_uring_need_wait(AioContext *ctx)
@@ -315,8 +415,8 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
-    /* Are we falling back to fdmon-poll? */
-    return qatomic_read(&ctx->external_disable_cnt);
+    /* Have external clients been enabled while events were held back? */
+    return deferred_list_ready(ctx);
 }
 
 static const FDMonOps fdmon_io_uring_ops = {
@@ -325,16 +425,125 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
+struct io_uring *aio_uring_get_ring(AioContext *ctx, unsigned int *features)
+{
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops) {
+        return NULL;
+    }
+    if (features) {
+        *features = ctx->fdmon_io_uring_features;
+    }
+    return &ctx->fdmon_io_uring;
+}
+
+void aio_uring_enqueue(AioContext *ctx, const struct io_uring_sqe *sqe,
+                       AioUringRequest *req)
+{
+    struct io_uring_sqe *new_sqe;
+
+    assert(ctx->fdmon_ops == &fdmon_io_uring_ops);
+    assert(!((uintptr_t)req & FDMON_IO_URING_REQUEST_TAG));
+
+    new_sqe = get_sqe(ctx);
+    *new_sqe = *sqe;
+    io_uring_sqe_set_data(new_sqe, (void *)((uintptr_t)req |
+                                            FDMON_IO_URING_REQUEST_TAG));
+    ctx->fdmon_io_uring_requests++;
+}
+
+void aio_uring_submit(AioContext *ctx)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+
+    assert(ctx->fdmon_ops == &fdmon_io_uring_ops);
+
+    if (io_uring_sq_ready(ring)) {
+        io_uring_submit(ring);
+    }
+}
+
+bool aio_uring_poll(AioContext *ctx)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    struct io_uring_cqe *cqe;
+    unsigned num_cqes = 0;
+    bool progress = false;
+    unsigned head;
+
+    assert(ctx->fdmon_ops == &fdmon_io_uring_ops);
+
+    io_uring_for_each_cqe(ring, head, cqe) {
+        uintptr_t user_data = (uintptr_t)io_uring_cqe_get_data(cqe);
+
+        if (user_data & FDMON_IO_URING_REQUEST_TAG) {
+            process_request(ctx, user_data, cqe->res);
+            progress = true;
+        } else if (user_data) {
+            /*
+             * There is no ready list to put the handler on here, so hold
+             * the event back; process_deferred_list() dispatches it.
+             */
+            AioHandler *node = (AioHandler *)user_data;
+
+            node->deferred_res = cqe->res;
+            QSLIST_INSERT_HEAD(&ctx->deferred_list, node, node_deferred);
+        }
+        num_cqes++;
+    }
+
+    io_uring_cq_advance(ring, num_cqes);
+    return progress;
+}
+
+/*
+ * Wait for the requests from aio_uring_enqueue() to complete before the ring
+ * goes away.  Fd monitoring cqes are dropped; fdmon-poll will see the events
+ * again since it is level-triggered.
+ */
+static void drain_requests(AioContext *ctx)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+
+    while (ctx->fdmon_io_uring_requests) {
+        struct io_uring_cqe *cqe;
+        unsigned num_cqes = 0;
+        unsigned head;
+        int ret;
+
+        do {
+            ret = io_uring_submit_and_wait(ring, 1);
+        } while (ret == -EINTR);
+        assert(ret >= 0);
+
+        io_uring_for_each_cqe(ring, head, cqe) {
+            uintptr_t user_data = (uintptr_t)io_uring_cqe_get_data(cqe);
+
+            if (user_data & FDMON_IO_URING_REQUEST_TAG) {
+                process_request(ctx, user_data, cqe->res);
+            } else if (user_data) {
+                process_remove(ctx, (AioHandler *)user_data);
+            }
+            num_cqes++;
+        }
+        io_uring_cq_advance(ring, num_cqes);
+    }
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
+    struct io_uring_params params = {};
     int ret;
 
-    ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
+    ret = io_uring_queue_init_params(FDMON_IO_URING_ENTRIES,
+                                     &ctx->fdmon_io_uring, &params);
     if (ret != 0) {
         return false;
     }
 
+    ctx->fdmon_io_uring_features = params.features;
+    ctx->fdmon_io_uring_requests = 0;
     QSLIST_INIT(&ctx->submit_list);
+    QSLIST_INIT(&ctx->deferred_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -344,8 +553,15 @@ void fdmon_io_uring_destroy(AioContext *ctx)
     if (ctx->fdmon_ops == &fdmon_io_uring_ops) {
         AioHandler *node;
 
+        drain_requests(ctx);
         io_uring_queue_exit(&ctx->fdmon_io_uring);
 
+        /* Held back events are seen again by fdmon-poll */
+        while ((node = QSLIST_FIRST(&ctx->deferred_list))) {
+            QSLIST_REMOVE_HEAD(&ctx->deferred_list, node_deferred);
+            process_remove(ctx, node);
+        }
+
         /* Move handlers due to be removed onto the deleted list */
         while ((node = QSLIST_FIRST_RCU(&ctx->submit_list))) {
             unsigned flags = qatomic_fetch_and(&node->flags,
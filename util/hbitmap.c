@@ -50,8 +50,235 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level, which is as large as all the others combined times
+ * BITS_PER_LONG, is split into chunks of HBITMAP_CHUNK_WORDS words that
+ * are only allocated when a bit in them is set; a missing chunk reads as
+ * all zeroes.  A chunk is released again when the 2nd-last level shows
+ * that all of its words are zero.  Bitmaps for very large disks are
+ * usually very sparse, so this keeps their memory footprint proportional
+ * to the number of dirty areas rather than to the size of the disk.
+ */
+
+/*
+ * Word-array primitives for the parts of HBitmap that are linear in the
+ * length of a range: scanning for zero bits, bulk set/reset, merging and
+ * counting.  As in buffer_is_zero(), the implementation is picked at
+ * startup according to the features of the host CPU.
  */
 
+/* Return the index of the first of the @n words at @p that is not @val,
+ * or @n if there is none.
+ */
+static size_t hb_find_not_int(const unsigned long *p, size_t n,
+                              unsigned long val)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        if ((p[i] ^ val) | (p[i + 1] ^ val) |
+            (p[i + 2] ^ val) | (p[i + 3] ^ val)) {
+            break;
+        }
+    }
+    while (i < n && p[i] == val) {
+        i++;
+    }
+    return i;
+}
+
+/* dst[i] = a[i] | b[i] for the @n words; @dst may alias @a or @b.  */
+static void hb_or_int(unsigned long *dst, const unsigned long *a,
+                      const unsigned long *b, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+    }
+}
+
+/* Return the number of bits set in the @n words at @p.  */
+static uint64_t hb_count_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+#if (defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)) && \
+    HOST_LONG_BITS == 64
+#include <immintrin.h>
+
+static uint64_t __attribute__((target("popcnt")))
+hb_count_popcnt(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += __builtin_popcountl(p[i]);
+    }
+    return count;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static size_t __attribute__((target("avx2")))
+hb_find_not_avx2(const unsigned long *p, size_t n, unsigned long val)
+{
+    __m256i v = _mm256_set1_epi64x(val);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_cmpeq_epi64(_mm256_loadu_si256((void *)(p + i)), v);
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(t)) ^ 0xf;
+
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    return i + hb_find_not_int(p + i, n - i, val);
+}
+
+static void __attribute__((target("avx2")))
+hb_or_avx2(unsigned long *dst, const unsigned long *a,
+           const unsigned long *b, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_or_si256(_mm256_loadu_si256((void *)(a + i)),
+                                    _mm256_loadu_si256((void *)(b + i)));
+        _mm256_storeu_si256((void *)(dst + i), t);
+    }
+    hb_or_int(dst + i, a + i, b + i, n - i);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512F_OPT
+static size_t __attribute__((target("avx512f")))
+hb_find_not_avx512(const unsigned long *p, size_t n, unsigned long val)
+{
+    __m512i v = _mm512_set1_epi64(val);
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __mmask8 mask = _mm512_cmpneq_epu64_mask(_mm512_loadu_si512(p + i),
+                                                 v);
+        if (mask) {
+            return i + ctz32(mask);
+        }
+    }
+    return i + hb_find_not_int(p + i, n - i, val);
+}
+
+static void __attribute__((target("avx512f")))
+hb_or_avx512(unsigned long *dst, const unsigned long *a,
+             const unsigned long *b, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m512i t = _mm512_or_si512(_mm512_loadu_si512(a + i),
+                                    _mm512_loadu_si512(b + i));
+        _mm512_storeu_si512(dst + i, t);
+    }
+    hb_or_int(dst + i, a + i, b + i, n - i);
+}
+#endif /* CONFIG_AVX512F_OPT */
+
+/* As for test_buffer_is_zero_next_accel, the most preferred ISA must
+ * have the least significant bit.
+ */
+#define CACHE_AVX512F 1
+#define CACHE_AVX2    2
+
+static unsigned cpuid_cache;
+#endif
+
+static size_t (*hb_find_not)(const unsigned long *p, size_t n,
+                             unsigned long val) = hb_find_not_int;
+static void (*hb_or)(unsigned long *dst, const unsigned long *a,
+                     const unsigned long *b, size_t n) = hb_or_int;
+static uint64_t (*hb_count)(const unsigned long *p, size_t n) = hb_count_int;
+
+#if (defined(CONFIG_AVX512F_OPT) || defined(CONFIG_AVX2_OPT)) && \
+    HOST_LONG_BITS == 64
+#include "qemu/cpuid.h"
+
+static void init_accel(unsigned cache)
+{
+    hb_find_not = hb_find_not_int;
+    hb_or = hb_or_int;
+    hb_count = hb_count_int;
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        hb_find_not = hb_find_not_avx2;
+        hb_or = hb_or_avx2;
+        hb_count = hb_count_popcnt;
+    }
+#endif
+#ifdef CONFIG_AVX512F_OPT
+    if (cache & CACHE_AVX512F) {
+        hb_find_not = hb_find_not_avx512;
+        hb_or = hb_or_avx512;
+        hb_count = hb_count_popcnt;
+    }
+#endif
+}
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* AVX must be usable, not just available; POPCNT comes along.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && (c & bit_POPCNT)) {
+            unsigned bv = xgetbv_low(0);
+
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* OPMASK and ZMM state, see util/bufferiszero.c */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F)) {
+                cache |= CACHE_AVX512F;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+
+bool test_hbitmap_next_accel(void)
+{
+    /* If no bits set, we just tested the generic functions.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+#else
+bool test_hbitmap_next_accel(void)
+{
+    return false;
+}
+#endif
+
+#define HBITMAP_CHUNK_BITS   9
+#define HBITMAP_CHUNK_WORDS  (1UL << HBITMAP_CHUNK_BITS)
+
 struct HBitmap {
     /*
      * Size of the bitmap, as requested in hbitmap_alloc or in hbitmap_truncate.
@@ -94,13 +321,143 @@ struct HBitmap {
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
      * bitmap will still allocate HBITMAP_LEVELS arrays.
+     *
+     * levels[HBITMAP_LEVELS - 1] is always NULL, the last level lives in
+     * @chunks instead.
      */
     unsigned long *levels[HBITMAP_LEVELS];
 
-    /* The length of each levels[] array. */
+    /* The length of each levels[] array, in words. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /* The last level, in chunks of HBITMAP_CHUNK_WORDS words (the last
+     * chunk may be shorter).  NULL chunks are all zero.
+     */
+    unsigned long **chunks;
+    uint64_t nb_chunks;
 };
 
+static inline uint64_t hb_nb_chunks(uint64_t words)
+{
+    return DIV_ROUND_UP(words, HBITMAP_CHUNK_WORDS);
+}
+
+/* Number of words in chunk @c of the last level.  */
+static inline uint64_t hb_chunk_words(const HBitmap *hb, uint64_t c)
+{
+    return MIN(HBITMAP_CHUNK_WORDS,
+               hb->sizes[HBITMAP_LEVELS - 1] - (c << HBITMAP_CHUNK_BITS));
+}
+
+/* Read word @pos of the last level.  */
+static inline unsigned long hb_word(const HBitmap *hb, uint64_t pos)
+{
+    const unsigned long *chunk = hb->chunks[pos >> HBITMAP_CHUNK_BITS];
+
+    return chunk ? chunk[pos & (HBITMAP_CHUNK_WORDS - 1)] : 0;
+}
+
+/* Return chunk @c of the last level, allocating it if needed.  */
+static unsigned long *hb_chunk_alloc(HBitmap *hb, uint64_t c)
+{
+    if (!hb->chunks[c]) {
+        hb->chunks[c] = g_new0(unsigned long, hb_chunk_words(hb, c));
+    }
+    return hb->chunks[c];
+}
+
+/* Return a pointer to word @pos of the last level for writing to it.
+ * If @alloc is false and the word lives in a chunk that is not allocated,
+ * i.e. it is zero, return NULL instead.
+ */
+static inline unsigned long *hb_word_ptr(HBitmap *hb, uint64_t pos,
+                                         bool alloc)
+{
+    uint64_t c = pos >> HBITMAP_CHUNK_BITS;
+
+    if (!hb->chunks[c] && !alloc) {
+        return NULL;
+    }
+    return &hb_chunk_alloc(hb, c)[pos & (HBITMAP_CHUNK_WORDS - 1)];
+}
+
+/* Return a pointer to word @pos of @level for writing to it.  */
+static inline unsigned long *hb_elem_ptr(HBitmap *hb, int level,
+                                         uint64_t pos, bool alloc)
+{
+    if (level == HBITMAP_LEVELS - 1) {
+        return hb_word_ptr(hb, pos, alloc);
+    }
+    return &hb->levels[level][pos];
+}
+
+/* Free the chunks in [@first, @last] whose words are all zero, as
+ * told by the 2nd-last level.
+ */
+static void hb_release_chunks(HBitmap *hb, uint64_t first, uint64_t last)
+{
+    const unsigned long *upper = hb->levels[HBITMAP_LEVELS - 2];
+    uint64_t upper_words = HBITMAP_CHUNK_WORDS / BITS_PER_LONG;
+    uint64_t c, i, n;
+
+    for (c = first; c <= last; c++) {
+        if (!hb->chunks[c]) {
+            continue;
+        }
+        i = c * upper_words;
+        n = MIN(upper_words, hb->sizes[HBITMAP_LEVELS - 2] - i);
+        if (hb_find_not(&upper[i], n, 0) == n) {
+            g_free(hb->chunks[c]);
+            hb->chunks[c] = NULL;
+        }
+    }
+}
+
+/* Return how many words of @level starting at @pos, and before @end, are
+ * stored contiguously.
+ */
+static inline uint64_t hb_run_words(int level, uint64_t pos, uint64_t end)
+{
+    if (level == HBITMAP_LEVELS - 1) {
+        end = MIN(end, ROUND_UP(pos + 1, HBITMAP_CHUNK_WORDS));
+    }
+    return end - pos;
+}
+
+/* Return the index of the first word of the last level in [@pos, @end)
+ * that is not all ones, or @end if there is none.
+ */
+static uint64_t hb_find_not_ones(const HBitmap *hb, uint64_t pos,
+                                 uint64_t end)
+{
+    uint64_t n, i;
+
+    for (; pos < end; pos += n) {
+        const unsigned long *chunk = hb->chunks[pos >> HBITMAP_CHUNK_BITS];
+        const unsigned long *p;
+
+        if (!chunk) {
+            return pos;
+        }
+        n = hb_run_words(HBITMAP_LEVELS - 1, pos, end);
+        p = &chunk[pos & (HBITMAP_CHUNK_WORDS - 1)];
+
+        /* Most gaps are short, look at a few words before calling out.  */
+        for (i = 0; i < MIN(n, 4); i++) {
+            if (p[i] != ~0UL) {
+                return pos + i;
+            }
+        }
+        if (i < n) {
+            i += hb_find_not(p + i, n - i, ~0UL);
+            if (i < n) {
+                return pos + i;
+            }
+        }
+    }
+    return end;
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -136,7 +493,8 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = i + 1 == HBITMAP_LEVELS - 1 ? hb_word(hb, pos)
+                                          : hb->levels[i + 1][pos];
     }
 
     hbi->pos = pos;
@@ -149,7 +507,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_word(hbi->hb, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -182,7 +540,9 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = i == HBITMAP_LEVELS - 1 ? hb_word(hb, pos)
+                                              : hb->levels[i][pos];
+        hbi->cur[i] &= ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -220,8 +580,7 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur;
     unsigned start_bit_offset;
     uint64_t end_bit, sz;
     int64_t res;
@@ -232,6 +591,8 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
         return -1;
     }
 
+    cur = hb_word(hb, pos);
+
     end_bit = count > hb->orig_size - start ?
                 hb->size :
                 ((start + count - 1) >> hb->granularity) + 1;
@@ -245,15 +606,12 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_not_ones(hb, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
 
-        cur = last_lev[pos];
+        cur = hb_word(hb, pos);
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -349,62 +707,34 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
+/* Count the number of set bits between start and last, not accounting for
+ * the granularity.
  */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
+static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 {
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
+    uint64_t pos = start >> BITS_PER_LEVEL;
+    uint64_t lastpos = last >> BITS_PER_LEVEL;
+    unsigned long first_mask = ~0UL << (start & (BITS_PER_LONG - 1));
+    unsigned long last_mask = 2UL << (last & (BITS_PER_LONG - 1));
+    uint64_t count, n;
 
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
-        }
-    }
+    /* Wraps to ~0UL if last is the final bit of its word */
+    last_mask -= 1;
 
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
-}
+    if (pos == lastpos) {
+        return ctpopl(hb_word(hb, pos) & first_mask & last_mask);
+    }
 
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
- */
-static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
-{
-    HBitmapIter hbi;
-    uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
+    count = ctpopl(hb_word(hb, pos) & first_mask) +
+            ctpopl(hb_word(hb, lastpos) & last_mask);
+    for (pos++; pos < lastpos; pos += n) {
+        const unsigned long *chunk = hb->chunks[pos >> HBITMAP_CHUNK_BITS];
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
+        n = hb_run_words(HBITMAP_LEVELS - 1, pos, lastpos);
+        if (chunk) {
+            count += hb_count(&chunk[pos & (HBITMAP_CHUNK_WORDS - 1)], n);
         }
-        count += ctpopl(cur);
     }
-
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
-    }
-
     return count;
 }
 
@@ -434,23 +764,25 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
-    size_t i;
+    unsigned long *elem;
+    size_t i, n;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+        changed |= hb_set_elem(hb_elem_ptr(hb, level, i, true),
+                               start, next - 1);
+
+        /* Fill the words in between one contiguous run at a time.  */
+        for (i++; i < lastpos; i += n) {
+            n = hb_run_words(level, i, lastpos);
+            elem = hb_elem_ptr(hb, level, i, true);
+            changed |= hb_find_not(elem, n, ~0UL) < n;
+            memset(elem, 0xff, n * sizeof(unsigned long));
         }
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(hb_elem_ptr(hb, level, i, true), start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -497,6 +829,11 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     assert((last >> BITS_PER_LEVEL) == (start >> BITS_PER_LEVEL));
     assert(start <= last);
 
+    /* An unallocated chunk of the last level is already zero.  */
+    if (!elem) {
+        return false;
+    }
+
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
@@ -512,7 +849,8 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
-    size_t i;
+    unsigned long *elem;
+    size_t i, n;
 
     i = pos;
     if (i < lastpos) {
@@ -523,25 +861,27 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(hb_elem_ptr(hb, level, i, false),
+                          start, next - 1)) {
             changed = true;
         } else {
             pos++;
         }
 
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
+        /* An unallocated chunk of the last level is already zero.  */
+        for (i++; i < lastpos; i += n) {
+            n = hb_run_words(level, i, lastpos);
+            elem = hb_elem_ptr(hb, level, i, false);
+            if (elem) {
+                changed |= hb_find_not(elem, n, 0) < n;
+                memset(elem, 0, n * sizeof(unsigned long));
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
         }
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(hb_elem_ptr(hb, level, i, false), start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -577,18 +917,27 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     assert(last < hb->size);
 
     hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
-        hbitmap_set(hb->meta, start, count);
+    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last)) {
+        hb_release_chunks(hb, (first >> BITS_PER_LEVEL) >> HBITMAP_CHUNK_BITS,
+                          (last >> BITS_PER_LEVEL) >> HBITMAP_CHUNK_BITS);
+        if (hb->meta) {
+            hbitmap_set(hb->meta, start, count);
+        }
     }
 }
 
 void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
+    uint64_t c;
+
+    for (c = 0; c < hb->nb_chunks; c++) {
+        g_free(hb->chunks[c]);
+        hb->chunks[c] = NULL;
+    }
 
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    for (i = HBITMAP_LEVELS - 1; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -621,7 +970,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_word(hb, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -638,7 +987,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -652,15 +1001,39 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
+/* Fill words [@first, @first + @el_count) of the last level with @fill,
+ * which is either 0 or ~0UL.  Chunks that are entirely zeroed are freed.
+ */
+static void hb_fill_words(HBitmap *hb, uint64_t first, uint64_t el_count,
+                          unsigned long fill)
+{
+    uint64_t end = first + el_count;
+
+    while (first < end) {
+        uint64_t c = first >> HBITMAP_CHUNK_BITS;
+        uint64_t idx = first & (HBITMAP_CHUNK_WORDS - 1);
+        uint64_t n = MIN(hb_chunk_words(hb, c) - idx, end - first);
+
+        if (!fill && idx == 0 && n == hb_chunk_words(hb, c)) {
+            g_free(hb->chunks[c]);
+            hb->chunks[c] = NULL;
+        } else if (fill || hb->chunks[c]) {
+            memset(&hb_chunk_alloc(hb, c)[idx], fill & 0xff,
+                   n * sizeof(unsigned long));
+        }
+        first += n;
+    }
+}
+
 uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur;
+    uint64_t cur;
 
     if (!count) {
         return 0;
@@ -674,7 +1047,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -683,9 +1056,9 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+        unsigned long el = hb_word(hb, cur);
 
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
         cur++;
@@ -697,7 +1070,7 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -706,12 +1079,19 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el, *elem;
 
+        memcpy(&el, buf, sizeof(el));
         if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
+            le32_to_cpus((uint32_t *)&el);
         } else {
-            le64_to_cpus((uint64_t *)cur);
+            le64_to_cpus((uint64_t *)&el);
+        }
+
+        /* Do not allocate chunks just to store zeroes in them */
+        elem = hb_word_ptr(hb, cur, el != 0);
+        if (elem) {
+            *elem = el;
         }
 
         buf += sizeof(unsigned long);
@@ -726,14 +1106,14 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, 0);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -743,14 +1123,14 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, ~0UL);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -759,6 +1139,7 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
 void hbitmap_deserialize_finish(HBitmap *bitmap)
 {
     int64_t i, size, prev_size;
+    uint64_t c;
     int lev;
 
     /* restore levels starting from penultimate to zero level, assuming
@@ -769,6 +1150,31 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
+        if (lev == HBITMAP_LEVELS - 2) {
+            /* Only visit the allocated chunks of the last level */
+            for (c = 0; c < bitmap->nb_chunks; c++) {
+                uint64_t base = c << HBITMAP_CHUNK_BITS;
+                uint64_t n = hb_chunk_words(bitmap, c);
+
+                if (!bitmap->chunks[c]) {
+                    continue;
+                }
+                i = hb_find_not(bitmap->chunks[c], n, 0);
+                if (i == n) {
+                    g_free(bitmap->chunks[c]);
+                    bitmap->chunks[c] = NULL;
+                    continue;
+                }
+                for (; i < n; i++) {
+                    if (bitmap->chunks[c][i]) {
+                        bitmap->levels[lev][(base + i) >> BITS_PER_LEVEL] |=
+                            1UL << ((base + i) & (BITS_PER_LONG - 1));
+                    }
+                }
+            }
+            continue;
+        }
+
         for (i = 0; i < prev_size; ++i) {
             if (bitmap->levels[lev + 1][i]) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
@@ -784,7 +1190,13 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
 void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
+    uint64_t c;
+
     assert(!hb->meta);
+    for (c = 0; c < hb->nb_chunks; c++) {
+        g_free(hb->chunks[c]);
+    }
+    g_free(hb->chunks);
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
@@ -808,7 +1220,12 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (i == HBITMAP_LEVELS - 1) {
+            hb->nb_chunks = hb_nb_chunks(size);
+            hb->chunks = g_new0(unsigned long *, hb->nb_chunks);
+        } else {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -820,6 +1237,40 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     return hb;
 }
 
+/* Resize the last level to @words words.  Bits beyond the end of the
+ * bitmap are always clear, so no zeroing is needed when shrinking.
+ */
+static void hb_truncate_chunks(HBitmap *hb, uint64_t words)
+{
+    uint64_t old_chunks = hb->nb_chunks;
+    uint64_t old_last = old_chunks - 1;
+    uint64_t old_words = hb_chunk_words(hb, old_last);
+    uint64_t c;
+
+    for (c = hb_nb_chunks(words); c < old_chunks; c++) {
+        g_free(hb->chunks[c]);
+    }
+    hb->nb_chunks = hb_nb_chunks(words);
+    hb->chunks = g_renew(unsigned long *, hb->chunks, hb->nb_chunks);
+    for (c = old_chunks; c < hb->nb_chunks; c++) {
+        hb->chunks[c] = NULL;
+    }
+
+    hb->sizes[HBITMAP_LEVELS - 1] = words;
+
+    /* Resize the formerly (or newly) partial last chunk */
+    c = MIN(old_last, hb->nb_chunks - 1);
+    if (hb->chunks[c]) {
+        uint64_t n = hb_chunk_words(hb, c);
+
+        hb->chunks[c] = g_renew(unsigned long, hb->chunks[c], n);
+        if (c == old_last && n > old_words) {
+            memset(&hb->chunks[c][old_words], 0,
+                   (n - old_words) * sizeof(unsigned long));
+        }
+    }
+}
+
 void hbitmap_truncate(HBitmap *hb, uint64_t size)
 {
     bool shrink;
@@ -860,6 +1311,10 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         if (hb->sizes[i] == size) {
             break;
         }
+        if (i == HBITMAP_LEVELS - 1) {
+            hb_truncate_chunks(hb, size);
+            continue;
+        }
         old = hb->sizes[i];
         hb->sizes[i] = size;
         hb->levels[i] = g_renew(unsigned long, hb->levels[i], size);
@@ -901,7 +1356,7 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
+    uint64_t c, n;
 
     assert(a->orig_size == result->orig_size);
     assert(b->orig_size == result->orig_size);
@@ -934,11 +1389,32 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+    for (c = 0; c < a->nb_chunks; c++) {
+        const unsigned long *ca = a->chunks[c], *cb = b->chunks[c];
+        unsigned long *cr;
+
+        if (!ca && !cb) {
+            if (result != a && result != b) {
+                g_free(result->chunks[c]);
+                result->chunks[c] = NULL;
+            }
+            continue;
+        }
+
+        /* Allocating may change a's or b's chunk if result aliases them */
+        cr = hb_chunk_alloc(result, c);
+        ca = a->chunks[c];
+        cb = b->chunks[c];
+        n = hb_chunk_words(result, c);
+        if (ca && cb) {
+            hb_or(cr, ca, cb, n);
+        } else if (cr != (ca ?: cb)) {
+            memcpy(cr, ca ?: cb, n * sizeof(unsigned long));
         }
     }
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
+        hb_or(result->levels[i], a->levels[i], b->levels[i], a->sizes[i]);
+    }
 
     /* Recompute the dirty count */
     result->count = hb_count_between(result, 0, result->size - 1);
@@ -946,10 +1422,18 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
 {
-    size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
-    char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
+    static const unsigned long zero_chunk[HBITMAP_CHUNK_WORDS];
+    g_autofree struct iovec *iov = g_new(struct iovec, bitmap->nb_chunks);
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALG_SHA256, data, size, &hash, errp);
+    uint64_t c;
+
+    /* Hash the last level as if it was stored contiguously */
+    for (c = 0; c < bitmap->nb_chunks; c++) {
+        iov[c].iov_base = bitmap->chunks[c] ?: (void *)zero_chunk;
+        iov[c].iov_len = hb_chunk_words(bitmap, c) * sizeof(unsigned long);
+    }
+    qcrypto_hash_digestv(QCRYPTO_HASH_ALG_SHA256, iov, bitmap->nb_chunks,
+                         &hash, errp);
 
     return hash;
 }
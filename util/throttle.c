@@ -484,6 +484,168 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+#define THROTTLE_TICKS_PER_SECOND \
+    ((double)NANOSECONDS_PER_SECOND * THROTTLE_TICKS_PER_NS)
+
+/* Anything beyond a few years is as good as forever */
+#define THROTTLE_TICKS_MAX (UINT64_MAX >> 4)
+
+/* Reset all buckets of a ThrottleTokens to empty
+ *
+ * @tok: the buckets to reset
+ */
+void throttle_tokens_init(ThrottleTokens *tok)
+{
+    int i;
+
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        stat64_init(&tok->empty_at[i][0], 0);
+        stat64_init(&tok->empty_at[i][1], 0);
+    }
+}
+
+/* Return how long a bucket takes to leak completely once it is full,
+ * i.e. how far ahead of the current time empty_at can be before I/O
+ * has to wait.  The bucket sizes are the same as in
+ * throttle_compute_wait().
+ *
+ * @bkt:   the leaky bucket
+ * @burst: true for the burst bucket
+ * @ret:   the tolerance in ticks
+ */
+uint64_t throttle_tokens_tolerance(const LeakyBucket *bkt, bool burst)
+{
+    double ticks;
+
+    if (burst || !bkt->max) {
+        /* bkt->max / 10 leaking at bkt->max, or bkt->avg / 10 at bkt->avg */
+        ticks = THROTTLE_TICKS_PER_SECOND / 10;
+    } else {
+        ticks = (double)bkt->max * bkt->burst_length *
+                THROTTLE_TICKS_PER_SECOND / bkt->avg;
+    }
+
+    return ticks < THROTTLE_TICKS_MAX ? (uint64_t)ticks : THROTTLE_TICKS_MAX;
+}
+
+static uint64_t throttle_tokens_ticks(double units, uint64_t rate)
+{
+    double ticks = units * THROTTLE_TICKS_PER_SECOND / rate;
+
+    return ticks < THROTTLE_TICKS_MAX ? (uint64_t)(ticks + 0.5) :
+                                        THROTTLE_TICKS_MAX;
+}
+
+/* Compute what an I/O request costs in each bucket.  Buckets without a
+ * limit, and those that the request does not go through, cost nothing.
+ *
+ * @cfg:      the configuration
+ * @is_write: the type of operation (read/write)
+ * @size:     the size of the operation
+ * @cost:     the cost will be written here
+ */
+void throttle_tokens_cost(const ThrottleConfig *cfg, bool is_write,
+                          uint64_t size, ThrottleCost *cost)
+{
+    const BucketType bucket_types[2][4] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ,
+          THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE,
+          THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE },
+    };
+    double units = 1.0;
+    unsigned i;
+
+    /* same unit count as throttle_account() */
+    if (cfg->op_size && size > cfg->op_size) {
+        units = (double) size / cfg->op_size;
+    }
+
+    memset(cost, 0, sizeof(*cost));
+    for (i = 0; i < 4; i++) {
+        BucketType index = bucket_types[is_write][i];
+        const LeakyBucket *bkt = &cfg->buckets[index];
+        double n = i < 2 ? size : units;
+
+        if (!bkt->avg) {
+            continue;
+        }
+        cost->ticks[index][0] = throttle_tokens_ticks(n, bkt->avg);
+        if (bkt->burst_length > 1) {
+            cost->ticks[index][1] = throttle_tokens_ticks(n, bkt->max);
+        }
+    }
+}
+
+/* Compute how long an I/O request has to wait before the buckets that it
+ * goes through have room for it.  This is the lock-free counterpart of
+ * throttle_compute_wait_for().
+ *
+ * @tok:      the bucket state
+ * @cfg:      the configuration
+ * @is_write: the type of operation (read/write)
+ * @now:      the current clock timestamp
+ * @ret:      the time to wait in ns, or 0 if the operation can go through
+ */
+int64_t throttle_tokens_compute_wait(ThrottleTokens *tok,
+                                     const ThrottleConfig *cfg,
+                                     bool is_write, int64_t now)
+{
+    const BucketType to_check[2][4] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_OPS_TOTAL,
+          THROTTLE_BPS_READ, THROTTLE_OPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_OPS_TOTAL,
+          THROTTLE_BPS_WRITE, THROTTLE_OPS_WRITE },
+    };
+    uint64_t now_ticks = now * THROTTLE_TICKS_PER_NS;
+    int64_t ahead, max_wait = 0;
+    int i, burst;
+
+    for (i = 0; i < 4; i++) {
+        BucketType index = to_check[is_write][i];
+        const LeakyBucket *bkt = &cfg->buckets[index];
+
+        if (!bkt->avg) {
+            continue;
+        }
+        for (burst = 0; burst <= (bkt->burst_length > 1); burst++) {
+            ahead = stat64_get(&tok->empty_at[index][burst]) - now_ticks;
+            if (ahead <= 0) {
+                continue;
+            }
+            /* Both operands are below THROTTLE_TICKS_MAX */
+            ahead -= throttle_tokens_tolerance(bkt, burst);
+            max_wait = MAX(max_wait, ahead);
+        }
+    }
+
+    return DIV_ROUND_UP(max_wait, THROTTLE_TICKS_PER_NS);
+}
+
+/* Do the accounting for an I/O request.  This can run concurrently with
+ * itself and with throttle_tokens_compute_wait(), without a lock.
+ *
+ * @tok:  the bucket state
+ * @cost: the cost of the request, see throttle_tokens_cost()
+ * @now:  the current clock timestamp
+ */
+void throttle_tokens_account(ThrottleTokens *tok, const ThrottleCost *cost,
+                             int64_t now)
+{
+    uint64_t now_ticks = now * THROTTLE_TICKS_PER_NS;
+    int i, burst;
+
+    for (i = 0; i < BUCKETS_COUNT; i++) {
+        for (burst = 0; burst < 2; burst++) {
+            if (cost->ticks[i][burst]) {
+                /* Leak everything that has leaked until now */
+                stat64_max(&tok->empty_at[i][burst], now_ticks);
+                stat64_add(&tok->empty_at[i][burst], cost->ticks[i][burst]);
+            }
+        }
+    }
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
@@ -231,6 +231,67 @@ int qemu_vfio_pci_init_irq(QEMUVFIOState *s, EventNotifier *e,
     return 0;
 }
 
+/*
+ * Enable @count interrupt vectors of type @irq_type, with vector i signalling
+ * @e[i].  Vectors that were enabled before are disabled first, because VFIO
+ * cannot grow the set of enabled MSI-X vectors in place.
+ */
+int qemu_vfio_pci_init_irqs(QEMUVFIOState *s, EventNotifier **e,
+                            unsigned count, int irq_type, Error **errp)
+{
+    int r;
+    unsigned i;
+    struct vfio_irq_set *irq_set;
+    size_t irq_set_size;
+    struct vfio_irq_info irq_info = { .argsz = sizeof(irq_info) };
+
+    irq_info.index = irq_type;
+    if (ioctl(s->device, VFIO_DEVICE_GET_IRQ_INFO, &irq_info)) {
+        error_setg_errno(errp, errno, "Failed to get device interrupt info");
+        return -errno;
+    }
+    if (!(irq_info.flags & VFIO_IRQ_INFO_EVENTFD)) {
+        error_setg(errp, "Device interrupt doesn't support eventfd");
+        return -EINVAL;
+    }
+    if (irq_info.count < count) {
+        error_setg(errp, "Device has only %u interrupt vectors, %u needed",
+                   irq_info.count, count);
+        return -EINVAL;
+    }
+
+    irq_set_size = sizeof(*irq_set) + count * sizeof(int);
+    irq_set = g_malloc0(irq_set_size);
+
+    /* Ignore errors, the vectors may not have been enabled yet */
+    *irq_set = (struct vfio_irq_set) {
+        .argsz = sizeof(*irq_set),
+        .flags = VFIO_IRQ_SET_DATA_NONE | VFIO_IRQ_SET_ACTION_TRIGGER,
+        .index = irq_info.index,
+        .start = 0,
+        .count = 0,
+    };
+    ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
+
+    *irq_set = (struct vfio_irq_set) {
+        .argsz = irq_set_size,
+        .flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
+        .index = irq_info.index,
+        .start = 0,
+        .count = count,
+    };
+    for (i = 0; i < count; i++) {
+        ((int *)&irq_set->data)[i] = event_notifier_get_fd(e[i]);
+    }
+    r = ioctl(s->device, VFIO_DEVICE_SET_IRQS, irq_set);
+    g_free(irq_set);
+    if (r) {
+        error_setg_errno(errp, errno, "Failed to setup device interrupts");
+        return -errno;
+    }
+    return 0;
+}
+
 static int qemu_vfio_pci_read_config(QEMUVFIOState *s, void *buf,
                                      int size, int ofs)
 {
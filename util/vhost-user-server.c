@@ -52,6 +52,14 @@
  * possible by QIOChannel's support for spurious coroutine re-entry in
  * qio_channel_yield(). The coroutine will restart I/O when re-entered from the
  * new AioContext.
+ *
+ * Virtqueues can also be processed in other AioContexts (queue threads), so
+ * that the requests of different virtqueues are taken off the rings and
+ * completed in parallel.  Their kick fds are monitored in the queue thread,
+ * and vhost-user message handling must then not change the virtqueues or the
+ * guest memory map under their feet: vu_client_trip() holds every queue
+ * thread's lock from when it has read a message until it starts to read the
+ * next one, and the queue threads take their lock around virtqueue accesses.
  */
 
 static void vmsg_close_fds(VhostUserMsg *vmsg)
@@ -77,18 +85,85 @@ static void panic_cb(VuDev *vu_dev, const char *buf)
 
 void vhost_user_server_ref(VuServer *server)
 {
-    assert(!server->wait_idle);
-    server->refcount++;
+    assert(!qatomic_read(&server->wait_idle));
+    qatomic_inc(&server->refcount);
 }
 
 void vhost_user_server_unref(VuServer *server)
 {
-    server->refcount--;
-    if (server->wait_idle && !server->refcount) {
+    /* Only one of us and vu_client_trip() gets to clear wait_idle */
+    if (qatomic_fetch_dec(&server->refcount) == 1 &&
+        qatomic_xchg(&server->wait_idle, false)) {
         aio_co_wake(server->co_trip);
     }
 }
 
+static VuQueueThread *vu_queue_thread(VuServer *server, int vq_idx)
+{
+    if (!server->nr_queue_threads) {
+        return NULL;
+    }
+    return &server->queue_threads[vq_idx % server->nr_queue_threads];
+}
+
+static void vu_queue_threads_lock_all(VuServer *server)
+{
+    unsigned int i;
+
+    for (i = 0; i < server->nr_queue_threads; i++) {
+        qemu_mutex_lock(&server->queue_threads[i].lock);
+    }
+}
+
+static void vu_queue_threads_unlock_all(VuServer *server)
+{
+    unsigned int i;
+
+    for (i = 0; i < server->nr_queue_threads; i++) {
+        qemu_mutex_unlock(&server->queue_threads[i].lock);
+    }
+}
+
+/* Keep the queue threads away from the virtqueues, called by vu_client_trip() */
+static void vu_lock_queue_threads(VuServer *server)
+{
+    if (!server->queue_threads_locked) {
+        vu_queue_threads_lock_all(server);
+        server->queue_threads_locked = true;
+    }
+}
+
+static void vu_unlock_queue_threads(VuServer *server)
+{
+    if (server->queue_threads_locked) {
+        server->queue_threads_locked = false;
+        vu_queue_threads_unlock_all(server);
+    }
+}
+
+/*
+ * Virtqueues that are processed in a queue thread may only be accessed
+ * with its lock held (or from vhost-user message handling).  A no-op for
+ * virtqueues that are processed in VuServer->ctx.
+ */
+void vhost_user_server_queue_lock(VuServer *server, int vq_idx)
+{
+    VuQueueThread *thread = vu_queue_thread(server, vq_idx);
+
+    if (thread) {
+        qemu_mutex_lock(&thread->lock);
+    }
+}
+
+void vhost_user_server_queue_unlock(VuServer *server, int vq_idx)
+{
+    VuQueueThread *thread = vu_queue_thread(server, vq_idx);
+
+    if (thread) {
+        qemu_mutex_unlock(&thread->lock);
+    }
+}
+
 static bool coroutine_fn
 vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
 {
@@ -102,6 +177,9 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
     VuServer *server = container_of(vu_dev, VuServer, vu_dev);
     QIOChannel *ioc = server->ioc;
 
+    /* The previous message has been handled */
+    vu_unlock_queue_threads(server);
+
     vmsg->fd_num = 0;
     if (!ioc) {
         error_report_err(local_err);
@@ -175,6 +253,7 @@ vu_message_read(VuDev *vu_dev, int conn_fd, VhostUserMsg *vmsg)
         }
     }
 
+    vu_lock_queue_threads(server);
     return true;
 
 fail:
@@ -187,20 +266,37 @@ static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
+    VuFdWatch *vu_fd_watch;
 
     while (!vu_dev->broken && vu_dispatch(vu_dev)) {
         /* Keep running */
     }
 
-    if (server->refcount) {
+    /* Do not let the queue threads take any more requests */
+    vu_lock_queue_threads(server);
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->thread) {
+            aio_set_fd_handler(vu_fd_watch->thread->ctx, vu_fd_watch->fd,
+                               true, NULL, NULL, NULL, NULL, NULL);
+            vu_fd_watch->stopped = true;
+        }
+    }
+    vu_unlock_queue_threads(server);
+
+    if (qatomic_read(&server->refcount)) {
         /* Wait for requests to complete before we can unmap the memory */
-        server->wait_idle = true;
-        qemu_coroutine_yield();
-        server->wait_idle = false;
+        qatomic_set(&server->wait_idle, true);
+        smp_mb();
+        if (qatomic_read(&server->refcount) ||
+            !qatomic_xchg(&server->wait_idle, false)) {
+            qemu_coroutine_yield();
+        }
     }
-    assert(server->refcount == 0);
+    assert(qatomic_read(&server->refcount) == 0);
 
+    vu_lock_queue_threads(server);
     vu_deinit(vu_dev);
+    vu_unlock_queue_threads(server);
 
     /* vu_deinit() should have called remove_watch() */
     assert(QTAILQ_EMPTY(&server->vu_fd_watches));
@@ -229,9 +325,22 @@ static void kick_handler(void *opaque)
 {
     VuFdWatch *vu_fd_watch = opaque;
     VuDev *vu_dev = vu_fd_watch->vu_dev;
+    VuQueueThread *thread = vu_fd_watch->thread;
+
+    if (thread) {
+        qemu_mutex_lock(&thread->lock);
+        if (vu_fd_watch->stopped) {
+            qemu_mutex_unlock(&thread->lock);
+            return;
+        }
+    }
 
     vu_fd_watch->cb(vu_dev, 0, vu_fd_watch->pvt);
 
+    if (thread) {
+        qemu_mutex_unlock(&thread->lock);
+    }
+
     /* Stop vu_client_trip() if an error occurred in vu_fd_watch->cb() */
     if (vu_dev->broken) {
         VuServer *server = container_of(vu_dev, VuServer, vu_dev);
@@ -271,11 +380,19 @@ set_watch(VuDev *vu_dev, int fd, int vu_evt,
 
         vu_fd_watch->fd = fd;
         vu_fd_watch->cb = cb;
-        qemu_socket_set_nonblock(fd);
-        aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
-                           NULL, NULL, NULL, vu_fd_watch);
         vu_fd_watch->vu_dev = vu_dev;
         vu_fd_watch->pvt = pvt;
+        /* libvhost-user only watches kick fds, @pvt is the virtqueue index */
+        vu_fd_watch->thread = vu_queue_thread(server, (long)pvt);
+        qemu_socket_set_nonblock(fd);
+
+        if (!vu_fd_watch->thread) {
+            aio_set_fd_handler(server->ioc->ctx, fd, true, kick_handler,
+                               NULL, NULL, NULL, vu_fd_watch);
+        } else if (!server->queues_paused) {
+            aio_set_fd_handler(vu_fd_watch->thread->ctx, fd, true,
+                               kick_handler, NULL, NULL, NULL, vu_fd_watch);
+        }
     }
 }
 
@@ -293,10 +410,24 @@ static void remove_watch(VuDev *vu_dev, int fd)
     if (!vu_fd_watch) {
         return;
     }
+    QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
+
+    if (vu_fd_watch->thread) {
+        AioContext *ctx = vu_fd_watch->thread->ctx;
+
+        aio_set_fd_handler(ctx, fd, true, NULL, NULL, NULL, NULL, NULL);
+
+        /*
+         * kick_handler() may already be waiting for the lock that we hold.
+         * It runs to completion before a BH in its AioContext can.
+         */
+        vu_fd_watch->stopped = true;
+        aio_bh_schedule_oneshot(ctx, g_free, vu_fd_watch);
+        return;
+    }
+
     aio_set_fd_handler(server->ioc->ctx, fd, true,
                        NULL, NULL, NULL, NULL, NULL);
-
-    QTAILQ_REMOVE(&server->vu_fd_watches, vu_fd_watch, next);
     g_free(vu_fd_watch);
 }
 
@@ -346,6 +477,11 @@ static void vu_accept(QIONetListener *listener, QIOChannelSocket *sioc,
     aio_context_release(server->ctx);
 }
 
+static void vu_queue_thread_flush_bh(void *opaque)
+{
+    /* Nothing to do, kick handlers that were running have returned */
+}
+
 /* server->ctx acquired by caller */
 void vhost_user_server_stop(VuServer *server)
 {
@@ -356,7 +492,10 @@ void vhost_user_server_stop(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+            AioContext *ctx = vu_fd_watch->thread ?
+                              vu_fd_watch->thread->ctx : server->ctx;
+
+            aio_set_fd_handler(ctx, vu_fd_watch->fd, true,
                                NULL, NULL, NULL, NULL, vu_fd_watch);
         }
 
@@ -369,6 +508,74 @@ void vhost_user_server_stop(VuServer *server)
         qio_net_listener_disconnect(server->listener);
         object_unref(OBJECT(server->listener));
     }
+
+    if (server->nr_queue_threads) {
+        unsigned int i;
+
+        /*
+         * The kick handlers are gone, but one may still be running (or
+         * waiting for the queue thread lock) in its iothread.  Wait for
+         * each iothread to get past it before freeing what it uses.
+         */
+        for (i = 0; i < server->nr_queue_threads; i++) {
+            VuQueueThread *thread = &server->queue_threads[i];
+
+            if (thread->ctx != server->ctx) {
+                aio_context_acquire(thread->ctx);
+                aio_wait_bh_oneshot(thread->ctx, vu_queue_thread_flush_bh,
+                                    NULL);
+                aio_context_release(thread->ctx);
+            }
+            qemu_mutex_destroy(&thread->lock);
+        }
+        g_free(server->queue_threads);
+        server->queue_threads = NULL;
+        server->nr_queue_threads = 0;
+    }
+}
+
+/*
+ * Stop monitoring the kick fds of virtqueues that are processed in queue
+ * threads, e.g. because the block node is drained, which disables only
+ * VuServer->ctx's external event sources.
+ */
+void vhost_user_server_pause_queues(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->nr_queue_threads) {
+        return;
+    }
+
+    vu_queue_threads_lock_all(server);
+    server->queues_paused = true;
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->thread) {
+            aio_set_fd_handler(vu_fd_watch->thread->ctx, vu_fd_watch->fd,
+                               true, NULL, NULL, NULL, NULL, NULL);
+        }
+    }
+    vu_queue_threads_unlock_all(server);
+}
+
+void vhost_user_server_resume_queues(VuServer *server)
+{
+    VuFdWatch *vu_fd_watch;
+
+    if (!server->nr_queue_threads) {
+        return;
+    }
+
+    vu_queue_threads_lock_all(server);
+    server->queues_paused = false;
+    QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
+        if (vu_fd_watch->thread && !vu_fd_watch->stopped) {
+            aio_set_fd_handler(vu_fd_watch->thread->ctx, vu_fd_watch->fd,
+                               true, kick_handler, NULL, NULL, NULL,
+                               vu_fd_watch);
+        }
+    }
+    vu_queue_threads_unlock_all(server);
 }
 
 /*
@@ -397,8 +604,11 @@ void vhost_user_server_attach_aio_context(VuServer *server, AioContext *ctx)
     qio_channel_attach_aio_context(server->ioc, ctx);
 
     QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-        aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler, NULL,
-                           NULL, NULL, vu_fd_watch);
+        /* Queue threads keep their kick fds */
+        if (!vu_fd_watch->thread) {
+            aio_set_fd_handler(ctx, vu_fd_watch->fd, true, kick_handler,
+                               NULL, NULL, NULL, vu_fd_watch);
+        }
     }
 
     aio_co_schedule(ctx, server->co_trip);
@@ -411,8 +621,10 @@ void vhost_user_server_detach_aio_context(VuServer *server)
         VuFdWatch *vu_fd_watch;
 
         QTAILQ_FOREACH(vu_fd_watch, &server->vu_fd_watches, next) {
-            aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
-                               NULL, NULL, NULL, NULL, vu_fd_watch);
+            if (!vu_fd_watch->thread) {
+                aio_set_fd_handler(server->ctx, vu_fd_watch->fd, true,
+                                   NULL, NULL, NULL, NULL, vu_fd_watch);
+            }
         }
 
         qio_channel_detach_aio_context(server->ioc);
@@ -425,11 +637,14 @@ bool vhost_user_server_start(VuServer *server,
                              SocketAddress *socket_addr,
                              AioContext *ctx,
                              uint16_t max_queues,
+                             AioContext **queue_ctxs,
+                             unsigned int nr_queue_ctxs,
                              const VuDevIface *vu_iface,
                              Error **errp)
 {
     QEMUBH *bh;
     QIONetListener *listener;
+    unsigned int i;
 
     if (socket_addr->type != SOCKET_ADDRESS_TYPE_UNIX &&
         socket_addr->type != SOCKET_ADDRESS_TYPE_FD) {
@@ -455,6 +670,15 @@ bool vhost_user_server_start(VuServer *server,
         .ctx                   = ctx,
     };
 
+    if (nr_queue_ctxs) {
+        server->queue_threads = g_new0(VuQueueThread, nr_queue_ctxs);
+        server->nr_queue_threads = nr_queue_ctxs;
+        for (i = 0; i < nr_queue_ctxs; i++) {
+            server->queue_threads[i].ctx = queue_ctxs[i];
+            qemu_mutex_init(&server->queue_threads[i].lock);
+        }
+    }
+
     qio_net_listener_set_name(server->listener, "vhost-user-backend-listener");
 
     qio_net_listener_set_client_func(server->listener,